@@ -43,6 +43,8 @@
 #include "tb-hash.h"
 #include "tb-context.h"
 #include "internal.h"
+#include "tb-trace.h"
+#include "tb-spec.h"
 
 /* -icount align implementation. */
 
@@ -423,6 +425,7 @@ const void *HELPER(lookup_tb_ptr)(CPUArchState *env)
     if (tb == NULL) {
         return tcg_code_gen_epilogue;
     }
+    tb_spec_check_used(tb);
 
     if (qemu_loglevel_mask(CPU_LOG_TB_CPU | CPU_LOG_EXEC)) {
         log_cpu_exec(pc, cpu, tb);
@@ -923,6 +926,10 @@ static inline void cpu_loop_exec_tb(CPUState *cpu, TranslationBlock *tb,
     }
 
     *last_tb = NULL;
+    if (tb_trace_hot(cpu, tb)) {
+        /* The TB asked to be retranslated as a trace. */
+        return;
+    }
     insns_left = qatomic_read(&cpu_neg(cpu)->icount_decr.u32);
     if (insns_left < 0) {
         /* Something asked us to stop executing chained TBs; just
@@ -1020,6 +1027,7 @@ cpu_exec_loop(CPUState *cpu, SyncClocks *sc)
                     qatomic_set(&jc->array[h].tb, tb);
                 }
             }
+            tb_spec_check_used(tb);
 
 #ifndef CONFIG_USER_ONLY
             /*
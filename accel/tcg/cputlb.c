@@ -321,10 +321,11 @@ static void flush_all_helper(CPUState *src, run_on_cpu_func fn,
     }
 }
 
-void tlb_flush_counts(size_t *pfull, size_t *ppart, size_t *pelide)
+void tlb_flush_counts(size_t *pfull, size_t *ppart, size_t *pelide,
+                      size_t *ppage)
 {
     CPUState *cpu;
-    size_t full = 0, part = 0, elide = 0;
+    size_t full = 0, part = 0, elide = 0, page = 0;
 
     CPU_FOREACH(cpu) {
         CPUArchState *env = cpu->env_ptr;
@@ -332,10 +333,12 @@ void tlb_flush_counts(size_t *pfull, size_t *ppart, size_t *pelide)
         full += qatomic_read(&env_tlb(env)->c.full_flush_count);
         part += qatomic_read(&env_tlb(env)->c.part_flush_count);
         elide += qatomic_read(&env_tlb(env)->c.elide_flush_count);
+        page += qatomic_read(&env_tlb(env)->c.page_flush_count);
     }
     *pfull = full;
     *ppart = part;
     *pelide = elide;
+    *ppage = page;
 }
 
 static void tlb_flush_by_mmuidx_async_work(CPUState *cpu, run_on_cpu_data data)
@@ -365,7 +368,11 @@ static void tlb_flush_by_mmuidx_async_work(CPUState *cpu, run_on_cpu_data data)
 
     tcg_flush_jmp_cache(cpu);
 
-    if (to_clean == ALL_MMUIDX_BITS) {
+    /*
+     * A request for every mmu_idx is a full flush, however many of them
+     * actually held entries; a request for a subset is a partial one.
+     */
+    if (asked == ALL_MMUIDX_BITS) {
         qatomic_set(&env_tlb(env)->c.full_flush_count,
                    env_tlb(env)->c.full_flush_count + 1);
     } else {
@@ -537,6 +544,9 @@ static void tlb_flush_page_by_mmuidx_async_0(CPUState *cpu,
     }
     qemu_spin_unlock(&env_tlb(env)->c.lock);
 
+    qatomic_set(&env_tlb(env)->c.page_flush_count,
+                env_tlb(env)->c.page_flush_count + 1);
+
     /*
      * Discard jump cache entries for any tb which might potentially
      * overlap the flushed page, which includes the previous.
@@ -1378,6 +1388,27 @@ static void save_iotlb_data(CPUState *cs, MemoryRegionSection *section,
 #endif
 }
 
+/*
+ * Take the BQL around an MMIO access unless the region behind @full has
+ * opted out of it with memory_region_enable_lockless_io().
+ */
+static inline IOThreadLockAuto *io_auto_lock(CPUArchState *env,
+                                             CPUTLBEntryFull *full)
+{
+    MemoryRegionSection *section = iotlb_to_section(env_cpu(env),
+                                                    full->xlat_section,
+                                                    full->attrs);
+
+    if (section->mr->lockless_io) {
+        return NULL;
+    }
+    return qemu_iothread_auto_lock(__FILE__, __LINE__);
+}
+
+#define IO_LOCK_GUARD(env, full) \
+    g_autoptr(IOThreadLockAuto) _iothread_lock_auto __attribute__((unused)) \
+        = io_auto_lock(env, full)
+
 static uint64_t io_readx(CPUArchState *env, CPUTLBEntryFull *full,
                          int mmu_idx, vaddr addr, uintptr_t retaddr,
                          MMUAccessType access_type, MemOp op)
@@ -1404,7 +1435,7 @@ static uint64_t io_readx(CPUArchState *env, CPUTLBEntryFull *full,
     save_iotlb_data(cpu, section, mr_offset);
 
     {
-        QEMU_IOTHREAD_LOCK_GUARD();
+        IO_LOCK_GUARD(env, full);
         r = memory_region_dispatch_read(mr, mr_offset, &val, op, full->attrs);
     }
 
@@ -1444,7 +1475,7 @@ static void io_writex(CPUArchState *env, CPUTLBEntryFull *full,
     save_iotlb_data(cpu, section, mr_offset);
 
     {
-        QEMU_IOTHREAD_LOCK_GUARD();
+        IO_LOCK_GUARD(env, full);
         r = memory_region_dispatch_write(mr, mr_offset, val, op, full->attrs);
     }
 
@@ -2266,7 +2297,7 @@ static uint64_t do_ld_beN(CPUArchState *env, MMULookupPageData *p,
     unsigned tmp, half_size;
 
     if (unlikely(p->flags & TLB_MMIO)) {
-        QEMU_IOTHREAD_LOCK_GUARD();
+        IO_LOCK_GUARD(env, p->full);
         return do_ld_mmio_beN(env, p->full, ret_be, p->addr, p->size,
                               mmu_idx, type, ra);
     }
@@ -2317,7 +2348,7 @@ static Int128 do_ld16_beN(CPUArchState *env, MMULookupPageData *p,
     MemOp atom;
 
     if (unlikely(p->flags & TLB_MMIO)) {
-        QEMU_IOTHREAD_LOCK_GUARD();
+        IO_LOCK_GUARD(env, p->full);
         a = do_ld_mmio_beN(env, p->full, a, p->addr, size - 8,
                            mmu_idx, MMU_DATA_LOAD, ra);
         b = do_ld_mmio_beN(env, p->full, 0, p->addr + 8, 8,
@@ -2379,7 +2410,7 @@ static uint16_t do_ld_2(CPUArchState *env, MMULookupPageData *p, int mmu_idx,
     uint16_t ret;
 
     if (unlikely(p->flags & TLB_MMIO)) {
-        QEMU_IOTHREAD_LOCK_GUARD();
+        IO_LOCK_GUARD(env, p->full);
         ret = do_ld_mmio_beN(env, p->full, 0, p->addr, 2, mmu_idx, type, ra);
         if ((memop & MO_BSWAP) == MO_LE) {
             ret = bswap16(ret);
@@ -2400,7 +2431,7 @@ static uint32_t do_ld_4(CPUArchState *env, MMULookupPageData *p, int mmu_idx,
     uint32_t ret;
 
     if (unlikely(p->flags & TLB_MMIO)) {
-        QEMU_IOTHREAD_LOCK_GUARD();
+        IO_LOCK_GUARD(env, p->full);
         ret = do_ld_mmio_beN(env, p->full, 0, p->addr, 4, mmu_idx, type, ra);
         if ((memop & MO_BSWAP) == MO_LE) {
             ret = bswap32(ret);
@@ -2421,7 +2452,7 @@ static uint64_t do_ld_8(CPUArchState *env, MMULookupPageData *p, int mmu_idx,
     uint64_t ret;
 
     if (unlikely(p->flags & TLB_MMIO)) {
-        QEMU_IOTHREAD_LOCK_GUARD();
+        IO_LOCK_GUARD(env, p->full);
         ret = do_ld_mmio_beN(env, p->full, 0, p->addr, 8, mmu_idx, type, ra);
         if ((memop & MO_BSWAP) == MO_LE) {
             ret = bswap64(ret);
@@ -2580,7 +2611,7 @@ static Int128 do_ld16_mmu(CPUArchState *env, vaddr addr,
     crosspage = mmu_lookup(env, addr, oi, ra, MMU_DATA_LOAD, &l);
     if (likely(!crosspage)) {
         if (unlikely(l.page[0].flags & TLB_MMIO)) {
-            QEMU_IOTHREAD_LOCK_GUARD();
+            IO_LOCK_GUARD(env, l.page[0].full);
             a = do_ld_mmio_beN(env, l.page[0].full, 0, addr, 8,
                                l.mmu_idx, MMU_DATA_LOAD, ra);
             b = do_ld_mmio_beN(env, l.page[0].full, 0, addr + 8, 8,
@@ -2779,7 +2810,7 @@ static uint64_t do_st_leN(CPUArchState *env, MMULookupPageData *p,
     unsigned tmp, half_size;
 
     if (unlikely(p->flags & TLB_MMIO)) {
-        QEMU_IOTHREAD_LOCK_GUARD();
+        IO_LOCK_GUARD(env, p->full);
         return do_st_mmio_leN(env, p->full, val_le, p->addr,
                               p->size, mmu_idx, ra);
     } else if (unlikely(p->flags & TLB_DISCARD_WRITE)) {
@@ -2834,7 +2865,7 @@ static uint64_t do_st16_leN(CPUArchState *env, MMULookupPageData *p,
     MemOp atom;
 
     if (unlikely(p->flags & TLB_MMIO)) {
-        QEMU_IOTHREAD_LOCK_GUARD();
+        IO_LOCK_GUARD(env, p->full);
         do_st_mmio_leN(env, p->full, int128_getlo(val_le),
                        p->addr, 8, mmu_idx, ra);
         return do_st_mmio_leN(env, p->full, int128_gethi(val_le),
@@ -2897,7 +2928,7 @@ static void do_st_2(CPUArchState *env, MMULookupPageData *p, uint16_t val,
         if ((memop & MO_BSWAP) != MO_LE) {
             val = bswap16(val);
         }
-        QEMU_IOTHREAD_LOCK_GUARD();
+        IO_LOCK_GUARD(env, p->full);
         do_st_mmio_leN(env, p->full, val, p->addr, 2, mmu_idx, ra);
     } else if (unlikely(p->flags & TLB_DISCARD_WRITE)) {
         /* nothing */
@@ -2917,7 +2948,7 @@ static void do_st_4(CPUArchState *env, MMULookupPageData *p, uint32_t val,
         if ((memop & MO_BSWAP) != MO_LE) {
             val = bswap32(val);
         }
-        QEMU_IOTHREAD_LOCK_GUARD();
+        IO_LOCK_GUARD(env, p->full);
         do_st_mmio_leN(env, p->full, val, p->addr, 4, mmu_idx, ra);
     } else if (unlikely(p->flags & TLB_DISCARD_WRITE)) {
         /* nothing */
@@ -2937,7 +2968,7 @@ static void do_st_8(CPUArchState *env, MMULookupPageData *p, uint64_t val,
         if ((memop & MO_BSWAP) != MO_LE) {
             val = bswap64(val);
         }
-        QEMU_IOTHREAD_LOCK_GUARD();
+        IO_LOCK_GUARD(env, p->full);
         do_st_mmio_leN(env, p->full, val, p->addr, 8, mmu_idx, ra);
     } else if (unlikely(p->flags & TLB_DISCARD_WRITE)) {
         /* nothing */
@@ -3067,7 +3098,7 @@ static void do_st16_mmu(CPUArchState *env, vaddr addr, Int128 val,
             }
             a = int128_getlo(val);
             b = int128_gethi(val);
-            QEMU_IOTHREAD_LOCK_GUARD();
+            IO_LOCK_GUARD(env, l.page[0].full);
             do_st_mmio_leN(env, l.page[0].full, a, addr, 8, l.mmu_idx, ra);
             do_st_mmio_leN(env, l.page[0].full, b, addr + 8, 8, l.mmu_idx, ra);
         } else if (unlikely(l.page[0].flags & TLB_DISCARD_WRITE)) {
@@ -0,0 +1,515 @@
+/*
+ * Persistent translation cache
+ *
+ * Repeated boots of the same guest translate the same code every time.
+ * With -accel tcg,tb-cache=FILE the optimized TCG ops of each TB are
+ * kept in FILE, keyed by what the TB is looked up by, and a later run
+ * that translates the same guest code replays them instead of running
+ * the front end and the optimizer.  Host code is still generated, so
+ * nothing in the file depends on where code, helpers or TBs live in the
+ * host.  An entry is only used if the guest bytes it was translated
+ * from are unchanged.
+ *
+ * The file is mapped read-only at startup and looked up in place.  New
+ * translations are kept in memory, up to TB_CACHE_PENDING_MAX bytes,
+ * and the file is rewritten at exit, dropping the entries that they
+ * replace.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bitmap.h"
+#include "qemu/cutils.h"
+#include "qemu/error-report.h"
+#include "qemu/host-utils.h"
+#include "qemu/lockable.h"
+#include "qemu/units.h"
+#include "qemu/xxhash.h"
+#include "qom/object.h"
+#include "exec/exec-all.h"
+#include "hw/core/tcg-cpu-ops.h"
+#include "tcg/tcg.h"
+#include "internal.h"
+#include "tb-cache.h"
+
+#define TB_CACHE_MAGIC      "QEMUTBC"
+#define TB_CACHE_VERSION    2
+
+/* A guest that keeps generating code must not grow QEMU without bound. */
+#define TB_CACHE_PENDING_MAX    (256 * MiB)
+
+typedef struct TBCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t nb_buckets;
+    uint64_t size;
+    uint64_t nb_entries;
+    uint8_t build_id[32];
+} TBCacheHeader;
+
+typedef struct TBCacheKey {
+    uint64_t pc;
+    uint64_t phys_pc;
+    uint64_t cs_base;
+    uint64_t cpu_id;
+    uint64_t cpu_state;
+    uint32_t flags;
+    uint32_t cflags;
+} TBCacheKey;
+
+/*
+ * nb_buckets file offsets follow the header, each the head of a chain
+ * of entries.  Entries follow the buckets, 8-byte aligned.
+ */
+typedef struct TBCacheEntry {
+    uint64_t next;
+    TBCacheKey key;
+    uint16_t size;              /* guest code bytes, as tb->size */
+    uint16_t icount;
+    uint32_t ops_len;
+    uint8_t data[];             /* guest code, then the encoded ops */
+} TBCacheEntry;
+
+static struct {
+    char *path;
+    GMappedFile *file;
+    const uint8_t *map;
+    size_t map_size;
+    uint8_t build_id[32];
+
+    QemuMutex lock;
+    GHashTable *pending;        /* new entries by key, NULL once saved */
+    size_t pending_bytes;
+
+    size_t hits;
+    size_t misses;
+    size_t stale;
+    size_t added;
+    size_t dropped;
+} tbc;
+
+/* Ops being recorded, and the guest code they are translated from. */
+static __thread GByteArray *tb_cache_ops;
+static __thread uint8_t *tb_cache_code;
+
+static uint32_t tb_cache_hash(const TBCacheKey *k)
+{
+    return qemu_xxhash8(k->phys_pc, k->pc,
+                        k->cs_base ^ k->cpu_id ^ k->cpu_state,
+                        k->flags, k->cflags);
+}
+
+static guint tb_cache_key_hash(gconstpointer p)
+{
+    return tb_cache_hash(p);
+}
+
+static gboolean tb_cache_key_equal(gconstpointer a, gconstpointer b)
+{
+    return !memcmp(a, b, sizeof(TBCacheKey));
+}
+
+/* A different build may translate the same code differently. */
+static void tb_cache_build_id(uint8_t *id)
+{
+    g_autoptr(GChecksum) sum = g_checksum_new(G_CHECKSUM_SHA256);
+    gsize len = sizeof(tbc.build_id);
+    struct stat st;
+    size_t i;
+
+    g_checksum_update(sum, (const guchar *)QEMU_VERSION " " TARGET_NAME, -1);
+    if (stat("/proc/self/exe", &st) == 0) {
+        g_checksum_update(sum, (const guchar *)&st.st_size,
+                          sizeof(st.st_size));
+        g_checksum_update(sum, (const guchar *)&st.st_mtime,
+                          sizeof(st.st_mtime));
+    }
+    for (i = 0; i < tcg_op_defs_max; i++) {
+        g_checksum_update(sum, (const guchar *)tcg_op_defs[i].name, -1);
+        g_checksum_update(sum, &tcg_op_defs[i].nb_args, 1);
+    }
+    g_checksum_get_digest(sum, id, &len);
+}
+
+static gint tb_cache_strcmp(gconstpointer a, gconstpointer b)
+{
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/*
+ * The front end depends on the CPU's configuration, which is set
+ * through its properties, and on the globals it registered.
+ */
+static uint64_t tb_cache_cpu_id(CPUState *cpu)
+{
+    g_autoptr(GChecksum) sum = NULL;
+    g_autoptr(GPtrArray) props = NULL;
+    ObjectPropertyIterator iter;
+    ObjectProperty *prop;
+    uint8_t digest[32];
+    gsize len = sizeof(digest);
+    uint64_t id;
+    guint i;
+
+    if (cpu->tb_cache_id) {
+        return cpu->tb_cache_id;
+    }
+
+    sum = g_checksum_new(G_CHECKSUM_SHA256);
+    g_checksum_update(sum, (const guchar *)object_get_typename(OBJECT(cpu)),
+                      -1);
+    for (i = 0; i < tcg_ctx->nb_globals; i++) {
+        const char *name = tcg_ctx->temps[i].name;
+
+        g_checksum_update(sum, (const guchar *)(name ? name : ""), -1);
+        g_checksum_update(sum, (const guchar *)";", 1);
+    }
+
+    props = g_ptr_array_new_with_free_func(g_free);
+    object_property_iter_init(&iter, OBJECT(cpu));
+    while ((prop = object_property_iter_next(&iter))) {
+        char *val;
+
+        /* Read-only properties are state, not configuration. */
+        if (!prop->get || !prop->set ||
+            strstart(prop->type, "link<", NULL) ||
+            strstart(prop->type, "child<", NULL)) {
+            continue;
+        }
+        val = object_property_print(OBJECT(cpu), prop->name, false, NULL);
+        if (val) {
+            g_ptr_array_add(props, g_strdup_printf("%s=%s;", prop->name, val));
+            g_free(val);
+        }
+    }
+    g_ptr_array_sort(props, tb_cache_strcmp);
+    for (i = 0; i < props->len; i++) {
+        g_checksum_update(sum, g_ptr_array_index(props, i), -1);
+    }
+
+    g_checksum_get_digest(sum, digest, &len);
+    memcpy(&id, digest, sizeof(id));
+    cpu->tb_cache_id = id ? id : 1;
+    return cpu->tb_cache_id;
+}
+
+static void tb_cache_key(CPUState *cpu, const TranslationBlock *tb,
+                         vaddr pc, TBCacheKey *key)
+{
+    const struct TCGCPUOps *ops = cpu->cc->tcg_ops;
+
+    key->pc = pc;
+    key->phys_pc = tb_page_addr0(tb);
+    key->cs_base = tb->cs_base;
+    key->cpu_id = tb_cache_cpu_id(cpu);
+    key->cpu_state = ops->tb_cache_state ? ops->tb_cache_state(cpu) : 0;
+    key->flags = tb->flags;
+    key->cflags = tb->cflags;
+}
+
+static size_t tb_cache_entry_len(const TBCacheEntry *e)
+{
+    return sizeof(*e) + e->size + e->ops_len;
+}
+
+/* Return the entry at @off in the mapped file, or NULL if it is bogus. */
+static const TBCacheEntry *tb_cache_entry_at(uint64_t off)
+{
+    const TBCacheEntry *e = (const TBCacheEntry *)(tbc.map + off);
+
+    if ((off & 7) || off < sizeof(TBCacheHeader) ||
+        off > tbc.map_size - sizeof(*e) ||
+        sizeof(*e) + e->size + e->ops_len > tbc.map_size - off) {
+        return NULL;
+    }
+    return e;
+}
+
+/*
+ * Find the entry for @key whose guest code matches the @page_left bytes
+ * at @host_pc, up to the end of the page.
+ */
+static const TBCacheEntry *tb_cache_find(const TBCacheKey *key,
+                                         const void *host_pc,
+                                         size_t page_left, bool *stale)
+{
+    const TBCacheHeader *hdr = (const TBCacheHeader *)tbc.map;
+    const uint64_t *buckets = (const uint64_t *)(hdr + 1);
+    uint64_t off, n;
+
+    off = buckets[tb_cache_hash(key) & (hdr->nb_buckets - 1)];
+    for (n = 0; off && n < hdr->nb_entries; n++) {
+        const TBCacheEntry *e = tb_cache_entry_at(off);
+
+        if (!e) {
+            break;
+        }
+        if (!memcmp(&e->key, key, sizeof(*key)) &&
+            e->size && e->size <= page_left) {
+            if (!memcmp(e->data, host_pc, e->size)) {
+                return e;
+            }
+            *stale = true;
+        }
+        off = e->next;
+    }
+    return NULL;
+}
+
+bool tb_cache_replay(CPUState *cpu, TranslationBlock *tb, vaddr pc,
+                     const void *host_pc, int max_insns)
+{
+    const TBCacheEntry *e = NULL;
+    TBCacheKey key;
+    size_t page_left;
+    bool stale = false;
+
+    tcg_ctx->ops_record = NULL;
+    if (!tbc.path || !host_pc || tb_page_addr0(tb) == -1) {
+        return false;
+    }
+    /* Instrumentation is not part of the cached ops. */
+    if (!bitmap_empty(cpu->plugin_mask, QEMU_PLUGIN_EV_MAX)) {
+        return false;
+    }
+
+    page_left = TARGET_PAGE_SIZE - (tb_page_addr0(tb) & ~TARGET_PAGE_MASK);
+    tb_cache_key(cpu, tb, pc, &key);
+    if (tbc.map) {
+        e = tb_cache_find(&key, host_pc, page_left, &stale);
+    }
+    if (e && e->icount <= max_insns) {
+        if (tcg_ops_decode(tcg_ctx, e->data + e->size, e->ops_len)) {
+            tb->size = e->size;
+            tb->icount = e->icount;
+            qatomic_inc(&tbc.hits);
+            return true;
+        }
+        /* Discard whatever was decoded before the error. */
+        tcg_func_start(tcg_ctx);
+    }
+    qatomic_inc(stale ? &tbc.stale : &tbc.misses);
+
+    if (!tb_cache_ops) {
+        tb_cache_ops = g_byte_array_new();
+        tb_cache_code = g_malloc(TARGET_PAGE_SIZE);
+    }
+    g_byte_array_set_size(tb_cache_ops, 0);
+    memcpy(tb_cache_code, host_pc, page_left);
+    tcg_ctx->ops_record = tb_cache_ops;
+    return false;
+}
+
+void tb_cache_record(CPUState *cpu, TranslationBlock *tb, vaddr pc,
+                     const void *host_pc)
+{
+    GByteArray *ops = tcg_ctx->ops_record;
+    TBCacheEntry *e;
+    bool full = false;
+
+    tcg_ctx->ops_record = NULL;
+
+    /*
+     * Entries are validated against the code in the TB's first page
+     * only.  Code that changed while it was translated, which a DMA
+     * write can do, may not match the ops.
+     */
+    if (!ops || !ops->len || tb_page_addr1(tb) != -1 ||
+        memcmp(tb_cache_code, host_pc, tb->size)) {
+        return;
+    }
+
+    e = g_malloc(sizeof(*e) + tb->size + ops->len);
+    e->next = 0;
+    tb_cache_key(cpu, tb, pc, &e->key);
+    e->size = tb->size;
+    e->icount = tb->icount;
+    e->ops_len = ops->len;
+    memcpy(e->data, tb_cache_code, tb->size);
+    memcpy(e->data + tb->size, ops->data, ops->len);
+
+    /* A retranslation replaces the entry recorded before it. */
+    WITH_QEMU_LOCK_GUARD(&tbc.lock) {
+        if (tbc.pending) {
+            TBCacheEntry *old = g_hash_table_lookup(tbc.pending, &e->key);
+            size_t bytes = tbc.pending_bytes + tb_cache_entry_len(e) -
+                           (old ? tb_cache_entry_len(old) : 0);
+
+            if (bytes <= TB_CACHE_PENDING_MAX) {
+                tbc.pending_bytes = bytes;
+                g_hash_table_replace(tbc.pending, &e->key, e);
+                e = NULL;
+            } else {
+                full = true;
+            }
+        }
+    }
+    if (e) {
+        g_free(e);
+        if (full) {
+            qatomic_inc(&tbc.dropped);
+        }
+    } else {
+        qatomic_inc(&tbc.added);
+    }
+}
+
+static void tb_cache_save(void)
+{
+    g_autoptr(GHashTable) pending = NULL;
+    g_autoptr(GPtrArray) entries = NULL;
+    g_autoptr(GByteArray) out = NULL;
+    g_autoptr(GError) err = NULL;
+    TBCacheHeader hdr = { .magic = TB_CACHE_MAGIC };
+    GHashTableIter iter;
+    gpointer value;
+    guint i;
+
+    WITH_QEMU_LOCK_GUARD(&tbc.lock) {
+        pending = tbc.pending;
+        tbc.pending = NULL;
+    }
+    if (!pending || !g_hash_table_size(pending)) {
+        return;
+    }
+
+    /* A new translation replaces any old entry with the same key. */
+    entries = g_ptr_array_new();
+    if (tbc.map) {
+        const TBCacheHeader *old = (const TBCacheHeader *)tbc.map;
+        const uint64_t *buckets = (const uint64_t *)(old + 1);
+
+        for (i = 0; i < old->nb_buckets; i++) {
+            uint64_t off = buckets[i], n;
+
+            for (n = 0; off && n < old->nb_entries; n++) {
+                const TBCacheEntry *e = tb_cache_entry_at(off);
+
+                if (!e) {
+                    break;
+                }
+                if (!g_hash_table_contains(pending, &e->key)) {
+                    g_ptr_array_add(entries, (gpointer)e);
+                }
+                off = e->next;
+            }
+        }
+    }
+    g_hash_table_iter_init(&iter, pending);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        g_ptr_array_add(entries, value);
+    }
+
+    hdr.version = TB_CACHE_VERSION;
+    hdr.nb_buckets = pow2ceil(MAX(entries->len, 1024));
+    hdr.nb_entries = entries->len;
+    memcpy(hdr.build_id, tbc.build_id, sizeof(hdr.build_id));
+
+    out = g_byte_array_new();
+    g_byte_array_set_size(out, sizeof(hdr) + hdr.nb_buckets * sizeof(uint64_t));
+    memset(out->data, 0, out->len);
+
+    for (i = 0; i < entries->len; i++) {
+        const TBCacheEntry *e = g_ptr_array_index(entries, i);
+        size_t len = tb_cache_entry_len(e);
+        uint64_t off = out->len;
+        uint64_t *bucket;
+        TBCacheEntry *copy;
+
+        g_byte_array_set_size(out, off + ROUND_UP(len, 8));
+        copy = (TBCacheEntry *)(out->data + off);
+        memcpy(copy, e, len);
+        memset(out->data + off + len, 0, ROUND_UP(len, 8) - len);
+
+        bucket = (uint64_t *)(out->data + sizeof(hdr)) +
+                 (tb_cache_hash(&e->key) & (hdr.nb_buckets - 1));
+        copy->next = *bucket;
+        *bucket = off;
+    }
+
+    hdr.size = out->len;
+    memcpy(out->data, &hdr, sizeof(hdr));
+
+    /* The file is replaced atomically, so concurrent runs can share it. */
+    if (!g_file_set_contents(tbc.path, (const char *)out->data, out->len,
+                             &err)) {
+        warn_report("tb-cache: %s", err->message);
+    }
+}
+
+void tb_cache_init(const char *path)
+{
+    CPUClass *cc = CPU_CLASS(object_class_by_name(CPU_RESOLVING_TYPE));
+    g_autoptr(GError) err = NULL;
+    const TBCacheHeader *hdr;
+
+    /*
+     * Without tb_cache_state, the key misses whatever CPU state the
+     * target's translator reads besides flags and cs_base, and replayed
+     * TBs could have been translated for a different one.
+     */
+    if (!cc->tcg_ops || !cc->tcg_ops->tb_cache_state) {
+        warn_report("tb-cache is not supported for this target, ignoring it");
+        return;
+    }
+
+    tbc.path = g_strdup(path);
+    tb_cache_build_id(tbc.build_id);
+    qemu_mutex_init(&tbc.lock);
+    tbc.pending = g_hash_table_new_full(tb_cache_key_hash, tb_cache_key_equal,
+                                        NULL, g_free);
+    atexit(tb_cache_save);
+
+    tbc.file = g_mapped_file_new(path, FALSE, &err);
+    if (!tbc.file) {
+        if (!g_error_matches(err, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
+            warn_report("tb-cache: %s", err->message);
+        }
+        return;
+    }
+    tbc.map = (const uint8_t *)g_mapped_file_get_contents(tbc.file);
+    tbc.map_size = g_mapped_file_get_length(tbc.file);
+
+    hdr = (const TBCacheHeader *)tbc.map;
+    if (tbc.map_size < sizeof(*hdr) ||
+        memcmp(hdr->magic, TB_CACHE_MAGIC, sizeof(hdr->magic)) ||
+        hdr->version != TB_CACHE_VERSION ||
+        hdr->size != tbc.map_size ||
+        !is_power_of_2(hdr->nb_buckets) ||
+        hdr->nb_buckets > (tbc.map_size - sizeof(*hdr)) / sizeof(uint64_t)) {
+        warn_report("tb-cache: ignoring malformed %s", path);
+    } else if (memcmp(hdr->build_id, tbc.build_id, sizeof(tbc.build_id))) {
+        warn_report("tb-cache: %s was written by a different QEMU binary, "
+                    "ignoring it", path);
+    } else {
+        return;
+    }
+
+    g_mapped_file_unref(tbc.file);
+    tbc.file = NULL;
+    tbc.map = NULL;
+    tbc.map_size = 0;
+}
+
+void tb_cache_dump_info(GString *buf)
+{
+    const TBCacheHeader *hdr = (const TBCacheHeader *)tbc.map;
+    size_t misses = qatomic_read(&tbc.misses);
+    size_t stale = qatomic_read(&tbc.stale);
+
+    if (!tbc.path) {
+        return;
+    }
+
+    g_string_append_printf(buf, "\nTB cache file       %s\n", tbc.path);
+    g_string_append_printf(buf, "TB cache entries    %" PRIu64 " loaded, "
+                           "%zu new, %zu dropped\n",
+                           hdr ? hdr->nb_entries : 0,
+                           qatomic_read(&tbc.added),
+                           qatomic_read(&tbc.dropped));
+    g_string_append_printf(buf, "TB cache hits       %zu\n",
+                           qatomic_read(&tbc.hits));
+    g_string_append_printf(buf, "TB cache misses     %zu (%zu stale)\n",
+                           misses + stale, stale);
+}
@@ -0,0 +1,27 @@
+/*
+ * Persistent translation cache
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#ifndef ACCEL_TCG_TB_CACHE_H
+#define ACCEL_TCG_TB_CACHE_H
+
+/* Use @path as the cache file: load it now and write it back at exit. */
+void tb_cache_init(const char *path);
+
+/*
+ * Called after tcg_func_start.  Emit the ops for @tb from the cache and
+ * return true, or prepare to record the ops that the front end is about
+ * to generate and return false.
+ */
+bool tb_cache_replay(CPUState *cpu, TranslationBlock *tb, vaddr pc,
+                     const void *host_pc, int max_insns);
+
+/* Add the ops recorded for @tb, once its code has been generated. */
+void tb_cache_record(CPUState *cpu, TranslationBlock *tb, vaddr pc,
+                     const void *host_pc);
+
+void tb_cache_dump_info(GString *buf);
+
+#endif /* ACCEL_TCG_TB_CACHE_H */
@@ -30,6 +30,7 @@
 #include "tb-hash.h"
 #include "tb-context.h"
 #include "internal.h"
+#include "tb-spec.h"
 
 
 /* List iterators for lists of tagged pointers in TranslationBlock. */
@@ -759,6 +760,7 @@ static void do_tb_flush(CPUState *cpu, run_on_cpu_data tb_flush_count)
 {
     bool did_flush = false;
 
+    tb_spec_pause();
     mmap_lock();
     /* If it is already been done on request of another CPU, just retry. */
     if (tb_ctx.tb_flush_count != tb_flush_count.host_int) {
@@ -779,6 +781,7 @@ static void do_tb_flush(CPUState *cpu, run_on_cpu_data tb_flush_count)
 
 done:
     mmap_unlock();
+    tb_spec_resume();
     if (did_flush) {
         qemu_plugin_flush_cb();
     }
@@ -0,0 +1,256 @@
+/*
+ * Speculative translation in background threads
+ *
+ * A vCPU that misses in tb_lookup translates the TB itself before it
+ * can go on, which makes boots and JIT-heavy guests stall on
+ * translation.  With -accel tcg,thread=multi,bg-translators=N, the
+ * direct jump targets that the translator saw are queued after each
+ * translation, and N threads translate them into tb_ctx.htable, two
+ * levels deep, so that the exit through goto_tb usually finds its
+ * destination ready to be linked.
+ *
+ * A background translation uses its own TCGContext and must not touch
+ * the vCPU's TLB, so only targets on the same guest page as the TB
+ * that jumps to them are translated, with the flags of that TB, and a
+ * translation that would need a second page is given up.  The threads
+ * translate in parallel; tb_flush waits for all the translations in
+ * progress and keeps new ones from starting until it is done.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bitmap.h"
+#include "qemu/lockable.h"
+#include "qemu/qht.h"
+#include "qemu/rcu.h"
+#include "qemu/thread.h"
+#include "exec/exec-all.h"
+#include "exec/memory.h"
+#include "tcg/tcg.h"
+#include "tb-hash.h"
+#include "tb-context.h"
+#include "internal.h"
+#include "tb-spec.h"
+
+#define TB_SPEC_QUEUE_LEN  256
+#define TB_SPEC_MAX_DEPTH  2
+
+/* Translations that need the vCPU, or that it will not look up. */
+#define TB_SPEC_CF_MASK  (CF_COUNT_MASK | CF_SINGLE_STEP | CF_LAST_IO | \
+                          CF_MEMI_ONLY | CF_USE_ICOUNT | CF_NOIRQ)
+
+static struct {
+    unsigned int nb_threads;
+    bool started;
+
+    /* Protects the queue. */
+    QemuMutex lock;
+    QemuCond cond;
+    TBSpecJob jobs[TB_SPEC_QUEUE_LEN];
+    unsigned int head, tail;
+
+    /*
+     * Protects active and paused: the number of translations in progress,
+     * and of tb_spec_pause() calls not yet resumed.
+     */
+    QemuMutex gen_lock;
+    QemuCond gen_idle;
+    QemuCond gen_resumed;
+    unsigned int active;
+    unsigned int paused;
+
+    unsigned int translated;
+    unsigned int used;
+    unsigned int dropped;
+} tb_spec;
+
+static bool tb_spec_cmp(const void *p, const void *d)
+{
+    const TranslationBlock *tb = p;
+    const TBSpecJob *job = d;
+
+    return (tb_cflags(tb) & CF_PCREL || tb->pc == job->pc) &&
+           tb_page_addr0(tb) == job->phys_pc &&
+           tb->cs_base == job->cs_base &&
+           tb->flags == job->flags &&
+           tb_cflags(tb) == job->cflags;
+}
+
+/* Is there a TB for @job already?  Called within an RCU read section. */
+static bool tb_spec_exists(const TBSpecJob *job)
+{
+    vaddr pc = job->cflags & CF_PCREL ? 0 : job->pc;
+    uint32_t h = tb_hash_func(job->phys_pc, pc, job->flags, job->cs_base,
+                              job->cflags);
+
+    return qht_lookup_custom(&tb_ctx.htable, job, h, tb_spec_cmp) != NULL;
+}
+
+static void tb_spec_translate(TBSpecJob *job)
+{
+    TranslationBlock *tb = NULL;
+
+    qemu_mutex_lock(&tb_spec.gen_lock);
+    while (tb_spec.paused) {
+        qemu_cond_wait(&tb_spec.gen_resumed, &tb_spec.gen_lock);
+    }
+    tb_spec.active++;
+    qemu_mutex_unlock(&tb_spec.gen_lock);
+
+    WITH_RCU_READ_LOCK_GUARD() {
+        /* The flags that the target was queued with may be stale by now. */
+        if (qatomic_read(&tb_ctx.tb_flush_count) == job->flush_count &&
+            !tb_spec_exists(job)) {
+            job->host_pc = qemu_map_ram_ptr(NULL, job->phys_pc);
+            tb = tb_gen_speculative(job);
+        }
+    }
+
+    qemu_mutex_lock(&tb_spec.gen_lock);
+    if (--tb_spec.active == 0 && tb_spec.paused) {
+        qemu_cond_broadcast(&tb_spec.gen_idle);
+    }
+    qemu_mutex_unlock(&tb_spec.gen_lock);
+
+    if (tb) {
+        qatomic_inc(&tb_spec.translated);
+    } else {
+        qatomic_inc(&tb_spec.dropped);
+    }
+}
+
+static void *tb_spec_thread(void *arg)
+{
+    rcu_register_thread();
+    tcg_register_thread();
+
+    while (true) {
+        TBSpecJob job;
+
+        qemu_mutex_lock(&tb_spec.lock);
+        while (tb_spec.head == tb_spec.tail) {
+            qemu_cond_wait(&tb_spec.cond, &tb_spec.lock);
+        }
+        job = tb_spec.jobs[tb_spec.head++ % TB_SPEC_QUEUE_LEN];
+        qemu_mutex_unlock(&tb_spec.lock);
+
+        tb_spec_translate(&job);
+    }
+    return NULL;
+}
+
+/* Called with tb_spec.lock held. */
+static void tb_spec_start(void)
+{
+    unsigned int i;
+
+    for (i = 0; i < tb_spec.nb_threads; i++) {
+        QemuThread thread;
+        char name[16];
+
+        snprintf(name, sizeof(name), "TCG spec %u", i);
+        qemu_thread_create(&thread, name, tb_spec_thread, NULL,
+                           QEMU_THREAD_DETACHED);
+    }
+    tb_spec.started = true;
+}
+
+void tb_spec_init(unsigned int nb_threads)
+{
+    tb_spec.nb_threads = nb_threads;
+    qemu_mutex_init(&tb_spec.lock);
+    qemu_cond_init(&tb_spec.cond);
+    qemu_mutex_init(&tb_spec.gen_lock);
+    qemu_cond_init(&tb_spec.gen_idle);
+    qemu_cond_init(&tb_spec.gen_resumed);
+}
+
+void tb_spec_queue(CPUState *cpu, const TranslationBlock *tb,
+                   const uint64_t *dest, int nb_dest, int depth)
+{
+    tb_page_addr_t page = tb_page_addr0(tb) & TARGET_PAGE_MASK;
+    int i;
+
+    if (!tb_spec.nb_threads || depth >= TB_SPEC_MAX_DEPTH ||
+        (tb_cflags(tb) & TB_SPEC_CF_MASK) || tb_page_addr0(tb) == -1 ||
+        !bitmap_empty(cpu->plugin_mask, QEMU_PLUGIN_EV_MAX)) {
+        return;
+    }
+
+    for (i = 0; i < nb_dest; i++) {
+        TBSpecJob job = {
+            .cpu = cpu,
+            .pc = dest[i],
+            .phys_pc = page | (dest[i] & ~TARGET_PAGE_MASK),
+            .cs_base = tb->cs_base,
+            .flags = tb->flags,
+            .cflags = tb_cflags(tb),
+            .flush_count = qatomic_read(&tb_ctx.tb_flush_count),
+            .depth = depth,
+        };
+
+        RCU_READ_LOCK_GUARD();
+        if (tb_spec_exists(&job)) {
+            continue;
+        }
+
+        QEMU_LOCK_GUARD(&tb_spec.lock);
+        if (!tb_spec.started) {
+            tb_spec_start();
+        }
+        if (tb_spec.tail - tb_spec.head == TB_SPEC_QUEUE_LEN) {
+            qatomic_inc(&tb_spec.dropped);
+            continue;
+        }
+        tb_spec.jobs[tb_spec.tail++ % TB_SPEC_QUEUE_LEN] = job;
+        qemu_cond_signal(&tb_spec.cond);
+    }
+}
+
+void tb_spec_used(TranslationBlock *tb)
+{
+    if (qatomic_xchg(&tb->speculative, false)) {
+        qatomic_inc(&tb_spec.used);
+    }
+}
+
+void tb_spec_pause(void)
+{
+    if (!tb_spec.nb_threads) {
+        return;
+    }
+
+    QEMU_LOCK_GUARD(&tb_spec.gen_lock);
+    tb_spec.paused++;
+    while (tb_spec.active) {
+        qemu_cond_wait(&tb_spec.gen_idle, &tb_spec.gen_lock);
+    }
+}
+
+void tb_spec_resume(void)
+{
+    if (!tb_spec.nb_threads) {
+        return;
+    }
+
+    QEMU_LOCK_GUARD(&tb_spec.gen_lock);
+    if (--tb_spec.paused == 0) {
+        qemu_cond_broadcast(&tb_spec.gen_resumed);
+    }
+}
+
+void tb_spec_dump_info(GString *buf)
+{
+    unsigned int translated = qatomic_read(&tb_spec.translated);
+    unsigned int used = qatomic_read(&tb_spec.used);
+
+    if (!tb_spec.nb_threads) {
+        return;
+    }
+    g_string_append_printf(buf, "speculative TBs     %u (%u used, "
+                           "%u wasted)\n", translated, used,
+                           translated - MIN(used, translated));
+    g_string_append_printf(buf, "speculative drops   %u\n",
+                           qatomic_read(&tb_spec.dropped));
+}
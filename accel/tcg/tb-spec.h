@@ -0,0 +1,71 @@
+/*
+ * Speculative translation in background threads
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#ifndef ACCEL_TCG_TB_SPEC_H
+#define ACCEL_TCG_TB_SPEC_H
+
+/* A direct jump target to translate ahead of time. */
+typedef struct TBSpecJob {
+    CPUState *cpu;
+    vaddr pc;
+    tb_page_addr_t phys_pc;
+    void *host_pc;
+    uint64_t cs_base;
+    uint32_t flags;
+    uint32_t cflags;
+    unsigned int flush_count;
+    int depth;
+} TBSpecJob;
+
+#ifdef CONFIG_USER_ONLY
+static inline void tb_spec_queue(CPUState *cpu, const TranslationBlock *tb,
+                                 const uint64_t *dest, int nb_dest,
+                                 int depth)
+{
+}
+static inline void tb_spec_check_used(TranslationBlock *tb) { }
+static inline void tb_spec_pause(void) { }
+static inline void tb_spec_resume(void) { }
+#else
+/* Start @nb_threads translator threads once translation begins. */
+void tb_spec_init(unsigned int nb_threads);
+
+/*
+ * Queue the direct jump targets @dest of the freshly translated @tb,
+ * which was itself translated @depth steps ahead of execution.
+ */
+void tb_spec_queue(CPUState *cpu, const TranslationBlock *tb,
+                   const uint64_t *dest, int nb_dest, int depth);
+
+void tb_spec_used(TranslationBlock *tb);
+
+/*
+ * Called when a vCPU looks up @tb, from the execution loop or from
+ * helper_lookup_tb_ptr.  A TB only ever reached through goto_tb links
+ * set up before it was counted cannot exist: links are added after the
+ * lookup in the execution loop.
+ */
+static inline void tb_spec_check_used(TranslationBlock *tb)
+{
+    if (unlikely(qatomic_read(&tb->speculative))) {
+        tb_spec_used(tb);
+    }
+}
+
+/* Keep translator threads out of the code buffer, for tb_flush. */
+void tb_spec_pause(void);
+void tb_spec_resume(void);
+
+/*
+ * Translate @job without touching the vCPU's TLB.  Return NULL if that
+ * was not possible or the TB already exists.  Defined in translate-all.c.
+ */
+TranslationBlock *tb_gen_speculative(TBSpecJob *job);
+
+void tb_spec_dump_info(GString *buf);
+#endif
+
+#endif /* ACCEL_TCG_TB_SPEC_H */
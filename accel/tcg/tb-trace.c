@@ -0,0 +1,176 @@
+/*
+ * Hot trace formation
+ *
+ * Every TB is translated on its own, so a loop whose body spans several
+ * TBs is optimized one piece at a time and pays a goto_tb between the
+ * pieces.  With -accel tcg,superblock-threshold=N each TB counts its
+ * executions in its prologue and leaves through the exitreq path when
+ * the count reaches N.  The TB is then retranslated together with the
+ * hottest chain of TBs it is linked to, as long as they are on the same
+ * guest page and follow it in memory, into one trace: the blocks fall
+ * through or branch to each other inside the TB, so the optimizer and
+ * the register allocator see the whole chain at once, and the other
+ * exits of each block leave the trace.  The trace replaces the TB in
+ * the lookup tables; the TBs of the other blocks stay as they are.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bitmap.h"
+#include "exec/exec-all.h"
+#include "tcg/tcg.h"
+#include "internal.h"
+#include "tb-trace.h"
+
+unsigned int tb_trace_threshold;
+
+static struct {
+    unsigned int traces;
+    unsigned int blocks;
+} tb_trace_stats;
+
+/* Translations that a trace cannot reproduce exactly. */
+#define TB_TRACE_CF_MASK  (CF_COUNT_MASK | CF_NO_GOTO_TB | CF_SINGLE_STEP | \
+                           CF_LAST_IO | CF_MEMI_ONLY | CF_USE_ICOUNT |      \
+                           CF_NOIRQ)
+
+bool tb_trace_counted(CPUState *cpu, const TranslationBlock *tb)
+{
+    return tb_trace_threshold && !tcg_ctx->trace &&
+           !(tb_cflags(tb) & TB_TRACE_CF_MASK) &&
+           tb_page_addr0(tb) != -1 &&
+           bitmap_empty(cpu->plugin_mask, QEMU_PLUGIN_EV_MAX);
+}
+
+/* Can @next be added to the trace that starts with @head? */
+static bool tb_trace_follow(const TranslationBlock *head,
+                            const TranslationBlock *next,
+                            tb_page_addr_t page, unsigned int threshold)
+{
+    return tb_cflags(next) == tb_cflags(head) &&
+           next->cs_base == head->cs_base &&
+           next->flags == head->flags &&
+           (tb_page_addr0(next) & TARGET_PAGE_MASK) == page &&
+           tb_page_addr1(next) == -1 &&
+           qatomic_read(&next->exec_count) >= threshold / 2;
+}
+
+/* Pick the linked TB that @cur jumps to most often, if any is hot. */
+static TranslationBlock *tb_trace_next(const TranslationBlock *head,
+                                       TranslationBlock *cur,
+                                       tb_page_addr_t page,
+                                       unsigned int threshold)
+{
+    TranslationBlock *next = NULL;
+    int n;
+
+    for (n = 0; n < 2; n++) {
+        uintptr_t dest = qatomic_read(&cur->jmp_dest[n]);
+        TranslationBlock *tb = (TranslationBlock *)(dest & ~(uintptr_t)1);
+
+        if (tb && tb_trace_follow(head, tb, page, threshold) &&
+            (!next || qatomic_read(&tb->exec_count) >
+                      qatomic_read(&next->exec_count))) {
+            next = tb;
+        }
+    }
+    return next;
+}
+
+bool tb_trace_hot(CPUState *cpu, TranslationBlock *tb)
+{
+    unsigned int threshold = tb_trace_threshold;
+    TBTrace trace = { };
+    TranslationBlock *cur;
+    tb_page_addr_t page;
+    uint64_t cs_base;
+    uint32_t flags;
+    vaddr pc;
+    int cflags, i;
+
+    if (!threshold || qatomic_read(&tb->exec_count) < threshold) {
+        return false;
+    }
+    /* Only one vCPU gets to retranslate it; the others just go on. */
+    if (qatomic_cmpxchg(&tb->exec_count, threshold, threshold + 1)
+        != threshold) {
+        return true;
+    }
+    if ((tb_cflags(tb) & CF_INVALID) || tb_page_addr1(tb) != -1) {
+        return true;
+    }
+
+    /* Nothing was executed, so the state is the one @tb was looked up by. */
+    cpu_get_tb_cpu_state(cpu->env_ptr, &pc, &cs_base, &flags);
+    if (cs_base != tb->cs_base || flags != tb->flags ||
+        ((pc ^ tb_page_addr0(tb)) & ~TARGET_PAGE_MASK)) {
+        return true;
+    }
+
+    page = tb_page_addr0(tb) & TARGET_PAGE_MASK;
+    trace.pc[0] = pc;
+    trace.icount[0] = tb->icount;
+    trace.nb_insns = tb->icount;
+    trace.nb_blocks = 1;
+
+    for (cur = tb; trace.nb_blocks < TB_TRACE_MAX_BLOCKS; ) {
+        TranslationBlock *next = tb_trace_next(tb, cur, page, threshold);
+        vaddr next_pc;
+
+        if (!next || trace.nb_insns + next->icount > TCG_MAX_INSNS) {
+            break;
+        }
+        /*
+         * The trace is invalidated as the range [pc, pc + size), so it
+         * may only extend forward.  That also keeps it free of loops.
+         */
+        next_pc = (pc & TARGET_PAGE_MASK) |
+                  (tb_page_addr0(next) & ~TARGET_PAGE_MASK);
+        if (next_pc <= pc) {
+            break;
+        }
+        for (i = 0; i < trace.nb_blocks; i++) {
+            if (trace.pc[i] == next_pc) {
+                break;
+            }
+        }
+        if (i < trace.nb_blocks) {
+            break;
+        }
+
+        trace.pc[trace.nb_blocks] = next_pc;
+        trace.icount[trace.nb_blocks] = next->icount;
+        trace.nb_insns += next->icount;
+        trace.nb_blocks++;
+        cur = next;
+    }
+    if (trace.nb_blocks < 2) {
+        return true;
+    }
+
+    cflags = tb_cflags(tb);
+    mmap_lock();
+    tb_phys_invalidate(tb, -1);
+    tb_gen_trace(cpu, &trace, pc, cs_base, flags, cflags);
+    mmap_unlock();
+
+    if (trace.nb_blocks > 1) {
+        qatomic_inc(&tb_trace_stats.traces);
+        qatomic_add(&tb_trace_stats.blocks, trace.nb_blocks);
+    }
+    return true;
+}
+
+void tb_trace_dump_info(GString *buf)
+{
+    unsigned int traces = qatomic_read(&tb_trace_stats.traces);
+    unsigned int blocks = qatomic_read(&tb_trace_stats.blocks);
+
+    if (!tb_trace_threshold) {
+        return;
+    }
+    g_string_append_printf(buf, "TB traces           %u\n", traces);
+    g_string_append_printf(buf, "TB trace avg blocks %0.1f\n",
+                           traces ? (double)blocks / traces : 0);
+}
@@ -0,0 +1,51 @@
+/*
+ * Hot trace formation
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#ifndef ACCEL_TCG_TB_TRACE_H
+#define ACCEL_TCG_TB_TRACE_H
+
+#define TB_TRACE_MAX_BLOCKS 8
+
+/*
+ * A chain of blocks on one guest page, all translated into a single TB.
+ * Each block branches to the next one inside the TB; any other exit
+ * leaves the TB.
+ */
+struct TBTrace {
+    int nb_blocks;
+    int nb_insns;
+    int cur;                /* Block being translated */
+    vaddr pc[TB_TRACE_MAX_BLOCKS];
+    uint16_t icount[TB_TRACE_MAX_BLOCKS];
+    TCGLabel *label[TB_TRACE_MAX_BLOCKS];
+};
+typedef struct TBTrace TBTrace;
+
+/* Executions after which a TB is retranslated as a trace; 0 disables. */
+extern unsigned int tb_trace_threshold;
+
+/* Return true if @tb should count its executions. */
+bool tb_trace_counted(CPUState *cpu, const TranslationBlock *tb);
+
+/*
+ * Called when @tb exited with TB_EXIT_REQUESTED.  Return true if the
+ * exit was caused by the execution counter, in which case @tb may have
+ * been replaced by a trace starting with it.
+ */
+bool tb_trace_hot(CPUState *cpu, TranslationBlock *tb);
+
+/*
+ * Translate the blocks of @trace into one TB, which replaces the TB of
+ * its first block.  On return, trace->nb_blocks is the number of blocks
+ * that made it into the TB.  Defined in translate-all.c.
+ */
+TranslationBlock *tb_gen_trace(CPUState *cpu, TBTrace *trace,
+                               vaddr pc, uint64_t cs_base, uint32_t flags,
+                               int cflags);
+
+void tb_trace_dump_info(GString *buf);
+
+#endif /* ACCEL_TCG_TB_TRACE_H */
@@ -39,6 +39,9 @@
 #include "hw/boards.h"
 #endif
 #include "internal.h"
+#include "tb-cache.h"
+#include "tb-trace.h"
+#include "tb-spec.h"
 
 struct TCGState {
     AccelState parent_obj;
@@ -46,7 +49,12 @@ struct TCGState {
     bool mttcg_enabled;
     bool one_insn_per_tb;
     int splitwx_enabled;
+    TCGHugePages tb_hugepages;
+    bool tb_numa;
     unsigned long tb_size;
+    char *tb_cache;
+    uint32_t superblock_threshold;
+    uint32_t bg_translators;
 };
 typedef struct TCGState TCGState;
 
@@ -112,9 +120,30 @@ static int tcg_init_machine(MachineState *ms)
     tcg_allowed = true;
     mttcg_enabled = s->mttcg_enabled;
 
+#ifndef CONFIG_USER_ONLY
+    if (s->bg_translators && !mttcg_enabled) {
+        warn_report("bg-translators requires thread=multi");
+        s->bg_translators = 0;
+    }
+#endif
+
     page_init();
     tb_htable_init();
-    tcg_init(s->tb_size * MiB, s->splitwx_enabled, max_cpus);
+    /* Each translator thread needs a TCGContext of its own. */
+    tcg_init(s->tb_size * MiB, s->splitwx_enabled, s->tb_hugepages,
+             s->tb_numa, max_cpus + s->bg_translators);
+#ifndef CONFIG_USER_ONLY
+    tb_spec_init(s->bg_translators);
+#endif
+    tb_trace_threshold = s->superblock_threshold;
+    if (s->tb_cache) {
+        /* The execution counters refer to the TB in the ops. */
+        if (tb_trace_threshold) {
+            warn_report("tb-cache is not used with superblock-threshold");
+        } else {
+            tb_cache_init(s->tb_cache);
+        }
+    }
 
 #if defined(CONFIG_SOFTMMU)
     /*
@@ -181,6 +210,110 @@ static void tcg_set_tb_size(Object *obj, Visitor *v,
     s->tb_size = value;
 }
 
+static void tcg_get_superblock_threshold(Object *obj, Visitor *v,
+                                         const char *name, void *opaque,
+                                         Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value = s->superblock_threshold;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void tcg_set_superblock_threshold(Object *obj, Visitor *v,
+                                         const char *name, void *opaque,
+                                         Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+
+    s->superblock_threshold = value;
+}
+
+static void tcg_get_bg_translators(Object *obj, Visitor *v,
+                                   const char *name, void *opaque,
+                                   Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value = s->bg_translators;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void tcg_set_bg_translators(Object *obj, Visitor *v,
+                                   const char *name, void *opaque,
+                                   Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+
+    s->bg_translators = value;
+}
+
+static char *tcg_get_tb_cache(Object *obj, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    return g_strdup(s->tb_cache);
+}
+
+static void tcg_set_tb_cache(Object *obj, const char *value, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    g_free(s->tb_cache);
+    s->tb_cache = g_strdup(value);
+}
+
+static char *tcg_get_tb_hugepages(Object *obj, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    switch (s->tb_hugepages) {
+    case TCG_HUGEPAGES_ON:
+        return g_strdup("on");
+    case TCG_HUGEPAGES_EXPLICIT:
+        return g_strdup("explicit");
+    default:
+        return g_strdup("off");
+    }
+}
+
+static void tcg_set_tb_hugepages(Object *obj, const char *value, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    if (strcmp(value, "off") == 0) {
+        s->tb_hugepages = TCG_HUGEPAGES_OFF;
+    } else if (strcmp(value, "on") == 0) {
+        s->tb_hugepages = TCG_HUGEPAGES_ON;
+    } else if (strcmp(value, "explicit") == 0) {
+        s->tb_hugepages = TCG_HUGEPAGES_EXPLICIT;
+    } else {
+        error_setg(errp, "Invalid 'tb-hugepages' setting %s", value);
+    }
+}
+
+static bool tcg_get_tb_numa(Object *obj, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    return s->tb_numa;
+}
+
+static void tcg_set_tb_numa(Object *obj, bool value, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    s->tb_numa = value;
+}
+
 static bool tcg_get_splitwx(Object *obj, Error **errp)
 {
     TCGState *s = TCG_STATE(obj);
@@ -240,6 +373,37 @@ static void tcg_accel_class_init(ObjectClass *oc, void *data)
     object_class_property_set_description(oc, "tb-size",
         "TCG translation block cache size");
 
+    object_class_property_add(oc, "superblock-threshold", "int",
+        tcg_get_superblock_threshold, tcg_set_superblock_threshold,
+        NULL, NULL);
+    object_class_property_set_description(oc, "superblock-threshold",
+        "Executions after which a TB is retranslated with its hot successors"
+        " (0 = off)");
+
+    object_class_property_add(oc, "bg-translators", "int",
+        tcg_get_bg_translators, tcg_set_bg_translators,
+        NULL, NULL);
+    object_class_property_set_description(oc, "bg-translators",
+        "Number of threads that translate jump targets ahead of time"
+        " (thread=multi only)");
+
+    object_class_property_add_str(oc, "tb-cache",
+                                  tcg_get_tb_cache,
+                                  tcg_set_tb_cache);
+    object_class_property_set_description(oc, "tb-cache",
+        "File that keeps translations across runs");
+
+    object_class_property_add_str(oc, "tb-hugepages",
+                                  tcg_get_tb_hugepages,
+                                  tcg_set_tb_hugepages);
+    object_class_property_set_description(oc, "tb-hugepages",
+        "Back the translation block cache with huge pages (off|on|explicit)");
+
+    object_class_property_add_bool(oc, "tb-numa",
+        tcg_get_tb_numa, tcg_set_tb_numa);
+    object_class_property_set_description(oc, "tb-numa",
+        "Allocate translated code from the host NUMA node of each thread");
+
     object_class_property_add_bool(oc, "split-wx",
         tcg_get_splitwx, tcg_set_splitwx);
     object_class_property_set_description(oc, "split-wx",
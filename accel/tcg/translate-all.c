@@ -63,6 +63,9 @@
 #include "tb-context.h"
 #include "internal.h"
 #include "perf.h"
+#include "tb-cache.h"
+#include "tb-trace.h"
+#include "tb-spec.h"
 #include "tcg/insn-start-words.h"
 
 TBContext tb_ctx;
@@ -264,29 +267,35 @@ void page_init(void)
  * Return the size of the generated code, or negative on error.
  */
 static int setjmp_gen_code(CPUArchState *env, TranslationBlock *tb,
-                           vaddr pc, void *host_pc,
+                           vaddr pc, void *host_pc, TBTrace *trace,
                            int *max_insns, int64_t *ti)
 {
     int ret = sigsetjmp(tcg_ctx->jmp_trans, 0);
     if (unlikely(ret != 0)) {
+        tcg_ctx->trace = NULL;
         return ret;
     }
 
     tcg_func_start(tcg_ctx);
 
     tcg_ctx->cpu = env_cpu(env);
-    gen_intermediate_code(env_cpu(env), tb, max_insns, pc, host_pc);
+    tcg_ctx->trace = trace;
+    if (trace || tcg_ctx->speculative ||
+        !tb_cache_replay(env_cpu(env), tb, pc, host_pc, *max_insns)) {
+        gen_intermediate_code(env_cpu(env), tb, max_insns, pc, host_pc);
+    }
     assert(tb->size != 0);
+    tcg_ctx->trace = NULL;
     tcg_ctx->cpu = NULL;
     *max_insns = tb->icount;
 
     return tcg_gen_code(tcg_ctx, tb, pc);
 }
 
-/* Called with mmap_lock held for user mode emulation.  */
-TranslationBlock *tb_gen_code(CPUState *cpu,
-                              vaddr pc, uint64_t cs_base,
-                              uint32_t flags, int cflags)
+static TranslationBlock *tb_gen_code_common(CPUState *cpu, TBTrace *trace,
+                                            TBSpecJob *spec,
+                                            vaddr pc, uint64_t cs_base,
+                                            uint32_t flags, int cflags)
 {
     CPUArchState *env = cpu->env_ptr;
     TranslationBlock *tb, *existing_tb;
@@ -299,7 +308,12 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     assert_memory_lock();
     qemu_thread_jit_write();
 
-    phys_pc = get_page_addr_code_hostp(env, pc, &host_pc);
+    if (spec) {
+        phys_pc = spec->phys_pc;
+        host_pc = spec->host_pc;
+    } else {
+        phys_pc = get_page_addr_code_hostp(env, pc, &host_pc);
+    }
 
     if (phys_pc == -1) {
         /* Generate a one-shot TB with 1 insn in it */
@@ -311,11 +325,18 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
         max_insns = TCG_MAX_INSNS;
     }
     QEMU_BUILD_BUG_ON(CF_COUNT_MASK + 1 != TCG_MAX_INSNS);
+    if (trace) {
+        max_insns = trace->nb_insns;
+    }
 
  buffer_overflow:
     assert_no_pages_locked();
     tb = tcg_tb_alloc(tcg_ctx);
     if (unlikely(!tb)) {
+        if (spec) {
+            /* Leave the flush to the vCPUs. */
+            return NULL;
+        }
         /* flush must be done */
         tb_flush(cpu);
         mmap_unlock();
@@ -332,6 +353,8 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     tb->cs_base = cs_base;
     tb->flags = flags;
     tb->cflags = cflags;
+    tb->exec_count = 0;
+    tb->speculative = spec != NULL;
     tb_set_page_addr0(tb, phys_pc);
     tb_set_page_addr1(tb, -1);
     if (phys_pc != -1) {
@@ -357,7 +380,10 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
  restart_translate:
     trace_translate_block(tb, pc, tb->tc.ptr);
 
-    gen_code_size = setjmp_gen_code(env, tb, pc, host_pc, &max_insns, &ti);
+    tcg_ctx->speculative = spec != NULL;
+    gen_code_size = setjmp_gen_code(env, tb, pc, host_pc, trace,
+                                    &max_insns, &ti);
+    tcg_ctx->speculative = false;
     if (unlikely(gen_code_size < 0)) {
         switch (gen_code_size) {
         case -1:
@@ -389,6 +415,12 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
              */
             assert(max_insns > 1);
             max_insns /= 2;
+            if (trace) {
+                /* Give up on the trace, and translate its first block. */
+                max_insns = MIN(max_insns, trace->icount[0]);
+                trace->nb_blocks = 1;
+                trace = NULL;
+            }
             qemu_log_mask(CPU_LOG_TB_OP | CPU_LOG_TB_OP_OPT,
                           "Restarting code generation with "
                           "smaller translation block (max %d insns)\n",
@@ -417,6 +449,13 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
                           "Restarting code generation with re-locked pages");
             goto restart_translate;
 
+        case -4:
+            /* A speculative translation needed a second page; drop it. */
+            tb_unlock_pages(tb);
+            tcg_ctx->gen_tb = NULL;
+            qatomic_set(&tcg_ctx->code_gen_ptr, (void *)tb);
+            return NULL;
+
         default:
             g_assert_not_reached();
         }
@@ -429,6 +468,7 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
         goto buffer_overflow;
     }
     tb->tc.size = gen_code_size;
+    tb_cache_record(cpu, tb, pc, host_pc);
 
     /*
      * For CF_PCREL, attribute all executions of the generated code
@@ -560,11 +600,38 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
         orig_aligned -= ROUND_UP(sizeof(*tb), qemu_icache_linesize);
         qatomic_set(&tcg_ctx->code_gen_ptr, (void *)orig_aligned);
         tcg_tb_remove(tb);
-        return existing_tb;
+        return spec ? NULL : existing_tb;
     }
+
+    tb_spec_queue(cpu, tb, tcg_ctx->goto_tb_dest, tcg_ctx->nb_goto_tb_dest,
+                  spec ? spec->depth + 1 : 0);
     return tb;
 }
 
+/* Called with mmap_lock held for user mode emulation.  */
+TranslationBlock *tb_gen_code(CPUState *cpu,
+                              vaddr pc, uint64_t cs_base,
+                              uint32_t flags, int cflags)
+{
+    return tb_gen_code_common(cpu, NULL, NULL, pc, cs_base, flags, cflags);
+}
+
+/* Called with mmap_lock held for user mode emulation.  */
+TranslationBlock *tb_gen_trace(CPUState *cpu, TBTrace *trace,
+                               vaddr pc, uint64_t cs_base,
+                               uint32_t flags, int cflags)
+{
+    return tb_gen_code_common(cpu, trace, NULL, pc, cs_base, flags, cflags);
+}
+
+#ifndef CONFIG_USER_ONLY
+TranslationBlock *tb_gen_speculative(TBSpecJob *job)
+{
+    return tb_gen_code_common(job->cpu, NULL, job, job->pc, job->cs_base,
+                              job->flags, job->cflags);
+}
+#endif
+
 /* user-mode: call with mmap_lock held */
 void tb_check_watchpoint(CPUState *cpu, uintptr_t retaddr)
 {
@@ -724,7 +791,7 @@ void dump_exec_info(GString *buf)
 {
     struct tb_tree_stats tst = {};
     struct qht_stats hst;
-    size_t nb_tbs, flush_full, flush_part, flush_elide;
+    size_t nb_tbs, flush_full, flush_part, flush_elide, flush_page;
 
     tcg_tb_foreach(tb_tree_stats_iter, &tst);
     nb_tbs = tst.nb_tbs;
@@ -765,11 +832,15 @@ void dump_exec_info(GString *buf)
                            qatomic_read(&tb_ctx.tb_flush_count));
     g_string_append_printf(buf, "TB invalidate count %u\n",
                            qatomic_read(&tb_ctx.tb_phys_invalidate_count));
+    tb_cache_dump_info(buf);
+    tb_trace_dump_info(buf);
+    tb_spec_dump_info(buf);
 
-    tlb_flush_counts(&flush_full, &flush_part, &flush_elide);
+    tlb_flush_counts(&flush_full, &flush_part, &flush_elide, &flush_page);
     g_string_append_printf(buf, "TLB full flushes    %zu\n", flush_full);
     g_string_append_printf(buf, "TLB partial flushes %zu\n", flush_part);
     g_string_append_printf(buf, "TLB elided flushes  %zu\n", flush_elide);
+    g_string_append_printf(buf, "TLB page flushes    %zu\n", flush_page);
     tcg_dump_info(buf);
 }
 
@@ -15,6 +15,7 @@
 #include "exec/plugin-gen.h"
 #include "tcg/tcg-op-common.h"
 #include "internal.h"
+#include "tb-trace.h"
 
 static void gen_io_start(void)
 {
@@ -47,7 +48,8 @@ bool translator_io_start(DisasContextBase *db)
     return true;
 }
 
-static TCGOp *gen_tb_start(uint32_t cflags)
+static TCGOp *gen_tb_start(CPUState *cpu, TranslationBlock *tb,
+                           uint32_t cflags)
 {
     TCGv_i32 count = tcg_temp_new_i32();
     TCGOp *icount_start_insn = NULL;
@@ -80,6 +82,21 @@ static TCGOp *gen_tb_start(uint32_t cflags)
         tcg_gen_brcondi_i32(TCG_COND_LT, count, 0, tcg_ctx->exitreq_label);
     }
 
+    /*
+     * Count executions for tb_trace_hot; the exit at the threshold is
+     * taken before any guest instruction runs, like the one above.
+     */
+    if (tb_trace_counted(cpu, tb)) {
+        TCGv_ptr ptr = tcg_constant_ptr(&tb->exec_count);
+        TCGv_i32 n = tcg_temp_new_i32();
+
+        tcg_gen_ld_i32(n, ptr, 0);
+        tcg_gen_addi_i32(n, n, 1);
+        tcg_gen_st_i32(n, ptr, 0);
+        tcg_gen_brcondi_i32(TCG_COND_EQ, n, tb_trace_threshold,
+                            tcg_ctx->exitreq_label);
+    }
+
     if (cflags & CF_USE_ICOUNT) {
         tcg_gen_st16_i32(count, cpu_env,
                          offsetof(ArchCPU, neg.icount_decr.u16.low) -
@@ -119,46 +136,49 @@ static void gen_tb_end(const TranslationBlock *tb, uint32_t cflags,
 
 bool translator_use_goto_tb(DisasContextBase *db, vaddr dest)
 {
+    TBTrace *trace = tcg_ctx->trace;
+
     /* Suppress goto_tb if requested. */
     if (tb_cflags(db->tb) & CF_NO_GOTO_TB) {
         return false;
     }
 
+    /*
+     * Within a trace, a jump to the next block becomes a branch inside
+     * the TB.  The TB has only two goto_tb exits, which are left to the
+     * last block; other exits of the earlier blocks use goto_ptr.
+     */
+    if (trace && trace->cur + 1 < trace->nb_blocks) {
+        int next = trace->cur + 1;
+
+        if (dest != trace->pc[next]) {
+            return false;
+        }
+        if (!trace->label[next]) {
+            trace->label[next] = gen_new_label();
+        }
+        tcg_ctx->goto_tb_label = trace->label[next];
+        return true;
+    }
+
     /* Check for the dest on the same page as the start of the TB.  */
-    return ((db->pc_first ^ dest) & TARGET_PAGE_MASK) == 0;
+    if ((db->pc_first ^ dest) & TARGET_PAGE_MASK) {
+        return false;
+    }
+    if (tcg_ctx->nb_goto_tb_dest < ARRAY_SIZE(tcg_ctx->goto_tb_dest)) {
+        tcg_ctx->goto_tb_dest[tcg_ctx->nb_goto_tb_dest++] = dest;
+    }
+    return true;
 }
 
-void translator_loop(CPUState *cpu, TranslationBlock *tb, int *max_insns,
-                     vaddr pc, void *host_pc, const TranslatorOps *ops,
-                     DisasContextBase *db)
+/* Translate the instructions of one TB, or of one block of a trace. */
+static void translator_insns(CPUState *cpu, DisasContextBase *db,
+                             const TranslatorOps *ops, uint32_t cflags,
+                             bool plugin_enabled, int *max_insns,
+                             int prev_insns)
 {
-    uint32_t cflags = tb_cflags(tb);
-    TCGOp *icount_start_insn;
-    bool plugin_enabled;
-
-    /* Initialize DisasContext */
-    db->tb = tb;
-    db->pc_first = pc;
-    db->pc_next = pc;
-    db->is_jmp = DISAS_NEXT;
-    db->num_insns = 0;
-    db->max_insns = *max_insns;
-    db->singlestep_enabled = cflags & CF_SINGLE_STEP;
-    db->host_addr[0] = host_pc;
-    db->host_addr[1] = NULL;
-
-    ops->init_disas_context(db, cpu);
-    tcg_debug_assert(db->is_jmp == DISAS_NEXT);  /* no early exit */
-
-    /* Start translating.  */
-    icount_start_insn = gen_tb_start(cflags);
-    ops->tb_start(db, cpu);
-    tcg_debug_assert(db->is_jmp == DISAS_NEXT);  /* no early exit */
-
-    plugin_enabled = plugin_gen_tb_start(cpu, db, cflags & CF_MEMI_ONLY);
-
     while (true) {
-        *max_insns = ++db->num_insns;
+        *max_insns = prev_insns + ++db->num_insns;
         ops->insn_start(db, cpu);
         tcg_debug_assert(db->is_jmp == DISAS_NEXT);  /* no early exit */
 
@@ -205,19 +225,11 @@ void translator_loop(CPUState *cpu, TranslationBlock *tb, int *max_insns,
             break;
         }
     }
+}
 
-    /* Emit code to exit the TB, as indicated by db->is_jmp.  */
-    ops->tb_stop(db, cpu);
-    gen_tb_end(tb, cflags, icount_start_insn, db->num_insns);
-
-    if (plugin_enabled) {
-        plugin_gen_tb_end(cpu);
-    }
-
-    /* The disas_log hook may use these values rather than recompute.  */
-    tb->size = db->pc_next - db->pc_first;
-    tb->icount = db->num_insns;
-
+static void translator_disas_log(CPUState *cpu, DisasContextBase *db,
+                                 const TranslatorOps *ops)
+{
     if (qemu_loglevel_mask(CPU_LOG_TB_IN_ASM)
         && qemu_log_in_addr_range(db->pc_first)) {
         FILE *logfile = qemu_log_trylock();
@@ -230,6 +242,148 @@ void translator_loop(CPUState *cpu, TranslationBlock *tb, int *max_insns,
     }
 }
 
+/*
+ * The block just translated is done; move on to the next block of
+ * the trace if it branches there.  Return false at the end of the trace.
+ */
+static bool translator_next_block(TBTrace *trace)
+{
+    TCGLabel *l;
+    TCGOp *op;
+    bool fallthrough = false;
+
+    if (trace->cur + 1 >= trace->nb_blocks) {
+        return false;
+    }
+    l = trace->label[trace->cur + 1];
+    if (!l) {
+        return false;
+    }
+
+    /* A branch to the next block at the very end can simply fall through. */
+    op = tcg_last_op();
+    if (op->opc == INDEX_op_br && arg_label(op->args[0]) == l) {
+        tcg_op_remove(tcg_ctx, op);
+        fallthrough = true;
+    }
+    if (!QSIMPLEQ_EMPTY(&l->branches)) {
+        gen_set_label(l);
+    } else if (!fallthrough) {
+        /* The front end exited some other way; the next block is dead. */
+        return false;
+    }
+    trace->cur++;
+    return true;
+}
+
+void translator_loop(CPUState *cpu, TranslationBlock *tb, int *max_insns,
+                     vaddr pc, void *host_pc, const TranslatorOps *ops,
+                     DisasContextBase *db)
+{
+    uint32_t cflags = tb_cflags(tb);
+    TBTrace *trace = tcg_ctx->trace;
+    TCGOp *icount_start_insn;
+    bool plugin_enabled;
+    int prev_insns = 0;
+    vaddr pc_end;
+
+    if (trace) {
+        /* This may be a retry after running out of code buffer. */
+        trace->cur = 0;
+        memset(trace->label, 0, sizeof(trace->label));
+    }
+
+    /* Initialize DisasContext */
+    db->tb = tb;
+    db->pc_first = pc;
+    db->pc_next = pc;
+    db->is_jmp = DISAS_NEXT;
+    db->num_insns = 0;
+    db->max_insns = trace ? trace->icount[0] : *max_insns;
+    db->singlestep_enabled = cflags & CF_SINGLE_STEP;
+    db->host_addr[0] = host_pc;
+    db->host_addr[1] = NULL;
+
+    ops->init_disas_context(db, cpu);
+    tcg_debug_assert(db->is_jmp == DISAS_NEXT);  /* no early exit */
+
+    /* Start translating.  */
+    icount_start_insn = gen_tb_start(cpu, tb, cflags);
+    ops->tb_start(db, cpu);
+    tcg_debug_assert(db->is_jmp == DISAS_NEXT);  /* no early exit */
+
+    plugin_enabled = plugin_gen_tb_start(cpu, db, cflags & CF_MEMI_ONLY);
+    tcg_debug_assert(!(trace && plugin_enabled));
+
+    translator_insns(cpu, db, ops, cflags, plugin_enabled, max_insns, 0);
+
+    /* Emit code to exit the TB, as indicated by db->is_jmp.  */
+    ops->tb_stop(db, cpu);
+    pc_end = db->pc_next;
+
+    /*
+     * The blocks of a trace are translated one after the other, each
+     * exactly as it would be as a TB of its own, except that the TB
+     * prologue is only emitted once.
+     */
+    if (trace) {
+        while (true) {
+            /* The disas_log hook uses the size of the block. */
+            tb->size = db->pc_next - db->pc_first;
+            translator_disas_log(cpu, db, ops);
+            tcg_ctx->goto_tb_label = NULL;
+
+            if (!translator_next_block(trace)) {
+                break;
+            }
+
+            prev_insns += db->num_insns;
+            db->pc_first = trace->pc[trace->cur];
+            db->pc_next = db->pc_first;
+            db->is_jmp = DISAS_NEXT;
+            db->num_insns = 0;
+            db->max_insns = trace->icount[trace->cur];
+            db->host_addr[0] = host_pc + (db->pc_first - pc);
+
+            ops->init_disas_context(db, cpu);
+            ops->tb_start(db, cpu);
+            tcg_debug_assert(db->is_jmp == DISAS_NEXT);  /* no early exit */
+            translator_insns(cpu, db, ops, cflags, false, max_insns,
+                             prev_insns);
+            ops->tb_stop(db, cpu);
+            pc_end = MAX(pc_end, db->pc_next);
+        }
+        trace->nb_blocks = trace->cur + 1;
+        db->pc_first = pc;
+        db->pc_next = pc_end;
+    }
+    gen_tb_end(tb, cflags, icount_start_insn, prev_insns + db->num_insns);
+
+    if (plugin_enabled) {
+        plugin_gen_tb_end(cpu);
+    }
+
+    /* The disas_log hook may use these values rather than recompute.  */
+    tb->size = pc_end - pc;
+    tb->icount = prev_insns + db->num_insns;
+
+    if (!trace) {
+        translator_disas_log(cpu, db, ops);
+    }
+}
+
+/*
+ * The cpu_ld*_code fallbacks fill the vCPU's TLB and may cpu_loop_exit
+ * on a fault, which a background translation must not do: give up on
+ * the speculative TB instead.
+ */
+static void translator_slow_path(void)
+{
+    if (tcg_ctx->speculative) {
+        siglongjmp(tcg_ctx->jmp_trans, -4);
+    }
+}
+
 static void *translator_access(CPUArchState *env, DisasContextBase *db,
                                vaddr pc, size_t len)
 {
@@ -254,6 +408,7 @@ static void *translator_access(CPUArchState *env, DisasContextBase *db,
         if (host == NULL) {
             tb_page_addr_t page0, old_page1, new_page1;
 
+            translator_slow_path();
             new_page1 = get_page_addr_code_hostp(env, base, &db->host_addr[1]);
 
             /*
@@ -325,6 +480,7 @@ uint8_t translator_ldub(CPUArchState *env, DisasContextBase *db, abi_ptr pc)
         plugin_insn_append(pc, p, sizeof(ret));
         return ldub_p(p);
     }
+    translator_slow_path();
     ret = cpu_ldub_code(env, pc);
     plugin_insn_append(pc, &ret, sizeof(ret));
     return ret;
@@ -339,6 +495,7 @@ uint16_t translator_lduw(CPUArchState *env, DisasContextBase *db, abi_ptr pc)
         plugin_insn_append(pc, p, sizeof(ret));
         return lduw_p(p);
     }
+    translator_slow_path();
     ret = cpu_lduw_code(env, pc);
     plug = tswap16(ret);
     plugin_insn_append(pc, &plug, sizeof(ret));
@@ -354,6 +511,7 @@ uint32_t translator_ldl(CPUArchState *env, DisasContextBase *db, abi_ptr pc)
         plugin_insn_append(pc, p, sizeof(ret));
         return ldl_p(p);
     }
+    translator_slow_path();
     ret = cpu_ldl_code(env, pc);
     plug = tswap32(ret);
     plugin_insn_append(pc, &plug, sizeof(ret));
@@ -369,12 +527,46 @@ uint64_t translator_ldq(CPUArchState *env, DisasContextBase *db, abi_ptr pc)
         plugin_insn_append(pc, p, sizeof(ret));
         return ldq_p(p);
     }
+    translator_slow_path();
     ret = cpu_ldq_code(env, pc);
     plug = tswap64(ret);
     plugin_insn_append(pc, &plug, sizeof(ret));
     return ret;
 }
 
+/*
+ * Return a host pointer to code on the first page of the TB, which is
+ * always mapped, or NULL if the caller must use the slow path.
+ */
+static void *translator_peek_access(DisasContextBase *db, vaddr pc,
+                                    size_t len)
+{
+    vaddr base = db->pc_first & TARGET_PAGE_MASK;
+
+    if (tb_page_addr0(db->tb) != -1 &&
+        is_same_page(db, pc) && is_same_page(db, pc + len - 1)) {
+        return db->host_addr[0] - (db->pc_first - base) + (pc - base);
+    }
+    translator_slow_path();
+    return NULL;
+}
+
+uint16_t translator_peek_lduw(CPUArchState *env, DisasContextBase *db,
+                              abi_ptr pc)
+{
+    void *p = translator_peek_access(db, pc, sizeof(uint16_t));
+
+    return p ? lduw_p(p) : cpu_lduw_code(env, pc);
+}
+
+uint32_t translator_peek_ldl(CPUArchState *env, DisasContextBase *db,
+                             abi_ptr pc)
+{
+    void *p = translator_peek_access(db, pc, sizeof(uint32_t));
+
+    return p ? ldl_p(p) : cpu_ldl_code(env, pc);
+}
+
 void translator_fake_ldb(uint8_t insn8, abi_ptr pc)
 {
     plugin_insn_append(pc, &insn8, sizeof(insn8));
@@ -25,11 +25,20 @@
 #include "hw/irq.h"
 #include "hw/char/sifive_uart.h"
 #include "hw/qdev-properties-system.h"
+#include "qemu/lockable.h"
+#include "qemu/main-loop.h"
 
 /*
- * Not yet implemented:
+ * RX bytes are kept in a ring of SIFIVE_UART_RX_FIFO_SIZE entries starting
+ * at rx_fifo_head. TX bytes are queued in tx_fifo and handed to the chardev
+ * backend in one go, either from a bottom half or as soon as the FIFO is
+ * full; if the backend cannot take them, they stay queued and the guest
+ * sees a full FIFO until the backend becomes writable again.
  *
- * Transmit FIFO using "qemu/fifo8.h"
+ * Register accesses run without the BQL under s->lock.  Whatever needs
+ * the BQL (a synchronous flush of a full TX FIFO, telling the backend
+ * that RX space is available, driving the interrupt line) is deferred to
+ * sifive_uart_sync(), which takes the BQL before s->lock.
  */
 
 /* Returns the state of the IP (interrupt pending) register */
@@ -40,7 +49,7 @@ static uint64_t sifive_uart_ip(SiFiveUARTState *s)
     uint64_t txcnt = SIFIVE_UART_GET_TXCNT(s->txctrl);
     uint64_t rxcnt = SIFIVE_UART_GET_RXCNT(s->rxctrl);
 
-    if (txcnt != 0) {
+    if (s->tx_fifo_len < txcnt) {
         ret |= SIFIVE_UART_IP_TXWM;
     }
     if (s->rx_fifo_len > rxcnt) {
@@ -52,37 +61,125 @@ static uint64_t sifive_uart_ip(SiFiveUARTState *s)
 
 static void sifive_uart_update_irq(SiFiveUARTState *s)
 {
-    int cond = 0;
-    if ((s->ie & SIFIVE_UART_IE_TXWM) ||
-        ((s->ie & SIFIVE_UART_IE_RXWM) && s->rx_fifo_len)) {
-        cond = 1;
+    bool level = sifive_uart_ip(s) & s->ie;
+
+    if (!qemu_mutex_iothread_locked()) {
+        if (level != s->irq_level) {
+            s->bql_pending = true;
+        }
+        return;
     }
-    if (cond) {
-        qemu_irq_raise(s->irq);
-    } else {
-        qemu_irq_lower(s->irq);
+
+    s->irq_level = level;
+    qemu_set_irq(s->irq, level);
+}
+
+static gboolean sifive_uart_xmit(void *do_not_use, GIOCondition cond,
+                                 void *opaque);
+
+/*
+ * Try to send the queued TX bytes, and arrange to be called back later
+ * for whatever the char backend could not take.
+ */
+static void sifive_uart_xmit_locked(SiFiveUARTState *s)
+{
+    int ret;
+
+    s->watch_tag = 0;
+
+    if (!s->tx_fifo_len) {
+        return;
     }
+
+    ret = qemu_chr_fe_write(&s->chr, s->tx_fifo, s->tx_fifo_len);
+    if (ret < 0) {
+        ret = 0;
+    }
+
+    s->tx_fifo_len -= ret;
+    if (s->tx_fifo_len) {
+        memmove(s->tx_fifo, s->tx_fifo + ret, s->tx_fifo_len);
+        s->watch_tag = qemu_chr_fe_add_watch(&s->chr, G_IO_OUT | G_IO_HUP,
+                                             sifive_uart_xmit, s);
+        if (!s->watch_tag) {
+            /*
+             * Most likely there is no chardev backend: drain the FIFO
+             * so that the output goes into a void rather than blocking
+             * the guest.
+             */
+            s->tx_fifo_len = 0;
+        }
+    }
+
+    sifive_uart_update_irq(s);
 }
 
-static uint64_t
-sifive_uart_read(void *opaque, hwaddr addr, unsigned int size)
+static gboolean sifive_uart_xmit(void *do_not_use, GIOCondition cond,
+                                 void *opaque)
 {
     SiFiveUARTState *s = opaque;
+
+    QEMU_LOCK_GUARD(&s->lock);
+    sifive_uart_xmit_locked(s);
+    return FALSE;
+}
+
+static void sifive_uart_tx_bh(void *opaque)
+{
+    SiFiveUARTState *s = opaque;
+
+    QEMU_LOCK_GUARD(&s->lock);
+
+    /* A pending watch already takes care of the queued bytes */
+    if (!s->watch_tag) {
+        sifive_uart_xmit_locked(s);
+    }
+}
+
+static void sifive_uart_sync(SiFiveUARTState *s)
+{
+    bool accept;
+
+    QEMU_IOTHREAD_LOCK_GUARD();
+
+    qemu_mutex_lock(&s->lock);
+    s->bql_pending = false;
+    accept = s->rx_accept;
+    s->rx_accept = false;
+    if (s->tx_fifo_len >= SIFIVE_UART_TX_FIFO_SIZE && !s->watch_tag) {
+        sifive_uart_xmit_locked(s);
+    }
+    sifive_uart_update_irq(s);
+    qemu_mutex_unlock(&s->lock);
+
+    /* The backend may hand over input right away, so call it unlocked */
+    if (accept) {
+        qemu_chr_fe_accept_input(&s->chr);
+    }
+}
+
+static uint64_t
+sifive_uart_read_locked(SiFiveUARTState *s, hwaddr addr)
+{
     unsigned char r;
     switch (addr) {
     case SIFIVE_UART_RXFIFO:
         if (s->rx_fifo_len) {
-            r = s->rx_fifo[0];
-            memmove(s->rx_fifo, s->rx_fifo + 1, s->rx_fifo_len - 1);
+            r = s->rx_fifo[s->rx_fifo_head];
+            s->rx_fifo_head = (s->rx_fifo_head + 1) % SIFIVE_UART_RX_FIFO_SIZE;
             s->rx_fifo_len--;
-            qemu_chr_fe_accept_input(&s->chr);
+            s->rx_accept = true;
+            s->bql_pending = true;
             sifive_uart_update_irq(s);
             return r;
         }
-        return 0x80000000;
+        return SIFIVE_UART_RXFIFO_EMPTY;
 
     case SIFIVE_UART_TXFIFO:
-        return 0; /* Should check tx fifo */
+        if (s->tx_fifo_len >= SIFIVE_UART_TX_FIFO_SIZE) {
+            return SIFIVE_UART_TXFIFO_FULL;
+        }
+        return 0;
     case SIFIVE_UART_IE:
         return s->ie;
     case SIFIVE_UART_IP:
@@ -101,16 +198,24 @@ sifive_uart_read(void *opaque, hwaddr addr, unsigned int size)
 }
 
 static void
-sifive_uart_write(void *opaque, hwaddr addr,
-                  uint64_t val64, unsigned int size)
+sifive_uart_write_locked(SiFiveUARTState *s, hwaddr addr, uint64_t val64)
 {
-    SiFiveUARTState *s = opaque;
     uint32_t value = val64;
     unsigned char ch = value;
 
     switch (addr) {
     case SIFIVE_UART_TXFIFO:
-        qemu_chr_fe_write(&s->chr, &ch, 1);
+        if (s->tx_fifo_len >= SIFIVE_UART_TX_FIFO_SIZE) {
+            qemu_log_mask(LOG_GUEST_ERROR, "%s: TX FIFO overflow\n",
+                          __func__);
+            return;
+        }
+        s->tx_fifo[s->tx_fifo_len++] = ch;
+        if (s->tx_fifo_len < SIFIVE_UART_TX_FIFO_SIZE) {
+            qemu_bh_schedule(s->tx_bh);
+        } else if (!s->watch_tag) {
+            s->bql_pending = true;
+        }
         sifive_uart_update_irq(s);
         return;
     case SIFIVE_UART_IE:
@@ -119,9 +224,11 @@ sifive_uart_write(void *opaque, hwaddr addr,
         return;
     case SIFIVE_UART_TXCTRL:
         s->txctrl = val64;
+        sifive_uart_update_irq(s);
         return;
     case SIFIVE_UART_RXCTRL:
         s->rxctrl = val64;
+        sifive_uart_update_irq(s);
         return;
     case SIFIVE_UART_DIV:
         s->div = val64;
@@ -131,6 +238,41 @@ sifive_uart_write(void *opaque, hwaddr addr,
                   __func__, (int)addr, (int)value);
 }
 
+static uint64_t
+sifive_uart_read(void *opaque, hwaddr addr, unsigned int size)
+{
+    SiFiveUARTState *s = opaque;
+    uint64_t ret;
+    bool sync;
+
+    qemu_mutex_lock(&s->lock);
+    ret = sifive_uart_read_locked(s, addr);
+    sync = s->bql_pending;
+    qemu_mutex_unlock(&s->lock);
+
+    if (sync) {
+        sifive_uart_sync(s);
+    }
+    return ret;
+}
+
+static void
+sifive_uart_write(void *opaque, hwaddr addr,
+                  uint64_t val64, unsigned int size)
+{
+    SiFiveUARTState *s = opaque;
+    bool sync;
+
+    qemu_mutex_lock(&s->lock);
+    sifive_uart_write_locked(s, addr, val64);
+    sync = s->bql_pending;
+    qemu_mutex_unlock(&s->lock);
+
+    if (sync) {
+        sifive_uart_sync(s);
+    }
+}
+
 static const MemoryRegionOps sifive_uart_ops = {
     .read = sifive_uart_read,
     .write = sifive_uart_write,
@@ -144,13 +286,20 @@ static const MemoryRegionOps sifive_uart_ops = {
 static void sifive_uart_rx(void *opaque, const uint8_t *buf, int size)
 {
     SiFiveUARTState *s = opaque;
+    int i;
 
-    /* Got a byte.  */
-    if (s->rx_fifo_len >= sizeof(s->rx_fifo)) {
-        printf("WARNING: UART dropped char.\n");
-        return;
+    QEMU_LOCK_GUARD(&s->lock);
+
+    for (i = 0; i < size; i++) {
+        if (s->rx_fifo_len >= SIFIVE_UART_RX_FIFO_SIZE) {
+            qemu_log_mask(LOG_GUEST_ERROR, "%s: RX FIFO overflow\n",
+                          __func__);
+            break;
+        }
+        s->rx_fifo[(s->rx_fifo_head + s->rx_fifo_len) %
+                   SIFIVE_UART_RX_FIFO_SIZE] = buf[i];
+        s->rx_fifo_len++;
     }
-    s->rx_fifo[s->rx_fifo_len++] = *buf;
 
     sifive_uart_update_irq(s);
 }
@@ -159,7 +308,8 @@ static int sifive_uart_can_rx(void *opaque)
 {
     SiFiveUARTState *s = opaque;
 
-    return s->rx_fifo_len < sizeof(s->rx_fifo);
+    QEMU_LOCK_GUARD(&s->lock);
+    return SIFIVE_UART_RX_FIFO_SIZE - s->rx_fifo_len;
 }
 
 static void sifive_uart_event(void *opaque, QEMUChrEvent event)
@@ -174,6 +324,16 @@ static int sifive_uart_be_change(void *opaque)
                              sifive_uart_event, sifive_uart_be_change, s,
                              NULL, true);
 
+    /* The watch belonged to the old backend; retry on the new one */
+    QEMU_LOCK_GUARD(&s->lock);
+    if (s->watch_tag) {
+        g_source_remove(s->watch_tag);
+        s->watch_tag = 0;
+    }
+    if (s->tx_fifo_len) {
+        sifive_uart_xmit_locked(s);
+    }
+
     return 0;
 }
 
@@ -187,8 +347,10 @@ static void sifive_uart_init(Object *obj)
     SysBusDevice *sbd = SYS_BUS_DEVICE(obj);
     SiFiveUARTState *s = SIFIVE_UART(obj);
 
+    qemu_mutex_init(&s->lock);
     memory_region_init_io(&s->mmio, OBJECT(s), &sifive_uart_ops, s,
                           TYPE_SIFIVE_UART, SIFIVE_UART_MAX);
+    memory_region_enable_lockless_io(&s->mmio);
     sysbus_init_mmio(sbd, &s->mmio);
     sysbus_init_irq(sbd, &s->irq);
 }
@@ -197,33 +359,82 @@ static void sifive_uart_realize(DeviceState *dev, Error **errp)
 {
     SiFiveUARTState *s = SIFIVE_UART(dev);
 
+    s->tx_bh = qemu_bh_new_guarded(sifive_uart_tx_bh, s,
+                                   &dev->mem_reentrancy_guard);
+
     qemu_chr_fe_set_handlers(&s->chr, sifive_uart_can_rx, sifive_uart_rx,
                              sifive_uart_event, sifive_uart_be_change, s,
                              NULL, true);
 
 }
 
+static void sifive_uart_unrealize(DeviceState *dev)
+{
+    SiFiveUARTState *s = SIFIVE_UART(dev);
+
+    qemu_chr_fe_deinit(&s->chr, false);
+
+    if (s->watch_tag) {
+        g_source_remove(s->watch_tag);
+        s->watch_tag = 0;
+    }
+    qemu_bh_delete(s->tx_bh);
+    s->tx_bh = NULL;
+}
+
 static void sifive_uart_reset_enter(Object *obj, ResetType type)
 {
     SiFiveUARTState *s = SIFIVE_UART(obj);
+
+    QEMU_LOCK_GUARD(&s->lock);
     s->ie = 0;
     s->ip = 0;
     s->txctrl = 0;
     s->rxctrl = 0;
     s->div = 0;
     s->rx_fifo_len = 0;
+    s->rx_fifo_head = 0;
+    s->tx_fifo_len = 0;
+    s->bql_pending = false;
+    s->rx_accept = false;
+
+    if (s->watch_tag) {
+        g_source_remove(s->watch_tag);
+        s->watch_tag = 0;
+    }
 }
 
 static void sifive_uart_reset_hold(Object *obj)
 {
     SiFiveUARTState *s = SIFIVE_UART(obj);
+
+    s->irq_level = false;
     qemu_irq_lower(s->irq);
 }
 
+static int sifive_uart_post_load(void *opaque, int version_id)
+{
+    SiFiveUARTState *s = opaque;
+
+    if (s->rx_fifo_len > SIFIVE_UART_RX_FIFO_SIZE ||
+        s->rx_fifo_head >= SIFIVE_UART_RX_FIFO_SIZE ||
+        s->tx_fifo_len > SIFIVE_UART_TX_FIFO_SIZE) {
+        return -EINVAL;
+    }
+
+    s->irq_level = sifive_uart_ip(s) & s->ie;
+    if (s->tx_fifo_len) {
+        qemu_bh_schedule(s->tx_bh);
+    }
+
+    return 0;
+}
+
 static const VMStateDescription vmstate_sifive_uart = {
     .name = TYPE_SIFIVE_UART,
-    .version_id = 1,
+    .version_id = 2,
     .minimum_version_id = 1,
+    .post_load = sifive_uart_post_load,
     .fields = (VMStateField[]) {
         VMSTATE_UINT8_ARRAY(rx_fifo, SiFiveUARTState,
                             SIFIVE_UART_RX_FIFO_SIZE),
@@ -233,6 +444,10 @@ static const VMStateDescription vmstate_sifive_uart = {
         VMSTATE_UINT32(txctrl, SiFiveUARTState),
         VMSTATE_UINT32(rxctrl, SiFiveUARTState),
         VMSTATE_UINT32(div, SiFiveUARTState),
+        VMSTATE_UINT8_V(rx_fifo_head, SiFiveUARTState, 2),
+        VMSTATE_UINT8_ARRAY_V(tx_fifo, SiFiveUARTState,
+                              SIFIVE_UART_TX_FIFO_SIZE, 2),
+        VMSTATE_UINT8_V(tx_fifo_len, SiFiveUARTState, 2),
         VMSTATE_END_OF_LIST()
     },
 };
@@ -244,6 +459,7 @@ static void sifive_uart_class_init(ObjectClass *oc, void *data)
     ResettableClass *rc = RESETTABLE_CLASS(oc);
 
     dc->realize = sifive_uart_realize;
+    dc->unrealize = sifive_uart_unrealize;
     dc->vmsd = &vmstate_sifive_uart;
     rc->phases.enter = sifive_uart_reset_enter;
     rc->phases.hold  = sifive_uart_reset_hold;
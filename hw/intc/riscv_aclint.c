@@ -31,14 +31,12 @@
 #include "hw/qdev-properties.h"
 #include "hw/intc/riscv_aclint.h"
 #include "qemu/timer.h"
+#include "qemu/bitmap.h"
+#include "qemu/lockable.h"
+#include "qemu/main-loop.h"
 #include "hw/irq.h"
 #include "migration/vmstate.h"
 
-typedef struct riscv_aclint_mtimer_callback {
-    RISCVAclintMTimerState *s;
-    int num;
-} riscv_aclint_mtimer_callback;
-
 static uint64_t cpu_riscv_read_rtc_raw(uint32_t timebase_freq)
 {
     return muldiv64(qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL),
@@ -51,6 +49,81 @@ static uint64_t cpu_riscv_read_rtc(void *opaque)
     return cpu_riscv_read_rtc_raw(mtimer->timebase_freq) + mtimer->time_delta;
 }
 
+/* Arm the shared timer for the earliest deadline of any hart. */
+static void riscv_aclint_mtimer_rearm(RISCVAclintMTimerState *mtimer)
+{
+    int64_t next = INT64_MAX;
+    int i;
+
+    for (i = 0; i < mtimer->num_harts; i++) {
+        next = MIN(next, mtimer->deadline_ns[i]);
+    }
+
+    mtimer->next_ns = next;
+    if (next == INT64_MAX) {
+        timer_del(mtimer->timer);
+    } else {
+        timer_mod(mtimer->timer, next);
+    }
+}
+
+static void riscv_aclint_mtimer_set_deadline(RISCVAclintMTimerState *mtimer,
+                                             int hartid, int64_t next)
+{
+    int64_t old = mtimer->deadline_ns[hartid];
+
+    mtimer->deadline_ns[hartid] = next;
+    if (next < mtimer->next_ns) {
+        mtimer->next_ns = next;
+        timer_mod(mtimer->timer, next);
+    } else if (old == mtimer->next_ns && next != old) {
+        /* This hart held the earliest deadline; find the new one. */
+        riscv_aclint_mtimer_rearm(mtimer);
+    }
+}
+
+/*
+ * Set the level of a hart's timer line.  Without the BQL the line cannot
+ * be driven here, so unless the hart already sees that level it is left
+ * for riscv_aclint_mtimer_flush_irqs().
+ */
+static void riscv_aclint_mtimer_set_irq(RISCVAclintMTimerState *mtimer,
+                                        RISCVCPU *cpu, int hartid, bool level)
+{
+    if (level) {
+        set_bit(hartid, mtimer->irq_level);
+    } else {
+        clear_bit(hartid, mtimer->irq_level);
+    }
+
+    if (qemu_mutex_iothread_locked()) {
+        clear_bit(hartid, mtimer->irq_dirty);
+        qemu_set_irq(mtimer->timer_irqs[hartid], level);
+    } else if (!!(cpu->env.mip & MIP_MTIP) != level) {
+        set_bit(hartid, mtimer->irq_dirty);
+        mtimer->irq_pending = true;
+    } else {
+        clear_bit(hartid, mtimer->irq_dirty);
+    }
+}
+
+/* Drive the timer lines left behind by accesses made without the BQL. */
+static void riscv_aclint_mtimer_flush_irqs(RISCVAclintMTimerState *mtimer)
+{
+    unsigned long i;
+
+    QEMU_IOTHREAD_LOCK_GUARD();
+    QEMU_LOCK_GUARD(&mtimer->lock);
+
+    mtimer->irq_pending = false;
+    for (i = find_first_bit(mtimer->irq_dirty, mtimer->num_harts);
+         i < mtimer->num_harts;
+         i = find_next_bit(mtimer->irq_dirty, mtimer->num_harts, i + 1)) {
+        clear_bit(i, mtimer->irq_dirty);
+        qemu_set_irq(mtimer->timer_irqs[i], test_bit(i, mtimer->irq_level));
+    }
+}
+
 /*
  * Called when timecmp is written to update the QEMU timer or immediately
  * trigger timer interrupt if mtimecmp <= current timer value.
@@ -75,12 +148,13 @@ static void riscv_aclint_mtimer_write_timecmp(RISCVAclintMTimerState *mtimer,
          * If we're setting an MTIMECMP value in the "past",
          * immediately raise the timer interrupt
          */
-        qemu_irq_raise(mtimer->timer_irqs[hartid]);
+        riscv_aclint_mtimer_set_deadline(mtimer, hartid, INT64_MAX);
+        riscv_aclint_mtimer_set_irq(mtimer, cpu, hartid, true);
         return;
     }
 
     /* otherwise, set up the future timer interrupt */
-    qemu_irq_lower(mtimer->timer_irqs[hartid]);
+    riscv_aclint_mtimer_set_irq(mtimer, cpu, hartid, false);
     diff = mtimer->timecmp[hartid] - rtc_r;
     /* back to ns (note args switched in muldiv64) */
     uint64_t ns_diff = muldiv64(diff, NANOSECONDS_PER_SECOND, timebase_freq);
@@ -106,18 +180,31 @@ static void riscv_aclint_mtimer_write_timecmp(RISCVAclintMTimerState *mtimer,
         next = MIN(next, INT64_MAX);
     }
 
-    timer_mod(mtimer->timers[hartid], next);
+    riscv_aclint_mtimer_set_deadline(mtimer, hartid, next);
 }
 
 /*
- * Callback used when the timer set using timer_mod expires.
- * Should raise the timer interrupt line
+ * Callback used when the shared timer expires.  Raises the timer interrupt
+ * line of every hart whose deadline has passed, so harts with the same
+ * deadline wake the host once, then re-arms for the next deadline.
  */
 static void riscv_aclint_mtimer_cb(void *opaque)
 {
-    riscv_aclint_mtimer_callback *state = opaque;
+    RISCVAclintMTimerState *mtimer = opaque;
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    int i;
+
+    QEMU_LOCK_GUARD(&mtimer->lock);
 
-    qemu_irq_raise(state->s->timer_irqs[state->num]);
+    for (i = 0; i < mtimer->num_harts; i++) {
+        if (mtimer->deadline_ns[i] <= now) {
+            mtimer->deadline_ns[i] = INT64_MAX;
+            set_bit(i, mtimer->irq_level);
+            clear_bit(i, mtimer->irq_dirty);
+            qemu_irq_raise(mtimer->timer_irqs[i]);
+        }
+    }
+    riscv_aclint_mtimer_rearm(mtimer);
 }
 
 /* CPU read MTIMER register */
@@ -126,6 +213,8 @@ static uint64_t riscv_aclint_mtimer_read(void *opaque, hwaddr addr,
 {
     RISCVAclintMTimerState *mtimer = opaque;
 
+    QEMU_LOCK_GUARD(&mtimer->lock);
+
     if (addr >= mtimer->timecmp_base &&
         addr < (mtimer->timecmp_base + (mtimer->num_harts << 3))) {
         size_t hartid = mtimer->hartid_base +
@@ -162,11 +251,9 @@ static uint64_t riscv_aclint_mtimer_read(void *opaque, hwaddr addr,
     return 0;
 }
 
-/* CPU write MTIMER register */
-static void riscv_aclint_mtimer_write(void *opaque, hwaddr addr,
-    uint64_t value, unsigned size)
+static void riscv_aclint_mtimer_write_locked(RISCVAclintMTimerState *mtimer,
+    hwaddr addr, uint64_t value, unsigned size)
 {
-    RISCVAclintMTimerState *mtimer = opaque;
     int i;
 
     if (addr >= mtimer->timecmp_base &&
@@ -247,6 +334,23 @@ static void riscv_aclint_mtimer_write(void *opaque, hwaddr addr,
                   "aclint-mtimer: invalid write: %08x", (uint32_t)addr);
 }
 
+/* CPU write MTIMER register */
+static void riscv_aclint_mtimer_write(void *opaque, hwaddr addr,
+    uint64_t value, unsigned size)
+{
+    RISCVAclintMTimerState *mtimer = opaque;
+    bool flush;
+
+    qemu_mutex_lock(&mtimer->lock);
+    riscv_aclint_mtimer_write_locked(mtimer, addr, value, size);
+    flush = mtimer->irq_pending;
+    qemu_mutex_unlock(&mtimer->lock);
+
+    if (flush) {
+        riscv_aclint_mtimer_flush_irqs(mtimer);
+    }
+}
+
 static const MemoryRegionOps riscv_aclint_mtimer_ops = {
     .read = riscv_aclint_mtimer_read,
     .write = riscv_aclint_mtimer_write,
@@ -281,14 +385,23 @@ static void riscv_aclint_mtimer_realize(DeviceState *dev, Error **errp)
     RISCVAclintMTimerState *s = RISCV_ACLINT_MTIMER(dev);
     int i;
 
+    qemu_mutex_init(&s->lock);
     memory_region_init_io(&s->mmio, OBJECT(dev), &riscv_aclint_mtimer_ops,
                           s, TYPE_RISCV_ACLINT_MTIMER, s->aperture_size);
+    memory_region_enable_lockless_io(&s->mmio);
     sysbus_init_mmio(SYS_BUS_DEVICE(dev), &s->mmio);
 
     s->timer_irqs = g_new(qemu_irq, s->num_harts);
     qdev_init_gpio_out(dev, s->timer_irqs, s->num_harts);
 
-    s->timers = g_new0(QEMUTimer *, s->num_harts);
+    s->timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, riscv_aclint_mtimer_cb, s);
+    s->deadline_ns = g_new(int64_t, s->num_harts);
+    for (i = 0; i < s->num_harts; i++) {
+        s->deadline_ns[i] = INT64_MAX;
+    }
+    s->next_ns = INT64_MAX;
+    s->irq_level = bitmap_new(s->num_harts);
+    s->irq_dirty = bitmap_new(s->num_harts);
     s->timecmp = g_new0(uint64_t, s->num_harts);
     /* Claim timer interrupt bits */
     for (i = 0; i < s->num_harts; i++) {
@@ -375,21 +488,14 @@ DeviceState *riscv_aclint_mtimer_create(hwaddr addr, hwaddr size,
         CPUState *cpu = cpu_by_arch_id(hartid_base + i);
         RISCVCPU *rvcpu = RISCV_CPU(cpu);
         CPURISCVState *env = cpu ? cpu->env_ptr : NULL;
-        riscv_aclint_mtimer_callback *cb =
-            g_new0(riscv_aclint_mtimer_callback, 1);
 
         if (!env) {
-            g_free(cb);
             continue;
         }
         if (provide_rdtime) {
             riscv_cpu_set_rdtime_fn(env, cpu_riscv_read_rtc, dev);
         }
 
-        cb->s = s;
-        cb->num = i;
-        s->timers[i] = timer_new_ns(QEMU_CLOCK_VIRTUAL,
-                                  &riscv_aclint_mtimer_cb, cb);
         s->timecmp[i] = 0;
 
         qdev_connect_gpio_out(dev, i,
@@ -475,6 +581,11 @@ static void riscv_aclint_swi_realize(DeviceState *dev, Error **errp)
 
     memory_region_init_io(&swi->mmio, OBJECT(dev), &riscv_aclint_swi_ops, swi,
                           TYPE_RISCV_ACLINT_SWI, RISCV_ACLINT_SWI_SIZE);
+    /*
+     * The SWI has no state of its own: accesses go straight to the
+     * harts' mip, and riscv_cpu_update_mip() takes the BQL if needed.
+     */
+    memory_region_enable_lockless_io(&swi->mmio);
     sysbus_init_mmio(SYS_BUS_DEVICE(dev), &swi->mmio);
 
     swi->soft_irqs = g_new(qemu_irq, swi->num_harts);
@@ -22,6 +22,7 @@
 #include "qemu/module.h"
 #include "qemu/error-report.h"
 #include "qemu/bswap.h"
+#include "qemu/host-utils.h"
 #include "exec/address-spaces.h"
 #include "hw/sysbus.h"
 #include "hw/pci/msi.h"
@@ -45,31 +46,66 @@
 #define IMSIC_EISTATE_ENPEND           (IMSIC_EISTATE_ENABLED | \
                                         IMSIC_EISTATE_PENDING)
 
+/*
+ * State that an MSI write can change is accessed with atomics, and MSI
+ * writes are dispatched without the BQL: a device thread or another hart
+ * posts an interrupt without waiting for the BQL unless the hart's
+ * external interrupt line actually has to change.
+ */
+
+static uint32_t riscv_imsic_atomic_rmw(uint32_t *a, uint32_t mask,
+                                       uint32_t value)
+{
+    uint32_t old, new, cmp = qatomic_read(a);
+
+    do {
+        old = cmp;
+        new = (old & ~mask) | (value & mask);
+        cmp = qatomic_cmpxchg(a, old, new);
+    } while (old != cmp);
+
+    return old;
+}
+
 static uint32_t riscv_imsic_topei(RISCVIMSICState *imsic, uint32_t page)
 {
-    uint32_t i, max_irq, base;
-
-    base = page * imsic->num_irqs;
-    max_irq = (imsic->eithreshold[page] &&
-               (imsic->eithreshold[page] <= imsic->num_irqs)) ?
-               imsic->eithreshold[page] : imsic->num_irqs;
-    for (i = 1; i < max_irq; i++) {
-        if ((imsic->eistate[base + i] & IMSIC_EISTATE_ENPEND) ==
-                IMSIC_EISTATE_ENPEND) {
-            return (i << IMSIC_TOPEI_IID_SHIFT) | i;
+    uint32_t i, id, max_irq, base, word;
+    uint32_t threshold = qatomic_read(&imsic->eithreshold[page]);
+
+    base = page * imsic->num_words;
+    max_irq = (threshold && (threshold <= imsic->num_irqs)) ?
+               threshold : imsic->num_irqs;
+    for (i = 0; (i << 5) < max_irq; i++) {
+        word = qatomic_read(&imsic->eip[base + i]) &
+               qatomic_read(&imsic->eie[base + i]);
+        if (word) {
+            id = (i << 5) + ctz32(word);
+            return (id < max_irq) ? (id << IMSIC_TOPEI_IID_SHIFT) | id : 0;
         }
     }
 
     return 0;
 }
 
+static bool riscv_imsic_level(RISCVIMSICState *imsic, uint32_t page)
+{
+    return qatomic_read(&imsic->eidelivery[page]) &&
+           riscv_imsic_topei(imsic, page);
+}
+
+/*
+ * Concurrent updates may drive the line in any order, so each one checks
+ * after driving it that the level still matches the state: whichever
+ * update drives the line last leaves it right.
+ */
 static void riscv_imsic_update(RISCVIMSICState *imsic, uint32_t page)
 {
-    if (imsic->eidelivery[page] && riscv_imsic_topei(imsic, page)) {
-        qemu_irq_raise(imsic->external_irqs[page]);
-    } else {
-        qemu_irq_lower(imsic->external_irqs[page]);
-    }
+    bool level;
+
+    do {
+        level = riscv_imsic_level(imsic, page);
+        qemu_set_irq(imsic->external_irqs[page], level);
+    } while (level != riscv_imsic_level(imsic, page));
 }
 
 static int riscv_imsic_eidelivery_rmw(RISCVIMSICState *imsic, uint32_t page,
@@ -84,7 +120,8 @@ static int riscv_imsic_eidelivery_rmw(RISCVIMSICState *imsic, uint32_t page,
     }
 
     wr_mask &= 0x1;
-    imsic->eidelivery[page] = (old_val & ~wr_mask) | (new_val & wr_mask);
+    qatomic_set(&imsic->eidelivery[page],
+                (old_val & ~wr_mask) | (new_val & wr_mask));
 
     riscv_imsic_update(imsic, page);
     return 0;
@@ -102,7 +139,8 @@ static int riscv_imsic_eithreshold_rmw(RISCVIMSICState *imsic, uint32_t page,
     }
 
     wr_mask &= IMSIC_MAX_ID;
-    imsic->eithreshold[page] = (old_val & ~wr_mask) | (new_val & wr_mask);
+    qatomic_set(&imsic->eithreshold[page],
+                (old_val & ~wr_mask) | (new_val & wr_mask));
 
     riscv_imsic_update(imsic, page);
     return 0;
@@ -112,7 +150,7 @@ static int riscv_imsic_topei_rmw(RISCVIMSICState *imsic, uint32_t page,
                                  target_ulong *val, target_ulong new_val,
                                  target_ulong wr_mask)
 {
-    uint32_t base, topei = riscv_imsic_topei(imsic, page);
+    uint32_t topei = riscv_imsic_topei(imsic, page);
 
     /* Read pending and enabled interrupt with highest priority */
     if (val) {
@@ -122,9 +160,9 @@ static int riscv_imsic_topei_rmw(RISCVIMSICState *imsic, uint32_t page,
     /* Writes ignore value and clear top pending interrupt */
     if (topei && wr_mask) {
         topei >>= IMSIC_TOPEI_IID_SHIFT;
-        base = page * imsic->num_irqs;
         if (topei) {
-            imsic->eistate[base + topei] &= ~IMSIC_EISTATE_PENDING;
+            qatomic_and(&imsic->eip[page * imsic->num_words + (topei >> 5)],
+                        ~(1U << (topei & 31)));
         }
 
         riscv_imsic_update(imsic, page);
@@ -138,9 +176,9 @@ static int riscv_imsic_eix_rmw(RISCVIMSICState *imsic,
                                uint32_t num, bool pend, target_ulong *val,
                                target_ulong new_val, target_ulong wr_mask)
 {
-    uint32_t i, base;
-    target_ulong mask;
-    uint32_t state = (pend) ? IMSIC_EISTATE_PENDING : IMSIC_EISTATE_ENABLED;
+    uint32_t *bits = pend ? imsic->eip : imsic->eie;
+    uint64_t old_val = 0;
+    uint32_t i, base, old;
 
     if (xlen != 32) {
         if (num & 0x1) {
@@ -152,30 +190,26 @@ static int riscv_imsic_eix_rmw(RISCVIMSICState *imsic,
         return -EINVAL;
     }
 
-    base = (page * imsic->num_irqs) + (num * xlen);
-
-    if (val) {
-        *val = 0;
-        for (i = 0; i < xlen; i++) {
-            mask = (target_ulong)1 << i;
-            *val |= (imsic->eistate[base + i] & state) ? mask : 0;
-        }
+    /* Bit0 of eip0 and eie0 are read-only zero */
+    if (!num) {
+        wr_mask &= ~(target_ulong)1;
     }
 
-    for (i = 0; i < xlen; i++) {
-        /* Bit0 of eip0 and eie0 are read-only zero */
-        if (!num && !i) {
-            continue;
-        }
+    base = (page * imsic->num_words) + (num * (xlen >> 5));
+    for (i = 0; i < (xlen >> 5); i++) {
+        uint32_t mask = (uint64_t)wr_mask >> (i << 5);
+        uint32_t value = (uint64_t)new_val >> (i << 5);
 
-        mask = (target_ulong)1 << i;
-        if (wr_mask & mask) {
-            if (new_val & mask) {
-                imsic->eistate[base + i] |= state;
-            } else {
-                imsic->eistate[base + i] &= ~state;
-            }
+        if (mask) {
+            old = riscv_imsic_atomic_rmw(&bits[base + i], mask, value);
+        } else {
+            old = qatomic_read(&bits[base + i]);
         }
+        old_val |= (uint64_t)old << (i << 5);
+    }
+
+    if (val) {
+        *val = old_val;
     }
 
     riscv_imsic_update(imsic, page);
@@ -287,8 +321,8 @@ static void riscv_imsic_write(void *opaque, hwaddr addr, uint64_t value,
     page = addr >> IMSIC_MMIO_PAGE_SHIFT;
     if ((addr & (IMSIC_MMIO_PAGE_SZ - 1)) == IMSIC_MMIO_PAGE_LE) {
         if (value && (value < imsic->num_irqs)) {
-            imsic->eistate[(page * imsic->num_irqs) + value] |=
-                                                    IMSIC_EISTATE_PENDING;
+            qatomic_or(&imsic->eip[page * imsic->num_words + (value >> 5)],
+                       1U << (value & 31));
         }
     }
 
@@ -320,14 +354,27 @@ static void riscv_imsic_realize(DeviceState *dev, Error **errp)
     CPUState *cpu = cpu_by_arch_id(imsic->hartid);
     CPURISCVState *env = cpu ? cpu->env_ptr : NULL;
 
+    /*
+     * The AIA makes the number of identities one less than a multiple of
+     * 64, which the eip/eie arrays and the 64-bit eipN/eieN CSRs rely on.
+     */
+    if (!imsic->num_irqs || imsic->num_irqs % 64) {
+        error_setg(errp, "num-irqs must be a non-zero multiple of 64");
+        return;
+    }
+
     imsic->num_eistate = imsic->num_pages * imsic->num_irqs;
     imsic->eidelivery = g_new0(uint32_t, imsic->num_pages);
     imsic->eithreshold = g_new0(uint32_t, imsic->num_pages);
     imsic->eistate = g_new0(uint32_t, imsic->num_eistate);
+    imsic->num_words = imsic->num_irqs >> 5;
+    imsic->eip = g_new0(uint32_t, imsic->num_pages * imsic->num_words);
+    imsic->eie = g_new0(uint32_t, imsic->num_pages * imsic->num_words);
 
     memory_region_init_io(&imsic->mmio, OBJECT(dev), &riscv_imsic_ops,
                           imsic, TYPE_RISCV_IMSIC,
                           IMSIC_MMIO_SIZE(imsic->num_pages));
+    memory_region_enable_lockless_io(&imsic->mmio);
     sysbus_init_mmio(SYS_BUS_DEVICE(dev), &imsic->mmio);
 
     /* Claim the CPU interrupt to be triggered by this IMSIC */
@@ -365,10 +412,57 @@ static Property riscv_imsic_properties[] = {
     DEFINE_PROP_END_OF_LIST(),
 };
 
+static int riscv_imsic_pre_save(void *opaque)
+{
+    RISCVIMSICState *imsic = opaque;
+    uint32_t i, word, bit;
+
+    for (i = 0; i < imsic->num_eistate; i++) {
+        word = (i / imsic->num_irqs) * imsic->num_words +
+               ((i % imsic->num_irqs) >> 5);
+        bit = 1U << (i & 31);
+        imsic->eistate[i] =
+            ((imsic->eip[word] & bit) ? IMSIC_EISTATE_PENDING : 0) |
+            ((imsic->eie[word] & bit) ? IMSIC_EISTATE_ENABLED : 0);
+    }
+
+    return 0;
+}
+
+static int riscv_imsic_post_load(void *opaque, int version_id)
+{
+    RISCVIMSICState *imsic = opaque;
+    uint32_t i, word, bit;
+
+    memset(imsic->eip, 0,
+           sizeof(uint32_t) * imsic->num_pages * imsic->num_words);
+    memset(imsic->eie, 0,
+           sizeof(uint32_t) * imsic->num_pages * imsic->num_words);
+    for (i = 0; i < imsic->num_eistate; i++) {
+        /* Identity 0 is never valid */
+        if (!(i % imsic->num_irqs)) {
+            continue;
+        }
+        word = (i / imsic->num_irqs) * imsic->num_words +
+               ((i % imsic->num_irqs) >> 5);
+        bit = 1U << (i & 31);
+        if (imsic->eistate[i] & IMSIC_EISTATE_PENDING) {
+            imsic->eip[word] |= bit;
+        }
+        if (imsic->eistate[i] & IMSIC_EISTATE_ENABLED) {
+            imsic->eie[word] |= bit;
+        }
+    }
+
+    return 0;
+}
+
 static const VMStateDescription vmstate_riscv_imsic = {
     .name = "riscv_imsic",
     .version_id = 1,
     .minimum_version_id = 1,
+    .pre_save = riscv_imsic_pre_save,
+    .post_load = riscv_imsic_post_load,
     .fields = (VMStateField[]) {
             VMSTATE_VARRAY_UINT32(eidelivery, RISCVIMSICState,
                                   num_pages, 0,
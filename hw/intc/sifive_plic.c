@@ -31,6 +31,9 @@
 #include "migration/vmstate.h"
 #include "hw/irq.h"
 #include "sysemu/kvm.h"
+#include "qemu/bitmap.h"
+#include "qemu/lockable.h"
+#include "qemu/main-loop.h"
 
 static bool addr_between(uint32_t addr, uint32_t base, uint32_t num)
 {
@@ -62,9 +65,12 @@ static uint32_t atomic_set_masked(uint32_t *a, uint32_t mask, uint32_t value)
     return old;
 }
 
-static void sifive_plic_set_pending(SiFivePLICState *plic, int irq, bool level)
+static bool sifive_plic_set_pending(SiFivePLICState *plic, int irq, bool level)
 {
-    atomic_set_masked(&plic->pending[irq >> 5], 1 << (irq & 31), -!!level);
+    uint32_t mask = 1u << (irq & 31);
+    uint32_t old = atomic_set_masked(&plic->pending[irq >> 5], mask, -!!level);
+
+    return !!(old & mask) != level;
 }
 
 static void sifive_plic_set_claimed(SiFivePLICState *plic, int irq, bool level)
@@ -72,39 +78,47 @@ static void sifive_plic_set_claimed(SiFivePLICState *plic, int irq, bool level)
     atomic_set_masked(&plic->claimed[irq >> 5], 1 << (irq & 31), -!!level);
 }
 
+static qemu_irq sifive_plic_context_output(SiFivePLICState *plic,
+                                           uint32_t addrid)
+{
+    uint32_t hartid = plic->addr_config[addrid].hartid;
+
+    switch (plic->addr_config[addrid].mode) {
+    case PLICMode_M:
+        return plic->m_external_irqs[hartid - plic->hartid_base];
+    case PLICMode_S:
+        return plic->s_external_irqs[hartid - plic->hartid_base];
+    default:
+        return NULL;
+    }
+}
+
+/*
+ * Highest priority claimable source above the context threshold; the
+ * lowest source ID wins a tie.  Only the set bits of the context's
+ * claimable bitmap are visited.
+ */
 static uint32_t sifive_plic_claimed(SiFivePLICState *plic, uint32_t addrid)
 {
+    uint32_t *claimable = &plic->claimable[addrid * plic->bitfield_words];
     uint32_t max_irq = 0;
     uint32_t max_prio = plic->target_priority[addrid];
-    int i, j;
-    int num_irq_in_word = 32;
+    int i;
 
     for (i = 0; i < plic->bitfield_words; i++) {
-        uint32_t pending_enabled_not_claimed =
-                        (plic->pending[i] & ~plic->claimed[i]) &
-                            plic->enable[addrid * plic->bitfield_words + i];
-
-        if (!pending_enabled_not_claimed) {
-            continue;
-        }
-
-        if (i == (plic->bitfield_words - 1)) {
-            /*
-             * If plic->num_sources is not multiple of 32, num-of-irq in last
-             * word is not 32. Compute the num-of-irq of last word to avoid
-             * out-of-bound access of source_priority array.
-             */
-            num_irq_in_word = plic->num_sources - ((plic->bitfield_words - 1) << 5);
-        }
+        uint32_t word = claimable[i];
 
-        for (j = 0; j < num_irq_in_word; j++) {
-            int irq = (i << 5) + j;
+        while (word) {
+            int irq = (i << 5) + ctz32(word);
             uint32_t prio = plic->source_priority[irq];
-            int enabled = pending_enabled_not_claimed & (1 << j);
 
-            if (enabled && prio > max_prio) {
+            word &= word - 1;
+            if (prio > max_prio) {
                 max_irq = irq;
                 max_prio = prio;
+                if (prio == plic->num_priorities) {
+                    return max_irq;
+                }
             }
         }
     }
@@ -112,33 +126,135 @@ static uint32_t sifive_plic_claimed(SiFivePLICState *plic, uint32_t addrid)
     return max_irq;
 }
 
-static void sifive_plic_update(SiFivePLICState *plic)
+static void sifive_plic_set_context_irq(SiFivePLICState *plic,
+                                        uint32_t addrid, uint32_t irq)
+{
+    uint32_t old = plic->context_irq[addrid];
+    qemu_irq output;
+
+    plic->context_irq[addrid] = irq;
+    if (!old == !irq) {
+        return;
+    }
+
+    if (!qemu_mutex_iothread_locked()) {
+        set_bit(addrid, plic->output_dirty);
+        plic->output_pending = true;
+        return;
+    }
+
+    output = sifive_plic_context_output(plic, addrid);
+    if (output) {
+        qemu_set_irq(output, !!irq);
+    }
+}
+
+/* Drive the context outputs left behind by accesses made without the BQL. */
+static void sifive_plic_flush_outputs(SiFivePLICState *plic)
+{
+    unsigned long addrid;
+    qemu_irq output;
+
+    QEMU_IOTHREAD_LOCK_GUARD();
+    QEMU_LOCK_GUARD(&plic->lock);
+
+    plic->output_pending = false;
+    for (addrid = find_first_bit(plic->output_dirty, plic->num_addrs);
+         addrid < plic->num_addrs;
+         addrid = find_next_bit(plic->output_dirty, plic->num_addrs,
+                                addrid + 1)) {
+        clear_bit(addrid, plic->output_dirty);
+        output = sifive_plic_context_output(plic, addrid);
+        if (output) {
+            qemu_set_irq(output, !!plic->context_irq[addrid]);
+        }
+    }
+}
+
+static void sifive_plic_update_context(SiFivePLICState *plic, uint32_t addrid)
+{
+    sifive_plic_set_context_irq(plic, addrid, sifive_plic_claimed(plic, addrid));
+}
+
+/* Recompute one word of a context's claimable bitmap. */
+static void sifive_plic_update_word(SiFivePLICState *plic, uint32_t addrid,
+                                    uint32_t word)
+{
+    uint32_t i = addrid * plic->bitfield_words + word;
+
+    plic->claimable[i] = plic->pending[word] & ~plic->claimed[word] &
+                         plic->enable[i];
+}
+
+/*
+ * Source @irq changed its pending or claimed state: fix up the bit in
+ * each context's claimable bitmap.  A context's selected source only
+ * needs rescanning when that source itself goes away.
+ */
+static void sifive_plic_update_source(SiFivePLICState *plic, int irq)
+{
+    uint32_t word = irq >> 5;
+    uint32_t mask = 1u << (irq & 31);
+    uint32_t avail = plic->pending[word] & ~plic->claimed[word] & mask;
+    uint32_t prio = plic->source_priority[irq];
+    uint32_t addrid;
+
+    for (addrid = 0; addrid < plic->num_addrs; addrid++) {
+        uint32_t i = addrid * plic->bitfield_words + word;
+        uint32_t bit = avail & plic->enable[i];
+        uint32_t cur;
+
+        if ((plic->claimable[i] & mask) == bit) {
+            continue;
+        }
+        plic->claimable[i] ^= mask;
+
+        cur = plic->context_irq[addrid];
+        if (bit) {
+            uint32_t cur_prio = cur ? plic->source_priority[cur]
+                                    : plic->target_priority[addrid];
+
+            if (prio > cur_prio || (cur && prio == cur_prio && irq < cur)) {
+                sifive_plic_set_context_irq(plic, addrid, irq);
+            }
+        } else if (cur == irq) {
+            sifive_plic_update_context(plic, addrid);
+        }
+    }
+}
+
+/* Source @irq changed priority: rescan the contexts it could be taken by. */
+static void sifive_plic_update_priority(SiFivePLICState *plic, int irq)
 {
-    int addrid;
+    uint32_t word = irq >> 5;
+    uint32_t mask = 1u << (irq & 31);
+    uint32_t addrid;
 
-    /* raise irq on harts where this irq is enabled */
     for (addrid = 0; addrid < plic->num_addrs; addrid++) {
-        uint32_t hartid = plic->addr_config[addrid].hartid;
-        PLICMode mode = plic->addr_config[addrid].mode;
-        bool level = !!sifive_plic_claimed(plic, addrid);
-
-        switch (mode) {
-        case PLICMode_M:
-            qemu_set_irq(plic->m_external_irqs[hartid - plic->hartid_base], level);
-            break;
-        case PLICMode_S:
-            qemu_set_irq(plic->s_external_irqs[hartid - plic->hartid_base], level);
-            break;
-        default:
-            break;
+        if (plic->claimable[addrid * plic->bitfield_words + word] & mask) {
+            sifive_plic_update_context(plic, addrid);
         }
     }
 }
 
-static uint64_t sifive_plic_read(void *opaque, hwaddr addr, unsigned size)
+/*
+ * Rebuild the derived per-context state from the registers.  The output
+ * lines are not driven: their level is part of each hart's migrated mip.
+ */
+static void sifive_plic_rebuild(SiFivePLICState *plic)
 {
-    SiFivePLICState *plic = opaque;
+    uint32_t addrid, word;
+
+    for (addrid = 0; addrid < plic->num_addrs; addrid++) {
+        for (word = 0; word < plic->bitfield_words; word++) {
+            sifive_plic_update_word(plic, addrid, word);
+        }
+        plic->context_irq[addrid] = sifive_plic_claimed(plic, addrid);
+    }
+}
 
+static uint64_t sifive_plic_read_locked(SiFivePLICState *plic, hwaddr addr)
+{
     if (addr_between(addr, plic->priority_base, plic->num_sources << 2)) {
         uint32_t irq = (addr - plic->priority_base) >> 2;
 
@@ -164,14 +280,14 @@ static uint64_t sifive_plic_read(void *opaque, hwaddr addr, unsigned size)
         if (contextid == 0) {
             return plic->target_priority[addrid];
         } else if (contextid == 4) {
-            uint32_t max_irq = sifive_plic_claimed(plic, addrid);
+            uint32_t max_irq = plic->context_irq[addrid];
 
             if (max_irq) {
                 sifive_plic_set_pending(plic, max_irq, false);
                 sifive_plic_set_claimed(plic, max_irq, true);
+                sifive_plic_update_source(plic, max_irq);
             }
 
-            sifive_plic_update(plic);
             return max_irq;
         }
     }
@@ -182,11 +298,9 @@ static uint64_t sifive_plic_read(void *opaque, hwaddr addr, unsigned size)
     return 0;
 }
 
-static void sifive_plic_write(void *opaque, hwaddr addr, uint64_t value,
-        unsigned size)
+static void sifive_plic_write_locked(SiFivePLICState *plic, hwaddr addr,
+                                     uint64_t value)
 {
-    SiFivePLICState *plic = opaque;
-
     if (addr_between(addr, plic->priority_base, plic->num_sources << 2)) {
         uint32_t irq = (addr - plic->priority_base) >> 2;
 
@@ -197,10 +311,10 @@ static void sifive_plic_write(void *opaque, hwaddr addr, uint64_t value,
              * out the access to unsupported priority bits.
              */
             plic->source_priority[irq] = value % (plic->num_priorities + 1);
-            sifive_plic_update(plic);
+            sifive_plic_update_priority(plic, irq);
         } else if (value <= plic->num_priorities) {
             plic->source_priority[irq] = value;
-            sifive_plic_update(plic);
+            sifive_plic_update_priority(plic, irq);
         }
     } else if (addr_between(addr, plic->pending_base,
                             (plic->num_sources + 31) >> 3)) {
@@ -214,6 +328,8 @@ static void sifive_plic_write(void *opaque, hwaddr addr, uint64_t value,
 
         if (wordid < plic->bitfield_words) {
             plic->enable[addrid * plic->bitfield_words + wordid] = value;
+            sifive_plic_update_word(plic, addrid, wordid);
+            sifive_plic_update_context(plic, addrid);
         } else {
             qemu_log_mask(LOG_GUEST_ERROR,
                           "%s: Invalid enable write 0x%" HWADDR_PRIx "\n",
@@ -233,15 +349,15 @@ static void sifive_plic_write(void *opaque, hwaddr addr, uint64_t value,
                  */
                 plic->target_priority[addrid] = value %
                                                 (plic->num_priorities + 1);
-                sifive_plic_update(plic);
+                sifive_plic_update_context(plic, addrid);
             } else if (value <= plic->num_priorities) {
                 plic->target_priority[addrid] = value;
-                sifive_plic_update(plic);
+                sifive_plic_update_context(plic, addrid);
             }
         } else if (contextid == 4) {
             if (value < plic->num_sources) {
                 sifive_plic_set_claimed(plic, value, false);
-                sifive_plic_update(plic);
+                sifive_plic_update_source(plic, value);
             }
         } else {
             qemu_log_mask(LOG_GUEST_ERROR,
@@ -255,6 +371,39 @@ static void sifive_plic_write(void *opaque, hwaddr addr, uint64_t value,
     }
 }
 
+static uint64_t sifive_plic_read(void *opaque, hwaddr addr, unsigned size)
+{
+    SiFivePLICState *plic = opaque;
+    uint64_t ret;
+    bool flush;
+
+    qemu_mutex_lock(&plic->lock);
+    ret = sifive_plic_read_locked(plic, addr);
+    flush = plic->output_pending;
+    qemu_mutex_unlock(&plic->lock);
+
+    if (flush) {
+        sifive_plic_flush_outputs(plic);
+    }
+    return ret;
+}
+
+static void sifive_plic_write(void *opaque, hwaddr addr, uint64_t value,
+        unsigned size)
+{
+    SiFivePLICState *plic = opaque;
+    bool flush;
+
+    qemu_mutex_lock(&plic->lock);
+    sifive_plic_write_locked(plic, addr, value);
+    flush = plic->output_pending;
+    qemu_mutex_unlock(&plic->lock);
+
+    if (flush) {
+        sifive_plic_flush_outputs(plic);
+    }
+}
+
 static const MemoryRegionOps sifive_plic_ops = {
     .read = sifive_plic_read,
     .write = sifive_plic_write,
@@ -270,11 +419,17 @@ static void sifive_plic_reset(DeviceState *dev)
     SiFivePLICState *s = SIFIVE_PLIC(dev);
     int i;
 
+    QEMU_LOCK_GUARD(&s->lock);
+
     memset(s->source_priority, 0, sizeof(uint32_t) * s->num_sources);
     memset(s->target_priority, 0, sizeof(uint32_t) * s->num_addrs);
     memset(s->pending, 0, sizeof(uint32_t) * s->bitfield_words);
     memset(s->claimed, 0, sizeof(uint32_t) * s->bitfield_words);
     memset(s->enable, 0, sizeof(uint32_t) * s->num_enables);
+    memset(s->claimable, 0, sizeof(uint32_t) * s->num_enables);
+    memset(s->context_irq, 0, sizeof(uint32_t) * s->num_addrs);
+    bitmap_zero(s->output_dirty, s->num_addrs);
+    s->output_pending = false;
 
     for (i = 0; i < s->num_harts; i++) {
         qemu_set_irq(s->m_external_irqs[i], 0);
@@ -348,9 +503,18 @@ static void parse_hart_config(SiFivePLICState *plic)
 static void sifive_plic_irq_request(void *opaque, int irq, int level)
 {
     SiFivePLICState *s = opaque;
+    bool flush;
 
-    sifive_plic_set_pending(s, irq, level > 0);
-    sifive_plic_update(s);
+    qemu_mutex_lock(&s->lock);
+    if (sifive_plic_set_pending(s, irq, level > 0)) {
+        sifive_plic_update_source(s, irq);
+    }
+    flush = s->output_pending;
+    qemu_mutex_unlock(&s->lock);
+
+    if (flush) {
+        sifive_plic_flush_outputs(s);
+    }
 }
 
 static void sifive_plic_realize(DeviceState *dev, Error **errp)
@@ -358,8 +522,10 @@ static void sifive_plic_realize(DeviceState *dev, Error **errp)
     SiFivePLICState *s = SIFIVE_PLIC(dev);
     int i;
 
+    qemu_mutex_init(&s->lock);
     memory_region_init_io(&s->mmio, OBJECT(dev), &sifive_plic_ops, s,
                           TYPE_SIFIVE_PLIC, s->aperture_size);
+    memory_region_enable_lockless_io(&s->mmio);
     sysbus_init_mmio(SYS_BUS_DEVICE(dev), &s->mmio);
 
     parse_hart_config(s);
@@ -376,6 +542,9 @@ static void sifive_plic_realize(DeviceState *dev, Error **errp)
     s->pending = g_new0(uint32_t, s->bitfield_words);
     s->claimed = g_new0(uint32_t, s->bitfield_words);
     s->enable = g_new0(uint32_t, s->num_enables);
+    s->claimable = g_new0(uint32_t, s->num_enables);
+    s->context_irq = g_new0(uint32_t, s->num_addrs);
+    s->output_dirty = bitmap_new(s->num_addrs);
 
     qdev_init_gpio_in(dev, sifive_plic_irq_request, s->num_sources);
 
@@ -402,10 +571,20 @@ static void sifive_plic_realize(DeviceState *dev, Error **errp)
     msi_nonbroken = true;
 }
 
+static int sifive_plic_post_load(void *opaque, int version_id)
+{
+    SiFivePLICState *plic = opaque;
+
+    QEMU_LOCK_GUARD(&plic->lock);
+    sifive_plic_rebuild(plic);
+    return 0;
+}
+
 static const VMStateDescription vmstate_sifive_plic = {
     .name = "riscv_sifive_plic",
     .version_id = 1,
     .minimum_version_id = 1,
+    .post_load = sifive_plic_post_load,
     .fields = (VMStateField[]) {
             VMSTATE_VARRAY_UINT32(source_priority, SiFivePLICState,
                                   num_sources, 0,
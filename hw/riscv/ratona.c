@@ -12,8 +12,9 @@
  * 2) PLIC (Platform Level Interrupt Controller)
  * 3) SPI0 connected to an SD card
  *
- * This board currently generates devicetree dynamically that indicates at least
- * two harts and up to five harts.
+ * This board currently generates devicetree dynamically that indicates up to
+ * 512 harts, split in up to four sockets (one per NUMA node), each socket
+ * having its own CLINT and PLIC.
  *
  * This program is free software; you can redistribute it and/or modify it
  * under the terms and conditions of the GNU General Public License,
@@ -30,6 +31,7 @@
 
 #include "qemu/osdep.h"
 #include "qemu/error-report.h"
+#include "qemu/host-utils.h"
 #include "qapi/error.h"
 #include "qapi/visitor.h"
 #include "hw/boards.h"
@@ -45,12 +47,16 @@
 #include "hw/riscv/riscv_hart.h"
 #include "hw/riscv/ratona.h"
 #include "hw/riscv/boot.h"
+#include "hw/riscv/numa.h"
 #include "hw/char/sifive_uart.h"
 #include "hw/intc/riscv_aclint.h"
 #include "hw/intc/sifive_plic.h"
 #include "chardev/char.h"
 #include "net/eth.h"
+#include "sysemu/block-backend.h"
+#include "sysemu/blockdev.h"
 #include "sysemu/device_tree.h"
+#include "sysemu/reset.h"
 #include "sysemu/runstate.h"
 #include "sysemu/sysemu.h"
 
@@ -67,6 +73,8 @@ static const MemMapEntry ratona_memmap[] = {
     [RATONA_DEV_PLIC] =     {  0xc000000,  0x4000000 },
     [RATONA_DEV_UART0] =    { 0x64000000,     0x1000 },
     [RATONA_DEV_QSPI0] =    { 0x64001000,     0x1000 },
+    [RATONA_DEV_QSPI0_DMA] = { 0x64002000,    0x1000 },
+    [RATONA_DEV_VIRTIO] =   { 0x60000000,     0x1000 },
     [RATONA_DEV_DRAM] =     { 0x80000000,        0x0 },
 };
 
@@ -74,12 +82,13 @@ static void create_fdt(RatonaState *s, const MemMapEntry *memmap,
                        bool is_32_bit)
 {
     MachineState *ms = MACHINE(s);
-    uint64_t mem_size = ms->ram_size;
     void *fdt;
-    int cpu;
+    int cpu, socket, i;
+    int socket_count = riscv_socket_count(ms);
     uint32_t *cells;
     char *nodename;
-    uint32_t plic_phandle, phandle = 1;
+    uint32_t plic_phandle, plic_phandles[RATONA_SOCKETS_MAX];
+    uint32_t phandle = 1;
     uint32_t hfclk_phandle, rtcclk_phandle;
     static const char * const clint_compat[2] = {
         "sifive,clint0", "riscv,clint0"
@@ -128,103 +137,146 @@ static void create_fdt(RatonaState *s, const MemMapEntry *memmap,
     qemu_fdt_setprop_cell(fdt, nodename, "#clock-cells", 0x0);
     g_free(nodename);
 
-    nodename = g_strdup_printf("/memory@%lx",
-        (long)memmap[RATONA_DEV_DRAM].base);
-    qemu_fdt_add_subnode(fdt, nodename);
-    qemu_fdt_setprop_cells(fdt, nodename, "reg",
-        memmap[RATONA_DEV_DRAM].base >> 32, memmap[RATONA_DEV_DRAM].base,
-        mem_size >> 32, mem_size);
-    qemu_fdt_setprop_string(fdt, nodename, "device_type", "memory");
-    g_free(nodename);
+    for (socket = 0; socket < socket_count; socket++) {
+        uint64_t addr = memmap[RATONA_DEV_DRAM].base +
+                        riscv_socket_mem_offset(ms, socket);
+        uint64_t size = riscv_socket_mem_size(ms, socket);
+
+        nodename = g_strdup_printf("/memory@%lx", (long)addr);
+        qemu_fdt_add_subnode(fdt, nodename);
+        qemu_fdt_setprop_cells(fdt, nodename, "reg",
+            addr >> 32, addr, size >> 32, size);
+        qemu_fdt_setprop_string(fdt, nodename, "device_type", "memory");
+        riscv_socket_fdt_write_id(ms, nodename, socket);
+        g_free(nodename);
+    }
 
     qemu_fdt_add_subnode(fdt, "/cpus");
     qemu_fdt_setprop_cell(fdt, "/cpus", "timebase-frequency",
         CLINT_TIMEBASE_FREQ);
     qemu_fdt_setprop_cell(fdt, "/cpus", "#size-cells", 0x0);
     qemu_fdt_setprop_cell(fdt, "/cpus", "#address-cells", 0x1);
-
-    for (cpu = ms->smp.cpus - 1; cpu >= 0; cpu--) {
-        int cpu_phandle = phandle++;
-        nodename = g_strdup_printf("/cpus/cpu@%d", cpu);
-        char *intc = g_strdup_printf("/cpus/cpu@%d/interrupt-controller", cpu);
-        char *isa;
-        qemu_fdt_add_subnode(fdt, nodename);
-        /* cpu 0 is the management hart that does not have mmu */
-        if (is_32_bit) {
-            qemu_fdt_setprop_string(fdt, nodename, "mmu-type", "riscv,sv32");
-        } else {
-            qemu_fdt_setprop_string(fdt, nodename, "mmu-type", "riscv,sv48");
+    qemu_fdt_add_subnode(fdt, "/cpus/cpu-map");
+
+    for (socket = socket_count - 1; socket >= 0; socket--) {
+        RISCVHartArrayState *harts = &s->soc.cpus[socket];
+        char *clust_name = g_strdup_printf("/cpus/cpu-map/cluster%d", socket);
+
+        qemu_fdt_add_subnode(fdt, clust_name);
+
+        for (cpu = harts->num_harts - 1; cpu >= 0; cpu--) {
+            int hartid = harts->hartid_base + cpu;
+            int cpu_phandle = phandle++;
+            int intc_phandle = phandle++;
+            char *intc, *core, *isa;
+
+            nodename = g_strdup_printf("/cpus/cpu@%d", hartid);
+            intc = g_strdup_printf("/cpus/cpu@%d/interrupt-controller",
+                                   hartid);
+            qemu_fdt_add_subnode(fdt, nodename);
+            if (is_32_bit) {
+                qemu_fdt_setprop_string(fdt, nodename, "mmu-type",
+                                        "riscv,sv32");
+            } else {
+                qemu_fdt_setprop_string(fdt, nodename, "mmu-type",
+                                        "riscv,sv48");
+            }
+            isa = riscv_isa_string(&harts->harts[cpu]);
+            qemu_fdt_setprop_string(fdt, nodename, "riscv,isa", isa);
+            qemu_fdt_setprop_string(fdt, nodename, "compatible", "riscv");
+            qemu_fdt_setprop_string(fdt, nodename, "status", "okay");
+            qemu_fdt_setprop_cell(fdt, nodename, "reg", hartid);
+            qemu_fdt_setprop_string(fdt, nodename, "device_type", "cpu");
+            riscv_socket_fdt_write_id(ms, nodename, socket);
+            qemu_fdt_setprop_cell(fdt, nodename, "phandle", cpu_phandle);
+            qemu_fdt_add_subnode(fdt, intc);
+            qemu_fdt_setprop_cell(fdt, intc, "phandle", intc_phandle);
+            qemu_fdt_setprop_string(fdt, intc, "compatible", "riscv,cpu-intc");
+            qemu_fdt_setprop(fdt, intc, "interrupt-controller", NULL, 0);
+            qemu_fdt_setprop_cell(fdt, intc, "#interrupt-cells", 1);
+
+            core = g_strdup_printf("%s/core%d", clust_name, cpu);
+            qemu_fdt_add_subnode(fdt, core);
+            qemu_fdt_setprop_cell(fdt, core, "cpu", cpu_phandle);
+
+            g_free(core);
+            g_free(isa);
+            g_free(intc);
+            g_free(nodename);
         }
-        isa = riscv_isa_string(&s->soc.cpus.harts[cpu]);
-        qemu_fdt_setprop_string(fdt, nodename, "riscv,isa", isa);
-        qemu_fdt_setprop_string(fdt, nodename, "compatible", "riscv");
-        qemu_fdt_setprop_string(fdt, nodename, "status", "okay");
-        qemu_fdt_setprop_cell(fdt, nodename, "reg", cpu);
-        qemu_fdt_setprop_string(fdt, nodename, "device_type", "cpu");
-        qemu_fdt_add_subnode(fdt, intc);
-        qemu_fdt_setprop_cell(fdt, intc, "phandle", cpu_phandle);
-        qemu_fdt_setprop_string(fdt, intc, "compatible", "riscv,cpu-intc");
-        qemu_fdt_setprop(fdt, intc, "interrupt-controller", NULL, 0);
-        qemu_fdt_setprop_cell(fdt, intc, "#interrupt-cells", 1);
-        g_free(isa);
-        g_free(intc);
-        g_free(nodename);
+
+        g_free(clust_name);
     }
 
-    cells =  g_new0(uint32_t, ms->smp.cpus * 4);
-    for (cpu = 0; cpu < ms->smp.cpus; cpu++) {
-        nodename =
-            g_strdup_printf("/cpus/cpu@%d/interrupt-controller", cpu);
-        uint32_t intc_phandle = qemu_fdt_get_phandle(fdt, nodename);
-        cells[cpu * 4 + 0] = cpu_to_be32(intc_phandle);
-        cells[cpu * 4 + 1] = cpu_to_be32(IRQ_M_SOFT);
-        cells[cpu * 4 + 2] = cpu_to_be32(intc_phandle);
-        cells[cpu * 4 + 3] = cpu_to_be32(IRQ_M_TIMER);
+    for (socket = 0; socket < socket_count; socket++) {
+        RISCVHartArrayState *harts = &s->soc.cpus[socket];
+        hwaddr clint_addr = memmap[RATONA_DEV_CLINT].base +
+                            socket * memmap[RATONA_DEV_CLINT].size;
+
+        cells = g_new0(uint32_t, harts->num_harts * 4);
+        for (cpu = 0; cpu < harts->num_harts; cpu++) {
+            nodename = g_strdup_printf("/cpus/cpu@%d/interrupt-controller",
+                                       harts->hartid_base + cpu);
+            uint32_t intc_phandle = qemu_fdt_get_phandle(fdt, nodename);
+            cells[cpu * 4 + 0] = cpu_to_be32(intc_phandle);
+            cells[cpu * 4 + 1] = cpu_to_be32(IRQ_M_SOFT);
+            cells[cpu * 4 + 2] = cpu_to_be32(intc_phandle);
+            cells[cpu * 4 + 3] = cpu_to_be32(IRQ_M_TIMER);
+            g_free(nodename);
+        }
+        nodename = g_strdup_printf("/soc/clint@%lx", (long)clint_addr);
+        qemu_fdt_add_subnode(fdt, nodename);
+        qemu_fdt_setprop_string_array(fdt, nodename, "compatible",
+            (char **)&clint_compat, ARRAY_SIZE(clint_compat));
+        qemu_fdt_setprop_cells(fdt, nodename, "reg",
+            0x0, clint_addr, 0x0, memmap[RATONA_DEV_CLINT].size);
+        qemu_fdt_setprop(fdt, nodename, "interrupts-extended",
+            cells, harts->num_harts * sizeof(uint32_t) * 4);
+        riscv_socket_fdt_write_id(ms, nodename, socket);
+        g_free(cells);
         g_free(nodename);
     }
-    nodename = g_strdup_printf("/soc/clint@%lx",
-        (long)memmap[RATONA_DEV_CLINT].base);
-    qemu_fdt_add_subnode(fdt, nodename);
-    qemu_fdt_setprop_string_array(fdt, nodename, "compatible",
-        (char **)&clint_compat, ARRAY_SIZE(clint_compat));
-    qemu_fdt_setprop_cells(fdt, nodename, "reg",
-        0x0, memmap[RATONA_DEV_CLINT].base,
-        0x0, memmap[RATONA_DEV_CLINT].size);
-    qemu_fdt_setprop(fdt, nodename, "interrupts-extended",
-        cells, ms->smp.cpus * sizeof(uint32_t) * 4);
-    g_free(cells);
-    g_free(nodename);
 
-    plic_phandle = phandle++;
-    cells =  g_new0(uint32_t, ms->smp.cpus * 4);
-    for (cpu = 0; cpu < ms->smp.cpus; cpu++) {
-        nodename =
-            g_strdup_printf("/cpus/cpu@%d/interrupt-controller", cpu);
-        uint32_t intc_phandle = qemu_fdt_get_phandle(fdt, nodename);
-        cells[cpu * 4 + 0] = cpu_to_be32(intc_phandle);
-        cells[cpu * 4 + 1] = cpu_to_be32(IRQ_M_EXT);
-        cells[cpu * 4 + 2] = cpu_to_be32(intc_phandle);
-        cells[cpu * 4 + 3] = cpu_to_be32(IRQ_S_EXT);
+    for (socket = socket_count - 1; socket >= 0; socket--) {
+        RISCVHartArrayState *harts = &s->soc.cpus[socket];
+        hwaddr plic_addr = memmap[RATONA_DEV_PLIC].base +
+                           socket * memmap[RATONA_DEV_PLIC].size;
+
+        plic_phandles[socket] = phandle++;
+        cells = g_new0(uint32_t, harts->num_harts * 4);
+        for (cpu = 0; cpu < harts->num_harts; cpu++) {
+            nodename = g_strdup_printf("/cpus/cpu@%d/interrupt-controller",
+                                       harts->hartid_base + cpu);
+            uint32_t intc_phandle = qemu_fdt_get_phandle(fdt, nodename);
+            cells[cpu * 4 + 0] = cpu_to_be32(intc_phandle);
+            cells[cpu * 4 + 1] = cpu_to_be32(IRQ_M_EXT);
+            cells[cpu * 4 + 2] = cpu_to_be32(intc_phandle);
+            cells[cpu * 4 + 3] = cpu_to_be32(IRQ_S_EXT);
+            g_free(nodename);
+        }
+        nodename = g_strdup_printf("/soc/interrupt-controller@%lx",
+                                   (long)plic_addr);
+        qemu_fdt_add_subnode(fdt, nodename);
+        qemu_fdt_setprop_cell(fdt, nodename, "#interrupt-cells", 1);
+        qemu_fdt_setprop_string_array(fdt, nodename, "compatible",
+            (char **)&plic_compat, ARRAY_SIZE(plic_compat));
+        qemu_fdt_setprop(fdt, nodename, "interrupt-controller", NULL, 0);
+        qemu_fdt_setprop(fdt, nodename, "interrupts-extended",
+            cells, (harts->num_harts * 4) * sizeof(uint32_t));
+        qemu_fdt_setprop_cells(fdt, nodename, "reg",
+            0x0, plic_addr, 0x0, memmap[RATONA_DEV_PLIC].size);
+        qemu_fdt_setprop_cell(fdt, nodename, "riscv,ndev",
+                              RATONA_PLIC_NUM_SOURCES - 1);
+        riscv_socket_fdt_write_id(ms, nodename, socket);
+        qemu_fdt_setprop_cell(fdt, nodename, "phandle", plic_phandles[socket]);
+        g_free(cells);
         g_free(nodename);
     }
-    nodename = g_strdup_printf("/soc/interrupt-controller@%lx",
-        (long)memmap[RATONA_DEV_PLIC].base);
-    qemu_fdt_add_subnode(fdt, nodename);
-    qemu_fdt_setprop_cell(fdt, nodename, "#interrupt-cells", 1);
-    qemu_fdt_setprop_string_array(fdt, nodename, "compatible",
-        (char **)&plic_compat, ARRAY_SIZE(plic_compat));
-    qemu_fdt_setprop(fdt, nodename, "interrupt-controller", NULL, 0);
-    qemu_fdt_setprop(fdt, nodename, "interrupts-extended",
-        cells, (ms->smp.cpus * 4) * sizeof(uint32_t));
-    qemu_fdt_setprop_cells(fdt, nodename, "reg",
-        0x0, memmap[RATONA_DEV_PLIC].base,
-        0x0, memmap[RATONA_DEV_PLIC].size);
-    qemu_fdt_setprop_cell(fdt, nodename, "riscv,ndev",
-                          RATONA_PLIC_NUM_SOURCES - 1);
-    qemu_fdt_setprop_cell(fdt, nodename, "phandle", plic_phandle);
-    plic_phandle = qemu_fdt_get_phandle(fdt, nodename);
-    g_free(cells);
-    g_free(nodename);
+
+    /* All on-chip peripherals are wired to the PLIC of socket 0 */
+    plic_phandle = plic_phandles[0];
+
+    riscv_socket_fdt_write_distance_matrix(ms);
 
     nodename = g_strdup_printf("/soc/spi@%lx",
         (long)memmap[RATONA_DEV_QSPI0].base);
@@ -250,6 +302,37 @@ static void create_fdt(RatonaState *s, const MemMapEntry *memmap,
     qemu_fdt_setprop_string(fdt, nodename, "compatible", "mmc-spi-slot");
     g_free(nodename);
 
+    if (s->spi_dma) {
+        nodename = g_strdup_printf("/soc/dma@%lx",
+            (long)memmap[RATONA_DEV_QSPI0_DMA].base);
+        qemu_fdt_add_subnode(fdt, nodename);
+        qemu_fdt_setprop_string(fdt, nodename, "compatible",
+                                "ratona,spi-dma");
+        qemu_fdt_setprop_cells(fdt, nodename, "reg",
+            0x0, memmap[RATONA_DEV_QSPI0_DMA].base,
+            0x0, memmap[RATONA_DEV_QSPI0_DMA].size);
+        qemu_fdt_setprop_cell(fdt, nodename, "interrupt-parent", plic_phandle);
+        qemu_fdt_setprop_cell(fdt, nodename, "interrupts",
+                              RATONA_QSPI0_DMA_IRQ);
+        g_free(nodename);
+    }
+
+    for (i = 0; i < s->virtio_transports; i++) {
+        nodename = g_strdup_printf("/soc/virtio_mmio@%lx",
+            (long)(memmap[RATONA_DEV_VIRTIO].base +
+                   i * memmap[RATONA_DEV_VIRTIO].size));
+        qemu_fdt_add_subnode(fdt, nodename);
+        qemu_fdt_setprop_string(fdt, nodename, "compatible", "virtio,mmio");
+        qemu_fdt_setprop_cells(fdt, nodename, "reg",
+            0x0, memmap[RATONA_DEV_VIRTIO].base +
+                 i * memmap[RATONA_DEV_VIRTIO].size,
+            0x0, memmap[RATONA_DEV_VIRTIO].size);
+        qemu_fdt_setprop_cell(fdt, nodename, "interrupt-parent", plic_phandle);
+        qemu_fdt_setprop_cell(fdt, nodename, "interrupts",
+                              RATONA_VIRTIO_IRQ + i);
+        g_free(nodename);
+    }
+
     nodename = g_strdup_printf("/soc/rom@%lx",
         (long)memmap[RATONA_DEV_BOOTROM].base);
     qemu_fdt_add_subnode(fdt, nodename);
@@ -279,6 +362,123 @@ static void create_fdt(RatonaState *s, const MemMapEntry *memmap,
     g_free(nodename);
 }
 
+/*
+ * Copy the SD payload straight from the card image into DRAM.  This runs
+ * on every system reset, like the ROM blobs, so the guest always starts
+ * from what is on the card.
+ */
+static void ratona_sd_payload_reset(void *opaque)
+{
+    RatonaState *s = opaque;
+    hwaddr addr = s->sd_payload_dest;
+    int64_t offset = s->sd_payload_lba * RATONA_SD_BLOCK_SIZE;
+    uint64_t left = s->sd_payload_size;
+
+    while (left) {
+        hwaddr len = left;
+        void *p;
+        int ret;
+
+        p = address_space_map(&address_space_memory, addr, &len, true,
+                               MEMTXATTRS_UNSPECIFIED);
+        if (!p) {
+            error_report("sd-fastboot: cannot map 0x%" HWADDR_PRIx, addr);
+            exit(1);
+        }
+        ret = blk_pread(s->sd_payload_blk, offset, len, p, 0);
+        address_space_unmap(&address_space_memory, p, len, true,
+                            ret < 0 ? 0 : len);
+        if (ret < 0) {
+            error_report("sd-fastboot: failed to read partition 1");
+            exit(1);
+        }
+
+        addr += len;
+        offset += len;
+        left -= len;
+    }
+}
+
+/*
+ * Do what sdboot does: find partition 1 of the GPT on the SD card image and
+ * arrange for it to be copied to @dest, below @limit, on reset. Returns the
+ * payload size.
+ */
+static uint64_t ratona_load_sd_payload(RatonaState *s, BlockBackend *blk,
+                                       hwaddr dest, hwaddr limit)
+{
+    uint8_t hdr[RATONA_SD_BLOCK_SIZE];
+    uint8_t entry[128];
+    uint64_t entries_lba, first_lba, last_lba, size;
+    uint32_t num_entries, entry_size;
+    int64_t blk_len;
+
+    if (!blk || !blk_is_available(blk)) {
+        error_report("sd-fastboot needs an SD card image (-drive if=sd)");
+        exit(1);
+    }
+
+    /* GPT header lives in LBA 1 */
+    if (blk_pread(blk, RATONA_SD_BLOCK_SIZE, sizeof(hdr), hdr, 0) < 0 ||
+        memcmp(hdr, "EFI PART", 8)) {
+        error_report("sd-fastboot: no GPT found on the SD card image");
+        exit(1);
+    }
+
+    /*
+     * The entry size is 128 << n; only the first 128 bytes of partition 1
+     * are needed, but a bogus size means the header cannot be trusted.
+     */
+    entries_lba = ldq_le_p(hdr + 72);
+    num_entries = ldl_le_p(hdr + 80);
+    entry_size = ldl_le_p(hdr + 84);
+    if (!num_entries || entry_size < sizeof(entry) ||
+        !is_power_of_2(entry_size)) {
+        error_report("sd-fastboot: invalid GPT partition entry array "
+                     "(%" PRIu32 " entries of %" PRIu32 " bytes)",
+                     num_entries, entry_size);
+        exit(1);
+    }
+
+    if (blk_pread(blk, entries_lba * RATONA_SD_BLOCK_SIZE, sizeof(entry),
+                  entry, 0) < 0) {
+        error_report("sd-fastboot: failed to read GPT partition entries");
+        exit(1);
+    }
+
+    first_lba = ldq_le_p(entry + 32);
+    last_lba = ldq_le_p(entry + 40);
+    if (!first_lba || last_lba < first_lba) {
+        error_report("sd-fastboot: invalid GPT partition 1");
+        exit(1);
+    }
+
+    /* Check the block count before it is turned into a size */
+    if (last_lba - first_lba >= (limit - dest) / RATONA_SD_BLOCK_SIZE) {
+        error_report("sd-fastboot: partition 1 (LBA %" PRIu64 "-%" PRIu64
+                     ") does not fit below the device tree at 0x%"
+                     HWADDR_PRIx, first_lba, last_lba, limit);
+        exit(1);
+    }
+    size = (last_lba - first_lba + 1) * RATONA_SD_BLOCK_SIZE;
+
+    blk_len = blk_getlength(blk);
+    if (blk_len < 0 ||
+        last_lba >= (uint64_t)blk_len / RATONA_SD_BLOCK_SIZE) {
+        error_report("sd-fastboot: partition 1 ends past the end of the "
+                     "SD card image");
+        exit(1);
+    }
+
+    s->sd_payload_blk = blk;
+    s->sd_payload_dest = dest;
+    s->sd_payload_lba = first_lba;
+    s->sd_payload_size = size;
+    qemu_register_reset(ratona_sd_payload_reset, s);
+
+    return size;
+}
+
 static void ratona_machine_init(MachineState *machine)
 {
     const MemMapEntry *memmap = ratona_memmap;
@@ -297,14 +497,35 @@ static void ratona_machine_init(MachineState *machine)
     DeviceState *sd_dev, *card_dev;
     qemu_irq sd_cs;
 
+    /* Check socket count limit */
+    if (RATONA_SOCKETS_MAX < riscv_socket_count(machine)) {
+        error_report("number of sockets/nodes should be less than %d",
+            RATONA_SOCKETS_MAX);
+        exit(1);
+    }
+
+    if (s->virtio_transports > RATONA_VIRTIO_MAX) {
+        error_report("Number of virtio-mmio transports (%u) exceeds max (%u)",
+                     s->virtio_transports, RATONA_VIRTIO_MAX);
+        exit(1);
+    }
+
     /* Initialize SoC */
     object_initialize_child(OBJECT(machine), "soc", &s->soc, TYPE_RATONA_SOC);
+    qdev_prop_set_bit(DEVICE(&s->soc.spi0), "dma", s->spi_dma);
     qdev_realize(DEVICE(&s->soc), NULL, &error_fatal);
 
     /* register RAM */
     memory_region_add_subregion(system_memory, memmap[RATONA_DEV_DRAM].base,
                                 machine->ram);
 
+    /* VirtIO MMIO devices */
+    for (i = 0; i < s->virtio_transports; i++) {
+        sysbus_create_simple("virtio-mmio",
+            memmap[RATONA_DEV_VIRTIO].base + i * memmap[RATONA_DEV_VIRTIO].size,
+            qdev_get_gpio_in(s->soc.plic[0], RATONA_VIRTIO_IRQ + i));
+    }
+
     /* register ROM */
     memory_region_init_ram(bootrom, NULL, "sifive.rom",
                            memmap[RATONA_DEV_BOOTROM].size, &error_fatal);
@@ -319,19 +540,37 @@ static void ratona_machine_init(MachineState *machine)
             exit(1);
         }
     } else {
-        create_fdt(s, memmap, riscv_is_32bit(&s->soc.cpus));
+        create_fdt(s, memmap, riscv_is_32bit(&s->soc.cpus[0]));
     }
 
+    dinfo = drive_get(IF_SD, 0, 0);
+    blk = dinfo ? blk_by_legacy_dinfo(dinfo) : NULL;
+
     start_addr = memmap[RATONA_DEV_DRAM].base;
-    firmware_name = riscv_default_firmware_name(&s->soc.cpus);
-    firmware_end_addr = riscv_find_and_load_firmware(machine, firmware_name,
-                                                     start_addr, NULL);
+    if (s->sd_fastboot) {
+        /* The SD payload takes the place of both firmware and kernel */
+        if (machine->kernel_filename) {
+            error_report("sd-fastboot cannot be used with -kernel");
+            exit(1);
+        }
+        fdt_load_addr = riscv_compute_fdt_addr(memmap[RATONA_DEV_DRAM].base,
+                                               memmap[RATONA_DEV_DRAM].size,
+                                               machine);
+        firmware_end_addr = start_addr +
+                            ratona_load_sd_payload(s, blk, start_addr,
+                                                   fdt_load_addr);
+    } else {
+        firmware_name = riscv_default_firmware_name(&s->soc.cpus[0]);
+        firmware_end_addr = riscv_find_and_load_firmware(machine,
+                                                         firmware_name,
+                                                         start_addr, NULL);
+    }
 
     if (machine->kernel_filename) {
-        kernel_start_addr = riscv_calc_kernel_start_addr(&s->soc.cpus,
+        kernel_start_addr = riscv_calc_kernel_start_addr(&s->soc.cpus[0],
                                                          firmware_end_addr);
 
-        kernel_entry = riscv_load_kernel(machine, &s->soc.cpus,
+        kernel_entry = riscv_load_kernel(machine, &s->soc.cpus[0],
                                          kernel_start_addr, true, NULL);
         start_addr = kernel_entry;
     } else {
@@ -347,7 +586,7 @@ static void ratona_machine_init(MachineState *machine)
                                            machine);
     riscv_load_fdt(fdt_load_addr, machine->fdt);
 
-    if (!riscv_is_32bit(&s->soc.cpus)) {
+    if (!riscv_is_32bit(&s->soc.cpus[0])) {
         start_addr_hi32 = (uint64_t)start_addr >> 32;
     }
 
@@ -367,7 +606,7 @@ static void ratona_machine_init(MachineState *machine)
         0x00000000,
                                        /* fw_dyn: */
     };
-    if (riscv_is_32bit(&s->soc.cpus)) {
+    if (riscv_is_32bit(&s->soc.cpus[0])) {
         reset_vec[4] = 0x0202a583;     /*     lw     a1, 32(t0) */
         reset_vec[5] = 0x0182a283;     /*     lw     t0, 24(t0) */
     } else {
@@ -393,8 +632,6 @@ static void ratona_machine_init(MachineState *machine)
     sd_cs = qdev_get_gpio_in_named(sd_dev, SSI_GPIO_CS, 0);
     sysbus_connect_irq(SYS_BUS_DEVICE(&s->soc.spi0), 1, sd_cs);
 
-    dinfo = drive_get(IF_SD, 0, 0);
-    blk = dinfo ? blk_by_legacy_dinfo(dinfo) : NULL;
     card_dev = qdev_new(TYPE_SD_CARD);
     qdev_prop_set_drive_err(card_dev, "drive", blk, &error_fatal);
     qdev_prop_set_bit(card_dev, "spi", true);
@@ -403,8 +640,48 @@ static void ratona_machine_init(MachineState *machine)
                            &error_fatal);
 }
 
+static bool ratona_machine_get_spi_dma(Object *obj, Error **errp)
+{
+    RatonaState *s = RATONA_MACHINE(obj);
+
+    return s->spi_dma;
+}
+
+static void ratona_machine_set_spi_dma(Object *obj, bool value, Error **errp)
+{
+    RatonaState *s = RATONA_MACHINE(obj);
+
+    s->spi_dma = value;
+}
+
+static bool ratona_machine_get_sd_fastboot(Object *obj, Error **errp)
+{
+    RatonaState *s = RATONA_MACHINE(obj);
+
+    return s->sd_fastboot;
+}
+
+static void ratona_machine_set_sd_fastboot(Object *obj, bool value,
+                                           Error **errp)
+{
+    RatonaState *s = RATONA_MACHINE(obj);
+
+    s->sd_fastboot = value;
+}
+
 static void ratona_machine_instance_init(Object *obj)
 {
+    RatonaState *s = RATONA_MACHINE(obj);
+
+    s->spi_dma = false;
+    s->sd_fastboot = false;
+    s->virtio_transports = 0;
+    object_property_add_uint32_ptr(obj, "virtio-transports",
+                                   &s->virtio_transports,
+                                   OBJ_PROP_FLAG_READWRITE);
+    object_property_set_description(obj, "virtio-transports",
+                                    "Number of virtio-mmio transports "
+                                    "(up to 8)");
 }
 
 static void ratona_machine_class_init(ObjectClass *oc, void *data)
@@ -417,7 +694,31 @@ static void ratona_machine_class_init(ObjectClass *oc, void *data)
     mc->min_cpus = 1;
     mc->default_cpu_type = RATONA_CPU;
     mc->default_cpus = mc->min_cpus;
+    mc->max_cpus = RATONA_CPUS_MAX;
     mc->default_ram_id = "riscv.ratona.ram";
+    mc->possible_cpu_arch_ids = riscv_numa_possible_cpu_arch_ids;
+    mc->cpu_index_to_instance_props = riscv_numa_cpu_index_to_props;
+    mc->get_default_cpu_node_id = riscv_numa_get_default_cpu_node_id;
+    mc->numa_mem_supported = true;
+    /* platform instead of architectural choice */
+    mc->cpu_cluster_has_numa_boundary = true;
+
+    object_class_property_add_bool(oc, "spi-dma",
+                                   ratona_machine_get_spi_dma,
+                                   ratona_machine_set_spi_dma);
+    object_class_property_set_description(oc, "spi-dma",
+                                          "Set on to add a DMA descriptor "
+                                          "extension to the SPI controller "
+                                          "driving the SD card");
+
+    object_class_property_add_bool(oc, "sd-fastboot",
+                                   ratona_machine_get_sd_fastboot,
+                                   ratona_machine_set_sd_fastboot);
+    object_class_property_set_description(oc, "sd-fastboot",
+                                          "Set on to copy partition 1 of the "
+                                          "SD card to DRAM and jump to it, "
+                                          "as sdboot would, instead of "
+                                          "loading the firmware");
 }
 
 static const TypeInfo ratona_machine_typeinfo = {
@@ -439,13 +740,18 @@ static void ratona_soc_instance_init(Object *obj)
 {
     MachineState *ms = MACHINE(qdev_get_machine());
     RatonaSoCState *s = RATONA_SOC(obj);
+    int socket_count = MIN(riscv_socket_count(ms), RATONA_SOCKETS_MAX);
+    char *name;
+    int i;
+
+    for (i = 0; i < socket_count; i++) {
+        name = g_strdup_printf("cpus%d", i);
+        object_initialize_child(obj, name, &s->cpus[i], TYPE_RISCV_HART_ARRAY);
+        g_free(name);
+        object_property_set_int(OBJECT(&s->cpus[i]), "resetvec", 0x1004,
+                                &error_abort);
+    }
 
-    object_initialize_child(obj, "cpus", &s->cpus, TYPE_RISCV_HART_ARRAY);
-    object_property_set_int(OBJECT(&s->cpus), "num-harts", ms->smp.cpus,
-                            &error_abort);
-    object_property_set_int(OBJECT(&s->cpus), "resetvec", 0x1004,
-                            &error_abort);
-                            
     object_initialize_child(obj, "spi0", &s->spi0, TYPE_SIFIVE_SPI);
 }
 
@@ -456,11 +762,64 @@ static void ratona_soc_realize(DeviceState *dev, Error **errp)
     const MemMapEntry *memmap = ratona_memmap;
     MemoryRegion *system_memory = get_system_memory();
     MemoryRegion *mask_rom = g_new(MemoryRegion, 1);
+    int socket_count = riscv_socket_count(ms);
+    int i, base_hartid, hart_count;
     char *plic_hart_config;
-    
-    object_property_set_str(OBJECT(&s->cpus), "cpu-type", ms->cpu_type,
-                            &error_abort);
-    sysbus_realize(SYS_BUS_DEVICE(&s->cpus), &error_fatal);
+
+    for (i = 0; i < socket_count; i++) {
+        if (!riscv_socket_check_hartids(ms, i)) {
+            error_setg(errp, "discontinuous hartids in socket%d", i);
+            return;
+        }
+
+        base_hartid = riscv_socket_first_hartid(ms, i);
+        if (base_hartid < 0) {
+            error_setg(errp, "can't find hartid base for socket%d", i);
+            return;
+        }
+
+        hart_count = riscv_socket_hart_count(ms, i);
+        if (hart_count < 0) {
+            error_setg(errp, "can't find hart count for socket%d", i);
+            return;
+        }
+
+        object_property_set_str(OBJECT(&s->cpus[i]), "cpu-type", ms->cpu_type,
+                                &error_abort);
+        object_property_set_int(OBJECT(&s->cpus[i]), "hartid-base",
+                                base_hartid, &error_abort);
+        object_property_set_int(OBJECT(&s->cpus[i]), "num-harts",
+                                hart_count, &error_abort);
+        if (!sysbus_realize(SYS_BUS_DEVICE(&s->cpus[i]), errp)) {
+            return;
+        }
+
+        /* Per-socket PLIC */
+        plic_hart_config = riscv_plic_hart_config_string(hart_count);
+        s->plic[i] = sifive_plic_create(
+            memmap[RATONA_DEV_PLIC].base + i * memmap[RATONA_DEV_PLIC].size,
+            plic_hart_config, hart_count, base_hartid,
+            RATONA_PLIC_NUM_SOURCES,
+            RATONA_PLIC_NUM_PRIORITIES,
+            RATONA_PLIC_PRIORITY_BASE,
+            RATONA_PLIC_PENDING_BASE,
+            RATONA_PLIC_ENABLE_BASE,
+            RATONA_PLIC_ENABLE_STRIDE,
+            RATONA_PLIC_CONTEXT_BASE,
+            RATONA_PLIC_CONTEXT_STRIDE,
+            memmap[RATONA_DEV_PLIC].size);
+        g_free(plic_hart_config);
+
+        /* Per-socket CLINT */
+        riscv_aclint_swi_create(
+            memmap[RATONA_DEV_CLINT].base + i * memmap[RATONA_DEV_CLINT].size,
+            base_hartid, hart_count, false);
+        riscv_aclint_mtimer_create(memmap[RATONA_DEV_CLINT].base +
+                i * memmap[RATONA_DEV_CLINT].size + RISCV_ACLINT_SWI_SIZE,
+            RISCV_ACLINT_DEFAULT_MTIMER_SIZE, base_hartid, hart_count,
+            RISCV_ACLINT_DEFAULT_MTIMECMP, RISCV_ACLINT_DEFAULT_MTIME,
+            CLINT_TIMEBASE_FREQ, false);
+    }
 
     /* boot rom */
     memory_region_init_rom(mask_rom, OBJECT(dev), "riscv.sifive.u.mrom",
@@ -468,37 +827,23 @@ static void ratona_soc_realize(DeviceState *dev, Error **errp)
     memory_region_add_subregion(system_memory, memmap[RATONA_DEV_MROM].base,
                                 mask_rom);
 
-    /* create PLIC hart topology configuration string */
-    plic_hart_config = riscv_plic_hart_config_string(ms->smp.cpus);
-
     /* MMIO */
-    s->plic = sifive_plic_create(memmap[RATONA_DEV_PLIC].base,
-        plic_hart_config, ms->smp.cpus, 0,
-        RATONA_PLIC_NUM_SOURCES,
-        RATONA_PLIC_NUM_PRIORITIES,
-        RATONA_PLIC_PRIORITY_BASE,
-        RATONA_PLIC_PENDING_BASE,
-        RATONA_PLIC_ENABLE_BASE,
-        RATONA_PLIC_ENABLE_STRIDE,
-        RATONA_PLIC_CONTEXT_BASE,
-        RATONA_PLIC_CONTEXT_STRIDE,
-        memmap[RATONA_DEV_PLIC].size);
-    g_free(plic_hart_config);
     sifive_uart_create(system_memory, memmap[RATONA_DEV_UART0].base,
-        serial_hd(0), qdev_get_gpio_in(DEVICE(s->plic), RATONA_UART0_IRQ));
-    riscv_aclint_swi_create(memmap[RATONA_DEV_CLINT].base, 0,
-        ms->smp.cpus, false);
-    riscv_aclint_mtimer_create(memmap[RATONA_DEV_CLINT].base +
-            RISCV_ACLINT_SWI_SIZE,
-        RISCV_ACLINT_DEFAULT_MTIMER_SIZE, 0, ms->smp.cpus,
-        RISCV_ACLINT_DEFAULT_MTIMECMP, RISCV_ACLINT_DEFAULT_MTIME,
-        CLINT_TIMEBASE_FREQ, false);
-    
+        serial_hd(0), qdev_get_gpio_in(s->plic[0], RATONA_UART0_IRQ));
+
     sysbus_realize(SYS_BUS_DEVICE(&s->spi0), errp);
     sysbus_mmio_map(SYS_BUS_DEVICE(&s->spi0), 0,
                     memmap[RATONA_DEV_QSPI0].base);
     sysbus_connect_irq(SYS_BUS_DEVICE(&s->spi0), 0,
-                       qdev_get_gpio_in(DEVICE(s->plic), RATONA_QSPI0_IRQ));
+                       qdev_get_gpio_in(s->plic[0], RATONA_QSPI0_IRQ));
+    if (s->spi0.dma) {
+        sysbus_mmio_map(SYS_BUS_DEVICE(&s->spi0), 1,
+                        memmap[RATONA_DEV_QSPI0_DMA].base);
+        /* The DMA interrupt comes after the SPI and chip select lines */
+        sysbus_connect_irq(SYS_BUS_DEVICE(&s->spi0), 1 + s->spi0.num_cs,
+                           qdev_get_gpio_in(s->plic[0],
+                                            RATONA_QSPI0_DMA_IRQ));
+    }
 }
 
 static void ratona_soc_class_init(ObjectClass *oc, void *data)
@@ -87,6 +87,15 @@ enum SDCardStates {
     sd_disconnect_state,
 };
 
+typedef struct SDReadahead {
+    uint8_t *buf;
+    uint64_t start;
+    uint32_t len;           /* bytes available at buf */
+    uint32_t pending_len;   /* bytes being fetched, while aiocb is set */
+    QEMUIOVector qiov;
+    BlockAIOCB *aiocb;
+} SDReadahead;
+
 struct SDState {
     DeviceState parent_obj;
 
@@ -134,6 +143,10 @@ struct SDState {
     uint64_t data_start;
     uint32_t data_offset;
     uint8_t data[512];
+    /* Multiple block read (CMD18) readahead, in two alternating windows */
+    uint32_t readahead_blocks;
+    uint8_t *readahead_buf;
+    SDReadahead readahead[2];
     qemu_irq readonly_cb;
     qemu_irq inserted_cb;
     QEMUTimer *ocr_power_timer;
@@ -144,6 +157,7 @@ struct SDState {
 };
 
 static void sd_realize(DeviceState *dev, Error **errp);
+static void sd_readahead_invalidate(SDState *sd);
 
 static const char *sd_state_name(enum SDCardStates state)
 {
@@ -590,6 +604,7 @@ static void sd_reset(DeviceState *dev)
     sd->dat_lines = 0xf;
     sd->cmd_line = true;
     sd->multi_blk_cnt = 0;
+    sd_readahead_invalidate(sd);
 }
 
 static bool sd_get_inserted(SDState *sd)
@@ -749,8 +764,131 @@ void sd_set_cb(SDState *sd, qemu_irq readonly, qemu_irq insert)
     qemu_set_irq(insert, sd->blk ? blk_is_inserted(sd->blk) : 0);
 }
 
+/*
+ * Readahead for multiple block reads: once CMD18 has read a block, the
+ * following readahead_blocks blocks are fetched asynchronously into one
+ * of two windows, so that the next blocks can be served without waiting
+ * for host I/O. When the guest is halfway through a window, the window
+ * after it is fetched into the other one, so that host I/O overlaps with
+ * the transfer. Any write to the card drops the readahead data.
+ */
+#define SD_READAHEAD_MAX_BLOCKS 2048
+
+static void sd_readahead_cb(void *opaque, int ret)
+{
+    SDReadahead *ra = opaque;
+
+    ra->aiocb = NULL;
+    qemu_iovec_destroy(&ra->qiov);
+    ra->len = ret < 0 ? 0 : ra->pending_len;
+}
+
+static void sd_readahead_invalidate(SDState *sd)
+{
+    int i;
+
+    if (sd->readahead[0].aiocb || sd->readahead[1].aiocb) {
+        blk_drain(sd->blk);
+    }
+    for (i = 0; i < ARRAY_SIZE(sd->readahead); i++) {
+        sd->readahead[i].len = 0;
+    }
+}
+
+/* End of the data that is in @ra or on its way there */
+static uint64_t sd_readahead_end(SDReadahead *ra)
+{
+    return ra->start + (ra->aiocb ? ra->pending_len : ra->len);
+}
+
+static SDReadahead *sd_readahead_find(SDState *sd, uint64_t addr,
+                                      uint32_t len)
+{
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(sd->readahead); i++) {
+        SDReadahead *ra = &sd->readahead[i];
+
+        if (addr >= ra->start && addr + len <= sd_readahead_end(ra)) {
+            return ra;
+        }
+    }
+    return NULL;
+}
+
+static void sd_readahead_fetch(SDState *sd, SDReadahead *ra, uint64_t addr,
+                               uint32_t len)
+{
+    uint64_t size = MIN((uint64_t)sd->readahead_blocks * len,
+                        sd->size - MIN(addr, sd->size));
+
+    if (ra->aiocb || !size) {
+        return;
+    }
+
+    trace_sdcard_readahead(addr, size);
+    ra->start = addr;
+    ra->len = 0;
+    ra->pending_len = size;
+    qemu_iovec_init(&ra->qiov, 1);
+    qemu_iovec_add(&ra->qiov, ra->buf, size);
+    ra->aiocb = blk_aio_preadv(sd->blk, addr, &ra->qiov, 0,
+                               sd_readahead_cb, ra);
+}
+
+/* Called with the address of the block that CMD18 will read next */
+static void sd_readahead_start(SDState *sd, uint64_t addr, uint32_t len)
+{
+    SDReadahead *ra, *other;
+    uint64_t next;
+
+    if (!sd->readahead_blocks || !sd->blk) {
+        return;
+    }
+
+    ra = sd_readahead_find(sd, addr, len);
+    if (!ra) {
+        /* A new stream: fill whichever window is idle */
+        ra = sd->readahead[0].aiocb ? &sd->readahead[1] : &sd->readahead[0];
+        sd_readahead_fetch(sd, ra, addr, len);
+        return;
+    }
+
+    other = ra == &sd->readahead[0] ? &sd->readahead[1] : &sd->readahead[0];
+    next = sd_readahead_end(ra);
+    if ((addr - ra->start) * 2 >= next - ra->start &&
+        !sd_readahead_find(sd, next, len)) {
+        sd_readahead_fetch(sd, other, next, len);
+    }
+}
+
+static bool sd_readahead_lookup(SDState *sd, uint64_t addr, uint32_t len)
+{
+    SDReadahead *ra = sd_readahead_find(sd, addr, len);
+
+    if (!ra) {
+        return false;
+    }
+    if (ra->aiocb) {
+        /* Being fetched: waiting for it beats issuing a second read */
+        blk_drain(sd->blk);
+    }
+    if (addr + len > ra->start + ra->len) {
+        /* The fetch failed */
+        return false;
+    }
+
+    trace_sdcard_readahead_hit(addr, len);
+    memcpy(sd->data, ra->buf + (addr - ra->start), len);
+    return true;
+}
+
 static void sd_blk_read(SDState *sd, uint64_t addr, uint32_t len)
 {
+    if (sd_readahead_lookup(sd, addr, len)) {
+        return;
+    }
+
     trace_sdcard_read_block(addr, len);
     if (!sd->blk || blk_pread(sd->blk, addr, len, sd->data, 0) < 0) {
         fprintf(stderr, "sd_blk_read: read error on host side\n");
@@ -759,6 +897,8 @@ static void sd_blk_read(SDState *sd, uint64_t addr, uint32_t len)
 
 static void sd_blk_write(SDState *sd, uint64_t addr, uint32_t len)
 {
+    sd_readahead_invalidate(sd);
+
     trace_sdcard_write_block(addr, len);
     if (!sd->blk || blk_pwrite(sd->blk, addr, len, sd->data, 0) < 0) {
         fprintf(stderr, "sd_blk_write: write error on host side\n");
@@ -2034,6 +2174,7 @@ uint8_t sd_read_byte(SDState *sd)
                 return 0x00;
             }
             BLK_READ_BLOCK(sd->data_start, io_len);
+            sd_readahead_start(sd, sd->data_start + io_len, io_len);
         }
         ret = sd->data[sd->data_offset ++];
 
@@ -2124,6 +2265,7 @@ static void sd_instance_finalize(Object *obj)
     SDState *sd = SD_CARD(obj);
 
     timer_free(sd->ocr_power_timer);
+    qemu_vfree(sd->readahead_buf);
 }
 
 static void sd_realize(DeviceState *dev, Error **errp)
@@ -2178,6 +2320,19 @@ static void sd_realize(DeviceState *dev, Error **errp)
             return;
         }
         blk_set_dev_ops(sd->blk, &sd_block_ops, sd);
+
+        if (sd->readahead_blocks > SD_READAHEAD_MAX_BLOCKS) {
+            error_setg(errp, "readahead-blocks must not exceed %u",
+                       SD_READAHEAD_MAX_BLOCKS);
+            return;
+        }
+        if (sd->readahead_blocks) {
+            size_t window = sd->readahead_blocks * 512;
+
+            sd->readahead_buf = blk_blockalign(sd->blk, 2 * window);
+            sd->readahead[0].buf = sd->readahead_buf;
+            sd->readahead[1].buf = sd->readahead_buf + window;
+        }
     }
 }
 
@@ -2190,6 +2345,8 @@ static Property sd_properties[] = {
      * board to ensure that ssi transfers only occur when the chip select
      * is asserted.  */
     DEFINE_PROP_BOOL("spi", SDState, spi, false),
+    /* Number of blocks fetched ahead of multiple block reads (0 disables) */
+    DEFINE_PROP_UINT32("readahead-blocks", SDState, readahead_blocks, 0),
     DEFINE_PROP_END_OF_LIST()
 };
 
@@ -325,6 +325,73 @@ static uint32_t ssi_sd_transfer(SSIPeripheral *dev, uint32_t val)
     return SSI_DUMMY;
 }
 
+/*
+ * The data bytes of CMD17/CMD18 reads and CMD24/CMD25 writes are moved
+ * to or from the card without going through ssi_sd_transfer() for each
+ * of them.  As there, a data block ends after 512 bytes or as soon as
+ * the card stops sending or receiving, which it does earlier if CMD16
+ * set a shorter block length.  Everything else, including the block
+ * framing (tokens, CRC16 and data response), goes through
+ * ssi_sd_transfer() byte by byte.
+ */
+static void ssi_sd_transfer_bulk(SSIPeripheral *dev, const uint8_t *tx,
+                                  uint8_t *rx, size_t len)
+{
+    ssi_sd_state *s = SSI_SD(dev);
+    const uint8_t *stop;
+    size_t n, max;
+    bool ready;
+
+    while (len) {
+        n = 0;
+        ready = true;
+        if (s->mode == SSI_SD_DATA_READ && (s->cmd == 17 || s->cmd == 18) &&
+            s->read_bytes < 512) {
+            max = MIN(len, 512 - s->read_bytes);
+            /* CMD12 must still be caught by ssi_sd_transfer() */
+            stop = memchr(tx, 0x4c, max);
+            if (stop) {
+                max = stop - tx;
+            }
+            while (n < max && ready) {
+                rx[n++] = sdbus_read_byte(&s->sdbus);
+                ready = sdbus_data_ready(&s->sdbus);
+            }
+            if (n) {
+                s->crc16 = crc_ccitt_false(s->crc16, rx, n);
+                s->read_bytes += n;
+                if (!ready || s->read_bytes == 512) {
+                    DPRINTF("Data read end\n");
+                    s->mode = SSI_SD_DATA_CRC16;
+                }
+            }
+        } else if (s->mode == SSI_SD_DATA_WRITE &&
+                   (s->cmd == 24 || s->cmd == 25) && s->write_bytes < 512) {
+            max = MIN(len, 512 - s->write_bytes);
+            while (n < max && ready) {
+                sdbus_write_byte(&s->sdbus, tx[n]);
+                rx[n] = tx[n];
+                n++;
+                ready = sdbus_receive_ready(&s->sdbus);
+            }
+            s->write_bytes += n;
+            if (!ready || s->write_bytes == 512) {
+                DPRINTF("Data write end\n");
+                s->mode = SSI_SD_SKIP_CRC16;
+                s->response_pos = 0;
+            }
+        }
+
+        if (!n) {
+            *rx = ssi_sd_transfer(dev, *tx);
+            n = 1;
+        }
+        tx += n;
+        rx += n;
+        len -= n;
+    }
+}
+
 static int ssi_sd_post_load(void *opaque, int version_id)
 {
     ssi_sd_state *s = (ssi_sd_state *)opaque;
@@ -396,6 +463,7 @@ static void ssi_sd_class_init(ObjectClass *klass, void *data)
 
     k->realize = ssi_sd_realize;
     k->transfer = ssi_sd_transfer;
+    k->transfer_bulk = ssi_sd_transfer_bulk;
     k->cs_polarity = SSI_CS_LOW;
     dc->vmsd = &vmstate_ssi_sd;
     dc->reset = ssi_sd_reset;
@@ -20,13 +20,17 @@
  */
 
 #include "qemu/osdep.h"
+#include "exec/address-spaces.h"
 #include "hw/irq.h"
 #include "hw/qdev-properties.h"
 #include "hw/sysbus.h"
 #include "hw/ssi/ssi.h"
 #include "qemu/fifo8.h"
+#include "qemu/lockable.h"
 #include "qemu/log.h"
+#include "qemu/main-loop.h"
 #include "qemu/module.h"
+#include "qemu/units.h"
 #include "hw/ssi/sifive_spi.h"
 
 #define R_SCKDIV        (0x00 / 4)
@@ -59,6 +63,41 @@
 
 #define FIFO_CAPACITY   8
 
+/*
+ * DMA descriptor extension registers, in a separate MMIO region.
+ *
+ * Writing CTRL with START set shifts LEN bytes out of SRC (or dummy 0xff
+ * bytes with TX_DUMMY) and stores the bytes shifted in to DST (unless
+ * RX_DISCARD is set), then sets STATUS.DONE and raises the DMA interrupt
+ * if CTRL.IE is set. STATUS bits are write-one-to-clear.
+ *
+ * At most DMA_KICK_SIZE bytes move per register write or bottom half, so
+ * that a long transfer does not hold up the vCPUs. Until it is done,
+ * STATUS.BUSY is set and SRC, DST and LEN show the progress; clearing
+ * BUSY aborts the transfer.
+ */
+#define R_DMA_SRC_LO    (0x00 / 4)
+#define R_DMA_SRC_HI    (0x04 / 4)
+#define R_DMA_DST_LO    (0x08 / 4)
+#define R_DMA_DST_HI    (0x0C / 4)
+#define R_DMA_LEN       (0x10 / 4)
+#define R_DMA_CTRL      (0x14 / 4)
+#define R_DMA_STATUS    (0x18 / 4)
+
+#define DMA_CTRL_START      (1 << 0)
+#define DMA_CTRL_IE         (1 << 1)
+#define DMA_CTRL_TX_DUMMY   (1 << 2)
+#define DMA_CTRL_RX_DISCARD (1 << 3)
+#define DMA_CTRL_MASK       (DMA_CTRL_IE | DMA_CTRL_TX_DUMMY | \
+                             DMA_CTRL_RX_DISCARD)
+
+#define DMA_STATUS_DONE     (1 << 0)
+#define DMA_STATUS_ERROR    (1 << 1)
+#define DMA_STATUS_BUSY     (1 << 2)
+
+#define DMA_CHUNK_SIZE  4096
+#define DMA_KICK_SIZE   (64 * KiB)
+
 static void sifive_spi_txfifo_reset(SiFiveSPIState *s)
 {
     fifo8_reset(&s->tx_fifo);
@@ -103,14 +142,39 @@ static void sifive_spi_update_irq(SiFiveSPIState *s)
     }
 
     level = s->regs[R_IP] & s->regs[R_IE] ? 1 : 0;
+    if (!qemu_mutex_iothread_locked()) {
+        s->irq_pending |= level != s->irq_level;
+        return;
+    }
+
+    s->irq_level = level;
     qemu_set_irq(s->irq, level);
 }
 
+static void sifive_spi_update_dma_irq(SiFiveSPIState *s)
+{
+    int level;
+
+    if (!s->dma) {
+        return;
+    }
+
+    level = (s->dma_regs[R_DMA_CTRL] & DMA_CTRL_IE) &&
+            (s->dma_regs[R_DMA_STATUS] & DMA_STATUS_DONE);
+    qemu_set_irq(s->dma_irq, level);
+}
+
 static void sifive_spi_reset(DeviceState *d)
 {
     SiFiveSPIState *s = SIFIVE_SPI(d);
 
+    QEMU_LOCK_GUARD(&s->lock);
+
     memset(s->regs, 0, sizeof(s->regs));
+    memset(s->dma_regs, 0, sizeof(s->dma_regs));
+    if (s->dma_bh) {
+        qemu_bh_cancel(s->dma_bh);
+    }
 
     /* The reset value is high for all implemented CS pins */
     s->regs[R_CSDEF] = (1 << s->num_cs) - 1;
@@ -125,13 +189,34 @@ static void sifive_spi_reset(DeviceState *d)
 
     sifive_spi_update_cs(s);
     sifive_spi_update_irq(s);
+    sifive_spi_update_dma_irq(s);
 }
 
 static void sifive_spi_flush_txfifo(SiFiveSPIState *s)
 {
+    uint8_t txbuf[FIFO_CAPACITY];
+    uint8_t rxbuf[FIFO_CAPACITY];
+    uint32_t num, i;
     uint8_t tx;
     uint8_t rx;
 
+    num = fifo8_num_used(&s->tx_fifo);
+    if (num > 1) {
+        for (i = 0; i < num; i++) {
+            txbuf[i] = fifo8_pop(&s->tx_fifo);
+        }
+        ssi_transfer_bulk(s->spi, txbuf, rxbuf, num);
+
+        for (i = 0; i < num; i++) {
+            if (!fifo8_is_full(&s->rx_fifo)) {
+                if (!(s->regs[R_FMT] & FMT_DIR)) {
+                    fifo8_push(&s->rx_fifo, rxbuf[i]);
+                }
+            }
+        }
+        return;
+    }
+
     while (!fifo8_is_empty(&s->tx_fifo)) {
         tx = fifo8_pop(&s->tx_fifo);
         rx = ssi_transfer(s->spi, tx);
@@ -177,9 +262,46 @@ static bool sifive_spi_is_bad_reg(hwaddr addr, bool allow_reserved)
     return bad;
 }
 
-static uint64_t sifive_spi_read(void *opaque, hwaddr addr, unsigned int size)
+/*
+ * Accesses that shift bytes over the SSI bus or move a chip select reach
+ * the peripherals behind the controller, which rely on the BQL.  Anything
+ * else only touches the controller's own registers and FIFOs.
+ */
+static bool sifive_spi_needs_bql(SiFiveSPIState *s, hwaddr addr,
+                                 bool is_write)
+{
+    addr >>= 2;
+
+    if ((!is_write || addr != R_TXDATA) && !fifo8_is_empty(&s->tx_fifo)) {
+        return true;
+    }
+    if (!is_write) {
+        return false;
+    }
+
+    switch (addr) {
+    case R_CSID:
+    case R_CSMODE:
+        return true;
+    case R_TXDATA:
+        return fifo8_num_used(&s->tx_fifo) + 1 >= FIFO_CAPACITY ||
+               s->regs[R_IE];
+    default:
+        return false;
+    }
+}
+
+static void sifive_spi_sync_irq(SiFiveSPIState *s)
+{
+    QEMU_IOTHREAD_LOCK_GUARD();
+    QEMU_LOCK_GUARD(&s->lock);
+
+    s->irq_pending = false;
+    sifive_spi_update_irq(s);
+}
+
+static uint64_t sifive_spi_read_locked(SiFiveSPIState *s, hwaddr addr)
 {
-    SiFiveSPIState *s = opaque;
     uint32_t r;
 
     if (sifive_spi_is_bad_reg(addr, true)) {
@@ -189,6 +311,10 @@ static uint64_t sifive_spi_read(void *opaque, hwaddr addr, unsigned int size)
     }
 
     addr >>= 2;
+
+    /* Any register access may observe the effects of queued TX bytes */
+    sifive_spi_flush_txfifo(s);
+
     switch (addr) {
     case R_TXDATA:
         if (fifo8_is_full(&s->tx_fifo)) {
@@ -214,10 +340,9 @@ static uint64_t sifive_spi_read(void *opaque, hwaddr addr, unsigned int size)
     return r;
 }
 
-static void sifive_spi_write(void *opaque, hwaddr addr,
-                             uint64_t val64, unsigned int size)
+static void sifive_spi_write_locked(SiFiveSPIState *s, hwaddr addr,
+                                    uint64_t val64)
 {
-    SiFiveSPIState *s = opaque;
     uint32_t value = val64;
 
     if (sifive_spi_is_bad_reg(addr, false)) {
@@ -227,6 +352,11 @@ static void sifive_spi_write(void *opaque, hwaddr addr,
     }
 
     addr >>= 2;
+
+    if (addr != R_TXDATA) {
+        sifive_spi_flush_txfifo(s);
+    }
+
     switch (addr) {
     case R_CSID:
         if (value >= s->num_cs) {
@@ -260,7 +390,15 @@ static void sifive_spi_write(void *opaque, hwaddr addr,
     case R_TXDATA:
         if (!fifo8_is_full(&s->tx_fifo)) {
             fifo8_push(&s->tx_fifo, (uint8_t)value);
-            sifive_spi_flush_txfifo(s);
+            /*
+             * Queue TX bytes while nothing can observe them so that they
+             * get shifted out as one burst: the queue is flushed once it
+             * fills up, on the next access to any other register, or right
+             * away when interrupts are enabled.
+             */
+            if (fifo8_is_full(&s->tx_fifo) || s->regs[R_IE]) {
+                sifive_spi_flush_txfifo(s);
+            }
         }
         break;
 
@@ -296,6 +434,54 @@ static void sifive_spi_write(void *opaque, hwaddr addr,
     sifive_spi_update_irq(s);
 }
 
+static uint64_t sifive_spi_read(void *opaque, hwaddr addr, unsigned int size)
+{
+    SiFiveSPIState *s = opaque;
+    uint64_t ret;
+    bool sync;
+
+    qemu_mutex_lock(&s->lock);
+    if (sifive_spi_needs_bql(s, addr, false) &&
+        !qemu_mutex_iothread_locked()) {
+        qemu_mutex_unlock(&s->lock);
+        QEMU_IOTHREAD_LOCK_GUARD();
+        QEMU_LOCK_GUARD(&s->lock);
+        return sifive_spi_read_locked(s, addr);
+    }
+    ret = sifive_spi_read_locked(s, addr);
+    sync = s->irq_pending;
+    qemu_mutex_unlock(&s->lock);
+
+    if (sync) {
+        sifive_spi_sync_irq(s);
+    }
+    return ret;
+}
+
+static void sifive_spi_write(void *opaque, hwaddr addr,
+                             uint64_t val64, unsigned int size)
+{
+    SiFiveSPIState *s = opaque;
+    bool sync;
+
+    qemu_mutex_lock(&s->lock);
+    if (sifive_spi_needs_bql(s, addr, true) &&
+        !qemu_mutex_iothread_locked()) {
+        qemu_mutex_unlock(&s->lock);
+        QEMU_IOTHREAD_LOCK_GUARD();
+        QEMU_LOCK_GUARD(&s->lock);
+        sifive_spi_write_locked(s, addr, val64);
+        return;
+    }
+    sifive_spi_write_locked(s, addr, val64);
+    sync = s->irq_pending;
+    qemu_mutex_unlock(&s->lock);
+
+    if (sync) {
+        sifive_spi_sync_irq(s);
+    }
+}
+
 static const MemoryRegionOps sifive_spi_ops = {
     .read = sifive_spi_read,
     .write = sifive_spi_write,
@@ -306,6 +492,156 @@ static const MemoryRegionOps sifive_spi_ops = {
     }
 };
 
+static void sifive_spi_dma_run(SiFiveSPIState *s)
+{
+    uint64_t src = deposit64(s->dma_regs[R_DMA_SRC_LO], 32, 32,
+                             s->dma_regs[R_DMA_SRC_HI]);
+    uint64_t dst = deposit64(s->dma_regs[R_DMA_DST_LO], 32, 32,
+                             s->dma_regs[R_DMA_DST_HI]);
+    uint32_t ctrl = s->dma_regs[R_DMA_CTRL];
+    uint32_t remainder = s->dma_regs[R_DMA_LEN];
+    uint32_t budget = DMA_KICK_SIZE;
+    g_autofree uint8_t *txbuf = g_malloc(DMA_CHUNK_SIZE);
+    g_autofree uint8_t *rxbuf = g_malloc(DMA_CHUNK_SIZE);
+    uint32_t status = DMA_STATUS_DONE;
+    MemTxResult res;
+    uint32_t size;
+
+    /* Bytes already queued in the TX FIFO go out first */
+    sifive_spi_flush_txfifo(s);
+
+    if (ctrl & DMA_CTRL_TX_DUMMY) {
+        memset(txbuf, 0xff, DMA_CHUNK_SIZE);
+    }
+
+    while (remainder && budget) {
+        size = MIN3(remainder, budget, DMA_CHUNK_SIZE);
+
+        if (!(ctrl & DMA_CTRL_TX_DUMMY)) {
+            res = address_space_read(&address_space_memory, src,
+                                     MEMTXATTRS_UNSPECIFIED, txbuf, size);
+            if (res != MEMTX_OK) {
+                qemu_log_mask(LOG_GUEST_ERROR, "%s: bad source address 0x%"
+                              PRIx64 "\n", __func__, src);
+                status |= DMA_STATUS_ERROR;
+                break;
+            }
+        }
+
+        ssi_transfer_bulk(s->spi, txbuf, rxbuf, size);
+
+        if (!(ctrl & DMA_CTRL_RX_DISCARD)) {
+            res = address_space_write(&address_space_memory, dst,
+                                      MEMTXATTRS_UNSPECIFIED, rxbuf, size);
+            if (res != MEMTX_OK) {
+                qemu_log_mask(LOG_GUEST_ERROR, "%s: bad destination address 0x%"
+                              PRIx64 "\n", __func__, dst);
+                status |= DMA_STATUS_ERROR;
+                break;
+            }
+        }
+
+        src += size;
+        dst += size;
+        remainder -= size;
+        budget -= size;
+    }
+
+    s->dma_regs[R_DMA_SRC_LO] = src;
+    s->dma_regs[R_DMA_SRC_HI] = src >> 32;
+    s->dma_regs[R_DMA_DST_LO] = dst;
+    s->dma_regs[R_DMA_DST_HI] = dst >> 32;
+    s->dma_regs[R_DMA_LEN] = remainder;
+
+    if (remainder && !(status & DMA_STATUS_ERROR)) {
+        s->dma_regs[R_DMA_STATUS] |= DMA_STATUS_BUSY;
+        qemu_bh_schedule(s->dma_bh);
+        return;
+    }
+    s->dma_regs[R_DMA_STATUS] &= ~DMA_STATUS_BUSY;
+    s->dma_regs[R_DMA_STATUS] |= status;
+}
+
+/* Continue a transfer that did not fit in DMA_KICK_SIZE, under the BQL */
+static void sifive_spi_dma_bh(void *opaque)
+{
+    SiFiveSPIState *s = opaque;
+
+    QEMU_LOCK_GUARD(&s->lock);
+
+    if (s->dma_regs[R_DMA_STATUS] & DMA_STATUS_BUSY) {
+        sifive_spi_dma_run(s);
+        sifive_spi_update_irq(s);
+        sifive_spi_update_dma_irq(s);
+    }
+}
+
+static uint64_t sifive_spi_dma_read(void *opaque, hwaddr addr,
+                                    unsigned int size)
+{
+    SiFiveSPIState *s = opaque;
+
+    QEMU_LOCK_GUARD(&s->lock);
+
+    addr >>= 2;
+    if (addr >= SIFIVE_SPI_DMA_REG_NUM) {
+        qemu_log_mask(LOG_GUEST_ERROR, "%s: bad read at address 0x%"
+                      HWADDR_PRIx "\n", __func__, addr << 2);
+        return 0;
+    }
+
+    return s->dma_regs[addr];
+}
+
+static void sifive_spi_dma_write(void *opaque, hwaddr addr,
+                                 uint64_t val64, unsigned int size)
+{
+    SiFiveSPIState *s = opaque;
+    uint32_t value = val64;
+
+    QEMU_LOCK_GUARD(&s->lock);
+
+    addr >>= 2;
+    switch (addr) {
+    case R_DMA_SRC_LO:
+    case R_DMA_SRC_HI:
+    case R_DMA_DST_LO:
+    case R_DMA_DST_HI:
+    case R_DMA_LEN:
+        s->dma_regs[addr] = value;
+        break;
+
+    case R_DMA_CTRL:
+        s->dma_regs[R_DMA_CTRL] = value & DMA_CTRL_MASK;
+        if (value & DMA_CTRL_START) {
+            sifive_spi_dma_run(s);
+            sifive_spi_update_irq(s);
+        }
+        break;
+
+    case R_DMA_STATUS:
+        s->dma_regs[R_DMA_STATUS] &= ~value;
+        break;
+
+    default:
+        qemu_log_mask(LOG_GUEST_ERROR, "%s: bad write at addr=0x%"
+                      HWADDR_PRIx " value=0x%x\n", __func__, addr << 2, value);
+        return;
+    }
+
+    sifive_spi_update_dma_irq(s);
+}
+
+static const MemoryRegionOps sifive_spi_dma_ops = {
+    .read = sifive_spi_dma_read,
+    .write = sifive_spi_dma_write,
+    .endianness = DEVICE_LITTLE_ENDIAN,
+    .valid = {
+        .min_access_size = 4,
+        .max_access_size = 4
+    }
+};
+
 static void sifive_spi_realize(DeviceState *dev, Error **errp)
 {
     SysBusDevice *sbd = SYS_BUS_DEVICE(dev);
@@ -320,16 +656,28 @@ static void sifive_spi_realize(DeviceState *dev, Error **errp)
         sysbus_init_irq(sbd, &s->cs_lines[i]);
     }
 
+    qemu_mutex_init(&s->lock);
     memory_region_init_io(&s->mmio, OBJECT(s), &sifive_spi_ops, s,
                           TYPE_SIFIVE_SPI, 0x1000);
+    memory_region_enable_lockless_io(&s->mmio);
     sysbus_init_mmio(sbd, &s->mmio);
 
+    if (s->dma) {
+        sysbus_init_irq(sbd, &s->dma_irq);
+        memory_region_init_io(&s->dma_mmio, OBJECT(s), &sifive_spi_dma_ops, s,
+                              TYPE_SIFIVE_SPI "-dma", 0x1000);
+        sysbus_init_mmio(sbd, &s->dma_mmio);
+        s->dma_bh = qemu_bh_new_guarded(sifive_spi_dma_bh, s,
+                                        &dev->mem_reentrancy_guard);
+    }
+
     fifo8_create(&s->tx_fifo, FIFO_CAPACITY);
     fifo8_create(&s->rx_fifo, FIFO_CAPACITY);
 }
 
 static Property sifive_spi_properties[] = {
     DEFINE_PROP_UINT32("num-cs", SiFiveSPIState, num_cs, 1),
+    DEFINE_PROP_BOOL("dma", SiFiveSPIState, dma, false),
     DEFINE_PROP_END_OF_LIST(),
 };
 
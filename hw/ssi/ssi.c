@@ -45,18 +45,45 @@ static void ssi_cs_default(void *opaque, int n, int level)
     s->cs = cs;
 }
 
+static bool ssi_peripheral_selected(SSIPeripheral *dev)
+{
+    SSIPeripheralClass *ssc = dev->spc;
+
+    return (dev->cs && ssc->cs_polarity == SSI_CS_HIGH) ||
+           (!dev->cs && ssc->cs_polarity == SSI_CS_LOW) ||
+           ssc->cs_polarity == SSI_CS_NONE;
+}
+
 static uint32_t ssi_transfer_raw_default(SSIPeripheral *dev, uint32_t val)
 {
     SSIPeripheralClass *ssc = dev->spc;
 
-    if ((dev->cs && ssc->cs_polarity == SSI_CS_HIGH) ||
-        (!dev->cs && ssc->cs_polarity == SSI_CS_LOW) ||
-        ssc->cs_polarity == SSI_CS_NONE) {
+    if (ssi_peripheral_selected(dev)) {
         return ssc->transfer(dev, val);
     }
     return 0;
 }
 
+static void ssi_transfer_raw_bulk(SSIPeripheral *dev, const uint8_t *tx,
+                                  uint8_t *rx, size_t len)
+{
+    SSIPeripheralClass *ssc = dev->spc;
+    size_t i;
+
+    if (ssc->transfer_bulk && ssc->transfer_raw == ssi_transfer_raw_default) {
+        if (ssi_peripheral_selected(dev)) {
+            ssc->transfer_bulk(dev, tx, rx, len);
+        } else {
+            memset(rx, 0, len);
+        }
+        return;
+    }
+
+    for (i = 0; i < len; i++) {
+        rx[i] = ssc->transfer_raw(dev, tx[i]);
+    }
+}
+
 static void ssi_peripheral_realize(DeviceState *dev, Error **errp)
 {
     SSIPeripheral *s = SSI_PERIPHERAL(dev);
@@ -125,6 +152,36 @@ uint32_t ssi_transfer(SSIBus *bus, uint32_t val)
     return r;
 }
 
+void ssi_transfer_bulk(SSIBus *bus, const uint8_t *tx, uint8_t *rx,
+                       size_t len)
+{
+    BusState *b = BUS(bus);
+    BusChild *kid;
+    g_autofree uint8_t *buf = NULL;
+    size_t i;
+
+    memset(rx, 0, len);
+
+    QTAILQ_FOREACH(kid, &b->children, sibling) {
+        SSIPeripheral *p = SSI_PERIPHERAL(kid->child);
+
+        /* The common case is a single peripheral: shift straight into rx */
+        if (kid == QTAILQ_FIRST(&b->children) &&
+            !QTAILQ_NEXT(kid, sibling)) {
+            ssi_transfer_raw_bulk(p, tx, rx, len);
+            break;
+        }
+
+        if (!buf) {
+            buf = g_malloc(len);
+        }
+        ssi_transfer_raw_bulk(p, tx, buf, len);
+        for (i = 0; i < len; i++) {
+            rx[i] |= buf[i];
+        }
+    }
+}
+
 const VMStateDescription vmstate_ssi_peripheral = {
     .name = "SSISlave",
     .version_id = 1,
@@ -188,6 +188,7 @@ typedef struct CPUTLBCommon {
     size_t full_flush_count;
     size_t part_flush_count;
     size_t elide_flush_count;
+    size_t page_flush_count;
 } CPUTLBCommon;
 
 /*
@@ -766,6 +766,7 @@ struct MemoryRegion {
     bool nonvolatile;
     bool rom_device;
     bool flush_coalesced_mmio;
+    bool lockless_io;
     uint8_t dirty_log_mask;
     bool is_iommu;
     RAMBlock *ram_block;
@@ -2193,6 +2194,20 @@ void memory_region_set_flush_coalesced(MemoryRegion *mr);
  */
 void memory_region_clear_flush_coalesced(MemoryRegion *mr);
 
+/**
+ * memory_region_enable_lockless_io: Dispatch accesses without the BQL.
+ *
+ * The accessors of @mr are called without the big QEMU lock held, possibly
+ * from several vCPU threads at once.  The owning device must protect its
+ * own state and take the BQL itself for anything that needs it, such as
+ * raising an interrupt line.  The re-entrancy guard still applies, but
+ * per thread: concurrent accesses from different vCPUs are allowed,
+ * re-entering the device from within one of its own accesses is not.
+ *
+ * @mr: the memory region to be updated.
+ */
+void memory_region_enable_lockless_io(MemoryRegion *mr);
+
 /**
  * memory_region_add_eventfd: Request an eventfd to be triggered when a word
  *                            is written to a location.
@@ -141,6 +141,19 @@ struct TranslationBlock {
     uintptr_t jmp_list_head;
     uintptr_t jmp_list_next[2];
     uintptr_t jmp_dest[2];
+
+    /*
+     * Executions of this TB, counted by its prologue when hot traces
+     * are enabled (see accel/tcg/tb-trace.c).  Updated without atomics,
+     * so the count is only approximate when several vCPUs run the TB.
+     */
+    uint32_t exec_count;
+
+    /*
+     * Set for a TB translated ahead of time by a background thread,
+     * until the execution loop first looks it up.
+     */
+    bool speculative;
 };
 
 /* The alignment given to TranslationBlock during allocation. */
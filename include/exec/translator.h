@@ -214,6 +214,24 @@ translator_ldq_swap(CPUArchState *env, DisasContextBase *db,
     return ret;
 }
 
+/**
+ * translator_peek_lduw, translator_peek_ldl - look at nearby code
+ * @env: CPU environment
+ * @db: Disassembly context
+ * @pc: address of the code to read
+ *
+ * Read code that is not part of the instruction being translated, for
+ * example to find the length of the next instruction.  Unlike the
+ * loads above, the bytes are not recorded for plugins.  Reads within
+ * the first page of the TB use its host mapping; anything else goes
+ * through the cpu_ld*_code slow path, or abandons the translation if
+ * it is running in the background.
+ */
+uint16_t translator_peek_lduw(CPUArchState *env, DisasContextBase *db,
+                              abi_ptr pc);
+uint32_t translator_peek_ldl(CPUArchState *env, DisasContextBase *db,
+                             abi_ptr pc);
+
 /**
  * translator_fake_ldb - fake instruction load
  * @insn8: byte of instruction
@@ -24,6 +24,7 @@
 #include "hw/qdev-properties.h"
 #include "hw/sysbus.h"
 #include "qom/object.h"
+#include "qemu/thread.h"
 
 enum {
     SIFIVE_UART_TXFIFO        = 0,
@@ -51,6 +52,10 @@ enum {
 #define SIFIVE_UART_GET_TXCNT(txctrl)   ((txctrl >> 16) & 0x7)
 #define SIFIVE_UART_GET_RXCNT(rxctrl)   ((rxctrl >> 16) & 0x7)
 #define SIFIVE_UART_RX_FIFO_SIZE 8
+#define SIFIVE_UART_TX_FIFO_SIZE 8
+
+#define SIFIVE_UART_TXFIFO_FULL    0x80000000
+#define SIFIVE_UART_RXFIFO_EMPTY   0x80000000
 
 #define TYPE_SIFIVE_UART "riscv.sifive.uart"
 OBJECT_DECLARE_SIMPLE_TYPE(SiFiveUARTState, SIFIVE_UART)
@@ -65,11 +70,26 @@ struct SiFiveUARTState {
     CharBackend chr;
     uint8_t rx_fifo[SIFIVE_UART_RX_FIFO_SIZE];
     uint8_t rx_fifo_len;
+    uint8_t rx_fifo_head;
+    uint8_t tx_fifo[SIFIVE_UART_TX_FIFO_SIZE];
+    uint8_t tx_fifo_len;
+    QEMUBH *tx_bh;
+    guint watch_tag;
     uint32_t ie;
     uint32_t ip;
     uint32_t txctrl;
     uint32_t rxctrl;
     uint32_t div;
+
+    /*
+     * MMIO is dispatched without the BQL and serialized by lock.  Work
+     * that needs the BQL is flagged in bql_pending and done once it is
+     * taken: see sifive_uart_sync().
+     */
+    QemuMutex lock;
+    bool bql_pending;
+    bool rx_accept;
+    bool irq_level;
 };
 
 SiFiveUARTState *sifive_uart_create(MemoryRegion *address_space, hwaddr base,
@@ -276,6 +276,8 @@ struct qemu_work_item;
  *   Under TCG this value is propagated to @tcg_cflags.
  *   See TranslationBlock::TCG CF_CLUSTER_MASK.
  * @tcg_cflags: Pre-computed cflags for this cpu.
+ * @tb_cache_id: Hash of the configuration that translation depends on,
+ *   for the persistent TB cache; 0 until first needed.
  * @nr_cores: Number of cores within this CPU package.
  * @nr_threads: Number of threads within this CPU.
  * @running: #true if CPU is currently running (lockless).
@@ -417,6 +419,7 @@ struct CPUState {
     int cpu_index;
     int cluster_index;
     uint32_t tcg_cflags;
+    uint64_t tb_cache_id;
     uint32_t halted;
     uint32_t can_do_io;
     int32_t exception_index;
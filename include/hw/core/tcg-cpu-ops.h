@@ -48,6 +48,15 @@ struct TCGCPUOps {
     void (*cpu_exec_exit)(CPUState *cpu);
     /** @debug_excp_handler: Callback for handling debug exceptions */
     void (*debug_excp_handler)(CPUState *cpu);
+    /**
+     * @tb_cache_state: Return the CPU state, other than the TB flags and
+     * the CPU's properties, that translation depends on.
+     *
+     * The persistent translation cache keys its entries on it.  State
+     * that the guest can change at run time, such as the set of enabled
+     * extensions, must be returned here.
+     */
+    uint64_t (*tb_cache_state)(CPUState *cpu);
 
 #ifdef NEED_CPU_H
 #if defined(CONFIG_USER_ONLY) && defined(TARGET_I386)
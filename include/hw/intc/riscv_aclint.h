@@ -22,6 +22,7 @@
 #define HW_RISCV_ACLINT_H
 
 #include "hw/sysbus.h"
+#include "qemu/thread.h"
 
 #define TYPE_RISCV_ACLINT_MTIMER "riscv.aclint.mtimer"
 
@@ -33,7 +34,23 @@ typedef struct RISCVAclintMTimerState {
     SysBusDevice parent_obj;
     uint64_t time_delta;
     uint64_t *timecmp;
-    QEMUTimer **timers;
+    /*
+     * One QEMU timer serves every hart, armed for the earliest deadline.
+     * deadline_ns[] holds each hart's QEMU_CLOCK_VIRTUAL deadline, or
+     * INT64_MAX when its interrupt is raised or too far away to matter.
+     */
+    QEMUTimer *timer;
+    int64_t *deadline_ns;
+    int64_t next_ns;
+    /*
+     * MMIO is dispatched without the BQL; lock protects the state above.
+     * Timer lines that must change level while the BQL is not held are
+     * recorded in irq_level/irq_dirty and driven once it is taken.
+     */
+    QemuMutex lock;
+    unsigned long *irq_level;
+    unsigned long *irq_dirty;
+    bool irq_pending;
 
     /*< public >*/
     MemoryRegion mmio;
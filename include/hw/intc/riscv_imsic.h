@@ -55,6 +55,15 @@ struct RISCVIMSICState {
     uint32_t *eithreshold;
     uint32_t *eistate;
 
+    /*
+     * Pending and enabled bits, num_words 32-bit words per page.  They are
+     * updated atomically so that MSIs can be posted without the BQL; the
+     * eistate array above is only filled in for migration.
+     */
+    uint32_t num_words;
+    uint32_t *eip;
+    uint32_t *eie;
+
     /* config */
     bool mmode;
     uint32_t hartid;
@@ -23,6 +23,7 @@
 
 #include "hw/sysbus.h"
 #include "qom/object.h"
+#include "qemu/thread.h"
 
 #define TYPE_SIFIVE_PLIC "riscv.sifive.plic"
 
@@ -59,6 +60,22 @@ struct SiFivePLICState {
     uint32_t *claimed;
     uint32_t *enable;
 
+    /*
+     * Derived state, per context: the sources that are pending, enabled
+     * and not claimed, and the one a claim would return right now.
+     */
+    uint32_t *claimable;
+    uint32_t *context_irq;
+
+    /*
+     * MMIO is dispatched without the BQL and serialized by lock.  Context
+     * outputs that change level while the BQL is not held are marked in
+     * output_dirty and driven once it is taken.
+     */
+    QemuMutex lock;
+    unsigned long *output_dirty;
+    bool output_pending;
+
     /* config */
     char *hart_config;
     uint32_t hartid_base;
@@ -28,6 +28,11 @@
 #include "hw/ssi/sifive_spi.h"
 #include "hw/timer/sifive_pwm.h"
 
+#define RATONA_CPUS_MAX_BITS 9
+#define RATONA_CPUS_MAX (1 << RATONA_CPUS_MAX_BITS)
+#define RATONA_SOCKETS_MAX_BITS 2
+#define RATONA_SOCKETS_MAX (1 << RATONA_SOCKETS_MAX_BITS)
+
 #define TYPE_RATONA_SOC "riscv.ratona.fpga.soc"
 #define RATONA_SOC(obj) \
     OBJECT_CHECK(RatonaSoCState, (obj), TYPE_RATONA_SOC)
@@ -37,8 +42,8 @@ typedef struct RatonaSoCState {
     DeviceState parent_obj;
 
     /*< public >*/
-    RISCVHartArrayState cpus;
-    DeviceState *plic;
+    RISCVHartArrayState cpus[RATONA_SOCKETS_MAX];
+    DeviceState *plic[RATONA_SOCKETS_MAX];
     SiFiveSPIState spi0;
 
     uint32_t serial;
@@ -56,6 +61,16 @@ typedef struct RatonaState {
     /*< public >*/
     RatonaSoCState soc;
     int fdt_size;
+
+    bool spi_dma;
+    bool sd_fastboot;
+    uint32_t virtio_transports;
+
+    /* Partition 1 of the SD card, copied to DRAM on reset by sd-fastboot */
+    BlockBackend *sd_payload_blk;
+    hwaddr sd_payload_dest;
+    uint64_t sd_payload_lba;
+    uint64_t sd_payload_size;
 } RatonaState;
 
 enum {
@@ -66,12 +81,16 @@ enum {
     RATONA_DEV_PLIC,
     RATONA_DEV_UART0,
     RATONA_DEV_QSPI0,
+    RATONA_DEV_QSPI0_DMA,
+    RATONA_DEV_VIRTIO,
     RATONA_DEV_DRAM
 };
 
 enum {
     RATONA_UART0_IRQ = 4,
-    RATONA_QSPI0_IRQ = 51
+    RATONA_VIRTIO_IRQ = 8, /* 8 to 15 */
+    RATONA_QSPI0_IRQ = 51,
+    RATONA_QSPI0_DMA_IRQ = 52
 };
 
 enum {
@@ -79,6 +98,10 @@ enum {
     RATONA_RTCCLK_FREQ = 1000000
 };
 
+#define RATONA_VIRTIO_MAX 8
+
+#define RATONA_SD_BLOCK_SIZE 512
+
 #define RATONA_PLIC_NUM_SOURCES 54
 #define RATONA_PLIC_NUM_PRIORITIES 7
 #define RATONA_PLIC_PRIORITY_BASE 0x00
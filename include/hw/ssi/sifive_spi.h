@@ -24,8 +24,10 @@
 
 #include "qemu/fifo8.h"
 #include "hw/sysbus.h"
+#include "qemu/thread.h"
 
 #define SIFIVE_SPI_REG_NUM  (0x78 / 4)
+#define SIFIVE_SPI_DMA_REG_NUM  (0x20 / 4)
 
 #define TYPE_SIFIVE_SPI "sifive.spi"
 #define SIFIVE_SPI(obj) OBJECT_CHECK(SiFiveSPIState, (obj), TYPE_SIFIVE_SPI)
@@ -45,6 +47,22 @@ typedef struct SiFiveSPIState {
     Fifo8 rx_fifo;
 
     uint32_t regs[SIFIVE_SPI_REG_NUM];
+
+    /* Optional DMA descriptor extension (not present in hardware) */
+    bool dma;
+    MemoryRegion dma_mmio;
+    qemu_irq dma_irq;
+    uint32_t dma_regs[SIFIVE_SPI_DMA_REG_NUM];
+    QEMUBH *dma_bh;
+
+    /*
+     * Register accesses that stay inside the controller run without the
+     * BQL under lock.  A DMA descriptor that points back at the
+     * controller's own registers is refused by the re-entrancy guard.
+     */
+    QemuMutex lock;
+    bool irq_pending;
+    bool irq_level;
 } SiFiveSPIState;
 
 #endif /* HW_SIFIVE_SPI_H */
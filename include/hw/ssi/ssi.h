@@ -54,6 +54,15 @@ struct SSIPeripheralClass {
      * always be called for the device for every txrx access to the parent bus
      */
     uint32_t (*transfer_raw)(SSIPeripheral *dev, uint32_t val);
+
+    /* Optional multi-byte variant of transfer for 8-bit peripherals. If
+     * implemented, it is called by ssi_transfer_bulk() when the device cs
+     * is active and must behave exactly as @len back-to-back calls to
+     * transfer would, storing the byte shifted out for tx[i] in rx[i].
+     * Not used if transfer_raw is overwritten.
+     */
+    void (*transfer_bulk)(SSIPeripheral *dev, const uint8_t *tx, uint8_t *rx,
+                          size_t len);
 };
 
 struct SSIPeripheral {
@@ -109,4 +118,18 @@ SSIBus *ssi_create_bus(DeviceState *parent, const char *name);
 
 uint32_t ssi_transfer(SSIBus *bus, uint32_t val);
 
+/**
+ * ssi_transfer_bulk: transfer a burst of bytes on an SSI bus
+ * @bus: SSI bus
+ * @tx: bytes shifted out by the master
+ * @rx: buffer receiving the bytes shifted in, @len bytes long
+ * @len: number of bytes
+ *
+ * Equivalent to calling ssi_transfer() once for each byte of @tx, but
+ * lets peripherals implementing transfer_bulk handle the whole burst
+ * in a single call.
+ */
+void ssi_transfer_bulk(SSIBus *bus, const uint8_t *tx, uint8_t *rx,
+                       size_t len);
+
 #endif
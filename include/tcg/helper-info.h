@@ -61,4 +61,7 @@ struct TCGHelperInfo {
     TCGCallArgumentLoc in[MAX_CALL_IARGS * (128 / TCG_TARGET_REG_BITS)];
 };
 
+/* Make @infos, a NULL-terminated array, known to tcg by name. */
+void tcg_helper_info_register(TCGHelperInfo * const *infos);
+
 #endif /* TCG_HELPER_INFO_H */
@@ -534,9 +534,48 @@ struct TCGContext {
 #ifdef TCG_TARGET_NEED_POOL_LABELS
     struct TCGLabelPoolData *pool_labels;
 #endif
+#ifdef TCG_TARGET_NEED_VTYPE_CACHE
+    /* Vector configuration currently in effect, or -1 if unknown.  */
+    int vtype_cache;
+#endif
 
     TCGLabel *exitreq_label;
 
+    /*
+     * Persistent TB cache: if ops_record is set, tcg_gen_code appends
+     * the optimized ops to it.  ops_decoded is set when the ops were
+     * read back from the cache and need no further optimization.
+     */
+    GByteArray *ops_record;
+    bool ops_decoded;
+
+    /*
+     * Hot traces: the trace being translated, if any.  When
+     * goto_tb_label is set, the next goto_tb is dropped and the
+     * exit_tb that follows it becomes a branch to the label.
+     */
+    struct TBTrace *trace;
+    TCGLabel *goto_tb_label;
+    bool goto_tb_redirect;
+
+    /*
+     * Speculative translation: the same-page targets of direct jumps
+     * seen by the translator, and whether this translation runs in a
+     * background thread, which cannot fill the TLB for a second page.
+     */
+    uint64_t goto_tb_dest[2];
+    int nb_goto_tb_dest;
+    bool speculative;
+
+    /* Optimizer statistics, summed over all contexts by tcg_dump_info. */
+    size_t opt_env_ld;
+    size_t opt_env_ld_removed;
+    size_t opt_env_st;
+    size_t opt_env_st_removed;
+
+    /* Code buffer region pool that this context allocates from. */
+    unsigned int region_pool;
+
 #ifdef CONFIG_PLUGIN
     /*
      * We keep one plugin_tb struct per TCGContext. Note that on every TB
@@ -783,7 +822,15 @@ static inline void *tcg_malloc(int size)
     }
 }
 
-void tcg_init(size_t tb_size, int splitwx, unsigned max_cpus);
+/* Backing of the code buffer, for -accel tcg,tb-hugepages. */
+typedef enum TCGHugePages {
+    TCG_HUGEPAGES_OFF,
+    TCG_HUGEPAGES_ON,           /* transparent huge pages */
+    TCG_HUGEPAGES_EXPLICIT,     /* MAP_HUGETLB, from the reserved pool */
+} TCGHugePages;
+
+void tcg_init(size_t tb_size, int splitwx, TCGHugePages hugepages,
+              bool numa, unsigned max_cpus);
 void tcg_register_thread(void);
 void tcg_prologue_init(TCGContext *s);
 void tcg_func_start(TCGContext *s);
@@ -919,6 +966,8 @@ void tcg_gen_call7(TCGHelperInfo *, TCGTemp *ret, TCGTemp *, TCGTemp *,
                    TCGTemp *, TCGTemp *, TCGTemp *, TCGTemp *, TCGTemp *);
 
 TCGOp *tcg_emit_op(TCGOpcode opc, unsigned nargs);
+bool tcg_ops_encode(TCGContext *s, GByteArray *buf);
+bool tcg_ops_decode(TCGContext *s, const void *data, size_t len);
 void tcg_op_remove(TCGContext *s, TCGOp *op);
 TCGOp *tcg_op_insert_before(TCGContext *s, TCGOp *op,
                             TCGOpcode opc, unsigned nargs);
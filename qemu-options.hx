@@ -185,6 +185,11 @@ DEF("accel", HAS_ARG, QEMU_OPTION_accel,
     "                one-insn-per-tb=on|off (one guest instruction per TCG translation block)\n"
     "                split-wx=on|off (enable TCG split w^x mapping)\n"
     "                tb-size=n (TCG translation block cache size)\n"
+    "                tb-hugepages=off|on|explicit (back the TCG translation block cache with huge pages)\n"
+    "                tb-numa=on|off (allocate TCG translated code on the local host NUMA node)\n"
+    "                tb-cache=file (persistent TCG translation cache)\n"
+    "                superblock-threshold=n (retranslate hot TBs with their successors)\n"
+    "                bg-translators=n (translate jump targets in n background threads)\n"
     "                dirty-ring-size=n (KVM dirty ring GFN count, default 0)\n"
     "                notify-vmexit=run|internal-error|disable,notify-window=n (enable notify VM exit and set notify window, x86 only)\n"
     "                thread=single|multi (enable multi-threaded TCG)\n", QEMU_ARCH_ALL)
@@ -226,6 +231,50 @@ SRST
     ``tb-size=n``
         Controls the size (in MiB) of the TCG translation block cache.
 
+    ``tb-hugepages=off|on|explicit``
+        Controls the huge pages backing the TCG translation block cache,
+        which reduce the iTLB misses of the host when running a lot of
+        translated code. ``on`` aligns the cache and its regions to the
+        transparent huge page size and drops the guard pages between
+        regions, which would split the huge pages. ``explicit`` also
+        takes the cache from the huge pages reserved with
+        ``vm.nr_hugepages``, and fails if there are not enough of them.
+        ``info jit`` shows how much of the cache is actually backed by
+        huge pages, and ``perf stat -e iTLB-load-misses`` on the QEMU
+        process shows the effect. Neither ``on`` nor ``explicit`` can be
+        combined with ``split-wx=on``. The default is ``off``.
+
+    ``tb-numa=on|off``
+        With ``thread=multi``, splits the TCG translation block cache into
+        one pool per host NUMA node, whose memory is preferably allocated
+        on that node, and makes each vCPU thread take the space for new
+        translations from the pool of the node it is running on. This
+        works best with vCPU threads pinned to host nodes. ``info jit``
+        shows how much of each pool is in use. The default is ``off``.
+
+    ``tb-cache=file``
+        Keeps the optimized TCG ops of the translated code in ``file``
+        and reuses them when a later run translates the same guest code
+        again, which speeds up repeated boots of the same guest. The
+        file is read at startup and rewritten at exit. A file written
+        by a different QEMU binary is ignored. ``info jit`` shows how
+        often the cache was used.
+
+    ``superblock-threshold=n``
+        Makes every TB count its executions.  A TB that runs ``n``
+        times is translated again together with the TBs it most often
+        jumps to on the same guest page, so that the whole chain is
+        optimized as one block.  The default is 0, which disables this.
+        ``tb-cache`` is ignored when this is enabled.
+
+    ``bg-translators=n``
+        Starts ``n`` threads that translate the direct jump targets of
+        newly translated blocks before a vCPU reaches them, so that the
+        vCPU threads spend less time translating. Only targets on the
+        same guest page are translated ahead of time. This requires
+        ``thread=multi``; the default is 0. ``info jit`` shows how many
+        of these translations were used.
+
     ``thread=single|multi``
         Controls number of TCG threads. When the TCG is multi-threaded
         there will be one thread per vCPU therefore taking advantage of
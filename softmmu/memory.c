@@ -514,6 +514,40 @@ static MemTxResult memory_region_write_with_attrs_accessor(MemoryRegion *mr,
     return mr->ops->write_with_attrs(mr->opaque, addr, tmp, size, attrs);
 }
 
+/*
+ * Devices in the middle of an access to one of their lockless regions on
+ * this thread.  Those regions can be entered by several vCPUs at once, so
+ * their re-entrancy guard is kept per thread instead of in the device.
+ */
+typedef struct LocklessIOFrame {
+    DeviceState *dev;
+    struct LocklessIOFrame *prev;
+} LocklessIOFrame;
+
+static __thread LocklessIOFrame *lockless_io_frames;
+
+static bool memory_region_reentered(MemoryRegion *mr)
+{
+    LocklessIOFrame *f;
+
+    for (f = lockless_io_frames; f; f = f->prev) {
+        if (f->dev == mr->dev) {
+            return true;
+        }
+    }
+
+    /*
+     * engaged_in_io is only set under the BQL, by the device's other
+     * regions and by its guarded bottom halves.  A lockless access that
+     * holds the BQL and finds it set was therefore made from within one
+     * of those on this thread.
+     */
+    if (mr->lockless_io && !qemu_mutex_iothread_locked()) {
+        return false;
+    }
+    return mr->dev->mem_reentrancy_guard.engaged_in_io;
+}
+
 static MemTxResult access_with_adjusted_size(hwaddr addr,
                                       uint64_t *value,
                                       unsigned size,
@@ -535,6 +569,7 @@ static MemTxResult access_with_adjusted_size(hwaddr addr,
     unsigned i;
     MemTxResult r = MEMTX_OK;
     bool reentrancy_guard_applied = false;
+    LocklessIOFrame frame;
 
     if (!access_size_min) {
         access_size_min = 1;
@@ -546,13 +581,19 @@ static MemTxResult access_with_adjusted_size(hwaddr addr,
     /* Do not allow more than one simultaneous access to a device's IO Regions */
     if (mr->dev && !mr->disable_reentrancy_guard &&
         !mr->ram_device && !mr->ram && !mr->rom_device && !mr->readonly) {
-        if (mr->dev->mem_reentrancy_guard.engaged_in_io) {
+        if (memory_region_reentered(mr)) {
             warn_report_once("Blocked re-entrant IO on MemoryRegion: "
                              "%s at addr: 0x%" HWADDR_PRIX,
                              memory_region_name(mr), addr);
             return MEMTX_ACCESS_ERROR;
         }
-        mr->dev->mem_reentrancy_guard.engaged_in_io = true;
+        if (mr->lockless_io) {
+            frame.dev = mr->dev;
+            frame.prev = lockless_io_frames;
+            lockless_io_frames = &frame;
+        } else {
+            mr->dev->mem_reentrancy_guard.engaged_in_io = true;
+        }
         reentrancy_guard_applied = true;
     }
 
@@ -571,7 +612,11 @@ static MemTxResult access_with_adjusted_size(hwaddr addr,
         }
     }
     if (mr->dev && reentrancy_guard_applied) {
-        mr->dev->mem_reentrancy_guard.engaged_in_io = false;
+        if (mr->lockless_io) {
+            lockless_io_frames = frame.prev;
+        } else {
+            mr->dev->mem_reentrancy_guard.engaged_in_io = false;
+        }
     }
     return r;
 }
@@ -2539,6 +2584,11 @@ void memory_region_clear_flush_coalesced(MemoryRegion *mr)
     }
 }
 
+void memory_region_enable_lockless_io(MemoryRegion *mr)
+{
+    mr->lockless_io = true;
+}
+
 static bool userspace_eventfd_warning;
 
 void memory_region_add_eventfd(MemoryRegion *mr,
@@ -21,6 +21,7 @@
 #include "qemu/qemu-print.h"
 #include "qemu/ctype.h"
 #include "qemu/log.h"
+#include "qemu/main-loop.h"
 #include "cpu.h"
 #include "cpu_vendorid.h"
 #include "pmu.h"
@@ -794,6 +795,14 @@ static void riscv_cpu_synchronize_from_tb(CPUState *cs,
     }
 }
 
+static uint64_t riscv_cpu_tb_cache_state(CPUState *cs)
+{
+    CPURISCVState *env = &RISCV_CPU(cs)->env;
+
+    /* misa is writable and the privileged spec version is per-cpu. */
+    return deposit64(env->misa_ext, 32, 32, env->priv_ver);
+}
+
 static bool riscv_cpu_has_work(CPUState *cs)
 {
 #ifndef CONFIG_USER_ONLY
@@ -873,6 +882,8 @@ static void riscv_cpu_reset_hold(Object *obj)
     env->pc = env->resetvec;
     env->bins = 0;
     env->two_stage_lookup = false;
+    riscv_cpu_pwc_flush(env);
+    riscv_cpu_reset_asid_slots(env);
 
     env->menvcfg = (cpu->cfg.ext_svpbmt ? MENVCFG_PBMTE : 0) |
                    (cpu->cfg.ext_svadu ? MENVCFG_HADE : 0);
@@ -1554,6 +1565,14 @@ static void riscv_cpu_set_irq(void *opaque, int irq, int level)
             if (kvm_enabled()) {
                 kvm_riscv_set_irq(cpu, irq, level);
             } else {
+                /*
+                 * The IMSIC drives this line without the BQL; only an
+                 * actual change needs it.
+                 */
+                if (qatomic_read(&env->external_seip) == level) {
+                    break;
+                }
+                QEMU_IOTHREAD_LOCK_GUARD();
                 env->external_seip = level;
                 riscv_cpu_update_mip(env, 1 << irq,
                                      BOOL_TO_MASK(level | env->software_seip));
@@ -1574,6 +1593,13 @@ static void riscv_cpu_set_irq(void *opaque, int irq, int level)
             g_assert_not_reached();
         }
 
+        /* Nothing to do, and no BQL needed, if the bit is unchanged */
+        if (!(qatomic_read(&env->hgeip) & ((target_ulong)1 << irq)) ==
+            !level) {
+            return;
+        }
+        QEMU_IOTHREAD_LOCK_GUARD();
+
         /* Update HGEIP CSR */
         env->hgeip &= ~((target_ulong)1 << irq);
         if (level) {
@@ -1598,6 +1624,9 @@ static void riscv_cpu_init(Object *obj)
 #ifndef CONFIG_USER_ONLY
     qdev_init_gpio_in(DEVICE(cpu), riscv_cpu_set_irq,
                       IRQ_LOCAL_MAX + IRQ_LOCAL_GUEST_MAX);
+    object_property_add_uint64_ptr(obj, "x-pmp-subpage-tlb-fills",
+                                   &cpu->env.pmp_state.subpage_tlb_fills,
+                                   OBJ_PROP_FLAG_READ);
 #endif /* CONFIG_USER_ONLY */
 }
 
@@ -1766,6 +1795,7 @@ static Property riscv_cpu_extensions[] = {
     DEFINE_PROP_BOOL("Zve64d", RISCVCPU, cfg.ext_zve64d, false),
     DEFINE_PROP_BOOL("mmu", RISCVCPU, cfg.mmu, true),
     DEFINE_PROP_BOOL("pmp", RISCVCPU, cfg.pmp, true),
+    DEFINE_PROP_BOOL("x-pwc", RISCVCPU, cfg.pwc, true),
     DEFINE_PROP_BOOL("sstc", RISCVCPU, cfg.ext_sstc, true),
 
     DEFINE_PROP_STRING("priv_spec", RISCVCPU, cfg.priv_spec),
@@ -1992,6 +2022,7 @@ static const struct TCGCPUOps riscv_tcg_ops = {
     .initialize = riscv_translate_init,
     .synchronize_from_tb = riscv_cpu_synchronize_from_tb,
     .restore_state_to_opc = riscv_restore_state_to_opc,
+    .tb_cache_state = riscv_cpu_tb_cache_state,
 
 #ifndef CONFIG_USER_ONLY
     .tlb_fill = riscv_cpu_tlb_fill,
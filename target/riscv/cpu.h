@@ -92,6 +92,22 @@ typedef enum {
 
 #define MAX_RISCV_PMPS (16)
 
+/*
+ * Page-walk cache: non-leaf PTEs found by get_physical_address(), so that
+ * a walk can resume at the deepest table already known for an address.
+ */
+#define RISCV_PWC_ENTRIES (64)
+
+typedef struct RISCVPWCEntry {
+    uint64_t tag;       /* address bits above those decoded from 'base' */
+    uint8_t shift;      /* tag is the walked address shifted right by this */
+    target_ulong aux;   /* hgatp for the VS-stage, 0 otherwise */
+    hwaddr root;        /* root table of the walk */
+    hwaddr base;        /* table at 'level' */
+    uint8_t level;      /* 0 if the entry is invalid */
+    uint8_t kind;       /* translation stage and mode */
+} RISCVPWCEntry;
+
 #if !defined(CONFIG_USER_ONLY)
 #include "pmp.h"
 #include "debug.h"
@@ -292,6 +308,23 @@ struct CPUArchState {
     /* PMU event selector configured values for RV32 */
     target_ulong mhpmeventh_val[RV_MAX_MHPMEVENTS];
 
+    /*
+     * Running totals of the events counted by translated code, indexed
+     * by priv | virt_enabled << 2 and by event.  A counter bound to one
+     * of them reads as its mhpmcounter value plus the growth, since the
+     * snapshot in mhpmcounter_prev, of the totals for the modes that it
+     * does not inhibit.
+     */
+    uint64_t pmu_insn_count[8][RISCV_PMU_INSN_EVENTS];
+    /*
+     * Totals for the current mode at which the earliest counter of each
+     * event overflows
+     */
+    uint64_t pmu_insn_deadline[RISCV_PMU_INSN_EVENTS];
+    /* Events to count, indexed by priv | virt_enabled << 2 */
+    uint8_t pmu_insn_events[8];
+    bool pmu_count_exceptions;
+
     target_ulong sscratch;
     target_ulong mscratch;
 
@@ -304,6 +337,18 @@ struct CPUArchState {
     pmp_table_t pmp_state;
     target_ulong mseccfg;
 
+    /* page-walk cache */
+    RISCVPWCEntry pwc[RISCV_PWC_ENTRIES];
+    uint32_t pwc_gen;
+
+    /*
+     * Softmmu TLB partitions of the single-stage S/U modes: the satp value
+     * whose translations each one holds, and the one currently in use.
+     */
+    target_ulong asid_slot_satp[2];
+    uint8_t asid_slot_valid;
+    uint8_t asid_slot;
+
     /* trigger module */
     target_ulong trigger_cur;
     target_ulong tdata1[RV_MAX_TRIGGERS];
@@ -456,7 +501,14 @@ void riscv_cpu_do_transaction_failed(CPUState *cs, hwaddr physaddr,
                                      MemTxResult response, uintptr_t retaddr);
 hwaddr riscv_cpu_get_phys_page_debug(CPUState *cpu, vaddr addr);
 bool riscv_cpu_exec_interrupt(CPUState *cs, int interrupt_request);
+void riscv_cpu_check_unmasked_irq(CPURISCVState *env);
 void riscv_cpu_swap_hypervisor_regs(CPURISCVState *env);
+void riscv_cpu_pwc_flush(CPURISCVState *env);
+void riscv_cpu_pwc_flush_addr(CPURISCVState *env, vaddr addr);
+void riscv_cpu_pwc_flush_all(void);
+void riscv_cpu_set_satp(CPURISCVState *env, target_ulong satp);
+void riscv_cpu_reset_asid_slots(CPURISCVState *env);
+uint16_t riscv_cpu_asid_idxmap(CPURISCVState *env, target_ulong asid);
 int riscv_cpu_claim_interrupts(RISCVCPU *cpu, uint64_t interrupts);
 uint64_t riscv_cpu_update_mip(CPURISCVState *env, uint64_t mask,
                               uint64_t value);
@@ -484,28 +536,32 @@ void riscv_cpu_set_fflags(CPURISCVState *env, target_ulong);
 
 #include "exec/cpu-all.h"
 
-FIELD(TB_FLAGS, MEM_IDX, 0, 3)
-FIELD(TB_FLAGS, FS, 3, 2)
+FIELD(TB_FLAGS, MEM_IDX, 0, 4)
+FIELD(TB_FLAGS, FS, 4, 2)
 /* Vector flags */
-FIELD(TB_FLAGS, VS, 5, 2)
-FIELD(TB_FLAGS, LMUL, 7, 3)
-FIELD(TB_FLAGS, SEW, 10, 3)
-FIELD(TB_FLAGS, VL_EQ_VLMAX, 13, 1)
-FIELD(TB_FLAGS, VILL, 14, 1)
-FIELD(TB_FLAGS, VSTART_EQ_ZERO, 15, 1)
+FIELD(TB_FLAGS, VS, 6, 2)
+FIELD(TB_FLAGS, LMUL, 8, 3)
+FIELD(TB_FLAGS, SEW, 11, 3)
+FIELD(TB_FLAGS, VL_EQ_VLMAX, 14, 1)
+FIELD(TB_FLAGS, VILL, 15, 1)
+FIELD(TB_FLAGS, VSTART_EQ_ZERO, 16, 1)
 /* The combination of MXL/SXL/UXL that applies to the current cpu mode. */
-FIELD(TB_FLAGS, XL, 16, 2)
+FIELD(TB_FLAGS, XL, 17, 2)
 /* If PointerMasking should be applied */
-FIELD(TB_FLAGS, PM_MASK_ENABLED, 18, 1)
-FIELD(TB_FLAGS, PM_BASE_ENABLED, 19, 1)
-FIELD(TB_FLAGS, VTA, 20, 1)
-FIELD(TB_FLAGS, VMA, 21, 1)
+FIELD(TB_FLAGS, PM_MASK_ENABLED, 19, 1)
+FIELD(TB_FLAGS, PM_BASE_ENABLED, 20, 1)
+FIELD(TB_FLAGS, VTA, 21, 1)
+FIELD(TB_FLAGS, VMA, 22, 1)
 /* Native debug itrigger */
-FIELD(TB_FLAGS, ITRIGGER, 22, 1)
+FIELD(TB_FLAGS, ITRIGGER, 23, 1)
 /* Virtual mode enabled */
-FIELD(TB_FLAGS, VIRT_ENABLED, 23, 1)
-FIELD(TB_FLAGS, PRIV, 24, 2)
-FIELD(TB_FLAGS, AXL, 26, 2)
+FIELD(TB_FLAGS, VIRT_ENABLED, 24, 1)
+FIELD(TB_FLAGS, PRIV, 25, 2)
+FIELD(TB_FLAGS, AXL, 27, 2)
+
+/* TB_FLAGS is full; further translation state is kept in cs_base. */
+/* PMU events counted by translated code, a mask of riscv_pmu_insn_event */
+FIELD(TB_CS_BASE, PMU_EVENTS, 0, 4)
 
 #ifdef TARGET_RISCV32
 #define riscv_cpu_mxl(env)  ((void)(env), MXL_RV32)
@@ -700,9 +756,28 @@ enum {
 enum riscv_pmu_event_idx {
     RISCV_PMU_EVENT_HW_CPU_CYCLES = 0x01,
     RISCV_PMU_EVENT_HW_INSTRUCTIONS = 0x02,
+    RISCV_PMU_EVENT_HW_BRANCH_INSTRUCTIONS = 0x05,
     RISCV_PMU_EVENT_CACHE_DTLB_READ_MISS = 0x10019,
     RISCV_PMU_EVENT_CACHE_DTLB_WRITE_MISS = 0x1001B,
     RISCV_PMU_EVENT_CACHE_ITLB_PREFETCH_MISS = 0x10021,
+    /*
+     * Raw events in the encoding of Rocket's event set 0, as used on
+     * Chipyard designs: mhpmevent[7:0] selects the set and each bit above
+     * it selects an instruction class.
+     */
+    RISCV_PMU_EVENT_RAW_EXCEPTION = 0x100,
+    RISCV_PMU_EVENT_RAW_LOAD = 0x200,
+    RISCV_PMU_EVENT_RAW_STORE = 0x400,
+    RISCV_PMU_EVENT_RAW_BRANCH = 0x4000,
+};
+
+/* Events counted inline by translated code into env->pmu_insn_count[] */
+enum riscv_pmu_insn_event {
+    RISCV_PMU_INSN_RETIRED,
+    RISCV_PMU_INSN_LOAD,
+    RISCV_PMU_INSN_STORE,
+    RISCV_PMU_INSN_BRANCH,
+    RISCV_PMU_INSN_EVENTS
 };
 
 /* CSR function table */
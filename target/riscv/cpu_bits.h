@@ -580,6 +580,12 @@ typedef enum {
 #define SSTATUS_SUM         0x00040000 /* since: priv-1.10 */
 #define SSTATUS_MXR         0x00080000
 
+/* mstatus bits visible through sstatus, as of priv-1.10 */
+#define SSTATUS_V1_10_MASK  (SSTATUS_SIE | SSTATUS_SPIE | SSTATUS_UIE | \
+                             SSTATUS_UPIE | SSTATUS_SPP | SSTATUS_FS | \
+                             SSTATUS_XS | SSTATUS_SUM | SSTATUS_MXR | \
+                             SSTATUS_VS)
+
 #define SSTATUS64_UXL       0x0000000300000000ULL
 
 #define SSTATUS32_SD        0x80000000
@@ -125,6 +125,7 @@ struct RISCVCPUConfig {
     uint16_t cboz_blocksize;
     bool mmu;
     bool pmp;
+    bool pwc;
     bool epmp;
     bool debug;
     bool misa_w;
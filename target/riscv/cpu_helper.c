@@ -58,7 +58,13 @@ int riscv_cpu_mmu_index(CPURISCVState *env, bool ifetch)
         }
     }
 
-    return mode | (virt ? MMU_2STAGE_BIT : 0);
+    if (virt) {
+        return mode | MMU_2STAGE_BIT;
+    }
+    if (mode != PRV_M && env->asid_slot) {
+        return mode | MMU_ASID_SLOT_BIT;
+    }
+    return mode;
 #endif
 }
 
@@ -106,6 +112,9 @@ void cpu_get_tb_cpu_state(CPURISCVState *env, vaddr *pc,
     vs = EXT_STATUS_DIRTY;
 #else
     flags = FIELD_DP32(flags, TB_FLAGS, PRIV, env->priv);
+    *cs_base = FIELD_DP64(*cs_base, TB_CS_BASE, PMU_EVENTS,
+                          env->pmu_insn_events[env->priv |
+                                               env->virt_enabled << 2]);
 
     flags |= cpu_mmu_index(env, 0);
     fs = get_field(env->mstatus, MSTATUS_FS);
@@ -476,6 +485,22 @@ bool riscv_cpu_exec_interrupt(CPUState *cs, int interrupt_request)
     return false;
 }
 
+/*
+ * Trap entry and xRET chain straight into the next TB and so skip the
+ * interrupt check in cpu_exec's main loop.  If the new privilege state
+ * unmasks a pending interrupt, request an exit at the start of the next
+ * TB so that it is taken before any instruction there executes.
+ */
+void riscv_cpu_check_unmasked_irq(CPURISCVState *env)
+{
+    CPUState *cs = env_cpu(env);
+
+    if ((qatomic_read(&cs->interrupt_request) & CPU_INTERRUPT_HARD) &&
+        riscv_cpu_local_irq_pending(env) >= 0) {
+        qatomic_set(&cpu_neg(cs)->icount_decr.u16.high, -1);
+    }
+}
+
 /* Return true is floating point support is currently enabled */
 bool riscv_cpu_fp_enabled(CPURISCVState *env)
 {
@@ -589,12 +614,17 @@ void riscv_cpu_set_geilen(CPURISCVState *env, target_ulong geilen)
 /* This function can only be called to set virt when RVH is enabled */
 void riscv_cpu_set_virt_enabled(CPURISCVState *env, bool enable)
 {
+    bool changed = env->virt_enabled != enable;
+
     /* Flush the TLB on all virt mode changes. */
-    if (env->virt_enabled != enable) {
+    if (changed) {
         tlb_flush(env_cpu(env));
     }
 
     env->virt_enabled = enable;
+    if (changed) {
+        riscv_pmu_insn_mode_changed(env);
+    }
 
     if (enable) {
         /*
@@ -634,8 +664,26 @@ uint64_t riscv_cpu_update_mip(CPURISCVState *env, uint64_t mask,
 
     vstip = env->vstime_irq ? MIP_VSTIP : 0;
 
+    /*
+     * Interrupt lines are often re-raised at the level they already have.
+     * Kicking the vCPU then only forces it out of cpu_exec, or wakes it
+     * from wfi to find nothing new, so skip it when neither mip nor the
+     * interrupt request changes.  A zero mask asks for re-evaluation after
+     * a change to hgeip or virt mode and always kicks.
+     *
+     * The check is done before taking the BQL so that devices dispatching
+     * MMIO without it do not serialize on it for no-op updates.  A racing
+     * update is simply ordered after this one.
+     */
+    if (mask && !((old ^ value) & mask) &&
+        !!(old | vsgein | vstip) ==
+        !!(qatomic_read(&cs->interrupt_request) & CPU_INTERRUPT_HARD)) {
+        return old;
+    }
+
     QEMU_IOTHREAD_LOCK_GUARD();
 
+    old = env->mip;
     env->mip = (env->mip & ~mask) | (value & mask);
 
     if (env->mip | vsgein | vstip) {
@@ -670,15 +718,20 @@ void riscv_cpu_set_aia_ireg_rmw_fn(CPURISCVState *env, uint32_t priv,
 
 void riscv_cpu_set_mode(CPURISCVState *env, target_ulong newpriv)
 {
+    bool changed = newpriv != env->priv;
+
     g_assert(newpriv <= PRV_M && newpriv != PRV_RESERVED);
 
-    if (icount_enabled() && newpriv != env->priv) {
+    if (icount_enabled() && changed) {
         riscv_itrigger_update_priv(env);
     }
     /* tlb_flush is unnecessary as mode is contained in mmu_idx */
     env->priv = newpriv;
     env->xl = cpu_recompute_xl(env);
     riscv_cpu_update_mask(env);
+    if (changed) {
+        riscv_pmu_insn_mode_changed(env);
+    }
 
     /*
      * Clear the load reservation - otherwise a reservation placed in one
@@ -727,6 +780,195 @@ static int get_physical_address_pmp(CPURISCVState *env, int *prot, hwaddr addr,
     return TRANSLATE_SUCCESS;
 }
 
+static target_ulong satp_asid(CPURISCVState *env, target_ulong satp)
+{
+    if (riscv_cpu_mxl(env) == MXL_RV32) {
+        return get_field(satp, SATP32_ASID);
+    }
+    return get_field(satp, SATP64_ASID);
+}
+
+/*
+ * Forget which satp each TLB partition belongs to and start over with the
+ * current one, for reset and after migration.
+ */
+void riscv_cpu_reset_asid_slots(CPURISCVState *env)
+{
+    env->asid_slot = 0;
+    env->asid_slot_satp[0] = env->satp;
+    env->asid_slot_valid = 1;
+}
+
+/*
+ * Switch the hart to a new satp, outside of virtualization.  Rather than
+ * flushing the whole TLB, keep the translations of the previous satp in
+ * their own partition: switching back to it, as a context switch between
+ * two address spaces does, then needs no flush at all.  Only the partition
+ * that is being recycled for a new satp is flushed.
+ */
+void riscv_cpu_set_satp(CPURISCVState *env, target_ulong satp)
+{
+    int slot;
+
+    for (slot = 0; slot < RISCV_ASID_SLOTS; slot++) {
+        if ((env->asid_slot_valid & (1 << slot)) &&
+            env->asid_slot_satp[slot] == satp) {
+            break;
+        }
+    }
+
+    if (slot == RISCV_ASID_SLOTS) {
+        /* Recycle the partition not in use */
+        slot = !env->asid_slot;
+        tlb_flush_by_mmuidx(env_cpu(env), riscv_asid_slot_idxmap(slot));
+        env->asid_slot_satp[slot] = satp;
+        env->asid_slot_valid |= 1 << slot;
+    }
+
+    env->asid_slot = slot;
+    env->satp = satp;
+}
+
+/*
+ * The single-stage mmu indexes that may hold translations for @asid, or
+ * for every address space if @asid is -1.
+ */
+uint16_t riscv_cpu_asid_idxmap(CPURISCVState *env, target_ulong asid)
+{
+    uint16_t idxmap = 0;
+    int slot;
+
+    if (asid != (target_ulong)-1) {
+        /* bits of rs2 beyond ASIDLEN are ignored */
+        asid &= satp_asid(env, (target_ulong)-1);
+    }
+
+    for (slot = 0; slot < RISCV_ASID_SLOTS; slot++) {
+        if (asid == (target_ulong)-1 ||
+            ((env->asid_slot_valid & (1 << slot)) &&
+             satp_asid(env, env->asid_slot_satp[slot]) == asid)) {
+            idxmap |= riscv_asid_slot_idxmap(slot);
+        }
+    }
+
+    return idxmap;
+}
+
+/* Bumped to flush the page-walk cache of every hart. */
+static uint32_t riscv_pwc_global_gen;
+
+/*
+ * Forget the non-leaf PTEs cached by get_physical_address().  Like any
+ * hardware page-walk cache this relies on the guest fencing its page
+ * table updates; it is flushed on sfence.vma, hfence.*, PMP changes and
+ * changes to menvcfg/henvcfg.PBMTE.  satp writes keep it: entries are
+ * keyed by root table.
+ */
+void riscv_cpu_pwc_flush(CPURISCVState *env)
+{
+    memset(env->pwc, 0, sizeof(env->pwc));
+}
+
+/*
+ * Forget the cached tables on the walk of @addr, for sfence.vma with an
+ * address.  Entries of any kind that match are dropped; G-stage ones are
+ * keyed by guest physical address and only go when they happen to match.
+ */
+void riscv_cpu_pwc_flush_addr(CPURISCVState *env, vaddr addr)
+{
+    int i;
+
+    for (i = 0; i < RISCV_PWC_ENTRIES; i++) {
+        RISCVPWCEntry *e = &env->pwc[i];
+
+        if (e->level && (uint64_t)addr >> e->shift == e->tag) {
+            e->level = 0;
+        }
+    }
+}
+
+void riscv_cpu_pwc_flush_all(void)
+{
+    qatomic_inc(&riscv_pwc_global_gen);
+}
+
+/*
+ * Kinds of walk, combined with the translation mode (satp.MODE) and the
+ * PTE attributes the walk accepted, so that an entry filled before a
+ * change to menvcfg/henvcfg.PBMTE never hits afterwards.
+ */
+#define PWC_KIND_S      0   /* single stage */
+#define PWC_KIND_VS     1   /* VS-stage of a two-stage translation */
+#define PWC_KIND_G      2   /* G-stage */
+#define PWC_KIND_PBMTE  (1 << 6)
+#define PWC_KIND_NAPOT  (1 << 7)
+
+static inline RISCVPWCEntry *riscv_pwc_entry(CPURISCVState *env,
+                                             uint64_t tag, int level,
+                                             int kind)
+{
+    return &env->pwc[(tag ^ (tag >> 6) ^ (level << 3) ^ kind) &
+                     (RISCV_PWC_ENTRIES - 1)];
+}
+
+static inline int riscv_pwc_shift(int level, int levels, int ptidxbits)
+{
+    return PGSHIFT + (levels - level) * ptidxbits;
+}
+
+static inline uint64_t riscv_pwc_tag(vaddr addr, int level, int levels,
+                                     int ptidxbits)
+{
+    return addr >> riscv_pwc_shift(level, levels, ptidxbits);
+}
+
+/*
+ * Look up the deepest cached table on the walk of @addr.  Returns its
+ * level and sets @base, or returns 0 if the walk must start at the root.
+ */
+static int riscv_pwc_lookup(CPURISCVState *env, int kind, hwaddr root,
+                            target_ulong aux, vaddr addr, int levels,
+                            int ptidxbits, hwaddr *base)
+{
+    uint32_t gen = qatomic_read(&riscv_pwc_global_gen);
+    int level;
+
+    if (unlikely(env->pwc_gen != gen)) {
+        riscv_cpu_pwc_flush(env);
+        env->pwc_gen = gen;
+        return 0;
+    }
+
+    for (level = levels - 1; level > 0; level--) {
+        uint64_t tag = riscv_pwc_tag(addr, level, levels, ptidxbits);
+        RISCVPWCEntry *e = riscv_pwc_entry(env, tag, level, kind);
+
+        if (e->level == level && e->kind == kind && e->tag == tag &&
+            e->root == root && e->aux == aux) {
+            *base = e->base;
+            return level;
+        }
+    }
+
+    return 0;
+}
+
+static void riscv_pwc_fill(CPURISCVState *env, int kind, hwaddr root,
+                           target_ulong aux, vaddr addr, int level,
+                           int levels, int ptidxbits, hwaddr base)
+{
+    uint64_t tag = riscv_pwc_tag(addr, level, levels, ptidxbits);
+    RISCVPWCEntry *e = riscv_pwc_entry(env, tag, level, kind);
+
+    e->tag = tag;
+    e->shift = riscv_pwc_shift(level, levels, ptidxbits);
+    e->aux = aux;
+    e->root = root;
+    e->base = base;
+    e->level = level;
+    e->kind = kind;
+}
+
 /*
  * get_physical_address - get the physical address for this virtual address
  *
@@ -868,7 +1110,14 @@ static int get_physical_address(CPURISCVState *env, hwaddr *physical,
         hade = hade && (env->henvcfg & HENVCFG_HADE);
     }
 
-    int ptshift = (levels - 1) * ptidxbits;
+    bool use_pwc = riscv_cpu_cfg(env)->pwc;
+    int pwc_kind = (two_stage ? (first_stage ? PWC_KIND_VS : PWC_KIND_G)
+                              : PWC_KIND_S) | (vm << 2) |
+                   (pbmte ? PWC_KIND_PBMTE : 0) |
+                   (riscv_cpu_cfg(env)->ext_svnapot ? PWC_KIND_NAPOT : 0);
+    target_ulong pwc_aux = (two_stage && first_stage) ? env->hgatp : 0;
+    hwaddr root = base;
+    int ptshift;
     target_ulong pte;
     hwaddr pte_addr;
     int i;
@@ -876,7 +1125,16 @@ static int get_physical_address(CPURISCVState *env, hwaddr *physical,
 #if !TCG_OVERSIZED_GUEST
 restart:
 #endif
-    for (i = 0; i < levels; i++, ptshift -= ptidxbits) {
+    /* Resume from the deepest table the page-walk cache knows about. */
+    base = root;
+    i = 0;
+    if (use_pwc) {
+        i = riscv_pwc_lookup(env, pwc_kind, root, pwc_aux, addr, levels,
+                             ptidxbits, &base);
+    }
+    ptshift = (levels - 1 - i) * ptidxbits;
+
+    for (; i < levels; i++, ptshift -= ptidxbits) {
         target_ulong idx;
         if (i == 0) {
             idx = (addr >> (PGSHIFT + ptshift)) &
@@ -959,6 +1217,10 @@ restart:
             return TRANSLATE_FAIL;
         }
         base = ppn << PGSHIFT;
+        if (use_pwc && i + 1 < levels) {
+            riscv_pwc_fill(env, pwc_kind, root, pwc_aux, addr, i + 1,
+                           levels, ptidxbits, base);
+        }
     }
 
     /* No leaf pte at any translation level. */
@@ -1613,6 +1875,10 @@ void riscv_cpu_do_interrupt(CPUState *cs)
     }
 
     if (!async) {
+        if (env->pmu_count_exceptions) {
+            riscv_pmu_incr_ctr(cpu, RISCV_PMU_EVENT_RAW_EXCEPTION);
+        }
+
         /* set tval to badaddr for traps with address information */
         switch (cause) {
         case RISCV_EXCP_LOAD_GUEST_ACCESS_FAULT:
@@ -814,6 +814,7 @@ static int write_mhpmevent(CPURISCVState *env, int csrno, target_ulong val)
     int evt_index = csrno - CSR_MCOUNTINHIBIT;
     uint64_t mhpmevt_val = val;
 
+    riscv_pmu_insn_ctrs_stop(env);
     env->mhpmevent_val[evt_index] = val;
 
     if (riscv_cpu_mxl(env) == MXL_RV32) {
@@ -821,6 +822,7 @@ static int write_mhpmevent(CPURISCVState *env, int csrno, target_ulong val)
                       ((uint64_t)env->mhpmeventh_val[evt_index] << 32);
     }
     riscv_pmu_update_event_map(env, mhpmevt_val, evt_index);
+    riscv_pmu_insn_ctrs_start(env);
 
     return RISCV_EXCP_NONE;
 }
@@ -841,9 +843,11 @@ static int write_mhpmeventh(CPURISCVState *env, int csrno, target_ulong val)
     uint64_t mhpmevt_val = env->mhpmevent_val[evt_index];
 
     mhpmevt_val = mhpmevt_val | (mhpmevth_val << 32);
+    riscv_pmu_insn_ctrs_stop(env);
     env->mhpmeventh_val[evt_index] = val;
 
     riscv_pmu_update_event_map(env, mhpmevt_val, evt_index);
+    riscv_pmu_insn_ctrs_start(env);
 
     return RISCV_EXCP_NONE;
 }
@@ -854,6 +858,13 @@ static int write_mhpmcounter(CPURISCVState *env, int csrno, target_ulong val)
     PMUCTRState *counter = &env->pmu_ctrs[ctr_idx];
     uint64_t mhpmctr_val = val;
 
+    if (riscv_pmu_ctr_insn_event(env, ctr_idx) >= 0) {
+        riscv_pmu_insn_ctrs_stop(env);
+        counter->mhpmcounter_val = val;
+        riscv_pmu_insn_ctrs_start(env);
+        return RISCV_EXCP_NONE;
+    }
+
     counter->mhpmcounter_val = val;
     if (riscv_pmu_ctr_monitor_cycles(env, ctr_idx) ||
         riscv_pmu_ctr_monitor_instructions(env, ctr_idx)) {
@@ -880,6 +891,13 @@ static int write_mhpmcounterh(CPURISCVState *env, int csrno, target_ulong val)
     uint64_t mhpmctr_val = counter->mhpmcounter_val;
     uint64_t mhpmctrh_val = val;
 
+    if (riscv_pmu_ctr_insn_event(env, ctr_idx) >= 0) {
+        riscv_pmu_insn_ctrs_stop(env);
+        counter->mhpmcounterh_val = val;
+        riscv_pmu_insn_ctrs_start(env);
+        return RISCV_EXCP_NONE;
+    }
+
     counter->mhpmcounterh_val = val;
     mhpmctr_val = mhpmctr_val | (mhpmctrh_val << 32);
     if (riscv_pmu_ctr_monitor_cycles(env, ctr_idx) ||
@@ -904,6 +922,19 @@ static RISCVException riscv_pmu_read_ctr(CPURISCVState *env, target_ulong *val,
     target_ulong ctr_val = upper_half ? counter.mhpmcounterh_val :
                                         counter.mhpmcounter_val;
 
+    if (riscv_pmu_ctr_insn_event(env, ctr_idx) >= 0) {
+        uint64_t insn_val = riscv_pmu_insn_ctr_read(env, ctr_idx);
+
+        if (upper_half) {
+            *val = insn_val >> 32;
+        } else if (riscv_cpu_mxl(env) == MXL_RV32) {
+            *val = (uint32_t)insn_val;
+        } else {
+            *val = insn_val;
+        }
+        return RISCV_EXCP_NONE;
+    }
+
     if (get_field(env->mcountinhibit, BIT(ctr_idx))) {
         /*
          * Counter should not increment if inhibit bit is set. We can't really
@@ -1159,9 +1190,7 @@ static const target_ulong vs_delegable_excps = DELEGABLE_EXCPS &
       (1ULL << (RISCV_EXCP_LOAD_GUEST_ACCESS_FAULT)) |
       (1ULL << (RISCV_EXCP_VIRT_INSTRUCTION_FAULT)) |
       (1ULL << (RISCV_EXCP_STORE_GUEST_AMO_ACCESS_FAULT)));
-static const target_ulong sstatus_v1_10_mask = SSTATUS_SIE | SSTATUS_SPIE |
-    SSTATUS_UIE | SSTATUS_UPIE | SSTATUS_SPP | SSTATUS_FS | SSTATUS_XS |
-    SSTATUS_SUM | SSTATUS_MXR | SSTATUS_VS;
+static const target_ulong sstatus_v1_10_mask = SSTATUS_V1_10_MASK;
 static const target_ulong sip_writable_mask = SIP_SSIP | MIP_USIP | MIP_UEIP |
                                               SIP_LCOFIP;
 static const target_ulong hip_writable_mask = MIP_VSSIP;
@@ -1835,7 +1864,9 @@ static RISCVException write_mcountinhibit(CPURISCVState *env, int csrno,
     int cidx;
     PMUCTRState *counter;
 
+    riscv_pmu_insn_ctrs_stop(env);
     env->mcountinhibit = val;
+    riscv_pmu_insn_ctrs_start(env);
 
     /* Check if any other counter is also monitoring cycles/instructions */
     for (cidx = 0; cidx < RV_MAX_MHPMCOUNTERS; cidx++) {
@@ -1935,6 +1966,21 @@ static RISCVException write_mtval(CPURISCVState *env, int csrno,
 }
 
 /* Execution environment configuration setup */
+/*
+ * menvcfg.PBMTE and henvcfg.PBMTE decide which PTEs a walk accepts, so
+ * the page-walk cache cannot be kept across a change to them.
+ */
+static void riscv_envcfg_write(CPURISCVState *env, uint64_t *envcfg,
+                               uint64_t mask, uint64_t val)
+{
+    uint64_t old = *envcfg;
+
+    *envcfg = (old & ~mask) | (val & mask);
+    if ((old ^ *envcfg) & MENVCFG_PBMTE) {
+        riscv_cpu_pwc_flush(env);
+    }
+}
+
 static RISCVException read_menvcfg(CPURISCVState *env, int csrno,
                                    target_ulong *val)
 {
@@ -1953,7 +1999,7 @@ static RISCVException write_menvcfg(CPURISCVState *env, int csrno,
                 (cfg->ext_sstc ? MENVCFG_STCE : 0) |
                 (cfg->ext_svadu ? MENVCFG_HADE : 0);
     }
-    env->menvcfg = (env->menvcfg & ~mask) | (val & mask);
+    riscv_envcfg_write(env, &env->menvcfg, mask, val);
 
     return RISCV_EXCP_NONE;
 }
@@ -1974,7 +2020,7 @@ static RISCVException write_menvcfgh(CPURISCVState *env, int csrno,
                     (cfg->ext_svadu ? MENVCFG_HADE : 0);
     uint64_t valh = (uint64_t)val << 32;
 
-    env->menvcfg = (env->menvcfg & ~mask) | (valh & mask);
+    riscv_envcfg_write(env, &env->menvcfg, mask, valh);
 
     return RISCV_EXCP_NONE;
 }
@@ -2043,7 +2089,7 @@ static RISCVException write_henvcfg(CPURISCVState *env, int csrno,
         mask |= env->menvcfg & (HENVCFG_PBMTE | HENVCFG_STCE | HENVCFG_HADE);
     }
 
-    env->henvcfg = (env->henvcfg & ~mask) | (val & mask);
+    riscv_envcfg_write(env, &env->henvcfg, mask, val);
 
     return RISCV_EXCP_NONE;
 }
@@ -2076,7 +2122,7 @@ static RISCVException write_henvcfgh(CPURISCVState *env, int csrno,
         return ret;
     }
 
-    env->henvcfg = (env->henvcfg & ~mask) | (valh & mask);
+    riscv_envcfg_write(env, &env->henvcfg, mask, valh);
     return RISCV_EXCP_NONE;
 }
 
@@ -2740,9 +2786,17 @@ static RISCVException write_satp(CPURISCVState *env, int csrno,
          * pass these through QEMU's TLB emulation as it improves
          * performance.  Flushing the TLB on SATP writes with paging
          * enabled avoids leaking those invalid cached mappings.
+         *
+         * Outside of virtualization the TLB is partitioned by satp value,
+         * so only a partition being recycled needs flushing.  The
+         * page-walk cache is keyed by root table and survives.
          */
-        tlb_flush(env_cpu(env));
-        env->satp = val;
+        if (env->virt_enabled) {
+            tlb_flush(env_cpu(env));
+            env->satp = val;
+        } else {
+            riscv_cpu_set_satp(env, val);
+        }
     }
     return RISCV_EXCP_NONE;
 }
@@ -30,12 +30,31 @@
  *  - U+2STAGE          0b100
  *  - S+2STAGE          0b101
  *  - S+SUM+2STAGE      0b110
+ *
+ * The single-stage U, S and S+SUM modes are further split into two
+ * partitions, selected by MMU_ASID_SLOT_BIT, each caching the
+ * translations of one satp value (see riscv_cpu_set_satp()).
  */
 #define MMUIdx_U            0
 #define MMUIdx_S            1
 #define MMUIdx_S_SUM        2
 #define MMUIdx_M            3
 #define MMU_2STAGE_BIT      (1 << 2)
+#define MMU_ASID_SLOT_BIT   (1 << 3)
+
+#define RISCV_ASID_SLOTS    2
+
+/* helper_tlb_flush_vma() scope */
+#define SFENCE_VMA_ADDR     (1 << 0)
+#define SFENCE_VMA_ASID     (1 << 1)
+
+/* The single-stage S/U mmu indexes of ASID partition @slot */
+static inline uint16_t riscv_asid_slot_idxmap(int slot)
+{
+    uint16_t map = (1 << MMUIdx_U) | (1 << MMUIdx_S) | (1 << MMUIdx_S_SUM);
+
+    return slot ? map << MMU_ASID_SLOT_BIT : map;
+}
 
 static inline int mmuidx_priv(int mmu_idx)
 {
@@ -23,6 +23,7 @@
 #include "migration/cpu.h"
 #include "sysemu/cpu-timers.h"
 #include "debug.h"
+#include "pmu.h"
 
 static bool pmp_needed(void *opaque)
 {
@@ -265,6 +266,9 @@ static int riscv_cpu_post_load(void *opaque, int version_id)
 
     env->xl = cpu_recompute_xl(env);
     riscv_cpu_update_mask(env);
+    riscv_cpu_pwc_flush(env);
+    riscv_cpu_reset_asid_slots(env);
+    riscv_pmu_update_insn_events(env);
     return 0;
 }
 
@@ -316,6 +320,18 @@ static bool pmu_needed(void *opaque)
     return cpu->cfg.pmu_num;
 }
 
+static const VMStateDescription vmstate_pmu_insn = {
+    .name = "cpu/pmu_insn",
+    .version_id = 2,
+    .minimum_version_id = 2,
+    .needed = pmu_needed,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT64_2DARRAY(env.pmu_insn_count, RISCVCPU, 8,
+                               RISCV_PMU_INSN_EVENTS),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
 static const VMStateDescription vmstate_pmu_ctr_state = {
     .name = "cpu/pmu",
     .version_id = 1,
@@ -418,6 +434,7 @@ const VMStateDescription vmstate_riscv_cpu = {
         &vmstate_debug,
         &vmstate_smstateen,
         &vmstate_jvt,
+        &vmstate_pmu_insn,
         NULL
     }
 };
@@ -21,6 +21,7 @@
 #include "qemu/osdep.h"
 #include "cpu.h"
 #include "internals.h"
+#include "pmu.h"
 #include "qemu/main-loop.h"
 #include "exec/exec-all.h"
 #include "exec/helper-proto.h"
@@ -312,6 +313,7 @@ target_ulong helper_sret(CPURISCVState *env)
     }
 
     riscv_cpu_set_mode(env, prev_priv);
+    riscv_cpu_check_unmasked_irq(env);
 
     return retpc;
 }
@@ -356,10 +358,38 @@ target_ulong helper_mret(CPURISCVState *env)
 
         riscv_cpu_set_virt_enabled(env, prev_virt);
     }
+    riscv_cpu_check_unmasked_irq(env);
 
     return retpc;
 }
 
+/*
+ * Take an ECALL trap without unwinding to cpu_exec.  The caller has
+ * stored the pc of the ecall; on return env->pc is the trap vector and
+ * the translator looks up the handler's TB with the new flags.
+ */
+void helper_ecall(CPURISCVState *env)
+{
+    CPUState *cs = env_cpu(env);
+
+    cs->exception_index = RISCV_EXCP_U_ECALL;
+    riscv_cpu_do_interrupt(cs);
+    riscv_cpu_check_unmasked_irq(env);
+}
+
+/*
+ * Called at the start of a TB that counts PMU events once one of the
+ * totals has reached its deadline.  Returns true if LCOFIP was raised, in
+ * which case the TB exits before running any instruction.
+ */
+uint32_t helper_pmu_insn_overflow(CPURISCVState *env)
+{
+    bool raised = riscv_pmu_insn_ctrs_stop(env);
+
+    riscv_pmu_insn_ctrs_start(env);
+    return raised;
+}
+
 void helper_wfi(CPURISCVState *env)
 {
     CPUState *cs = env_cpu(env);
@@ -373,6 +403,12 @@ void helper_wfi(CPURISCVState *env)
     } else if (env->virt_enabled &&
                (prv_u || (prv_s && get_field(env->hstatus, HSTATUS_VTW)))) {
         riscv_raise_exception(env, RISCV_EXCP_VIRT_INSTRUCTION_FAULT, GETPC());
+    } else if (riscv_cpu_all_pending(env)) {
+        /*
+         * cpu_exec would find work at once and resume the hart, so skip
+         * the round trip through it and carry on in translated code.
+         */
+        return;
     } else {
         cs->halted = 1;
         cs->exception_index = EXCP_HLT;
@@ -380,24 +416,68 @@ void helper_wfi(CPURISCVState *env)
     }
 }
 
-void helper_tlb_flush(CPURISCVState *env)
+static void check_sfence_vma(CPURISCVState *env, uintptr_t ra)
 {
-    CPUState *cs = env_cpu(env);
     if (!env->virt_enabled &&
         (env->priv == PRV_U ||
          (env->priv == PRV_S && get_field(env->mstatus, MSTATUS_TVM)))) {
-        riscv_raise_exception(env, RISCV_EXCP_ILLEGAL_INST, GETPC());
+        riscv_raise_exception(env, RISCV_EXCP_ILLEGAL_INST, ra);
     } else if (env->virt_enabled &&
                (env->priv == PRV_U || get_field(env->hstatus, HSTATUS_VTVM))) {
-        riscv_raise_exception(env, RISCV_EXCP_VIRT_INSTRUCTION_FAULT, GETPC());
+        riscv_raise_exception(env, RISCV_EXCP_VIRT_INSTRUCTION_FAULT, ra);
+    }
+}
+
+void helper_tlb_flush(CPURISCVState *env)
+{
+    CPUState *cs = env_cpu(env);
+
+    check_sfence_vma(env, GETPC());
+    riscv_cpu_pwc_flush(env);
+    tlb_flush(cs);
+}
+
+/*
+ * sfence.vma with rs1 and/or rs2 other than x0: flush only the page at
+ * @addr (SFENCE_VMA_ADDR) and/or only the translations of @asid
+ * (SFENCE_VMA_ASID).
+ */
+void helper_tlb_flush_vma(CPURISCVState *env, target_ulong addr,
+                          target_ulong asid, uint32_t scope)
+{
+    CPUState *cs = env_cpu(env);
+    uint16_t idxmap;
+
+    check_sfence_vma(env, GETPC());
+
+    if (env->virt_enabled) {
+        /* VS-stage translations live in the two-stage mmu indexes */
+        idxmap = (1 << (MMUIdx_U | MMU_2STAGE_BIT)) |
+                 (1 << (MMUIdx_S | MMU_2STAGE_BIT)) |
+                 (1 << (MMUIdx_S_SUM | MMU_2STAGE_BIT));
     } else {
-        tlb_flush(cs);
+        idxmap = riscv_cpu_asid_idxmap(env, scope & SFENCE_VMA_ASID ?
+                                            asid : (target_ulong)-1);
+    }
+
+    if (scope & SFENCE_VMA_ADDR) {
+        /* Only the cached tables on the walk of @addr go. */
+        riscv_cpu_pwc_flush_addr(env, addr);
+        if (idxmap) {
+            tlb_flush_page_by_mmuidx(cs, addr, idxmap);
+        }
+    } else {
+        riscv_cpu_pwc_flush(env);
+        if (idxmap) {
+            tlb_flush_by_mmuidx(cs, idxmap);
+        }
     }
 }
 
 void helper_tlb_flush_all(CPURISCVState *env)
 {
     CPUState *cs = env_cpu(env);
+    riscv_cpu_pwc_flush_all();
     tlb_flush_all_cpus_synced(cs);
 }
 
@@ -411,6 +491,7 @@ void helper_hyp_tlb_flush(CPURISCVState *env)
 
     if (env->priv == PRV_M ||
         (env->priv == PRV_S && !env->virt_enabled)) {
+        riscv_cpu_pwc_flush(env);
         tlb_flush(cs);
         return;
     }
@@ -206,21 +206,188 @@ void pmp_update_rule_nums(CPURISCVState *env)
             env->pmp_state.num_rules++;
         }
     }
+
+    pmp_update_rule_index(env);
 }
 
-static int pmp_is_in_range(CPURISCVState *env, int pmp_index,
-                           target_ulong addr)
+/*
+ * Compute the privileges rule pmp_index grants to an access that falls
+ * entirely inside it, for M-mode (m_mode) or for the lower privilege modes.
+ */
+static uint8_t pmp_rule_privs(CPURISCVState *env, int pmp_index, bool m_mode)
 {
-    int result = 0;
+    uint8_t cfg = env->pmp_state.pmp[pmp_index].cfg_reg;
+    uint8_t epmp_operation;
+
+    if (!MSECCFG_MML_ISSET(env)) {
+        /*
+         * If mseccfg.MML Bit is not set, do pmp priv check
+         * This will always apply to regular PMP.
+         */
+        if (!m_mode || pmp_is_locked(env, pmp_index)) {
+            return cfg & (PMP_READ | PMP_WRITE | PMP_EXEC);
+        }
+        return PMP_READ | PMP_WRITE | PMP_EXEC;
+    }
 
-    if ((addr >= env->pmp_state.addr[pmp_index].sa) &&
-        (addr <= env->pmp_state.addr[pmp_index].ea)) {
-        result = 1;
+    /*
+     * If mseccfg.MML Bit set, do the enhanced pmp priv check.
+     * Convert the PMP permissions to match the truth table in the
+     * ePMP spec.
+     */
+    epmp_operation = ((cfg & PMP_LOCK) >> 4) | ((cfg & PMP_READ) << 2) |
+                     (cfg & PMP_WRITE) | ((cfg & PMP_EXEC) >> 2);
+
+    if (m_mode) {
+        switch (epmp_operation) {
+        case 0:
+        case 1:
+        case 4:
+        case 5:
+        case 6:
+        case 7:
+        case 8:
+            return 0;
+        case 2:
+        case 3:
+        case 14:
+            return PMP_READ | PMP_WRITE;
+        case 9:
+        case 10:
+            return PMP_EXEC;
+        case 11:
+        case 13:
+            return PMP_READ | PMP_EXEC;
+        case 12:
+        case 15:
+            return PMP_READ;
+        default:
+            g_assert_not_reached();
+        }
     } else {
-        result = 0;
+        switch (epmp_operation) {
+        case 0:
+        case 8:
+        case 9:
+        case 12:
+        case 13:
+        case 14:
+            return 0;
+        case 1:
+        case 10:
+        case 11:
+            return PMP_EXEC;
+        case 2:
+        case 4:
+        case 15:
+            return PMP_READ;
+        case 3:
+        case 6:
+            return PMP_READ | PMP_WRITE;
+        case 5:
+            return PMP_READ | PMP_EXEC;
+        case 7:
+            return PMP_READ | PMP_WRITE | PMP_EXEC;
+        default:
+            g_assert_not_reached();
+        }
+    }
+}
+
+static int pmp_bound_cmp(const void *a, const void *b)
+{
+    target_ulong x = *(const target_ulong *)a;
+    target_ulong y = *(const target_ulong *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * Rebuild the interval index from the decoded rules.  Must be called
+ * whenever a pmpcfg, pmpaddr or mseccfg write changes the rules or the
+ * privileges they grant.
+ *
+ * Every rule boundary splits the address space, so within one interval
+ * each address is matched by the same set of rules and the lowest
+ * numbered of them decides.
+ */
+void pmp_update_rule_index(CPURISCVState *env)
+{
+    pmp_index_t *idx = &env->pmp_state.index;
+    target_ulong bounds[PMP_MAX_SEGS];
+    int nbounds = 0;
+    int n = 0;
+    int i, j;
+
+    bounds[nbounds++] = 0;
+    for (i = 0; i < MAX_RISCV_PMPS; i++) {
+        if (pmp_get_a_field(env->pmp_state.pmp[i].cfg_reg) ==
+            PMP_AMATCH_OFF) {
+            continue;
+        }
+
+        idx->privs[i][0] = pmp_rule_privs(env, i, false);
+        idx->privs[i][1] = pmp_rule_privs(env, i, true);
+
+        bounds[nbounds++] = env->pmp_state.addr[i].sa;
+        if (env->pmp_state.addr[i].ea != (target_ulong)-1) {
+            bounds[nbounds++] = env->pmp_state.addr[i].ea + 1;
+        }
+    }
+
+    qsort(bounds, nbounds, sizeof(bounds[0]), pmp_bound_cmp);
+
+    for (i = 0; i < nbounds; i++) {
+        uint8_t rule = PMP_NO_RULE;
+
+        if (i > 0 && bounds[i] == bounds[i - 1]) {
+            continue;
+        }
+
+        for (j = 0; j < MAX_RISCV_PMPS; j++) {
+            if (pmp_get_a_field(env->pmp_state.pmp[j].cfg_reg) !=
+                PMP_AMATCH_OFF &&
+                bounds[i] >= env->pmp_state.addr[j].sa &&
+                bounds[i] <= env->pmp_state.addr[j].ea) {
+                rule = j;
+                break;
+            }
+        }
+
+        if (n > 0 && idx->seg_rule[n - 1] == rule) {
+            continue;
+        }
+        idx->seg_sa[n] = bounds[i];
+        idx->seg_rule[n] = rule;
+        n++;
+    }
+
+    idx->num_segs = n;
+    idx->tlb_page = -1;
+
+    /* Cached page-table walks skipped the PMP checks on their PTEs. */
+    riscv_cpu_pwc_flush(env);
+}
+
+/*
+ * Find the interval containing addr.
+ */
+static uint32_t pmp_find_seg(const pmp_index_t *idx, target_ulong addr)
+{
+    uint32_t lo = 0;
+    uint32_t hi = idx->num_segs - 1;
+
+    while (lo < hi) {
+        uint32_t mid = (lo + hi + 1) / 2;
+
+        if (idx->seg_sa[mid] <= addr) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
     }
 
-    return result;
+    return lo;
 }
 
 /*
@@ -290,10 +457,9 @@ bool pmp_hart_has_privs(CPURISCVState *env, target_ulong addr,
                         target_ulong size, pmp_priv_t privs,
                         pmp_priv_t *allowed_privs, target_ulong mode)
 {
-    int i = 0;
+    const pmp_index_t *idx = &env->pmp_state.index;
     int pmp_size = 0;
-    target_ulong s = 0;
-    target_ulong e = 0;
+    uint8_t s_rule, e_rule;
 
     /* Short cut if no rules */
     if (0 == pmp_get_num_rules(env)) {
@@ -316,130 +482,34 @@ bool pmp_hart_has_privs(CPURISCVState *env, target_ulong addr,
 
     /*
      * 1.10 draft priv spec states there is an implicit order
-     * from low to high
+     * from low to high.  The index already resolved that order, so the
+     * highest priority rule touching either end of the access is the one
+     * governing it; if the two ends disagree, that rule covers only one
+     * of them.
      */
-    for (i = 0; i < MAX_RISCV_PMPS; i++) {
-        s = pmp_is_in_range(env, i, addr);
-        e = pmp_is_in_range(env, i, addr + pmp_size - 1);
-
-        /* partially inside */
-        if ((s + e) == 1) {
-            qemu_log_mask(LOG_GUEST_ERROR,
-                          "pmp violation - access is partially inside\n");
-            *allowed_privs = 0;
-            return false;
-        }
-
-        /* fully inside */
-        const uint8_t a_field =
-            pmp_get_a_field(env->pmp_state.pmp[i].cfg_reg);
-
-        /*
-         * Convert the PMP permissions to match the truth table in the
-         * ePMP spec.
-         */
-        const uint8_t epmp_operation =
-            ((env->pmp_state.pmp[i].cfg_reg & PMP_LOCK) >> 4) |
-            ((env->pmp_state.pmp[i].cfg_reg & PMP_READ) << 2) |
-            (env->pmp_state.pmp[i].cfg_reg & PMP_WRITE) |
-            ((env->pmp_state.pmp[i].cfg_reg & PMP_EXEC) >> 2);
-
-        if (((s + e) == 2) && (PMP_AMATCH_OFF != a_field)) {
-            /*
-             * If the PMP entry is not off and the address is in range,
-             * do the priv check
-             */
-            if (!MSECCFG_MML_ISSET(env)) {
-                /*
-                 * If mseccfg.MML Bit is not set, do pmp priv check
-                 * This will always apply to regular PMP.
-                 */
-                *allowed_privs = PMP_READ | PMP_WRITE | PMP_EXEC;
-                if ((mode != PRV_M) || pmp_is_locked(env, i)) {
-                    *allowed_privs &= env->pmp_state.pmp[i].cfg_reg;
-                }
-            } else {
-                /*
-                 * If mseccfg.MML Bit set, do the enhanced pmp priv check
-                 */
-                if (mode == PRV_M) {
-                    switch (epmp_operation) {
-                    case 0:
-                    case 1:
-                    case 4:
-                    case 5:
-                    case 6:
-                    case 7:
-                    case 8:
-                        *allowed_privs = 0;
-                        break;
-                    case 2:
-                    case 3:
-                    case 14:
-                        *allowed_privs = PMP_READ | PMP_WRITE;
-                        break;
-                    case 9:
-                    case 10:
-                        *allowed_privs = PMP_EXEC;
-                        break;
-                    case 11:
-                    case 13:
-                        *allowed_privs = PMP_READ | PMP_EXEC;
-                        break;
-                    case 12:
-                    case 15:
-                        *allowed_privs = PMP_READ;
-                        break;
-                    default:
-                        g_assert_not_reached();
-                    }
-                } else {
-                    switch (epmp_operation) {
-                    case 0:
-                    case 8:
-                    case 9:
-                    case 12:
-                    case 13:
-                    case 14:
-                        *allowed_privs = 0;
-                        break;
-                    case 1:
-                    case 10:
-                    case 11:
-                        *allowed_privs = PMP_EXEC;
-                        break;
-                    case 2:
-                    case 4:
-                    case 15:
-                        *allowed_privs = PMP_READ;
-                        break;
-                    case 3:
-                    case 6:
-                        *allowed_privs = PMP_READ | PMP_WRITE;
-                        break;
-                    case 5:
-                        *allowed_privs = PMP_READ | PMP_EXEC;
-                        break;
-                    case 7:
-                        *allowed_privs = PMP_READ | PMP_WRITE | PMP_EXEC;
-                        break;
-                    default:
-                        g_assert_not_reached();
-                    }
-                }
-            }
+    s_rule = idx->seg_rule[pmp_find_seg(idx, addr)];
+    e_rule = idx->seg_rule[pmp_find_seg(idx, addr + pmp_size - 1)];
 
-            /*
-             * If matching address range was found, the protection bits
-             * defined with PMP must be used. We shouldn't fallback on
-             * finding default privileges.
-             */
-            return (privs & *allowed_privs) == privs;
-        }
+    /* partially inside */
+    if (s_rule != e_rule) {
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "pmp violation - access is partially inside\n");
+        *allowed_privs = 0;
+        return false;
     }
 
     /* No rule matched */
-    return pmp_hart_has_privs_default(env, privs, allowed_privs, mode);
+    if (s_rule == PMP_NO_RULE) {
+        return pmp_hart_has_privs_default(env, privs, allowed_privs, mode);
+    }
+
+    /*
+     * If matching address range was found, the protection bits
+     * defined with PMP must be used. We shouldn't fallback on
+     * finding default privileges.
+     */
+    *allowed_privs = idx->privs[s_rule][mode == PRV_M];
+    return (privs & *allowed_privs) == privs;
 }
 
 /*
@@ -520,6 +590,7 @@ void pmpaddr_csr_write(CPURISCVState *env, uint32_t addr_index,
                 if (is_next_cfg_tor) {
                     pmp_update_rule_addr(env, addr_index + 1);
                 }
+                pmp_update_rule_index(env);
                 tlb_flush(env_cpu(env));
             }
         } else {
@@ -581,6 +652,7 @@ void mseccfg_csr_write(CPURISCVState *env, target_ulong val)
     }
 
     env->mseccfg = val;
+    pmp_update_rule_index(env);
 }
 
 /*
@@ -607,11 +679,10 @@ target_ulong mseccfg_csr_read(CPURISCVState *env)
  */
 target_ulong pmp_get_tlb_size(CPURISCVState *env, target_ulong addr)
 {
-    target_ulong pmp_sa;
-    target_ulong pmp_ea;
+    pmp_index_t *idx = &env->pmp_state.index;
     target_ulong tlb_sa = addr & ~(TARGET_PAGE_SIZE - 1);
     target_ulong tlb_ea = tlb_sa + TARGET_PAGE_SIZE - 1;
-    int i;
+    uint32_t i;
 
     /*
      * If PMP is not supported or there are no PMP rules, the TLB page will not
@@ -622,38 +693,24 @@ target_ulong pmp_get_tlb_size(CPURISCVState *env, target_ulong addr)
         return TARGET_PAGE_SIZE;
     }
 
-    for (i = 0; i < MAX_RISCV_PMPS; i++) {
-        if (pmp_get_a_field(env->pmp_state.pmp[i].cfg_reg) == PMP_AMATCH_OFF) {
-            continue;
-        }
-
-        pmp_sa = env->pmp_state.addr[i].sa;
-        pmp_ea = env->pmp_state.addr[i].ea;
+    /*
+     * Only the first PMP entry that covers (whole or partial of) the TLB
+     * page really matters, and the index already resolved that: the page
+     * may be cached whole if and only if a single interval spans it.
+     */
+    if (idx->tlb_page != tlb_sa) {
+        i = pmp_find_seg(idx, tlb_sa);
+        idx->tlb_page = tlb_sa;
+        idx->tlb_size = (i + 1 < idx->num_segs &&
+                         idx->seg_sa[i + 1] <= tlb_ea) ? 1 : TARGET_PAGE_SIZE;
+    }
 
-        /*
-         * Only the first PMP entry that covers (whole or partial of) the TLB
-         * page really matters:
-         * If it covers the whole TLB page, set the size to TARGET_PAGE_SIZE,
-         * since the following PMP entries have lower priority and will not
-         * affect the permissions of the page.
-         * If it only covers partial of the TLB page, set the size to 1 since
-         * the allowed permissions of the region may be different from other
-         * region of the page.
-         */
-        if (pmp_sa <= tlb_sa && pmp_ea >= tlb_ea) {
-            return TARGET_PAGE_SIZE;
-        } else if ((pmp_sa >= tlb_sa && pmp_sa <= tlb_ea) ||
-                   (pmp_ea >= tlb_sa && pmp_ea <= tlb_ea)) {
-            return 1;
-        }
+    if (idx->tlb_size == 1) {
+        env->pmp_state.subpage_tlb_fills++;
+        trace_pmp_subpage_tlb_fill(env->mhartid, addr);
     }
 
-    /*
-     * If no PMP entry matches the TLB page, the TLB page will also not be
-     * split into regions with different permissions by PMP so we set the size
-     * to TARGET_PAGE_SIZE.
-     */
-    return TARGET_PAGE_SIZE;
+    return idx->tlb_size;
 }
 
 /*
@@ -56,10 +56,33 @@ typedef struct {
     target_ulong ea;
 } pmp_addr_t;
 
+/*
+ * The active rules flattened into disjoint address intervals.  Interval i
+ * covers [seg_sa[i], seg_sa[i + 1] - 1] (the last one runs to the top of the
+ * address space) and is governed by rule seg_rule[i], or by no rule at all
+ * when that is PMP_NO_RULE.  Adjacent intervals never share a rule.
+ */
+#define PMP_MAX_SEGS     (2 * MAX_RISCV_PMPS + 1)
+#define PMP_NO_RULE      0xff
+
+typedef struct {
+    target_ulong seg_sa[PMP_MAX_SEGS];
+    uint8_t seg_rule[PMP_MAX_SEGS];
+    uint32_t num_segs;
+    /* allowed privileges of each rule, indexed by [rule][mode == PRV_M] */
+    uint8_t privs[MAX_RISCV_PMPS][2];
+    /* last pmp_get_tlb_size() answer, tlb_page is -1 when invalid */
+    target_ulong tlb_page;
+    target_ulong tlb_size;
+} pmp_index_t;
+
 typedef struct {
     pmp_entry_t pmp[MAX_RISCV_PMPS];
     pmp_addr_t  addr[MAX_RISCV_PMPS];
     uint32_t num_rules;
+    pmp_index_t index;
+    /* TLB fills that PMP limited to less than a page */
+    uint64_t subpage_tlb_fills;
 } pmp_table_t;
 
 void pmpcfg_csr_write(CPURISCVState *env, uint32_t reg_index,
@@ -79,6 +102,7 @@ bool pmp_hart_has_privs(CPURISCVState *env, target_ulong addr,
 target_ulong pmp_get_tlb_size(CPURISCVState *env, target_ulong addr);
 void pmp_update_rule_addr(CPURISCVState *env, uint32_t pmp_index);
 void pmp_update_rule_nums(CPURISCVState *env);
+void pmp_update_rule_index(CPURISCVState *env);
 uint32_t pmp_get_num_rules(CPURISCVState *env);
 int pmp_priv_to_page_prot(pmp_priv_t pmp_priv);
 
@@ -35,8 +35,16 @@
  */
 void riscv_pmu_generate_fdt_node(void *fdt, int num_ctrs, char *pmu_name)
 {
-    uint32_t fdt_event_ctr_map[15] = {};
+    uint32_t fdt_event_ctr_map[18] = {};
+    uint32_t fdt_raw_event_ctr_map[4 * 5] = {};
+    static const uint32_t raw_events[] = {
+        RISCV_PMU_EVENT_RAW_EXCEPTION,
+        RISCV_PMU_EVENT_RAW_LOAD,
+        RISCV_PMU_EVENT_RAW_STORE,
+        RISCV_PMU_EVENT_RAW_BRANCH,
+    };
     uint32_t cmask;
+    int i;
 
     /* All the programmable counters can map to any event */
     cmask = MAKE_32BIT_MASK(3, num_ctrs);
@@ -77,9 +85,24 @@ void riscv_pmu_generate_fdt_node(void *fdt, int num_ctrs, char *pmu_name)
    fdt_event_ctr_map[13] = cpu_to_be32(0x00010021);
    fdt_event_ctr_map[14] = cpu_to_be32(cmask);
 
+   /* SBI_PMU_HW_BRANCH_INSTRUCTIONS: 0x05 : type(0x00) */
+   fdt_event_ctr_map[15] = cpu_to_be32(0x00000005);
+   fdt_event_ctr_map[16] = cpu_to_be32(0x00000005);
+   fdt_event_ctr_map[17] = cpu_to_be32(cmask);
+
    /* This a OpenSBI specific DT property documented in OpenSBI docs */
    qemu_fdt_setprop(fdt, pmu_name, "riscv,event-to-mhpmcounters",
                     fdt_event_ctr_map, sizeof(fdt_event_ctr_map));
+
+   /* Raw events: 64-bit mhpmevent value, 64-bit match mask, counters */
+   for (i = 0; i < ARRAY_SIZE(raw_events); i++) {
+       fdt_raw_event_ctr_map[i * 5 + 1] = cpu_to_be32(raw_events[i]);
+       fdt_raw_event_ctr_map[i * 5 + 2] = cpu_to_be32(UINT32_MAX);
+       fdt_raw_event_ctr_map[i * 5 + 3] = cpu_to_be32(UINT32_MAX);
+       fdt_raw_event_ctr_map[i * 5 + 4] = cpu_to_be32(cmask);
+   }
+   qemu_fdt_setprop(fdt, pmu_name, "riscv,raw-event-to-mhpmcounters",
+                    fdt_raw_event_ctr_map, sizeof(fdt_raw_event_ctr_map));
 }
 
 static bool riscv_pmu_counter_valid(RISCVCPU *cpu, uint32_t ctr_idx)
@@ -318,6 +341,11 @@ int riscv_pmu_update_event_map(CPURISCVState *env, uint64_t value,
     case RISCV_PMU_EVENT_CACHE_DTLB_READ_MISS:
     case RISCV_PMU_EVENT_CACHE_DTLB_WRITE_MISS:
     case RISCV_PMU_EVENT_CACHE_ITLB_PREFETCH_MISS:
+    case RISCV_PMU_EVENT_HW_BRANCH_INSTRUCTIONS:
+    case RISCV_PMU_EVENT_RAW_EXCEPTION:
+    case RISCV_PMU_EVENT_RAW_LOAD:
+    case RISCV_PMU_EVENT_RAW_STORE:
+    case RISCV_PMU_EVENT_RAW_BRANCH:
         break;
     default:
         /* We don't support any raw events right now */
@@ -339,8 +367,7 @@ static void pmu_timer_trigger_irq(RISCVCPU *cpu,
     uint64_t of_bit_mask;
     int64_t irq_trigger_at;
 
-    if (evt_idx != RISCV_PMU_EVENT_HW_CPU_CYCLES &&
-        evt_idx != RISCV_PMU_EVENT_HW_INSTRUCTIONS) {
+    if (evt_idx != RISCV_PMU_EVENT_HW_CPU_CYCLES) {
         return;
     }
 
@@ -381,9 +408,11 @@ void riscv_pmu_timer_cb(void *priv)
 {
     RISCVCPU *cpu = priv;
 
-    /* Timer event was triggered only for these events */
+    /*
+     * Timer event was triggered only for cycles; programmable instruction
+     * counters overflow from translated code.
+     */
     pmu_timer_trigger_irq(cpu, RISCV_PMU_EVENT_HW_CPU_CYCLES);
-    pmu_timer_trigger_irq(cpu, RISCV_PMU_EVENT_HW_INSTRUCTIONS);
 }
 
 int riscv_pmu_setup_timer(CPURISCVState *env, uint64_t value, uint32_t ctr_idx)
@@ -433,6 +462,237 @@ int riscv_pmu_setup_timer(CPURISCVState *env, uint64_t value, uint32_t ctr_idx)
 }
 
 
+/*
+ * Instructions, loads, stores and branches are counted by translated code
+ * into env->pmu_insn_count[mode][], but only in TBs translated while a
+ * counter is programmed with the event for the current privilege mode (see
+ * TB_CS_BASE.PMU_EVENTS).  Each counter sums the totals of the modes it
+ * does not inhibit, so counters bound to the same event can filter
+ * different modes.
+ *
+ * Overflow is checked at the start of every such TB against
+ * env->pmu_insn_deadline[], in the manner of icount's TB budget, so the
+ * interrupt is raised on the first TB boundary after the counter wraps.
+ * Only the total of the current mode grows, so the deadlines are
+ * recomputed whenever the mode changes.
+ */
+static const uint64_t pmu_mode_inh[8] = {
+    [PRV_U] = MHPMEVENT_BIT_UINH,
+    [PRV_S] = MHPMEVENT_BIT_SINH,
+    [PRV_M] = MHPMEVENT_BIT_MINH,
+    [4 | PRV_U] = MHPMEVENT_BIT_VUINH,
+    [4 | PRV_S] = MHPMEVENT_BIT_VSINH,
+};
+
+static uint64_t pmu_get_mhpmevent(CPURISCVState *env, uint32_t ctr_idx)
+{
+    uint64_t evt = env->mhpmevent_val[ctr_idx];
+
+    if (riscv_cpu_mxl(env) == MXL_RV32) {
+        evt = (uint32_t)evt | ((uint64_t)env->mhpmeventh_val[ctr_idx] << 32);
+    }
+    return evt;
+}
+
+static void pmu_set_of(CPURISCVState *env, uint32_t ctr_idx)
+{
+    if (riscv_cpu_mxl(env) == MXL_RV32) {
+        env->mhpmeventh_val[ctr_idx] |= MHPMEVENTH_BIT_OF;
+    } else {
+        env->mhpmevent_val[ctr_idx] |= MHPMEVENT_BIT_OF;
+    }
+}
+
+static uint64_t pmu_ctr_pair(CPURISCVState *env, target_ulong lo,
+                             target_ulong hi)
+{
+    if (riscv_cpu_mxl(env) == MXL_RV32) {
+        return (uint32_t)lo | ((uint64_t)hi << 32);
+    }
+    return lo;
+}
+
+static void pmu_ctr_split(CPURISCVState *env, uint64_t val,
+                          target_ulong *lo, target_ulong *hi)
+{
+    if (riscv_cpu_mxl(env) == MXL_RV32) {
+        *lo = (uint32_t)val;
+        *hi = val >> 32;
+    } else {
+        *lo = val;
+    }
+}
+
+/* Sum the totals of @event over the modes that counter @ctr_idx counts in */
+static uint64_t pmu_insn_total(CPURISCVState *env, uint32_t ctr_idx,
+                               int event)
+{
+    uint64_t evt = pmu_get_mhpmevent(env, ctr_idx);
+    uint64_t total = 0;
+    int mode;
+
+    for (mode = 0; mode < ARRAY_SIZE(pmu_mode_inh); mode++) {
+        if (pmu_mode_inh[mode] && !(evt & pmu_mode_inh[mode])) {
+            total += env->pmu_insn_count[mode][event];
+        }
+    }
+    return total;
+}
+
+int riscv_pmu_ctr_insn_event(CPURISCVState *env, uint32_t ctr_idx)
+{
+    if (!riscv_pmu_counter_valid(env_archcpu(env), ctr_idx)) {
+        return -1;
+    }
+
+    switch (pmu_get_mhpmevent(env, ctr_idx) & MHPMEVENT_IDX_MASK) {
+    case RISCV_PMU_EVENT_HW_INSTRUCTIONS:
+        return RISCV_PMU_INSN_RETIRED;
+    case RISCV_PMU_EVENT_RAW_LOAD:
+        return RISCV_PMU_INSN_LOAD;
+    case RISCV_PMU_EVENT_RAW_STORE:
+        return RISCV_PMU_INSN_STORE;
+    case RISCV_PMU_EVENT_HW_BRANCH_INSTRUCTIONS:
+    case RISCV_PMU_EVENT_RAW_BRANCH:
+        return RISCV_PMU_INSN_BRANCH;
+    default:
+        return -1;
+    }
+}
+
+uint64_t riscv_pmu_insn_ctr_read(CPURISCVState *env, uint32_t ctr_idx)
+{
+    PMUCTRState *counter = &env->pmu_ctrs[ctr_idx];
+    int event = riscv_pmu_ctr_insn_event(env, ctr_idx);
+    uint64_t base = pmu_ctr_pair(env, counter->mhpmcounter_val,
+                                 counter->mhpmcounterh_val);
+    uint64_t snap = pmu_ctr_pair(env, counter->mhpmcounter_prev,
+                                 counter->mhpmcounterh_prev);
+
+    if (event < 0 || get_field(env->mcountinhibit, BIT(ctr_idx))) {
+        return base;
+    }
+    return base + pmu_insn_total(env, ctr_idx, event) - snap;
+}
+
+/*
+ * Fold the events counted since the last snapshot into the value of each
+ * counter, before the binding, inhibit state or value of any of them
+ * changes.  Returns true if a counter wrapped and LCOFIP was raised.
+ */
+bool riscv_pmu_insn_ctrs_stop(CPURISCVState *env)
+{
+    RISCVCPU *cpu = env_archcpu(env);
+    bool raise = false;
+    uint32_t ctr_idx;
+
+    for (ctr_idx = 3; ctr_idx < RV_MAX_MHPMCOUNTERS; ctr_idx++) {
+        PMUCTRState *counter = &env->pmu_ctrs[ctr_idx];
+        uint64_t base, val;
+
+        if (riscv_pmu_ctr_insn_event(env, ctr_idx) < 0) {
+            continue;
+        }
+
+        base = pmu_ctr_pair(env, counter->mhpmcounter_val,
+                            counter->mhpmcounterh_val);
+        val = riscv_pmu_insn_ctr_read(env, ctr_idx);
+        pmu_ctr_split(env, val, &counter->mhpmcounter_val,
+                      &counter->mhpmcounterh_val);
+
+        /* Generate interrupt only if OF bit is clear */
+        if (val < base &&
+            !(pmu_get_mhpmevent(env, ctr_idx) & MHPMEVENT_BIT_OF)) {
+            pmu_set_of(env, ctr_idx);
+            raise = cpu->cfg.ext_sscofpmf;
+        }
+    }
+
+    if (raise) {
+        riscv_cpu_update_mip(env, MIP_LCOFIP, BOOL_TO_MASK(1));
+    }
+    return raise;
+}
+
+/* Take new snapshots once the change is done and resume counting. */
+void riscv_pmu_insn_ctrs_start(CPURISCVState *env)
+{
+    uint32_t ctr_idx;
+
+    for (ctr_idx = 3; ctr_idx < RV_MAX_MHPMCOUNTERS; ctr_idx++) {
+        PMUCTRState *counter = &env->pmu_ctrs[ctr_idx];
+        int event = riscv_pmu_ctr_insn_event(env, ctr_idx);
+
+        if (event >= 0) {
+            pmu_ctr_split(env, pmu_insn_total(env, ctr_idx, event),
+                          &counter->mhpmcounter_prev,
+                          &counter->mhpmcounterh_prev);
+        }
+    }
+    riscv_pmu_update_insn_events(env);
+}
+
+/* Recompute the events to count in each mode and the overflow deadlines. */
+void riscv_pmu_update_insn_events(CPURISCVState *env)
+{
+    int cur = env->priv | env->virt_enabled << 2;
+    uint32_t ctr_idx;
+    int mode, i;
+
+    memset(env->pmu_insn_events, 0, sizeof(env->pmu_insn_events));
+    for (i = 0; i < RISCV_PMU_INSN_EVENTS; i++) {
+        env->pmu_insn_deadline[i] = UINT64_MAX;
+    }
+    env->pmu_count_exceptions = false;
+
+    for (ctr_idx = 3; ctr_idx < RV_MAX_MHPMCOUNTERS; ctr_idx++) {
+        uint64_t evt = pmu_get_mhpmevent(env, ctr_idx);
+        int event = riscv_pmu_ctr_insn_event(env, ctr_idx);
+        uint64_t val, deadline;
+
+        if (!riscv_pmu_counter_enabled(env_archcpu(env), ctr_idx)) {
+            continue;
+        }
+        if ((evt & MHPMEVENT_IDX_MASK) == RISCV_PMU_EVENT_RAW_EXCEPTION) {
+            env->pmu_count_exceptions = true;
+            continue;
+        }
+        if (event < 0) {
+            continue;
+        }
+
+        for (mode = 0; mode < ARRAY_SIZE(env->pmu_insn_events); mode++) {
+            if (pmu_mode_inh[mode] && !(evt & pmu_mode_inh[mode])) {
+                env->pmu_insn_events[mode] |= BIT(event);
+            }
+        }
+        if (!pmu_mode_inh[cur] || (evt & pmu_mode_inh[cur])) {
+            continue;
+        }
+
+        /* A counter at zero needs 2^64 events to wrap; never in practice */
+        val = riscv_pmu_insn_ctr_read(env, ctr_idx);
+        if (val && !uadd64_overflow(env->pmu_insn_count[cur][event], -val,
+                                    &deadline)) {
+            env->pmu_insn_deadline[event] =
+                MIN(env->pmu_insn_deadline[event], deadline);
+        }
+    }
+}
+
+/* The deadlines are for the current mode; recompute them on a switch. */
+void riscv_pmu_insn_mode_changed(CPURISCVState *env)
+{
+    int mode;
+
+    for (mode = 0; mode < ARRAY_SIZE(env->pmu_insn_events); mode++) {
+        if (env->pmu_insn_events[mode]) {
+            riscv_pmu_update_insn_events(env);
+            return;
+        }
+    }
+}
+
 int riscv_pmu_init(RISCVCPU *cpu, int num_counters)
 {
     if (num_counters > (RV_MAX_MHPMCOUNTERS - 3)) {
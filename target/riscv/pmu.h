@@ -33,3 +33,9 @@ int riscv_pmu_incr_ctr(RISCVCPU *cpu, enum riscv_pmu_event_idx event_idx);
 void riscv_pmu_generate_fdt_node(void *fdt, int num_counters, char *pmu_name);
 int riscv_pmu_setup_timer(CPURISCVState *env, uint64_t value,
                           uint32_t ctr_idx);
+int riscv_pmu_ctr_insn_event(CPURISCVState *env, uint32_t ctr_idx);
+uint64_t riscv_pmu_insn_ctr_read(CPURISCVState *env, uint32_t ctr_idx);
+bool riscv_pmu_insn_ctrs_stop(CPURISCVState *env);
+void riscv_pmu_insn_ctrs_start(CPURISCVState *env);
+void riscv_pmu_update_insn_events(CPURISCVState *env);
+void riscv_pmu_insn_mode_changed(CPURISCVState *env);
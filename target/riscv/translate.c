@@ -111,6 +111,8 @@ typedef struct DisasContext {
     bool pm_base_enabled;
     /* Use icount trigger for native debug */
     bool itrigger;
+    /* PMU events counted by this TB, a mask of riscv_pmu_insn_event */
+    uint8_t pmu_insn_events;
     /* FRM is known to contain a valid value. */
     bool frm_valid;
     /* TCG of the current insn_start */
@@ -1076,7 +1078,7 @@ static uint32_t opcode_at(DisasContextBase *dcbase, target_ulong pc)
     CPUState *cpu = ctx->cs;
     CPURISCVState *env = cpu->env_ptr;
 
-    return cpu_ldl_code(env, pc);
+    return translator_peek_ldl(env, dcbase, pc);
 }
 
 /* Include insn module translation function */
@@ -1116,6 +1118,128 @@ static inline int insn_len(uint16_t first_word)
     return (first_word & 3) == 3 ? 4 : 2;
 }
 
+#ifndef CONFIG_USER_ONLY
+/* Classify ctx->opcode as Rocket's event set 0 does, integer accesses only */
+static uint32_t pmu_insn_class(DisasContext *ctx)
+{
+    uint32_t ev = BIT(RISCV_PMU_INSN_RETIRED);
+    uint32_t op = ctx->opcode;
+    bool rv32 = get_xl(ctx) == MXL_RV32;
+
+    if (ctx->cur_insn_len == 2) {
+        /* quadrant | funct3 << 2 */
+        switch (extract32(op, 0, 2) | extract32(op, 13, 3) << 2) {
+        case 0 | 3 << 2:    /* c.ld, c.flw on RV32 */
+        case 2 | 3 << 2:    /* c.ldsp, c.flwsp on RV32 */
+            if (rv32) {
+                break;
+            }
+            /* fall through */
+        case 0 | 2 << 2:    /* c.lw */
+        case 2 | 2 << 2:    /* c.lwsp */
+            ev |= BIT(RISCV_PMU_INSN_LOAD);
+            break;
+        case 0 | 7 << 2:    /* c.sd, c.fsw on RV32 */
+        case 2 | 7 << 2:    /* c.sdsp, c.fswsp on RV32 */
+            if (rv32) {
+                break;
+            }
+            /* fall through */
+        case 0 | 6 << 2:    /* c.sw */
+        case 2 | 6 << 2:    /* c.swsp */
+            ev |= BIT(RISCV_PMU_INSN_STORE);
+            break;
+        case 1 | 6 << 2:    /* c.beqz */
+        case 1 | 7 << 2:    /* c.bnez */
+            ev |= BIT(RISCV_PMU_INSN_BRANCH);
+            break;
+        }
+    } else {
+        switch (MASK_OP_MAJOR(op)) {
+        case OPC_RISC_LOAD:
+            ev |= BIT(RISCV_PMU_INSN_LOAD);
+            break;
+        case OPC_RISC_STORE:
+            ev |= BIT(RISCV_PMU_INSN_STORE);
+            break;
+        case OPC_RISC_BRANCH:
+            ev |= BIT(RISCV_PMU_INSN_BRANCH);
+            break;
+        }
+    }
+    return ev;
+}
+
+/* The mode of the TB, as it indexes env->pmu_insn_count */
+static int pmu_insn_mode(DisasContext *ctx)
+{
+    return ctx->priv | ctx->virt_enabled << 2;
+}
+
+/*
+ * Count the events of the current instruction.  This happens before it
+ * executes, so an instruction that traps is counted each time it is
+ * attempted.
+ */
+static void gen_pmu_count_insn(DisasContext *ctx)
+{
+    uint32_t events;
+    TCGv_i64 t;
+    int i;
+
+    if (!ctx->pmu_insn_events) {
+        return;
+    }
+    events = ctx->pmu_insn_events & pmu_insn_class(ctx);
+
+    t = tcg_temp_new_i64();
+    for (i = 0; i < RISCV_PMU_INSN_EVENTS; i++) {
+        if (events & BIT(i)) {
+            int ofs = offsetof(CPURISCVState,
+                               pmu_insn_count[pmu_insn_mode(ctx)][i]);
+
+            tcg_gen_ld_i64(t, cpu_env, ofs);
+            tcg_gen_addi_i64(t, t, 1);
+            tcg_gen_st_i64(t, cpu_env, ofs);
+        }
+    }
+}
+
+/*
+ * Like the icount budget check, test at TB entry whether a counted total
+ * has passed the point where a counter wraps, and leave the TB before its
+ * first instruction if that raised LCOFIP.
+ */
+static void gen_pmu_overflow_check(DisasContext *ctx)
+{
+    TCGLabel *over = gen_new_label();
+    TCGLabel *done = gen_new_label();
+    TCGv_i64 count = tcg_temp_new_i64();
+    TCGv_i64 deadline = tcg_temp_new_i64();
+    TCGv_i32 raised = tcg_temp_new_i32();
+    int i;
+
+    for (i = 0; i < RISCV_PMU_INSN_EVENTS; i++) {
+        if (ctx->pmu_insn_events & BIT(i)) {
+            tcg_gen_ld_i64(count, cpu_env,
+                           offsetof(CPURISCVState,
+                                    pmu_insn_count[pmu_insn_mode(ctx)][i]));
+            tcg_gen_ld_i64(deadline, cpu_env,
+                           offsetof(CPURISCVState, pmu_insn_deadline[i]));
+            tcg_gen_brcond_i64(TCG_COND_GEU, count, deadline, over);
+        }
+    }
+    tcg_gen_br(done);
+
+    gen_set_label(over);
+    gen_helper_pmu_insn_overflow(raised, cpu_env);
+    tcg_gen_brcondi_i32(TCG_COND_EQ, raised, 0, done);
+    tcg_gen_exit_tb(ctx->base.tb, TB_EXIT_REQUESTED);
+
+    gen_set_label(done);
+}
+#endif
+
 static void decode_opc(CPURISCVState *env, DisasContext *ctx, uint16_t opcode)
 {
     /*
@@ -1136,6 +1260,9 @@ static void decode_opc(CPURISCVState *env, DisasContext *ctx, uint16_t opcode)
     /* Check for compressed insn */
     if (ctx->cur_insn_len == 2) {
         ctx->opcode = opcode;
+#ifndef CONFIG_USER_ONLY
+        gen_pmu_count_insn(ctx);
+#endif
         /*
          * The Zca extension is added as way to refer to instructions in the C
          * extension that do not include the floating-point loads and stores
@@ -1150,6 +1277,9 @@ static void decode_opc(CPURISCVState *env, DisasContext *ctx, uint16_t opcode)
                              translator_lduw(env, &ctx->base,
                                              ctx->base.pc_next + 2));
         ctx->opcode = opcode32;
+#ifndef CONFIG_USER_ONLY
+        gen_pmu_count_insn(ctx);
+#endif
 
         for (size_t i = 0; i < ARRAY_SIZE(decoders); ++i) {
             if (decoders[i].guard_func(ctx->cfg_ptr) &&
@@ -1194,12 +1324,21 @@ static void riscv_tr_init_disas_context(DisasContextBase *dcbase, CPUState *cs)
     ctx->pm_mask_enabled = FIELD_EX32(tb_flags, TB_FLAGS, PM_MASK_ENABLED);
     ctx->pm_base_enabled = FIELD_EX32(tb_flags, TB_FLAGS, PM_BASE_ENABLED);
     ctx->itrigger = FIELD_EX32(tb_flags, TB_FLAGS, ITRIGGER);
+    ctx->pmu_insn_events = FIELD_EX64(ctx->base.tb->cs_base, TB_CS_BASE,
+                                      PMU_EVENTS);
     ctx->zero = tcg_constant_tl(0);
     ctx->virt_inst_excp = false;
 }
 
 static void riscv_tr_tb_start(DisasContextBase *db, CPUState *cpu)
 {
+#ifndef CONFIG_USER_ONLY
+    DisasContext *ctx = container_of(db, DisasContext, base);
+
+    if (ctx->pmu_insn_events) {
+        gen_pmu_overflow_check(ctx);
+    }
+#endif
 }
 
 static void riscv_tr_insn_start(DisasContextBase *dcbase, CPUState *cpu)
@@ -1233,7 +1372,8 @@ static void riscv_tr_translate_insn(DisasContextBase *dcbase, CPUState *cpu)
             unsigned page_ofs = ctx->base.pc_next & ~TARGET_PAGE_MASK;
 
             if (page_ofs > TARGET_PAGE_SIZE - MAX_INSN_LEN) {
-                uint16_t next_insn = cpu_lduw_code(env, ctx->base.pc_next);
+                uint16_t next_insn = translator_peek_lduw(env, &ctx->base,
+                                                          ctx->base.pc_next);
                 int len = insn_len(next_insn);
 
                 if (!is_same_page(&ctx->base, ctx->base.pc_next + len - 1)) {
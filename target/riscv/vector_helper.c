@@ -376,6 +376,23 @@ vext_ldst_us(void *vd, target_ulong base, CPURISCVState *env, uint32_t desc,
     vext_set_tail_elems_1s(evl, vd, desc, nf, esz, max_elems);
 }
 
+/*
+ * Check the whole range of a unit-stride access that translated code
+ * performs inline, so that it cannot fault once part of it is done.
+ */
+/*
+ * Probe the @len bytes at @base, which are within one page, for the inline
+ * unit-stride copy.  Return whether they are RAM: device memory must see
+ * the element-sized accesses of the helpers instead.
+ */
+uint32_t HELPER(vext_probe_us)(CPURISCVState *env, target_ulong base,
+                               uint32_t len, uint32_t is_store)
+{
+    return probe_access(env, adjust_addr(env, base), len,
+                        is_store ? MMU_DATA_STORE : MMU_DATA_LOAD,
+                        cpu_mmu_index(env, false), GETPC()) != NULL;
+}
+
 /*
  * masked unit-stride load and store operation will be a special case of
  * stride, stride = NF * sizeof (ETYPE)
@@ -776,6 +793,44 @@ static void do_##NAME(void *vd, void *vs1, void *vs2, int i)    \
 #define DO_SUB(N, M) (N - M)
 #define DO_RSUB(N, M) (M - N)
 
+/*
+ * Host SIMD kernels for unmasked operations that start at vstart == 0.
+ * Every body element is active, so whole 16-byte chunks of the register
+ * group can be processed with host vector operations; the remaining
+ * vl % (16 / esz) elements go through the per-element function.
+ * On big-endian hosts the H() element swizzle stays within each 8-byte
+ * word, so element-wise operations on whole chunks need no reordering.
+ */
+#define VEXT_BULK_BYTES 16
+
+typedef int8_t  vext_vec_b __attribute__((vector_size(VEXT_BULK_BYTES)));
+typedef int16_t vext_vec_h __attribute__((vector_size(VEXT_BULK_BYTES)));
+typedef int32_t vext_vec_w __attribute__((vector_size(VEXT_BULK_BYTES)));
+typedef int64_t vext_vec_d __attribute__((vector_size(VEXT_BULK_BYTES)));
+typedef uint8_t  vext_uvec_b __attribute__((vector_size(VEXT_BULK_BYTES)));
+typedef uint16_t vext_uvec_h __attribute__((vector_size(VEXT_BULK_BYTES)));
+typedef uint32_t vext_uvec_w __attribute__((vector_size(VEXT_BULK_BYTES)));
+typedef uint64_t vext_uvec_d __attribute__((vector_size(VEXT_BULK_BYTES)));
+
+/* Number of leading elements covered by whole chunks */
+static inline uint32_t vext_bulk_elems(uint32_t vl, uint32_t esz)
+{
+    return QEMU_ALIGN_DOWN(vl * esz, VEXT_BULK_BYTES) / esz;
+}
+
+typedef void opivv2_bulk_fn(void *vd, void *vs1, void *vs2, uint32_t bytes);
+
+#define OPIVV2_BULK(NAME, VT, OP)                                       \
+static void do_##NAME##_bulk(void *vd, void *vs1, void *vs2,            \
+                             uint32_t bytes)                            \
+{                                                                       \
+    uint32_t i;                                                         \
+                                                                        \
+    for (i = 0; i < bytes; i += sizeof(VT)) {                           \
+        *(VT *)(vd + i) = OP(*(VT *)(vs2 + i), *(VT *)(vs1 + i));       \
+    }                                                                   \
+}
+
 RVVCALL(OPIVV2, vadd_vv_b, OP_SSS_B, H1, H1, H1, DO_ADD)
 RVVCALL(OPIVV2, vadd_vv_h, OP_SSS_H, H2, H2, H2, DO_ADD)
 RVVCALL(OPIVV2, vadd_vv_w, OP_SSS_W, H4, H4, H4, DO_ADD)
@@ -787,16 +842,21 @@ RVVCALL(OPIVV2, vsub_vv_d, OP_SSS_D, H8, H8, H8, DO_SUB)
 
 static void do_vext_vv(void *vd, void *v0, void *vs1, void *vs2,
                        CPURISCVState *env, uint32_t desc,
-                       opivv2_fn *fn, uint32_t esz)
+                       opivv2_fn *fn, opivv2_bulk_fn *bulk, uint32_t esz)
 {
     uint32_t vm = vext_vm(desc);
     uint32_t vl = env->vl;
     uint32_t total_elems = vext_get_total_elems(env, desc, esz);
     uint32_t vta = vext_vta(desc);
     uint32_t vma = vext_vma(desc);
-    uint32_t i;
+    uint32_t i = env->vstart;
 
-    for (i = env->vstart; i < vl; i++) {
+    if (bulk && vm && i == 0) {
+        i = vext_bulk_elems(vl, esz);
+        bulk(vd, vs1, vs2, i * esz);
+    }
+
+    for (; i < vl; i++) {
         if (!vm && !vext_elem_mask(v0, i)) {
             /* set masked-off elements to 1s */
             vext_set_elems_1s(vd, vma, i * esz, (i + 1) * esz);
@@ -816,17 +876,35 @@ void HELPER(NAME)(void *vd, void *v0, void *vs1,          \
                   uint32_t desc)                          \
 {                                                         \
     do_vext_vv(vd, v0, vs1, vs2, env, desc,               \
-               do_##NAME, ESZ);                           \
+               do_##NAME, NULL, ESZ);                     \
 }
 
-GEN_VEXT_VV(vadd_vv_b, 1)
-GEN_VEXT_VV(vadd_vv_h, 2)
-GEN_VEXT_VV(vadd_vv_w, 4)
-GEN_VEXT_VV(vadd_vv_d, 8)
-GEN_VEXT_VV(vsub_vv_b, 1)
-GEN_VEXT_VV(vsub_vv_h, 2)
-GEN_VEXT_VV(vsub_vv_w, 4)
-GEN_VEXT_VV(vsub_vv_d, 8)
+/* as GEN_VEXT_VV, with a do_NAME_bulk kernel for unmasked operation */
+#define GEN_VEXT_VV_BULK(NAME, ESZ)                       \
+void HELPER(NAME)(void *vd, void *v0, void *vs1,          \
+                  void *vs2, CPURISCVState *env,          \
+                  uint32_t desc)                          \
+{                                                         \
+    do_vext_vv(vd, v0, vs1, vs2, env, desc,               \
+               do_##NAME, do_##NAME##_bulk, ESZ);         \
+}
+
+OPIVV2_BULK(vadd_vv_b, vext_vec_b, DO_ADD)
+OPIVV2_BULK(vadd_vv_h, vext_vec_h, DO_ADD)
+OPIVV2_BULK(vadd_vv_w, vext_vec_w, DO_ADD)
+OPIVV2_BULK(vadd_vv_d, vext_vec_d, DO_ADD)
+OPIVV2_BULK(vsub_vv_b, vext_vec_b, DO_SUB)
+OPIVV2_BULK(vsub_vv_h, vext_vec_h, DO_SUB)
+OPIVV2_BULK(vsub_vv_w, vext_vec_w, DO_SUB)
+OPIVV2_BULK(vsub_vv_d, vext_vec_d, DO_SUB)
+GEN_VEXT_VV_BULK(vadd_vv_b, 1)
+GEN_VEXT_VV_BULK(vadd_vv_h, 2)
+GEN_VEXT_VV_BULK(vadd_vv_w, 4)
+GEN_VEXT_VV_BULK(vadd_vv_d, 8)
+GEN_VEXT_VV_BULK(vsub_vv_b, 1)
+GEN_VEXT_VV_BULK(vsub_vv_h, 2)
+GEN_VEXT_VV_BULK(vsub_vv_w, 4)
+GEN_VEXT_VV_BULK(vsub_vv_d, 8)
 
 typedef void opivx2_fn(void *vd, target_long s1, void *vs2, int i);
 
@@ -854,18 +932,39 @@ RVVCALL(OPIVX2, vrsub_vx_h, OP_SSS_H, H2, H2, DO_RSUB)
 RVVCALL(OPIVX2, vrsub_vx_w, OP_SSS_W, H4, H4, DO_RSUB)
 RVVCALL(OPIVX2, vrsub_vx_d, OP_SSS_D, H8, H8, DO_RSUB)
 
+typedef void opivx2_bulk_fn(void *vd, target_long s1, void *vs2,
+                            uint32_t bytes);
+
+#define OPIVX2_BULK(NAME, VT, T1, OP)                                   \
+static void do_##NAME##_bulk(void *vd, target_long s1, void *vs2,       \
+                             uint32_t bytes)                            \
+{                                                                       \
+    VT zero = { 0 };                                                    \
+    VT vs1 = zero + (T1)s1;                                             \
+    uint32_t i;                                                         \
+                                                                        \
+    for (i = 0; i < bytes; i += sizeof(VT)) {                           \
+        *(VT *)(vd + i) = OP(*(VT *)(vs2 + i), vs1);                    \
+    }                                                                   \
+}
+
 static void do_vext_vx(void *vd, void *v0, target_long s1, void *vs2,
                        CPURISCVState *env, uint32_t desc,
-                       opivx2_fn fn, uint32_t esz)
+                       opivx2_fn fn, opivx2_bulk_fn *bulk, uint32_t esz)
 {
     uint32_t vm = vext_vm(desc);
     uint32_t vl = env->vl;
     uint32_t total_elems = vext_get_total_elems(env, desc, esz);
     uint32_t vta = vext_vta(desc);
     uint32_t vma = vext_vma(desc);
-    uint32_t i;
+    uint32_t i = env->vstart;
 
-    for (i = env->vstart; i < vl; i++) {
+    if (bulk && vm && i == 0) {
+        i = vext_bulk_elems(vl, esz);
+        bulk(vd, s1, vs2, i * esz);
+    }
+
+    for (; i < vl; i++) {
         if (!vm && !vext_elem_mask(v0, i)) {
             /* set masked-off elements to 1s */
             vext_set_elems_1s(vd, vma, i * esz, (i + 1) * esz);
@@ -885,21 +984,43 @@ void HELPER(NAME)(void *vd, void *v0, target_ulong s1,    \
                   uint32_t desc)                          \
 {                                                         \
     do_vext_vx(vd, v0, s1, vs2, env, desc,                \
-               do_##NAME, ESZ);                           \
-}
-
-GEN_VEXT_VX(vadd_vx_b, 1)
-GEN_VEXT_VX(vadd_vx_h, 2)
-GEN_VEXT_VX(vadd_vx_w, 4)
-GEN_VEXT_VX(vadd_vx_d, 8)
-GEN_VEXT_VX(vsub_vx_b, 1)
-GEN_VEXT_VX(vsub_vx_h, 2)
-GEN_VEXT_VX(vsub_vx_w, 4)
-GEN_VEXT_VX(vsub_vx_d, 8)
-GEN_VEXT_VX(vrsub_vx_b, 1)
-GEN_VEXT_VX(vrsub_vx_h, 2)
-GEN_VEXT_VX(vrsub_vx_w, 4)
-GEN_VEXT_VX(vrsub_vx_d, 8)
+               do_##NAME, NULL, ESZ);                     \
+}
+
+/* as GEN_VEXT_VX, with a do_NAME_bulk kernel for unmasked operation */
+#define GEN_VEXT_VX_BULK(NAME, ESZ)                       \
+void HELPER(NAME)(void *vd, void *v0, target_ulong s1,    \
+                  void *vs2, CPURISCVState *env,          \
+                  uint32_t desc)                          \
+{                                                         \
+    do_vext_vx(vd, v0, s1, vs2, env, desc,                \
+               do_##NAME, do_##NAME##_bulk, ESZ);         \
+}
+
+OPIVX2_BULK(vadd_vx_b, vext_vec_b, int8_t, DO_ADD)
+OPIVX2_BULK(vadd_vx_h, vext_vec_h, int16_t, DO_ADD)
+OPIVX2_BULK(vadd_vx_w, vext_vec_w, int32_t, DO_ADD)
+OPIVX2_BULK(vadd_vx_d, vext_vec_d, int64_t, DO_ADD)
+OPIVX2_BULK(vsub_vx_b, vext_vec_b, int8_t, DO_SUB)
+OPIVX2_BULK(vsub_vx_h, vext_vec_h, int16_t, DO_SUB)
+OPIVX2_BULK(vsub_vx_w, vext_vec_w, int32_t, DO_SUB)
+OPIVX2_BULK(vsub_vx_d, vext_vec_d, int64_t, DO_SUB)
+OPIVX2_BULK(vrsub_vx_b, vext_vec_b, int8_t, DO_RSUB)
+OPIVX2_BULK(vrsub_vx_h, vext_vec_h, int16_t, DO_RSUB)
+OPIVX2_BULK(vrsub_vx_w, vext_vec_w, int32_t, DO_RSUB)
+OPIVX2_BULK(vrsub_vx_d, vext_vec_d, int64_t, DO_RSUB)
+GEN_VEXT_VX_BULK(vadd_vx_b, 1)
+GEN_VEXT_VX_BULK(vadd_vx_h, 2)
+GEN_VEXT_VX_BULK(vadd_vx_w, 4)
+GEN_VEXT_VX_BULK(vadd_vx_d, 8)
+GEN_VEXT_VX_BULK(vsub_vx_b, 1)
+GEN_VEXT_VX_BULK(vsub_vx_h, 2)
+GEN_VEXT_VX_BULK(vsub_vx_w, 4)
+GEN_VEXT_VX_BULK(vsub_vx_d, 8)
+GEN_VEXT_VX_BULK(vrsub_vx_b, 1)
+GEN_VEXT_VX_BULK(vrsub_vx_h, 2)
+GEN_VEXT_VX_BULK(vrsub_vx_w, 4)
+GEN_VEXT_VX_BULK(vrsub_vx_d, 8)
 
 void HELPER(vec_rsubs8)(void *d, void *a, uint64_t b, uint32_t desc)
 {
@@ -1213,18 +1334,30 @@ RVVCALL(OPIVV2, vxor_vv_b, OP_SSS_B, H1, H1, H1, DO_XOR)
 RVVCALL(OPIVV2, vxor_vv_h, OP_SSS_H, H2, H2, H2, DO_XOR)
 RVVCALL(OPIVV2, vxor_vv_w, OP_SSS_W, H4, H4, H4, DO_XOR)
 RVVCALL(OPIVV2, vxor_vv_d, OP_SSS_D, H8, H8, H8, DO_XOR)
-GEN_VEXT_VV(vand_vv_b, 1)
-GEN_VEXT_VV(vand_vv_h, 2)
-GEN_VEXT_VV(vand_vv_w, 4)
-GEN_VEXT_VV(vand_vv_d, 8)
-GEN_VEXT_VV(vor_vv_b, 1)
-GEN_VEXT_VV(vor_vv_h, 2)
-GEN_VEXT_VV(vor_vv_w, 4)
-GEN_VEXT_VV(vor_vv_d, 8)
-GEN_VEXT_VV(vxor_vv_b, 1)
-GEN_VEXT_VV(vxor_vv_h, 2)
-GEN_VEXT_VV(vxor_vv_w, 4)
-GEN_VEXT_VV(vxor_vv_d, 8)
+OPIVV2_BULK(vand_vv_b, vext_vec_b, DO_AND)
+OPIVV2_BULK(vand_vv_h, vext_vec_h, DO_AND)
+OPIVV2_BULK(vand_vv_w, vext_vec_w, DO_AND)
+OPIVV2_BULK(vand_vv_d, vext_vec_d, DO_AND)
+OPIVV2_BULK(vor_vv_b, vext_vec_b, DO_OR)
+OPIVV2_BULK(vor_vv_h, vext_vec_h, DO_OR)
+OPIVV2_BULK(vor_vv_w, vext_vec_w, DO_OR)
+OPIVV2_BULK(vor_vv_d, vext_vec_d, DO_OR)
+OPIVV2_BULK(vxor_vv_b, vext_vec_b, DO_XOR)
+OPIVV2_BULK(vxor_vv_h, vext_vec_h, DO_XOR)
+OPIVV2_BULK(vxor_vv_w, vext_vec_w, DO_XOR)
+OPIVV2_BULK(vxor_vv_d, vext_vec_d, DO_XOR)
+GEN_VEXT_VV_BULK(vand_vv_b, 1)
+GEN_VEXT_VV_BULK(vand_vv_h, 2)
+GEN_VEXT_VV_BULK(vand_vv_w, 4)
+GEN_VEXT_VV_BULK(vand_vv_d, 8)
+GEN_VEXT_VV_BULK(vor_vv_b, 1)
+GEN_VEXT_VV_BULK(vor_vv_h, 2)
+GEN_VEXT_VV_BULK(vor_vv_w, 4)
+GEN_VEXT_VV_BULK(vor_vv_d, 8)
+GEN_VEXT_VV_BULK(vxor_vv_b, 1)
+GEN_VEXT_VV_BULK(vxor_vv_h, 2)
+GEN_VEXT_VV_BULK(vxor_vv_w, 4)
+GEN_VEXT_VV_BULK(vxor_vv_d, 8)
 
 RVVCALL(OPIVX2, vand_vx_b, OP_SSS_B, H1, H1, DO_AND)
 RVVCALL(OPIVX2, vand_vx_h, OP_SSS_H, H2, H2, DO_AND)
@@ -1238,25 +1371,37 @@ RVVCALL(OPIVX2, vxor_vx_b, OP_SSS_B, H1, H1, DO_XOR)
 RVVCALL(OPIVX2, vxor_vx_h, OP_SSS_H, H2, H2, DO_XOR)
 RVVCALL(OPIVX2, vxor_vx_w, OP_SSS_W, H4, H4, DO_XOR)
 RVVCALL(OPIVX2, vxor_vx_d, OP_SSS_D, H8, H8, DO_XOR)
-GEN_VEXT_VX(vand_vx_b, 1)
-GEN_VEXT_VX(vand_vx_h, 2)
-GEN_VEXT_VX(vand_vx_w, 4)
-GEN_VEXT_VX(vand_vx_d, 8)
-GEN_VEXT_VX(vor_vx_b, 1)
-GEN_VEXT_VX(vor_vx_h, 2)
-GEN_VEXT_VX(vor_vx_w, 4)
-GEN_VEXT_VX(vor_vx_d, 8)
-GEN_VEXT_VX(vxor_vx_b, 1)
-GEN_VEXT_VX(vxor_vx_h, 2)
-GEN_VEXT_VX(vxor_vx_w, 4)
-GEN_VEXT_VX(vxor_vx_d, 8)
+OPIVX2_BULK(vand_vx_b, vext_vec_b, int8_t, DO_AND)
+OPIVX2_BULK(vand_vx_h, vext_vec_h, int16_t, DO_AND)
+OPIVX2_BULK(vand_vx_w, vext_vec_w, int32_t, DO_AND)
+OPIVX2_BULK(vand_vx_d, vext_vec_d, int64_t, DO_AND)
+OPIVX2_BULK(vor_vx_b, vext_vec_b, int8_t, DO_OR)
+OPIVX2_BULK(vor_vx_h, vext_vec_h, int16_t, DO_OR)
+OPIVX2_BULK(vor_vx_w, vext_vec_w, int32_t, DO_OR)
+OPIVX2_BULK(vor_vx_d, vext_vec_d, int64_t, DO_OR)
+OPIVX2_BULK(vxor_vx_b, vext_vec_b, int8_t, DO_XOR)
+OPIVX2_BULK(vxor_vx_h, vext_vec_h, int16_t, DO_XOR)
+OPIVX2_BULK(vxor_vx_w, vext_vec_w, int32_t, DO_XOR)
+OPIVX2_BULK(vxor_vx_d, vext_vec_d, int64_t, DO_XOR)
+GEN_VEXT_VX_BULK(vand_vx_b, 1)
+GEN_VEXT_VX_BULK(vand_vx_h, 2)
+GEN_VEXT_VX_BULK(vand_vx_w, 4)
+GEN_VEXT_VX_BULK(vand_vx_d, 8)
+GEN_VEXT_VX_BULK(vor_vx_b, 1)
+GEN_VEXT_VX_BULK(vor_vx_h, 2)
+GEN_VEXT_VX_BULK(vor_vx_w, 4)
+GEN_VEXT_VX_BULK(vor_vx_d, 8)
+GEN_VEXT_VX_BULK(vxor_vx_b, 1)
+GEN_VEXT_VX_BULK(vxor_vx_h, 2)
+GEN_VEXT_VX_BULK(vxor_vx_w, 4)
+GEN_VEXT_VX_BULK(vxor_vx_d, 8)
 
 /* Vector Single-Width Bit Shift Instructions */
 #define DO_SLL(N, M)  (N << (M))
 #define DO_SRL(N, M)  (N >> (M))
 
 /* generate the helpers for shift instructions with two vector operators */
-#define GEN_VEXT_SHIFT_VV(NAME, TS1, TS2, HS1, HS2, OP, MASK)             \
+#define GEN_VEXT_SHIFT_VV_COMMON(NAME, TS1, TS2, HS1, HS2, OP, MASK, BULK) \
 void HELPER(NAME)(void *vd, void *v0, void *vs1,                          \
                   void *vs2, CPURISCVState *env, uint32_t desc)           \
 {                                                                         \
@@ -1266,9 +1411,15 @@ void HELPER(NAME)(void *vd, void *v0, void *vs1,                          \
     uint32_t total_elems = vext_get_total_elems(env, desc, esz);          \
     uint32_t vta = vext_vta(desc);                                        \
     uint32_t vma = vext_vma(desc);                                        \
-    uint32_t i;                                                           \
+    opivv2_bulk_fn *bulk = BULK;                                          \
+    uint32_t i = env->vstart;                                             \
                                                                           \
-    for (i = env->vstart; i < vl; i++) {                                  \
+    if (bulk && vm && i == 0) {                                           \
+        i = vext_bulk_elems(vl, esz);                                     \
+        bulk(vd, vs1, vs2, i * esz);                                      \
+    }                                                                     \
+                                                                          \
+    for (; i < vl; i++) {                                                 \
         if (!vm && !vext_elem_mask(v0, i)) {                              \
             /* set masked-off elements to 1s */                           \
             vext_set_elems_1s(vd, vma, i * esz, (i + 1) * esz);           \
@@ -1283,25 +1434,55 @@ void HELPER(NAME)(void *vd, void *v0, void *vs1,                          \
     vext_set_elems_1s(vd, vta, vl * esz, total_elems * esz);              \
 }
 
-GEN_VEXT_SHIFT_VV(vsll_vv_b, uint8_t,  uint8_t, H1, H1, DO_SLL, 0x7)
-GEN_VEXT_SHIFT_VV(vsll_vv_h, uint16_t, uint16_t, H2, H2, DO_SLL, 0xf)
-GEN_VEXT_SHIFT_VV(vsll_vv_w, uint32_t, uint32_t, H4, H4, DO_SLL, 0x1f)
-GEN_VEXT_SHIFT_VV(vsll_vv_d, uint64_t, uint64_t, H8, H8, DO_SLL, 0x3f)
-
-GEN_VEXT_SHIFT_VV(vsrl_vv_b, uint8_t, uint8_t, H1, H1, DO_SRL, 0x7)
-GEN_VEXT_SHIFT_VV(vsrl_vv_h, uint16_t, uint16_t, H2, H2, DO_SRL, 0xf)
-GEN_VEXT_SHIFT_VV(vsrl_vv_w, uint32_t, uint32_t, H4, H4, DO_SRL, 0x1f)
-GEN_VEXT_SHIFT_VV(vsrl_vv_d, uint64_t, uint64_t, H8, H8, DO_SRL, 0x3f)
+#define GEN_VEXT_SHIFT_VV(NAME, TS1, TS2, HS1, HS2, OP, MASK)             \
+    GEN_VEXT_SHIFT_VV_COMMON(NAME, TS1, TS2, HS1, HS2, OP, MASK, NULL)
 
-GEN_VEXT_SHIFT_VV(vsra_vv_b, uint8_t,  int8_t, H1, H1, DO_SRL, 0x7)
-GEN_VEXT_SHIFT_VV(vsra_vv_h, uint16_t, int16_t, H2, H2, DO_SRL, 0xf)
-GEN_VEXT_SHIFT_VV(vsra_vv_w, uint32_t, int32_t, H4, H4, DO_SRL, 0x1f)
-GEN_VEXT_SHIFT_VV(vsra_vv_d, uint64_t, int64_t, H8, H8, DO_SRL, 0x3f)
+/* single-width shifts, with a host SIMD kernel for unmasked operation */
+#define GEN_VEXT_SHIFT_VV_BULK(NAME, TS1, TS2, HS1, HS2, VT1, VT2, OP, MASK) \
+static void do_##NAME##_bulk(void *vd, void *vs1, void *vs2,             \
+                             uint32_t bytes)                             \
+{                                                                        \
+    uint32_t i;                                                          \
+                                                                         \
+    for (i = 0; i < bytes; i += sizeof(VT1)) {                           \
+        VT1 s1 = *(VT1 *)(vs1 + i) & MASK;                               \
+        *(VT1 *)(vd + i) = (VT1)OP(*(VT2 *)(vs2 + i), (VT2)s1);          \
+    }                                                                    \
+}                                                                        \
+GEN_VEXT_SHIFT_VV_COMMON(NAME, TS1, TS2, HS1, HS2, OP, MASK,             \
+                         do_##NAME##_bulk)
+
+GEN_VEXT_SHIFT_VV_BULK(vsll_vv_b, uint8_t, uint8_t, H1, H1,
+                       vext_uvec_b, vext_uvec_b, DO_SLL, 0x7)
+GEN_VEXT_SHIFT_VV_BULK(vsll_vv_h, uint16_t, uint16_t, H2, H2,
+                       vext_uvec_h, vext_uvec_h, DO_SLL, 0xf)
+GEN_VEXT_SHIFT_VV_BULK(vsll_vv_w, uint32_t, uint32_t, H4, H4,
+                       vext_uvec_w, vext_uvec_w, DO_SLL, 0x1f)
+GEN_VEXT_SHIFT_VV_BULK(vsll_vv_d, uint64_t, uint64_t, H8, H8,
+                       vext_uvec_d, vext_uvec_d, DO_SLL, 0x3f)
+
+GEN_VEXT_SHIFT_VV_BULK(vsrl_vv_b, uint8_t, uint8_t, H1, H1,
+                       vext_uvec_b, vext_uvec_b, DO_SRL, 0x7)
+GEN_VEXT_SHIFT_VV_BULK(vsrl_vv_h, uint16_t, uint16_t, H2, H2,
+                       vext_uvec_h, vext_uvec_h, DO_SRL, 0xf)
+GEN_VEXT_SHIFT_VV_BULK(vsrl_vv_w, uint32_t, uint32_t, H4, H4,
+                       vext_uvec_w, vext_uvec_w, DO_SRL, 0x1f)
+GEN_VEXT_SHIFT_VV_BULK(vsrl_vv_d, uint64_t, uint64_t, H8, H8,
+                       vext_uvec_d, vext_uvec_d, DO_SRL, 0x3f)
+
+GEN_VEXT_SHIFT_VV_BULK(vsra_vv_b, uint8_t, int8_t, H1, H1,
+                       vext_uvec_b, vext_vec_b, DO_SRL, 0x7)
+GEN_VEXT_SHIFT_VV_BULK(vsra_vv_h, uint16_t, int16_t, H2, H2,
+                       vext_uvec_h, vext_vec_h, DO_SRL, 0xf)
+GEN_VEXT_SHIFT_VV_BULK(vsra_vv_w, uint32_t, int32_t, H4, H4,
+                       vext_uvec_w, vext_vec_w, DO_SRL, 0x1f)
+GEN_VEXT_SHIFT_VV_BULK(vsra_vv_d, uint64_t, int64_t, H8, H8,
+                       vext_uvec_d, vext_vec_d, DO_SRL, 0x3f)
 
 /*
  * generate the helpers for shift instructions with one vector and one scalar
  */
-#define GEN_VEXT_SHIFT_VX(NAME, TD, TS2, HD, HS2, OP, MASK) \
+#define GEN_VEXT_SHIFT_VX_COMMON(NAME, TD, TS2, HD, HS2, OP, MASK, BULK) \
 void HELPER(NAME)(void *vd, void *v0, target_ulong s1,      \
                   void *vs2, CPURISCVState *env,            \
                   uint32_t desc)                            \
@@ -1313,9 +1494,15 @@ void HELPER(NAME)(void *vd, void *v0, target_ulong s1,      \
         vext_get_total_elems(env, desc, esz);               \
     uint32_t vta = vext_vta(desc);                          \
     uint32_t vma = vext_vma(desc);                          \
-    uint32_t i;                                             \
+    opivx2_bulk_fn *bulk = BULK;                            \
+    uint32_t i = env->vstart;                               \
+                                                            \
+    if (bulk && vm && i == 0) {                             \
+        i = vext_bulk_elems(vl, esz);                       \
+        bulk(vd, s1, vs2, i * esz);                         \
+    }                                                       \
                                                             \
-    for (i = env->vstart; i < vl; i++) {                    \
+    for (; i < vl; i++) {                                   \
         if (!vm && !vext_elem_mask(v0, i)) {                \
             /* set masked-off elements to 1s */             \
             vext_set_elems_1s(vd, vma, i * esz,             \
@@ -1330,20 +1517,50 @@ void HELPER(NAME)(void *vd, void *v0, target_ulong s1,      \
     vext_set_elems_1s(vd, vta, vl * esz, total_elems * esz);\
 }
 
-GEN_VEXT_SHIFT_VX(vsll_vx_b, uint8_t, int8_t, H1, H1, DO_SLL, 0x7)
-GEN_VEXT_SHIFT_VX(vsll_vx_h, uint16_t, int16_t, H2, H2, DO_SLL, 0xf)
-GEN_VEXT_SHIFT_VX(vsll_vx_w, uint32_t, int32_t, H4, H4, DO_SLL, 0x1f)
-GEN_VEXT_SHIFT_VX(vsll_vx_d, uint64_t, int64_t, H8, H8, DO_SLL, 0x3f)
-
-GEN_VEXT_SHIFT_VX(vsrl_vx_b, uint8_t, uint8_t, H1, H1, DO_SRL, 0x7)
-GEN_VEXT_SHIFT_VX(vsrl_vx_h, uint16_t, uint16_t, H2, H2, DO_SRL, 0xf)
-GEN_VEXT_SHIFT_VX(vsrl_vx_w, uint32_t, uint32_t, H4, H4, DO_SRL, 0x1f)
-GEN_VEXT_SHIFT_VX(vsrl_vx_d, uint64_t, uint64_t, H8, H8, DO_SRL, 0x3f)
-
-GEN_VEXT_SHIFT_VX(vsra_vx_b, int8_t, int8_t, H1, H1, DO_SRL, 0x7)
-GEN_VEXT_SHIFT_VX(vsra_vx_h, int16_t, int16_t, H2, H2, DO_SRL, 0xf)
-GEN_VEXT_SHIFT_VX(vsra_vx_w, int32_t, int32_t, H4, H4, DO_SRL, 0x1f)
-GEN_VEXT_SHIFT_VX(vsra_vx_d, int64_t, int64_t, H8, H8, DO_SRL, 0x3f)
+#define GEN_VEXT_SHIFT_VX(NAME, TD, TS2, HD, HS2, OP, MASK)  \
+    GEN_VEXT_SHIFT_VX_COMMON(NAME, TD, TS2, HD, HS2, OP, MASK, NULL)
+
+/* single-width shifts, with a host SIMD kernel for unmasked operation */
+#define GEN_VEXT_SHIFT_VX_BULK(NAME, TD, TS2, HD, HS2, VTD, VT2, OP, MASK) \
+static void do_##NAME##_bulk(void *vd, target_long s1, void *vs2,      \
+                             uint32_t bytes)                           \
+{                                                                      \
+    int shift = s1 & MASK;                                             \
+    uint32_t i;                                                        \
+                                                                       \
+    for (i = 0; i < bytes; i += sizeof(VTD)) {                         \
+        *(VTD *)(vd + i) = (VTD)OP(*(VT2 *)(vs2 + i), shift);          \
+    }                                                                  \
+}                                                                      \
+GEN_VEXT_SHIFT_VX_COMMON(NAME, TD, TS2, HD, HS2, OP, MASK,             \
+                         do_##NAME##_bulk)
+
+GEN_VEXT_SHIFT_VX_BULK(vsll_vx_b, uint8_t, int8_t, H1, H1,
+                       vext_uvec_b, vext_vec_b, DO_SLL, 0x7)
+GEN_VEXT_SHIFT_VX_BULK(vsll_vx_h, uint16_t, int16_t, H2, H2,
+                       vext_uvec_h, vext_vec_h, DO_SLL, 0xf)
+GEN_VEXT_SHIFT_VX_BULK(vsll_vx_w, uint32_t, int32_t, H4, H4,
+                       vext_uvec_w, vext_vec_w, DO_SLL, 0x1f)
+GEN_VEXT_SHIFT_VX_BULK(vsll_vx_d, uint64_t, int64_t, H8, H8,
+                       vext_uvec_d, vext_vec_d, DO_SLL, 0x3f)
+
+GEN_VEXT_SHIFT_VX_BULK(vsrl_vx_b, uint8_t, uint8_t, H1, H1,
+                       vext_uvec_b, vext_uvec_b, DO_SRL, 0x7)
+GEN_VEXT_SHIFT_VX_BULK(vsrl_vx_h, uint16_t, uint16_t, H2, H2,
+                       vext_uvec_h, vext_uvec_h, DO_SRL, 0xf)
+GEN_VEXT_SHIFT_VX_BULK(vsrl_vx_w, uint32_t, uint32_t, H4, H4,
+                       vext_uvec_w, vext_uvec_w, DO_SRL, 0x1f)
+GEN_VEXT_SHIFT_VX_BULK(vsrl_vx_d, uint64_t, uint64_t, H8, H8,
+                       vext_uvec_d, vext_uvec_d, DO_SRL, 0x3f)
+
+GEN_VEXT_SHIFT_VX_BULK(vsra_vx_b, int8_t, int8_t, H1, H1,
+                       vext_vec_b, vext_vec_b, DO_SRL, 0x7)
+GEN_VEXT_SHIFT_VX_BULK(vsra_vx_h, int16_t, int16_t, H2, H2,
+                       vext_vec_h, vext_vec_h, DO_SRL, 0xf)
+GEN_VEXT_SHIFT_VX_BULK(vsra_vx_w, int32_t, int32_t, H4, H4,
+                       vext_vec_w, vext_vec_w, DO_SRL, 0x1f)
+GEN_VEXT_SHIFT_VX_BULK(vsra_vx_d, int64_t, int64_t, H8, H8,
+                       vext_vec_d, vext_vec_d, DO_SRL, 0x3f)
 
 /* Vector Narrowing Integer Right Shift Instructions */
 GEN_VEXT_SHIFT_VV(vnsrl_wv_b, uint8_t,  uint16_t, H1, H2, DO_SRL, 0xf)
@@ -1375,9 +1592,24 @@ void HELPER(NAME)(void *vd, void *v0, void *vs1, void *vs2,   \
     uint32_t total_elems = riscv_cpu_cfg(env)->vlen;          \
     uint32_t vta_all_1s = vext_vta_all_1s(desc);              \
     uint32_t vma = vext_vma(desc);                            \
-    uint32_t i;                                               \
+    uint32_t i = env->vstart;                                 \
                                                               \
-    for (i = env->vstart; i < vl; i++) {                      \
+    /* unmasked: fill whole 64-bit words of the mask */       \
+    if (vm && i == 0) {                                       \
+        for (; i + 64 <= vl; i += 64) {                       \
+            uint64_t word = 0;                                \
+            uint32_t j;                                       \
+                                                              \
+            for (j = 0; j < 64; j++) {                        \
+                ETYPE s1 = *((ETYPE *)vs1 + H(i + j));        \
+                ETYPE s2 = *((ETYPE *)vs2 + H(i + j));        \
+                word |= (uint64_t)DO_OP(s2, s1) << j;         \
+            }                                                 \
+            ((uint64_t *)vd)[i / 64] = word;                  \
+        }                                                     \
+    }                                                         \
+                                                              \
+    for (; i < vl; i++) {                                     \
         ETYPE s1 = *((ETYPE *)vs1 + H(i));                    \
         ETYPE s2 = *((ETYPE *)vs2 + H(i));                    \
         if (!vm && !vext_elem_mask(v0, i)) {                  \
@@ -1440,9 +1672,25 @@ void HELPER(NAME)(void *vd, void *v0, target_ulong s1, void *vs2,   \
     uint32_t total_elems = riscv_cpu_cfg(env)->vlen;                \
     uint32_t vta_all_1s = vext_vta_all_1s(desc);                    \
     uint32_t vma = vext_vma(desc);                                  \
-    uint32_t i;                                                     \
+    uint32_t i = env->vstart;                                       \
                                                                     \
-    for (i = env->vstart; i < vl; i++) {                            \
+    /* unmasked: fill whole 64-bit words of the mask */             \
+    if (vm && i == 0) {                                             \
+        ETYPE s1e = (ETYPE)(target_long)s1;                         \
+                                                                    \
+        for (; i + 64 <= vl; i += 64) {                             \
+            uint64_t word = 0;                                      \
+            uint32_t j;                                             \
+                                                                    \
+            for (j = 0; j < 64; j++) {                              \
+                ETYPE s2 = *((ETYPE *)vs2 + H(i + j));              \
+                word |= (uint64_t)DO_OP(s2, s1e) << j;              \
+            }                                                       \
+            ((uint64_t *)vd)[i / 64] = word;                        \
+        }                                                           \
+    }                                                               \
+                                                                    \
+    for (; i < vl; i++) {                                           \
         ETYPE s2 = *((ETYPE *)vs2 + H(i));                          \
         if (!vm && !vext_elem_mask(v0, i)) {                        \
             /* set masked-off elements to 1s */                     \
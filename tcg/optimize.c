@@ -39,6 +39,7 @@
 
 typedef struct TempOptInfo {
     bool is_const;
+    uint32_t version; /* incremented whenever the value changes */
     TCGTemp *prev_copy;
     TCGTemp *next_copy;
     uint64_t val;
@@ -46,6 +47,23 @@ typedef struct TempOptInfo {
     uint64_t s_mask;  /* a left-aligned mask of clrsb(value) bits. */
 } TempOptInfo;
 
+/*
+ * What is known about the env bytes [start, last] within the current
+ * basic block: they hold the value of TS, of type TYPE, as long as TS
+ * still has VERSION; and STORE, if not NULL, wrote them and nothing
+ * has read them since.
+ */
+typedef struct EnvMemInfo {
+    intptr_t start;
+    intptr_t last;
+    TCGTemp *ts;
+    uint32_t version;
+    TCGType type;
+    TCGOp *store;
+} EnvMemInfo;
+
+#define ENV_MEM_SLOTS  32
+
 typedef struct OptContext {
     TCGContext *tcg;
     TCGOp *prev_mb;
@@ -56,6 +74,10 @@ typedef struct OptContext {
     uint64_t z_mask;  /* mask bit is 0 iff value bit is 0 */
     uint64_t s_mask;  /* mask of clrsb(value) bits */
     TCGType type;
+
+    /* Env memory contents, see env_mem_record. */
+    int nb_env_mem;
+    EnvMemInfo env_mem[ENV_MEM_SLOTS];
 } OptContext;
 
 /* Calculate the smask for a specific value. */
@@ -134,6 +156,7 @@ static void reset_ts(TCGTemp *ts)
     ti->next_copy = ts;
     ti->prev_copy = ts;
     ti->is_const = false;
+    ti->version++;
     ti->z_mask = -1;
     ti->s_mask = 0;
 }
@@ -157,11 +180,13 @@ static void init_ts_info(OptContext *ctx, TCGTemp *ts)
     ti = ts->state_ptr;
     if (ti == NULL) {
         ti = tcg_malloc(sizeof(TempOptInfo));
+        ti->version = 0;
         ts->state_ptr = ti;
     }
 
     ti->next_copy = ts;
     ti->prev_copy = ts;
+    ti->version++;
     if (ts->kind == TEMP_CONST) {
         ti->is_const = true;
         ti->val = ts->val;
@@ -294,6 +319,115 @@ static bool tcg_opt_gen_movi(OptContext *ctx, TCGOp *op,
     return tcg_opt_gen_mov(ctx, op, dst, temp_arg(tv));
 }
 
+/*
+ * Env memory tracking.
+ *
+ * Front ends keep much of the guest state in env fields that they
+ * access with ld/st rather than with globals, and often load a field
+ * that was just stored or loaded, or store a field twice in a row.
+ * Within a basic block, remember which temp holds the contents of
+ * each range of env, so that a load of it becomes a move, and which
+ * stores have not been read, so that a store that is overwritten
+ * before a helper call, a guest memory access (which may raise an
+ * exception) or the end of the block can be removed.
+ *
+ * Only non-negative offsets from env are tracked; the fields before
+ * env, such as icount_decr, are written by other threads.
+ */
+
+static bool ldst_is_env(TCGOp *op)
+{
+    return arg_temp(op->args[1]) == tcgv_ptr_temp(cpu_env);
+}
+
+static inline bool env_mem_overlaps(const EnvMemInfo *m,
+                                    intptr_t start, intptr_t last)
+{
+    return m->start <= last && start <= m->last;
+}
+
+static void env_mem_remove(OptContext *ctx, int i)
+{
+    ctx->env_mem[i] = ctx->env_mem[--ctx->nb_env_mem];
+}
+
+/* Forget everything about env memory, e.g. after a helper call. */
+static void env_mem_reset(OptContext *ctx)
+{
+    ctx->nb_env_mem = 0;
+}
+
+/* Env bytes [start, last] may be read: keep the stores to them. */
+static void env_mem_read(OptContext *ctx, intptr_t start, intptr_t last)
+{
+    for (int i = 0; i < ctx->nb_env_mem; i++) {
+        if (env_mem_overlaps(&ctx->env_mem[i], start, last)) {
+            ctx->env_mem[i].store = NULL;
+        }
+    }
+}
+
+/* Any part of env may be read: keep all stores. */
+static void env_mem_read_all(OptContext *ctx)
+{
+    env_mem_read(ctx, INTPTR_MIN, INTPTR_MAX);
+}
+
+/*
+ * Env bytes [start, last] are about to be written.  If @dead, nothing
+ * reads the old contents, so the stores entirely overwritten are
+ * removed.
+ */
+static void env_mem_write(OptContext *ctx, intptr_t start, intptr_t last,
+                          bool dead)
+{
+    for (int i = 0; i < ctx->nb_env_mem; ) {
+        EnvMemInfo *m = &ctx->env_mem[i];
+
+        if (!env_mem_overlaps(m, start, last)) {
+            i++;
+            continue;
+        }
+        if (dead && m->store && start <= m->start && m->last <= last) {
+            tcg_op_remove(ctx->tcg, m->store);
+            ctx->tcg->opt_env_st_removed++;
+        }
+        env_mem_remove(ctx, i);
+    }
+}
+
+static void env_mem_record(OptContext *ctx, intptr_t start, intptr_t last,
+                           TCGTemp *ts, TCGType type, TCGOp *store)
+{
+    EnvMemInfo *m;
+
+    if (ctx->nb_env_mem == ENV_MEM_SLOTS) {
+        env_mem_remove(ctx, 0);
+    }
+    m = &ctx->env_mem[ctx->nb_env_mem++];
+    m->start = start;
+    m->last = last;
+    m->ts = ts;
+    m->version = ts ? ts_info(ts)->version : 0;
+    m->type = type;
+    m->store = store;
+}
+
+/* Return a temp that holds env bytes [start, last] as @type, if any. */
+static TCGTemp *env_mem_find(OptContext *ctx, intptr_t start, intptr_t last,
+                             TCGType type)
+{
+    for (int i = 0; i < ctx->nb_env_mem; i++) {
+        EnvMemInfo *m = &ctx->env_mem[i];
+
+        if (m->ts && m->start == start && m->last == last &&
+            m->type == type && ts_info(m->ts)->version == m->version) {
+            return m->ts;
+        }
+    }
+    return NULL;
+}
+
 static uint64_t do_constant_folding_2(TCGOpcode op, uint64_t x, uint64_t y)
 {
     uint64_t l64, h64;
@@ -694,6 +828,7 @@ static void finish_folding(OptContext *ctx, TCGOp *op)
     if (def->flags & TCG_OPF_BB_END) {
         memset(&ctx->temps_used, 0, sizeof(ctx->temps_used));
         ctx->prev_mb = NULL;
+        env_mem_reset(ctx);
         return;
     }
 
@@ -1223,8 +1358,9 @@ static bool fold_call(OptContext *ctx, TCGOp *op)
         reset_temp(op->args[i]);
     }
 
-    /* Stop optimizing MB across calls. */
+    /* Stop optimizing MB and env memory across calls. */
     ctx->prev_mb = NULL;
+    env_mem_reset(ctx);
     return true;
 }
 
@@ -1721,6 +1857,8 @@ static bool fold_qemu_ld(OptContext *ctx, TCGOp *op)
 
     /* Opcodes that touch guest memory stop the mb optimization.  */
     ctx->prev_mb = NULL;
+    /* They may also raise an exception, which reads env. */
+    env_mem_read_all(ctx);
     return false;
 }
 
@@ -1728,6 +1866,8 @@ static bool fold_qemu_st(OptContext *ctx, TCGOp *op)
 {
     /* Opcodes that touch guest memory stop the mb optimization.  */
     ctx->prev_mb = NULL;
+    /* They may also raise an exception, which reads env. */
+    env_mem_read_all(ctx);
     return false;
 }
 
@@ -1971,9 +2111,46 @@ static bool fold_sub2(OptContext *ctx, TCGOp *op)
     return fold_addsub2(ctx, op, false);
 }
 
+/* Return the number of bytes accessed by a host ld/st opcode. */
+static int tcg_ldst_size(TCGOpcode opc)
+{
+    switch (opc) {
+    CASE_OP_32_64(ld8s):
+    CASE_OP_32_64(ld8u):
+    CASE_OP_32_64(st8):
+        return 1;
+    CASE_OP_32_64(ld16s):
+    CASE_OP_32_64(ld16u):
+    CASE_OP_32_64(st16):
+        return 2;
+    case INDEX_op_ld32s_i64:
+    case INDEX_op_ld32u_i64:
+    case INDEX_op_st32_i64:
+    case INDEX_op_ld_i32:
+    case INDEX_op_st_i32:
+        return 4;
+    case INDEX_op_ld_i64:
+    case INDEX_op_st_i64:
+        return 8;
+    default:
+        g_assert_not_reached();
+    }
+}
+
 static bool fold_tcg_ld(OptContext *ctx, TCGOp *op)
 {
-    /* We can't do any folding with a load, but we can record bits. */
+    intptr_t start = op->args[2];
+    intptr_t last = start + tcg_ldst_size(op->opc) - 1;
+    TCGTemp *dst, *src;
+
+    if (!ldst_is_env(op)) {
+        /* This may read env through another pointer. */
+        env_mem_read_all(ctx);
+    } else if (start >= 0) {
+        ctx->tcg->opt_env_ld++;
+    }
+
+    /* We can't do any folding with a partial load, but we can record bits. */
     switch (op->opc) {
     CASE_OP_32_64(ld8s):
         ctx->s_mask = MAKE_64BIT_MASK(8, 56);
@@ -1996,9 +2173,87 @@ static bool fold_tcg_ld(OptContext *ctx, TCGOp *op)
         ctx->z_mask = MAKE_64BIT_MASK(0, 32);
         ctx->s_mask = MAKE_64BIT_MASK(33, 31);
         break;
+    case INDEX_op_ld_i32:
+    case INDEX_op_ld_i64:
+        if (!ldst_is_env(op) || start < 0) {
+            break;
+        }
+        /* Forward the value last stored or loaded. */
+        src = env_mem_find(ctx, start, last, ctx->type);
+        if (src) {
+            ctx->tcg->opt_env_ld_removed++;
+            return tcg_opt_gen_mov(ctx, op, op->args[0], temp_arg(src));
+        }
+        env_mem_read(ctx, start, last);
+
+        /* The destination now holds these bytes. */
+        dst = arg_temp(op->args[0]);
+        reset_ts(dst);
+        env_mem_record(ctx, start, last, dst, ctx->type, NULL);
+        return true;
     default:
         g_assert_not_reached();
     }
+
+    if (ldst_is_env(op) && start >= 0) {
+        env_mem_read(ctx, start, last);
+    }
+    return false;
+}
+
+static bool fold_tcg_ld_vec(OptContext *ctx, TCGOp *op)
+{
+    intptr_t start = op->args[2];
+    intptr_t size;
+
+    if (!ldst_is_env(op)) {
+        env_mem_read_all(ctx);
+        return false;
+    }
+    if (op->opc == INDEX_op_dupm_vec) {
+        size = 1 << TCGOP_VECE(op);
+    } else {
+        size = 8 << TCGOP_VECL(op);
+    }
+    env_mem_read(ctx, start, start + size - 1);
+    return false;
+}
+
+static bool fold_tcg_st(OptContext *ctx, TCGOp *op)
+{
+    int size = tcg_ldst_size(op->opc);
+    intptr_t start = op->args[2];
+    intptr_t last = start + size - 1;
+    TCGTemp *src = arg_temp(op->args[0]);
+
+    if (!ldst_is_env(op)) {
+        /* This may write env through another pointer. */
+        env_mem_reset(ctx);
+        return false;
+    }
+    if (start < 0) {
+        return false;
+    }
+
+    ctx->tcg->opt_env_st++;
+    env_mem_write(ctx, start, last, true);
+    if (size == tcg_type_size(ctx->type)) {
+        env_mem_record(ctx, start, last, src, ctx->type, op);
+    } else {
+        env_mem_record(ctx, start, last, NULL, ctx->type, op);
+    }
+    return false;
+}
+
+static bool fold_tcg_st_vec(OptContext *ctx, TCGOp *op)
+{
+    intptr_t start = op->args[2];
+
+    if (!ldst_is_env(op)) {
+        env_mem_reset(ctx);
+        return false;
+    }
+    env_mem_write(ctx, start, start + (8 << TCGOP_VECL(op)) - 1, false);
     return false;
 }
 
@@ -2144,8 +2399,13 @@ void tcg_optimize(TCGContext *s)
         CASE_OP_32_64(ld16u):
         case INDEX_op_ld32s_i64:
         case INDEX_op_ld32u_i64:
+        CASE_OP_32_64(ld):
             done = fold_tcg_ld(&ctx, op);
             break;
+        case INDEX_op_ld_vec:
+        case INDEX_op_dupm_vec:
+            done = fold_tcg_ld_vec(&ctx, op);
+            break;
         case INDEX_op_mb:
             done = fold_mb(&ctx, op);
             break;
@@ -2222,6 +2482,15 @@ void tcg_optimize(TCGContext *s)
         CASE_OP_32_64(sextract):
             done = fold_sextract(&ctx, op);
             break;
+        CASE_OP_32_64(st8):
+        CASE_OP_32_64(st16):
+        case INDEX_op_st32_i64:
+        CASE_OP_32_64(st):
+            done = fold_tcg_st(&ctx, op);
+            break;
+        case INDEX_op_st_vec:
+            done = fold_tcg_st_vec(&ctx, op);
+            break;
         CASE_OP_32_64(sub):
             done = fold_sub(&ctx, op);
             break;
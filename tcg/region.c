@@ -29,11 +29,19 @@
 #include "qemu/memalign.h"
 #include "qemu/cacheinfo.h"
 #include "qemu/qtree.h"
+#include "qemu/bitops.h"
+#include "qemu/cutils.h"
+#include "qemu/error-report.h"
 #include "qapi/error.h"
 #include "tcg/tcg.h"
 #include "exec/translation-block.h"
 #include "tcg-internal.h"
 
+#ifdef CONFIG_NUMA
+#include <numa.h>
+#include <numaif.h>
+#endif
+
 
 struct tcg_region_tree {
     QemuMutex lock;
@@ -46,7 +54,20 @@ struct tcg_region_tree {
  * dynamically allocate from as demand dictates. Given appropriate region
  * sizing, this minimizes flushes even when some TCG threads generate a lot
  * more code than others.
+ *
+ * With -accel tcg,tb-numa=on the regions are further split into one pool
+ * per host NUMA node, whose memory is bound to the node, and a thread
+ * takes its regions from the pool of the node it runs on.
  */
+#define TCG_REGION_MAX_NODES 64
+
+struct tcg_region_pool {
+    size_t first; /* first region of the pool */
+    size_t end; /* one past its last region */
+    size_t current; /* next free region, protected by region.lock */
+    int node; /* host NUMA node, or -1 */
+};
+
 struct tcg_region_state {
     QemuMutex lock;
 
@@ -57,9 +78,12 @@ struct tcg_region_state {
     size_t size; /* size of one region */
     size_t stride; /* .size + guard size */
     size_t total_size; /* size of entire buffer, >= n * stride */
+    TCGHugePages hugepages;
+    size_t hugepage_size;
+    size_t n_pools;
+    struct tcg_region_pool pools[TCG_REGION_MAX_NODES];
 
     /* fields protected by the lock */
-    size_t current; /* current region index */
     size_t agg_size_full; /* aggregate size of full regions */
 };
 
@@ -334,14 +358,40 @@ static void tcg_region_assign(TCGContext *s, size_t curr_region)
     s->code_gen_highwater = end - TCG_HIGHWATER;
 }
 
+/* Return the pool for the host NUMA node that the caller runs on. */
+static unsigned int tcg_region_current_pool(void)
+{
+#if defined(CONFIG_NUMA) && defined(CONFIG_SCHED_GETCPU)
+    if (region.n_pools > 1) {
+        int cpu = sched_getcpu();
+        int node = cpu < 0 ? -1 : numa_node_of_cpu(cpu);
+        size_t i;
+
+        for (i = 0; i < region.n_pools; i++) {
+            if (region.pools[i].node == node) {
+                return i;
+            }
+        }
+    }
+#endif
+    return 0;
+}
+
 static bool tcg_region_alloc__locked(TCGContext *s)
 {
-    if (region.current == region.n) {
-        return true;
+    size_t i;
+
+    /* Once the pool of the context is empty, use the other ones. */
+    for (i = 0; i < region.n_pools; i++) {
+        struct tcg_region_pool *p =
+            &region.pools[(s->region_pool + i) % region.n_pools];
+
+        if (p->current < p->end) {
+            tcg_region_assign(s, p->current++);
+            return false;
+        }
     }
-    tcg_region_assign(s, region.current);
-    region.current++;
-    return false;
+    return true;
 }
 
 /*
@@ -354,6 +404,7 @@ bool tcg_region_alloc(TCGContext *s)
     /* read the region size now; alloc__locked will overwrite it on success */
     size_t size_full = s->code_gen_buffer_size;
 
+    s->region_pool = tcg_region_current_pool();
     qemu_mutex_lock(&region.lock);
     err = tcg_region_alloc__locked(s);
     if (!err) {
@@ -375,6 +426,7 @@ static void tcg_region_initial_alloc__locked(TCGContext *s)
 
 void tcg_region_initial_alloc(TCGContext *s)
 {
+    s->region_pool = tcg_region_current_pool();
     qemu_mutex_lock(&region.lock);
     tcg_region_initial_alloc__locked(s);
     qemu_mutex_unlock(&region.lock);
@@ -387,7 +439,9 @@ void tcg_region_reset_all(void)
     unsigned int i;
 
     qemu_mutex_lock(&region.lock);
-    region.current = 0;
+    for (i = 0; i < region.n_pools; i++) {
+        region.pools[i].current = region.pools[i].first;
+    }
     region.agg_size_full = 0;
 
     for (i = 0; i < n_ctxs; i++) {
@@ -485,6 +539,10 @@ static int alloc_code_gen_buffer(size_t tb_size, int splitwx, Error **errp)
         error_setg(errp, "jit split-wx not supported");
         return -1;
     }
+    if (region.hugepages == TCG_HUGEPAGES_EXPLICIT) {
+        error_setg(errp, "jit explicit huge pages not supported");
+        return -1;
+    }
 
     /* page-align the beginning and end of the buffer */
     buf = static_code_gen_buffer;
@@ -521,6 +579,10 @@ static int alloc_code_gen_buffer(size_t size, int splitwx, Error **errp)
         error_setg(errp, "jit split-wx not supported");
         return -1;
     }
+    if (region.hugepages == TCG_HUGEPAGES_EXPLICIT) {
+        error_setg(errp, "jit explicit huge pages not supported");
+        return -1;
+    }
 
     buf = VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT,
                              PAGE_EXECUTE_READWRITE);
@@ -553,6 +615,34 @@ static int alloc_code_gen_buffer_anon(size_t size, int prot,
     return prot;
 }
 
+/*
+ * Like alloc_code_gen_buffer_anon, but align the buffer to the huge
+ * page size so that transparent huge pages can back all of it.
+ */
+static int alloc_code_gen_buffer_aligned(size_t size, int prot,
+                                         int flags, Error **errp)
+{
+    size_t align = region.hugepage_size;
+    void *buf, *start;
+
+    buf = mmap(NULL, size + align, prot, flags, -1, 0);
+    if (buf == MAP_FAILED) {
+        error_setg_errno(errp, errno,
+                         "allocate %zu bytes for jit buffer", size);
+        return -1;
+    }
+
+    start = QEMU_ALIGN_PTR_UP(buf, align);
+    if (start > buf) {
+        munmap(buf, start - buf);
+    }
+    munmap(start + size, buf + align - start);
+
+    region.start_aligned = start;
+    region.total_size = size;
+    return prot;
+}
+
 #ifndef CONFIG_TCG_INTERPRETER
 #ifdef CONFIG_POSIX
 #include "qemu/memfd.h"
@@ -674,6 +764,38 @@ static int alloc_code_gen_buffer(size_t size, int splitwx, Error **errp)
     ERRP_GUARD();
     int prot, flags;
 
+    if (region.hugepages == TCG_HUGEPAGES_EXPLICIT) {
+#ifdef MAP_HUGETLB
+        /* The pages come from the pool reserved with vm.nr_hugepages. */
+        if (splitwx > 0) {
+            error_setg(errp, "jit split-wx not supported with explicit "
+                       "huge pages");
+            return -1;
+        }
+        flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB;
+#ifdef MAP_HUGE_SHIFT
+        /* Ask for the page size the buffer was sized for. */
+        flags |= ctz64(region.hugepage_size) << MAP_HUGE_SHIFT;
+#endif
+        return alloc_code_gen_buffer_anon(size, PROT_NONE, flags, errp);
+#else
+        error_setg(errp, "jit explicit huge pages not supported");
+        return -1;
+#endif
+    }
+
+    if (splitwx && region.hugepages == TCG_HUGEPAGES_ON) {
+        /*
+         * The split mappings are not aligned to the huge page size, yet
+         * tcg_region_init would still drop the guard pages for them.
+         */
+        if (splitwx > 0) {
+            error_setg(errp, "jit split-wx not supported with huge pages");
+            return -1;
+        }
+        splitwx = 0;
+    }
+
     if (splitwx) {
         prot = alloc_code_gen_buffer_splitwx(size, errp);
         if (prot >= 0) {
@@ -704,10 +826,100 @@ static int alloc_code_gen_buffer(size_t size, int splitwx, Error **errp)
     }
 #endif
 
+    if (region.hugepages == TCG_HUGEPAGES_ON) {
+        return alloc_code_gen_buffer_aligned(size, prot, flags, errp);
+    }
     return alloc_code_gen_buffer_anon(size, prot, flags, errp);
 }
 #endif /* USE_STATIC_CODE_GEN_BUFFER, WIN32, POSIX */
 
+/*
+ * Return the size of the huge pages that may back the buffer: the default
+ * hugetlbfs page size for explicit huge pages, the PMD size for THP.
+ */
+static size_t tcg_hugepage_size(TCGHugePages hugepages)
+{
+#ifdef CONFIG_LINUX
+    g_autofree char *buf = NULL;
+    const char *end;
+    uint64_t size;
+
+    if (hugepages == TCG_HUGEPAGES_EXPLICIT) {
+        const char *line;
+
+        if (g_file_get_contents("/proc/meminfo", &buf, NULL, NULL) &&
+            (line = strstr(buf, "Hugepagesize:")) &&
+            !qemu_strtou64(line + strlen("Hugepagesize:"), &end, 10,
+                           &size) &&
+            is_power_of_2(size)) {
+            return size * KiB;
+        }
+        return QEMU_VMALLOC_ALIGN;
+    }
+
+    if (g_file_get_contents("/sys/kernel/mm/transparent_hugepage/"
+                            "hpage_pmd_size", &buf, NULL, NULL) &&
+        !qemu_strtou64(buf, &end, 10, &size) && is_power_of_2(size)) {
+        return size;
+    }
+#endif
+    return QEMU_VMALLOC_ALIGN;
+}
+
+#ifdef CONFIG_NUMA
+/*
+ * Split the regions into one pool per host NUMA node that we may
+ * allocate from, and prefer the memory of each node for its pool.
+ */
+static void tcg_region_numa_init(void)
+{
+    int nodes[TCG_REGION_MAX_NODES];
+    size_t n_nodes = 0, per_pool, i;
+    int node;
+
+    if (numa_available() < 0) {
+        return;
+    }
+    for (node = 0; node <= numa_max_node() && node < TCG_REGION_MAX_NODES;
+         node++) {
+        if (numa_bitmask_isbitset(numa_all_nodes_ptr, node)) {
+            nodes[n_nodes++] = node;
+        }
+    }
+    if (n_nodes < 2 || region.n < n_nodes) {
+        return;
+    }
+
+    per_pool = region.n / n_nodes;
+    for (i = 0; i < n_nodes; i++) {
+        struct tcg_region_pool *p = &region.pools[i];
+        unsigned long mask[BITS_TO_LONGS(TCG_REGION_MAX_NODES + 1)] = { };
+        void *start, *end;
+
+        p->first = i * per_pool;
+        p->end = i == n_nodes - 1 ? region.n : p->first + per_pool;
+        p->current = p->first;
+        p->node = nodes[i];
+
+        start = region.start_aligned + p->first * region.stride;
+        if (i == n_nodes - 1) {
+            end = region.start_aligned + region.total_size;
+        } else {
+            end = region.start_aligned + p->end * region.stride;
+        }
+
+        /* Preferred rather than bound: a full node must not fail the JIT. */
+        set_bit(p->node, mask);
+        if (mbind(start, end - start, MPOL_PREFERRED, mask,
+                  TCG_REGION_MAX_NODES + 1, 0)) {
+            warn_report("tb-numa: cannot bind jit buffer to node %d: %s",
+                        p->node, strerror(errno));
+        }
+    }
+    region.n_pools = n_nodes;
+}
+#endif
+
 /*
  * Initializes region partitioning.
  *
@@ -736,12 +948,16 @@ static int alloc_code_gen_buffer(size_t size, int splitwx, Error **errp)
  * in practice. Multi-threaded guests share most if not all of their translated
  * code, which makes parallel code generation less appealing than in softmmu.
  */
-void tcg_region_init(size_t tb_size, int splitwx, unsigned max_cpus)
+void tcg_region_init(size_t tb_size, int splitwx, TCGHugePages hugepages,
+                     bool numa, unsigned max_cpus)
 {
     const size_t page_size = qemu_real_host_page_size();
     size_t region_size;
     int have_prot, need_prot;
 
+    region.hugepages = hugepages;
+    region.hugepage_size = MAX(tcg_hugepage_size(hugepages), page_size);
+
     /* Size the buffer.  */
     if (tb_size == 0) {
         size_t phys_mem = qemu_get_host_physmem();
@@ -758,6 +974,11 @@ void tcg_region_init(size_t tb_size, int splitwx, unsigned max_cpus)
     if (tb_size > MAX_CODE_GEN_BUFFER_SIZE) {
         tb_size = MAX_CODE_GEN_BUFFER_SIZE;
     }
+    if (hugepages != TCG_HUGEPAGES_OFF) {
+        /* Whole huge pages only; MAP_HUGETLB requires it. */
+        tb_size = MAX(QEMU_ALIGN_DOWN(tb_size, region.hugepage_size),
+                      region.hugepage_size);
+    }
 
     have_prot = alloc_code_gen_buffer(tb_size, splitwx, &error_fatal);
     assert(have_prot >= 0);
@@ -776,7 +997,13 @@ void tcg_region_init(size_t tb_size, int splitwx, unsigned max_cpus)
      */
     region.n = tcg_n_regions(tb_size, max_cpus);
     region_size = tb_size / region.n;
-    region_size = QEMU_ALIGN_DOWN(region_size, page_size);
+    if (hugepages != TCG_HUGEPAGES_OFF &&
+        region_size >= region.hugepage_size) {
+        /* Keep huge pages from straddling regions, and thus NUMA nodes. */
+        region_size = QEMU_ALIGN_DOWN(region_size, region.hugepage_size);
+    } else {
+        region_size = QEMU_ALIGN_DOWN(region_size, page_size);
+    }
 
     /* A region must have at least 2 pages; one code, one guard */
     g_assert(region_size >= 2 * page_size);
@@ -795,6 +1022,20 @@ void tcg_region_init(size_t tb_size, int splitwx, unsigned max_cpus)
 
     /* init the region struct */
     qemu_mutex_init(&region.lock);
+    region.n_pools = 1;
+    region.pools[0].first = 0;
+    region.pools[0].end = region.n;
+    region.pools[0].current = 0;
+    region.pools[0].node = -1;
+#ifdef CONFIG_NUMA
+    if (numa) {
+        tcg_region_numa_init();
+    }
+#else
+    if (numa) {
+        warn_report("tb-numa is not supported by this build");
+    }
+#endif
 
     /*
      * Set guard pages in the rw buffer, as that's the one into which
@@ -808,17 +1049,20 @@ void tcg_region_init(size_t tb_size, int splitwx, unsigned max_cpus)
         need_prot |= PROT_EXEC;
     }
 #endif
-    for (size_t i = 0, n = region.n; i < n; i++) {
-        void *start, *end;
-
-        tcg_region_bounds(i, &start, &end);
+    if (hugepages != TCG_HUGEPAGES_OFF) {
+        /*
+         * Changing the protection of single pages would split the huge
+         * pages, so do without guard pages and change the whole buffer.
+         */
         if (have_prot != need_prot) {
+            void *start = region.start_aligned;
+            size_t size = region.total_size + page_size;
             int rc;
 
             if (need_prot == (PROT_READ | PROT_WRITE | PROT_EXEC)) {
-                rc = qemu_mprotect_rwx(start, end - start);
+                rc = qemu_mprotect_rwx(start, size);
             } else if (need_prot == (PROT_READ | PROT_WRITE)) {
-                rc = qemu_mprotect_rw(start, end - start);
+                rc = qemu_mprotect_rw(start, size);
             } else {
                 g_assert_not_reached();
             }
@@ -827,9 +1071,30 @@ void tcg_region_init(size_t tb_size, int splitwx, unsigned max_cpus)
                                  "mprotect of jit buffer");
             }
         }
-        if (have_prot != 0) {
-            /* Guard pages are nice for bug detection but are not essential. */
-            (void)qemu_mprotect_none(end, page_size);
+    } else {
+        for (size_t i = 0, n = region.n; i < n; i++) {
+            void *start, *end;
+
+            tcg_region_bounds(i, &start, &end);
+            if (have_prot != need_prot) {
+                int rc;
+
+                if (need_prot == (PROT_READ | PROT_WRITE | PROT_EXEC)) {
+                    rc = qemu_mprotect_rwx(start, end - start);
+                } else if (need_prot == (PROT_READ | PROT_WRITE)) {
+                    rc = qemu_mprotect_rw(start, end - start);
+                } else {
+                    g_assert_not_reached();
+                }
+                if (rc) {
+                    error_setg_errno(&error_fatal, errno,
+                                     "mprotect of jit buffer");
+                }
+            }
+            if (have_prot != 0) {
+                /* Guard pages are nice for bug detection but not essential. */
+                (void)qemu_mprotect_none(end, page_size);
+            }
         }
     }
 
@@ -902,3 +1167,69 @@ size_t tcg_code_capacity(void)
 
     return capacity;
 }
+
+#ifdef CONFIG_LINUX
+/* Return how much of the buffer is backed by huge pages, in KiB. */
+static size_t tcg_region_hugepage_kib(void)
+{
+    uintptr_t buf_start = (uintptr_t)region.start_aligned;
+    uintptr_t buf_end = buf_start + region.total_size;
+    g_autofree char *smaps = NULL;
+    bool in_buf = false;
+    size_t kib = 0;
+    char *line, *next;
+
+    if (!g_file_get_contents("/proc/self/smaps", &smaps, NULL, NULL)) {
+        return 0;
+    }
+    for (line = smaps; *line; line = next) {
+        unsigned long start, end, val;
+
+        next = strchr(line, '\n');
+        if (next) {
+            *next++ = '\0';
+        } else {
+            next = line + strlen(line);
+        }
+        if (sscanf(line, "%lx-%lx ", &start, &end) == 2) {
+            in_buf = start < buf_end && buf_start < end;
+        } else if (in_buf &&
+                   (sscanf(line, "AnonHugePages: %lu kB", &val) == 1 ||
+                    sscanf(line, "ShmemPmdMapped: %lu kB", &val) == 1 ||
+                    sscanf(line, "Private_Hugetlb: %lu kB", &val) == 1)) {
+            kib += val;
+        }
+    }
+    return kib;
+}
+#endif
+
+void tcg_region_dump_info(GString *buf)
+{
+    static const char * const hugepages[] = {
+        [TCG_HUGEPAGES_OFF] = "off",
+        [TCG_HUGEPAGES_ON] = "transparent",
+        [TCG_HUGEPAGES_EXPLICIT] = "explicit",
+    };
+    size_t i;
+
+    g_string_append_printf(buf, "code huge pages     %s, %zu KiB pages",
+                           hugepages[region.hugepages],
+                           region.hugepage_size / KiB);
+#ifdef CONFIG_LINUX
+    g_string_append_printf(buf, ", %zu/%zu KiB backed",
+                           tcg_region_hugepage_kib(),
+                           region.total_size / KiB);
+#endif
+    g_string_append_c(buf, '\n');
+
+    qemu_mutex_lock(&region.lock);
+    for (i = 0; i < region.n_pools; i++) {
+        const struct tcg_region_pool *p = &region.pools[i];
+
+        g_string_append_printf(buf, "code region pool %-2zu node %d, "
+                               "%zu/%zu regions used\n", i, p->node,
+                               p->current - p->first, p->end - p->first);
+    }
+    qemu_mutex_unlock(&region.lock);
+}
@@ -12,12 +12,19 @@
 C_O0_I1(r)
 C_O0_I2(rZ, r)
 C_O0_I2(rZ, rZ)
+C_O0_I2(v, r)
 C_O1_I1(r, r)
+C_O1_I1(v, r)
+C_O1_I1(v, v)
 C_O1_I2(r, r, ri)
 C_O1_I2(r, r, rI)
 C_O1_I2(r, r, rJ)
 C_O1_I2(r, rZ, rN)
 C_O1_I2(r, rZ, rZ)
+C_O1_I2(v, v, r)
+C_O1_I2(v, v, v)
+C_O1_I3(v, v, v, v)
 C_N1_I2(r, r, rM)
 C_O1_I4(r, r, rI, rM, rM)
+C_O1_I4(v, v, v, v, v)
 C_O2_I4(r, r, rZ, rZ, rM, rM)
@@ -2806,6 +2806,20 @@ void tcg_gen_exit_tb(const TranslationBlock *tb, unsigned idx)
      */
     uintptr_t val = (uintptr_t)tcg_splitwx_to_rx((void *)tb) + idx;
 
+    if (tcg_ctx->goto_tb_label) {
+        TCGLabel *l = tcg_ctx->goto_tb_label;
+        bool redirect = tcg_ctx->goto_tb_redirect;
+
+        tcg_ctx->goto_tb_label = NULL;
+        tcg_ctx->goto_tb_redirect = false;
+        if (redirect) {
+            /* Continue with the next block of the trace instead. */
+            tcg_debug_assert(tb != NULL && idx <= TB_EXIT_IDXMAX);
+            tcg_gen_br(l);
+            return;
+        }
+    }
+
     if (tb == NULL) {
         tcg_debug_assert(idx == 0);
     } else if (idx <= TB_EXIT_IDXMAX) {
@@ -2824,6 +2838,12 @@ void tcg_gen_exit_tb(const TranslationBlock *tb, unsigned idx)
 
 void tcg_gen_goto_tb(unsigned idx)
 {
+    /* Within a trace, tcg_gen_exit_tb branches to goto_tb_label. */
+    if (tcg_ctx->goto_tb_label) {
+        tcg_ctx->goto_tb_redirect = true;
+        return;
+    }
+
     /* We tested CF_NO_GOTO_TB in translator_use_goto_tb. */
     tcg_debug_assert(!(tcg_ctx->gen_tb->cflags & CF_NO_GOTO_TB));
     /* We only support two chained exits.  */
@@ -2841,6 +2861,7 @@ void tcg_gen_lookup_and_goto_ptr(void)
 {
     TCGv_ptr ptr;
 
+    tcg_ctx->goto_tb_label = NULL;
     if (tcg_ctx->gen_tb->cflags & CF_NO_GOTO_PTR) {
         tcg_gen_exit_tb(NULL, 0);
         return;
@@ -1355,10 +1355,11 @@ static void tcg_context_init(unsigned max_cpus)
     cpu_env = temp_tcgv_ptr(ts);
 }
 
-void tcg_init(size_t tb_size, int splitwx, unsigned max_cpus)
+void tcg_init(size_t tb_size, int splitwx, TCGHugePages hugepages,
+              bool numa, unsigned max_cpus)
 {
     tcg_context_init(max_cpus);
-    tcg_region_init(tb_size, splitwx, max_cpus);
+    tcg_region_init(tb_size, splitwx, hugepages, numa, max_cpus);
 }
 
 /*
@@ -1483,6 +1484,10 @@ void tcg_func_start(TCGContext *s)
 
     s->nb_ops = 0;
     s->nb_labels = 0;
+    s->ops_decoded = false;
+    s->goto_tb_label = NULL;
+    s->goto_tb_redirect = false;
+    s->nb_goto_tb_dest = 0;
     s->current_frame_offset = s->frame_start;
 
 #ifdef CONFIG_DEBUG_TCG
@@ -5913,6 +5918,323 @@ void tcg_dump_op_count(GString *buf)
     g_string_append_printf(buf, "[TCG profiler not compiled]\n");
 }
 
+/*
+ * Ops for the persistent TB cache, see accel/tcg/tb-cache.c.
+ *
+ * Nothing in the encoding may depend on host addresses, which change
+ * from one run to the next.  Globals are encoded by index, constants by
+ * type and value, and the other temps in the order of their first use.
+ * Labels are encoded by id, helpers by name and exit_tb by its exit
+ * index alone.
+ */
+
+static GHashTable *helper_info_by_name;
+
+void tcg_helper_info_register(TCGHelperInfo * const *infos)
+{
+    if (!helper_info_by_name) {
+        helper_info_by_name = g_hash_table_new(g_str_hash, g_str_equal);
+    }
+    for (; *infos; infos++) {
+        g_hash_table_insert(helper_info_by_name,
+                            (gpointer)(*infos)->name, *infos);
+    }
+}
+
+enum {
+    TCG_OPS_TEMP_GLOBAL,
+    TCG_OPS_TEMP_CONST,
+    TCG_OPS_TEMP_NEW,
+    TCG_OPS_TEMP_LOCAL,
+};
+
+typedef struct TCGOpsReader {
+    const uint8_t *ptr, *end;
+} TCGOpsReader;
+
+static bool tcg_ops_get(TCGOpsReader *r, void *dst, size_t len)
+{
+    if ((size_t)(r->end - r->ptr) < len) {
+        return false;
+    }
+    memcpy(dst, r->ptr, len);
+    r->ptr += len;
+    return true;
+}
+
+/* Return the index of the label argument of @opc, or -1 if none. */
+static int tcg_op_label_idx(TCGOpcode opc)
+{
+    switch (opc) {
+    case INDEX_op_set_label:
+    case INDEX_op_br:
+        return 0;
+    case INDEX_op_brcond_i32:
+    case INDEX_op_brcond_i64:
+        return 3;
+    case INDEX_op_brcond2_i32:
+        return 5;
+    default:
+        return -1;
+    }
+}
+
+bool tcg_ops_encode(TCGContext *s, GByteArray *buf)
+{
+    int16_t *local = tcg_malloc(sizeof(int16_t) * s->nb_temps);
+    uint16_t nb_local = 0, nb_labels = s->nb_labels;
+    TCGOp *op;
+
+    memset(local, -1, sizeof(int16_t) * s->nb_temps);
+    g_byte_array_append(buf, (uint8_t *)&nb_labels, sizeof(nb_labels));
+
+    QTAILQ_FOREACH(op, &s->ops, link) {
+        TCGOpcode opc = op->opc;
+        const TCGOpDef *def = &tcg_op_defs[opc];
+        uint8_t hdr[4] = { opc, op->nargs, op->param1, op->param2 };
+        int i, nb_temps, label_idx;
+
+        /* The opcode is stored in one byte. */
+        QEMU_BUILD_BUG_ON(NB_OPS > UINT8_MAX + 1);
+        g_byte_array_append(buf, hdr, sizeof(hdr));
+
+        if (opc == INDEX_op_call) {
+            nb_temps = TCGOP_CALLO(op) + TCGOP_CALLI(op);
+        } else {
+            nb_temps = def->nb_oargs + def->nb_iargs;
+        }
+        for (i = 0; i < nb_temps; i++) {
+            TCGTemp *ts = arg_temp(op->args[i]);
+            uint16_t idx = temp_idx(ts);
+            uint8_t tag[3];
+
+            /* Parts of a multi-word temp are not worth the trouble. */
+            if (ts->base_type != ts->type) {
+                return false;
+            }
+            switch (ts->kind) {
+            case TEMP_GLOBAL:
+            case TEMP_FIXED:
+                tag[0] = TCG_OPS_TEMP_GLOBAL;
+                g_byte_array_append(buf, tag, 1);
+                g_byte_array_append(buf, (uint8_t *)&idx, sizeof(idx));
+                break;
+            case TEMP_CONST:
+                tag[0] = TCG_OPS_TEMP_CONST;
+                tag[1] = ts->type;
+                g_byte_array_append(buf, tag, 2);
+                g_byte_array_append(buf, (uint8_t *)&ts->val, sizeof(ts->val));
+                break;
+            case TEMP_EBB:
+            case TEMP_TB:
+                if (local[idx] < 0) {
+                    local[idx] = nb_local++;
+                    tag[0] = TCG_OPS_TEMP_NEW;
+                    tag[1] = ts->type;
+                    tag[2] = ts->kind;
+                    g_byte_array_append(buf, tag, 3);
+                } else {
+                    tag[0] = TCG_OPS_TEMP_LOCAL;
+                    g_byte_array_append(buf, tag, 1);
+                    g_byte_array_append(buf, (uint8_t *)&local[idx],
+                                        sizeof(local[idx]));
+                }
+                break;
+            default:
+                g_assert_not_reached();
+            }
+        }
+
+        if (opc == INDEX_op_call) {
+            const TCGHelperInfo *info = tcg_call_info(op);
+            size_t len = info->name ? strlen(info->name) : 0;
+            uint8_t len8 = len;
+
+            if (len == 0 || len > UINT8_MAX ||
+                !g_hash_table_contains(helper_info_by_name, info->name)) {
+                return false;
+            }
+            g_byte_array_append(buf, &len8, 1);
+            g_byte_array_append(buf, (uint8_t *)info->name, len);
+            continue;
+        }
+
+        label_idx = tcg_op_label_idx(opc);
+        for (; i < op->nargs; i++) {
+            uint64_t val = op->args[i];
+
+            if (i == label_idx) {
+                val = arg_label(op->args[i])->id;
+            } else if (opc == INDEX_op_exit_tb && val) {
+                /*
+                 * 0 for a NULL tb, else the exit index plus one; the
+                 * value holds the read-only alias of the TB.
+                 */
+                val = val - (uintptr_t)tcg_splitwx_to_rx(s->gen_tb) + 1;
+                tcg_debug_assert(val <= TB_EXIT_MASK + 1);
+            }
+            g_byte_array_append(buf, (uint8_t *)&val, sizeof(val));
+        }
+    }
+    return true;
+}
+
+bool tcg_ops_decode(TCGContext *s, const void *data, size_t len)
+{
+    TCGOpsReader r = { data, data + len };
+    TCGTemp **local = tcg_malloc(sizeof(TCGTemp *) * TCG_MAX_TEMPS);
+    TCGLabel **labels;
+    unsigned nb_local = 0;
+    uint16_t nb_labels;
+
+    if (!tcg_ops_get(&r, &nb_labels, sizeof(nb_labels))) {
+        return false;
+    }
+    labels = tcg_malloc(sizeof(TCGLabel *) * (nb_labels + 1));
+    for (int i = 0; i < nb_labels; i++) {
+        labels[i] = gen_new_label();
+    }
+
+    while (r.ptr < r.end) {
+        const TCGOpDef *def;
+        uint8_t hdr[4];
+        int i, nb_temps, label_idx;
+        TCGOp *op;
+
+        if (!tcg_ops_get(&r, hdr, sizeof(hdr)) || hdr[0] >= NB_OPS) {
+            return false;
+        }
+        def = &tcg_op_defs[hdr[0]];
+        if (hdr[0] == INDEX_op_call) {
+            nb_temps = hdr[2] + hdr[3];
+            if (nb_temps + 2 != hdr[1]) {
+                return false;
+            }
+        } else {
+            nb_temps = def->nb_oargs + def->nb_iargs;
+            if (hdr[1] != def->nb_args) {
+                return false;
+            }
+        }
+
+        op = tcg_emit_op(hdr[0], hdr[1]);
+        op->param1 = hdr[2];
+        op->param2 = hdr[3];
+
+        for (i = 0; i < nb_temps; i++) {
+            TCGTemp *ts;
+            uint8_t tag[2];
+            uint16_t idx;
+            int64_t val;
+
+            if (!tcg_ops_get(&r, tag, 1)) {
+                return false;
+            }
+            switch (tag[0]) {
+            case TCG_OPS_TEMP_GLOBAL:
+                if (!tcg_ops_get(&r, &idx, sizeof(idx)) ||
+                    idx >= s->nb_globals) {
+                    return false;
+                }
+                ts = &s->temps[idx];
+                break;
+            case TCG_OPS_TEMP_CONST:
+                if (!tcg_ops_get(&r, tag, 1) ||
+                    !tcg_ops_get(&r, &val, sizeof(val)) ||
+                    tag[0] >= TCG_TYPE_COUNT || tag[0] == TCG_TYPE_I128 ||
+                    (TCG_TARGET_REG_BITS == 32 && tag[0] == TCG_TYPE_I64)) {
+                    return false;
+                }
+                ts = tcg_constant_internal(tag[0], val);
+                break;
+            case TCG_OPS_TEMP_NEW:
+                if (!tcg_ops_get(&r, tag, 2) ||
+                    tag[0] >= TCG_TYPE_COUNT || tag[0] == TCG_TYPE_I128 ||
+                    (TCG_TARGET_REG_BITS == 32 && tag[0] == TCG_TYPE_I64) ||
+                    (tag[1] != TEMP_EBB && tag[1] != TEMP_TB) ||
+                    s->nb_temps >= TCG_MAX_TEMPS) {
+                    return false;
+                }
+                ts = tcg_temp_new_internal(tag[0], tag[1]);
+                local[nb_local++] = ts;
+                break;
+            case TCG_OPS_TEMP_LOCAL:
+                if (!tcg_ops_get(&r, &idx, sizeof(idx)) || idx >= nb_local) {
+                    return false;
+                }
+                ts = local[idx];
+                break;
+            default:
+                return false;
+            }
+            op->args[i] = temp_arg(ts);
+        }
+
+        if (hdr[0] == INDEX_op_call) {
+            TCGHelperInfo *info;
+            char name[UINT8_MAX + 1];
+            uint8_t len8;
+
+            if (!tcg_ops_get(&r, &len8, 1) || !tcg_ops_get(&r, name, len8)) {
+                return false;
+            }
+            name[len8] = 0;
+            info = g_hash_table_lookup(helper_info_by_name, name);
+            if (!info) {
+                return false;
+            }
+            if (unlikely(g_once_init_enter(HELPER_INFO_INIT(info)))) {
+                init_call_layout(info);
+                g_once_init_leave(HELPER_INFO_INIT(info),
+                                  HELPER_INFO_INIT_VAL(info));
+            }
+            if (info->nr_out != hdr[3] || info->nr_in != hdr[2]) {
+                return false;
+            }
+            op->args[i++] = (uintptr_t)info->func;
+            op->args[i++] = (uintptr_t)info;
+            continue;
+        }
+
+        label_idx = tcg_op_label_idx(hdr[0]);
+        for (; i < hdr[1]; i++) {
+            uint64_t val;
+
+            if (!tcg_ops_get(&r, &val, sizeof(val))) {
+                return false;
+            }
+            if (i == label_idx) {
+                TCGLabel *l;
+
+                if (val >= nb_labels) {
+                    return false;
+                }
+                l = labels[val];
+                op->args[i] = label_arg(l);
+                if (hdr[0] == INDEX_op_set_label) {
+                    l->present = 1;
+                } else {
+                    TCGLabelUse *u = tcg_malloc(sizeof(TCGLabelUse));
+
+                    u->op = op;
+                    QSIMPLEQ_INSERT_TAIL(&l->branches, u, next);
+                }
+            } else if (hdr[0] == INDEX_op_exit_tb && val) {
+                if (val > TB_EXIT_MASK + 1) {
+                    return false;
+                }
+                op->args[i] =
+                    (uintptr_t)tcg_splitwx_to_rx(s->gen_tb) + val - 1;
+            } else {
+                op->args[i] = val;
+            }
+        }
+    }
+
+    s->ops_decoded = true;
+    return true;
+}
+
 int tcg_gen_code(TCGContext *s, TranslationBlock *tb, uint64_t pc_start)
 {
     int i, start_words, num_insns;
@@ -5946,9 +6268,17 @@ int tcg_gen_code(TCGContext *s, TranslationBlock *tb, uint64_t pc_start)
     }
 #endif
 
-    tcg_optimize(s);
+    /* Ops read back from the TB cache were optimized before encoding. */
+    if (!s->ops_decoded) {
+        tcg_optimize(s);
+    }
 
     reachable_code_pass(s);
+
+    if (s->ops_record && !tcg_ops_encode(s, s->ops_record)) {
+        g_byte_array_set_size(s->ops_record, 0);
+    }
+
     liveness_pass_0(s);
     liveness_pass_1(s);
 
@@ -6004,6 +6334,9 @@ int tcg_gen_code(TCGContext *s, TranslationBlock *tb, uint64_t pc_start)
 #ifdef TCG_TARGET_NEED_POOL_LABELS
     s->pool_labels = NULL;
 #endif
+#ifdef TCG_TARGET_NEED_VTYPE_CACHE
+    s->vtype_cache = -1;
+#endif
 
     start_words = s->insn_start_words;
     s->gen_insn_data =
@@ -6041,6 +6374,10 @@ int tcg_gen_code(TCGContext *s, TranslationBlock *tb, uint64_t pc_start)
         case INDEX_op_set_label:
             tcg_reg_alloc_bb_end(s, s->reserved_regs);
             tcg_out_label(s, arg_label(op->args[0]));
+#ifdef TCG_TARGET_NEED_VTYPE_CACHE
+            /* Control flow merges here; the vector config is unknown.  */
+            s->vtype_cache = -1;
+#endif
             break;
         case INDEX_op_call:
             tcg_reg_alloc_call(s, op);
@@ -6109,7 +6446,23 @@ int tcg_gen_code(TCGContext *s, TranslationBlock *tb, uint64_t pc_start)
 
 void tcg_dump_info(GString *buf)
 {
-    g_string_append_printf(buf, "[TCG profiler not compiled]\n");
+    unsigned int n_ctxs = qatomic_read(&tcg_cur_ctxs);
+    size_t ld = 0, ld_removed = 0, st = 0, st_removed = 0;
+    unsigned int i;
+
+    for (i = 0; i < n_ctxs; i++) {
+        const TCGContext *s = qatomic_read(&tcg_ctxs[i]);
+
+        ld += qatomic_read(&s->opt_env_ld);
+        ld_removed += qatomic_read(&s->opt_env_ld_removed);
+        st += qatomic_read(&s->opt_env_st);
+        st_removed += qatomic_read(&s->opt_env_st_removed);
+    }
+    g_string_append_printf(buf, "env loads forwarded %zu/%zu\n",
+                           ld_removed, ld);
+    g_string_append_printf(buf, "env stores removed  %zu/%zu\n",
+                           st_removed, st);
+    tcg_region_dump_info(buf);
 }
 
 #ifdef ELF_HOST_MACHINE
@@ -0,0 +1,31 @@
+#! /usr/bin/env python3
+
+# Check in a "-d op,op_opt" log that the optimizer removed at least one
+# env load and one env store from the logged TBs.
+#
+# SPDX-License-Identifier: GPL-2.0-or-later
+
+import sys
+
+counts = {}
+section = None
+with open(sys.argv[1]) as log:
+    for line in log:
+        if line.startswith("OP:"):
+            section = "op"
+        elif line.startswith("OP after optimization"):
+            section = "opt"
+        elif line.startswith("OP "):
+            section = None
+        elif section:
+            words = line.split()
+            if words and words[0] in ("ld_i64", "st_i64"):
+                key = (section, words[0])
+                counts[key] = counts.get(key, 0) + 1
+
+for op in ("ld_i64", "st_i64"):
+    before = counts.get(("op", op), 0)
+    after = counts.get(("opt", op), 0)
+    print(f"{op}: {before} before optimization, {after} after")
+    if after >= before:
+        sys.exit(1)
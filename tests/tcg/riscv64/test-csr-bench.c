@@ -0,0 +1,81 @@
+/*
+ * Throughput of read-only CSR accesses.
+ *
+ * Reads of the unprivileged counters no longer end the translation
+ * block; this measures how many csrr instructions per second the
+ * translated code sustains for each of them.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define ITERATIONS  2000000
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Eight reads per iteration, summed so that none can be dropped. */
+#define DEF_CSR_LOOP(NAME, CSR)                                         \
+static uint64_t NAME(void)                                              \
+{                                                                       \
+    uint64_t sum = 0, v;                                                \
+    int i;                                                              \
+                                                                        \
+    for (i = 0; i < ITERATIONS; i++) {                                  \
+        asm volatile("csrr %0, " CSR "\n\t" "add %1, %1, %0\n\t"        \
+                     "csrr %0, " CSR "\n\t" "add %1, %1, %0\n\t"        \
+                     "csrr %0, " CSR "\n\t" "add %1, %1, %0\n\t"        \
+                     "csrr %0, " CSR "\n\t" "add %1, %1, %0\n\t"        \
+                     "csrr %0, " CSR "\n\t" "add %1, %1, %0\n\t"        \
+                     "csrr %0, " CSR "\n\t" "add %1, %1, %0\n\t"        \
+                     "csrr %0, " CSR "\n\t" "add %1, %1, %0\n\t"        \
+                     "csrr %0, " CSR "\n\t" "add %1, %1, %0"            \
+                     : "=&r"(v), "+r"(sum));                            \
+    }                                                                   \
+    return sum;                                                         \
+}
+
+DEF_CSR_LOOP(read_cycle, "cycle")
+DEF_CSR_LOOP(read_time, "time")
+DEF_CSR_LOOP(read_instret, "instret")
+
+static void bench(const char *name, uint64_t (*fn)(void))
+{
+    double t0, t1;
+    uint64_t sum;
+
+    t0 = now();
+    sum = fn();
+    t1 = now();
+    printf("%-8s %8.2f Mreads/s (sum %#llx)\n", name,
+           8.0 * ITERATIONS / (t1 - t0) / 1e6, (unsigned long long)sum);
+}
+
+int main(void)
+{
+    uint64_t a, b;
+
+    /* The counters must keep moving forward within a TB. */
+    asm volatile("csrr %0, cycle\n\t"
+                 "nop\n\t"
+                 "csrr %1, cycle" : "=&r"(a), "=r"(b));
+    if (b < a) {
+        fprintf(stderr, "cycle went backwards: %#llx -> %#llx\n",
+                (unsigned long long)a, (unsigned long long)b);
+        return EXIT_FAILURE;
+    }
+
+    bench("cycle", read_cycle);
+    bench("time", read_time);
+    bench("instret", read_instret);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,142 @@
+/*
+ * Branchy loops for hot trace formation.
+ *
+ * Each kernel is a loop whose body is split over several TBs by
+ * conditional branches, the case that -superblock-threshold targets.
+ * Run it with and without the option to compare; the results are
+ * checked so that a bad trace shows up as a failure.  Each kernel is
+ * timed REPEAT times and the best time is reported, which keeps the
+ * first run's translation cost and host noise out of the comparison.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define CRC_LEN      4096
+#define CRC_ROUNDS   64
+#define COLLATZ_N    100000
+#define SORT_LEN     256
+#define SORT_ROUNDS  200
+#define REPEAT       3
+
+static uint8_t buf[CRC_LEN];
+static uint32_t arr[SORT_LEN];
+static uint32_t seed = 1;
+
+static uint32_t lcg(void)
+{
+    seed = seed * 1103515245 + 12345;
+    return seed >> 8;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Bitwise CRC-32, one branch per bit. */
+static uint64_t crc32_bits(void)
+{
+    uint32_t crc = ~0u;
+    int r, i, b;
+
+    for (r = 0; r < CRC_ROUNDS; r++) {
+        for (i = 0; i < CRC_LEN; i++) {
+            crc ^= buf[i];
+            for (b = 0; b < 8; b++) {
+                if (crc & 1) {
+                    crc = (crc >> 1) ^ 0xedb88320;
+                } else {
+                    crc >>= 1;
+                }
+            }
+        }
+    }
+    return ~crc;
+}
+
+/* Total number of Collatz steps from 1..COLLATZ_N down to 1. */
+static uint64_t collatz(void)
+{
+    uint64_t total = 0;
+    uint64_t i, n;
+
+    for (i = 1; i <= COLLATZ_N; i++) {
+        for (n = i; n != 1; total++) {
+            if (n & 1) {
+                n = 3 * n + 1;
+            } else {
+                n >>= 1;
+            }
+        }
+    }
+    return total;
+}
+
+static uint64_t insertion_sort(void)
+{
+    uint64_t sum = 0;
+    int r, i, j;
+
+    for (r = 0; r < SORT_ROUNDS; r++) {
+        for (i = 0; i < SORT_LEN; i++) {
+            arr[i] = lcg();
+        }
+        for (i = 1; i < SORT_LEN; i++) {
+            uint32_t v = arr[i];
+
+            for (j = i; j > 0 && arr[j - 1] > v; j--) {
+                arr[j] = arr[j - 1];
+            }
+            arr[j] = v;
+        }
+        sum += arr[r % SORT_LEN];
+    }
+    return sum;
+}
+
+static int bench(const char *name, uint64_t (*fn)(void), uint64_t expect)
+{
+    uint32_t start_seed = seed;
+    double t0, t1, best = 0;
+    uint64_t ret;
+    int i;
+
+    for (i = 0; i < REPEAT; i++) {
+        seed = start_seed;
+        t0 = now();
+        ret = fn();
+        t1 = now();
+        if (ret != expect) {
+            fprintf(stderr, "%s: got %#llx, expected %#llx\n", name,
+                    (unsigned long long)ret, (unsigned long long)expect);
+            return 1;
+        }
+        if (!i || t1 - t0 < best) {
+            best = t1 - t0;
+        }
+    }
+    printf("%-16s %8.1f ms (best of %d)\n", name, best * 1e3, REPEAT);
+    return 0;
+}
+
+int main(void)
+{
+    int i, err = 0;
+
+    for (i = 0; i < CRC_LEN; i++) {
+        buf[i] = lcg();
+    }
+
+    err |= bench("crc32-bits", crc32_bits, 0x39175d67);
+    err |= bench("collatz", collatz, 10753840);
+    err |= bench("insertion-sort", insertion_sort, 1306892757);
+    return err ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,150 @@
+/*
+ * Throughput of the out-of-line RVV integer helpers.
+ *
+ * Every operation is issued with vl = VLMAX - 1 so that the translator
+ * cannot expand it inline and the helper in vector_helper.c is called.
+ * Results are checked against a scalar reference before timing.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MAX_ELEMS   1024
+#define ITERATIONS  20000
+
+static uint32_t a[MAX_ELEMS], b[MAX_ELEMS], r[MAX_ELEMS];
+static uint8_t ab[MAX_ELEMS], bb[MAX_ELEMS];
+static uint64_t mask[MAX_ELEMS / 64];
+
+static size_t vl_e32, vl_e8;
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+#define DEF_VV_E32(NAME, INSN)                                          \
+static void NAME(void)                                                  \
+{                                                                       \
+    asm volatile("vsetvli zero, %0, e32, m8, ta, ma\n\t"                \
+                 "vle32.v v8, (%1)\n\t"                                 \
+                 "vle32.v v16, (%2)\n\t"                                \
+                 INSN " v24, v8, v16\n\t"                               \
+                 "vse32.v v24, (%3)"                                    \
+                 : : "r"(vl_e32), "r"(a), "r"(b), "r"(r)                \
+                 : "memory", "v8", "v16", "v24");                       \
+}
+
+DEF_VV_E32(do_vadd, "vadd.vv")
+DEF_VV_E32(do_vand, "vand.vv")
+DEF_VV_E32(do_vsll, "vsll.vv")
+
+static void do_vmseq(void)
+{
+    asm volatile("vsetvli zero, %0, e8, m8, ta, ma\n\t"
+                 "vle8.v v8, (%1)\n\t"
+                 "vle8.v v16, (%2)\n\t"
+                 "vmseq.vv v0, v8, v16\n\t"
+                 "vsetvli zero, %3, e8, m1, ta, ma\n\t"
+                 "vsm.v v0, (%4)"
+                 : : "r"(vl_e8), "r"(ab), "r"(bb), "r"(vl_e8 / 8 + 1),
+                     "r"(mask)
+                 : "memory", "v0", "v8", "v16");
+}
+
+static int check_e32(const char *name, uint32_t (*ref)(uint32_t, uint32_t))
+{
+    size_t i;
+
+    for (i = 0; i < vl_e32; i++) {
+        if (r[i] != ref(a[i], b[i])) {
+            fprintf(stderr, "%s: element %zu: got %#x expected %#x\n",
+                    name, i, r[i], ref(a[i], b[i]));
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static uint32_t ref_add(uint32_t x, uint32_t y) { return x + y; }
+static uint32_t ref_and(uint32_t x, uint32_t y) { return x & y; }
+static uint32_t ref_sll(uint32_t x, uint32_t y) { return x << (y & 31); }
+
+static int check_vmseq(void)
+{
+    size_t i;
+
+    for (i = 0; i < vl_e8; i++) {
+        int bit = (mask[i / 64] >> (i % 64)) & 1;
+
+        if (bit != (ab[i] == bb[i])) {
+            fprintf(stderr, "vmseq: element %zu: got %d\n", i, bit);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void bench(const char *name, void (*fn)(void), size_t elems)
+{
+    double t0, t1;
+    int i;
+
+    t0 = now();
+    for (i = 0; i < ITERATIONS; i++) {
+        fn();
+    }
+    t1 = now();
+    printf("%-8s vl=%-5zu %8.2f Melem/s\n", name, elems,
+           (double)elems * ITERATIONS / (t1 - t0) / 1e6);
+}
+
+int main(void)
+{
+    size_t vlmax;
+    int err = 0;
+    int i;
+
+    asm volatile("vsetvli %0, zero, e32, m8, ta, ma" : "=r"(vlmax));
+    vl_e32 = vlmax - 1;
+    asm volatile("vsetvli %0, zero, e8, m8, ta, ma" : "=r"(vlmax));
+    vl_e8 = vlmax - 1;
+    if (vl_e8 > MAX_ELEMS) {
+        printf("SKIP: VLEN too large\n");
+        return 0;
+    }
+
+    srand(1);
+    for (i = 0; i < MAX_ELEMS; i++) {
+        a[i] = rand();
+        b[i] = rand();
+        ab[i] = rand() & 3;
+        bb[i] = rand() & 3;
+    }
+
+    do_vadd();
+    err |= check_e32("vadd", ref_add);
+    do_vand();
+    err |= check_e32("vand", ref_and);
+    do_vsll();
+    err |= check_e32("vsll", ref_sll);
+    do_vmseq();
+    err |= check_vmseq();
+    if (err) {
+        return EXIT_FAILURE;
+    }
+
+    bench("vadd.vv", do_vadd, vl_e32);
+    bench("vand.vv", do_vand, vl_e32);
+    bench("vsll.vv", do_vsll, vl_e32);
+    bench("vmseq.vv", do_vmseq, vl_e8);
+    return EXIT_SUCCESS;
+}